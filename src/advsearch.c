@@ -26,6 +26,7 @@
 
 #include <glib.h>
 #include <ctype.h>
+#include <string.h>
 
 #include "matcher.h"
 #include "matcher_parser.h"
@@ -41,6 +42,16 @@ struct _AdvancedSearch {
 	MatcherList			*predicate;
 	gboolean			 is_fast;
 	gboolean			 search_aborted;
+	gboolean			 search_stopped;
+
+	/* results of the last complete searches of single folders, by
+	 * folder identifier; as long as each new predicate strictly
+	 * refines the previous one, only these messages need to be
+	 * searched again */
+	struct {
+		MatcherList		*predicate;
+		GHashTable		*folders;
+	} results;
 
 	struct {
 		gboolean (*cb)(gpointer data, guint at, guint matched, guint total);
@@ -65,6 +76,8 @@ void advsearch_set_on_error_cb(AdvancedSearch* search, void (*cb)(gpointer data)
 }
 
 static void prepare_matcher(AdvancedSearch *search);
+static void search_results_update(AdvancedSearch *search);
+static void search_results_clear(AdvancedSearch *search);
 static gboolean search_impl(MsgInfoList **messages, AdvancedSearch* search,
 			    FolderItem* folderItem, gboolean recursive);
 
@@ -84,6 +97,10 @@ void advsearch_free(AdvancedSearch *search)
 	if (search->predicate != NULL)
 		matcherlist_free(search->predicate);
 
+	search_results_clear(search);
+	if (search->results.folders != NULL)
+		g_hash_table_destroy(search->results.folders);
+
 	g_free(search->request.matchstring);
 	g_free(search);
 }
@@ -98,6 +115,7 @@ void advsearch_set(AdvancedSearch *search, AdvancedSearchType type, const gchar
 	search->request.matchstring = g_strdup(matchstring);
 
 	prepare_matcher(search);
+	search_results_update(search);
 }
 
 gboolean advsearch_is_fast(AdvancedSearch *search)
@@ -121,6 +139,7 @@ gboolean advsearch_search_msgs_in_folders(AdvancedSearch* search, MsgInfoList **
 		return FALSE;
 
 	search->search_aborted = FALSE;
+	search->search_stopped = FALSE;
 	return search_impl(messages, search, folderItem, recursive);
 }
 
@@ -457,13 +476,126 @@ static gboolean search_progress_notify_cb(gpointer data, gboolean on_server, gui
 {
 	AdvancedSearch *search = (AdvancedSearch*) data;
 
-	if (search->search_aborted)
+	if (search->search_aborted) {
+		search->search_stopped = TRUE;
 		return FALSE;
+	}
 
 	if (on_server || search->on_progress_cb.cb == NULL)
 		return TRUE;
 
-	return search->on_progress_cb.cb(search->on_progress_cb.data, at, matched, total);
+	if (!search->on_progress_cb.cb(search->on_progress_cb.data, at, matched, total)) {
+		search->search_stopped = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+typedef struct _SearchResult SearchResult;
+struct _SearchResult {
+	MsgNumberList	*msgnums;
+	/* most changes to the folder change one of these */
+	gint		 counts[8];
+	gint		 last_num;
+	time_t		 mtime;
+};
+
+static void search_result_get_counts(FolderItem *item, gint *counts)
+{
+	counts[0] = item->total_msgs;
+	counts[1] = item->new_msgs;
+	counts[2] = item->unread_msgs;
+	counts[3] = item->marked_msgs;
+	counts[4] = item->replied_msgs;
+	counts[5] = item->forwarded_msgs;
+	counts[6] = item->locked_msgs;
+	counts[7] = item->ignored_msgs;
+}
+
+static void search_result_free(gpointer data)
+{
+	SearchResult *result = (SearchResult *)data;
+
+	g_slist_free(result->msgnums);
+	g_free(result);
+}
+
+static void search_results_clear(AdvancedSearch *search)
+{
+	if (search->results.predicate != NULL) {
+		matcherlist_free(search->results.predicate);
+		search->results.predicate = NULL;
+	}
+	if (search->results.folders != NULL)
+		g_hash_table_remove_all(search->results.folders);
+}
+
+/* Keeps the results of the previous searches if the new predicate
+ * can only match a subset of them */
+static void search_results_update(AdvancedSearch *search)
+{
+	if (search->predicate == NULL) {
+		search_results_clear(search);
+		return;
+	}
+
+	if (search->results.predicate == NULL
+	    || !matcherlist_is_refinement(search->results.predicate,
+					  search->predicate)) {
+		search_results_clear(search);
+	} else {
+		debug_print("search refines the previous one\n");
+		matcherlist_free(search->results.predicate);
+	}
+	search->results.predicate = matcherlist_copy(search->predicate);
+}
+
+/* Returns the previous result for the folder, if it can be searched
+ * instead of the whole folder */
+static SearchResult *search_results_lookup(AdvancedSearch *search,
+					   FolderItem *item,
+					   const gchar *id)
+{
+	SearchResult *result;
+	gint counts[8];
+
+	if (search->results.folders == NULL || id == NULL)
+		return NULL;
+
+	result = g_hash_table_lookup(search->results.folders, id);
+	if (result == NULL)
+		return NULL;
+
+	search_result_get_counts(item, counts);
+	if (memcmp(counts, result->counts, sizeof(counts)) != 0
+	    || result->last_num != item->last_num
+	    || result->mtime != item->mtime) {
+		g_hash_table_remove(search->results.folders, id);
+		return NULL;
+	}
+
+	return result;
+}
+
+static void search_results_insert(AdvancedSearch *search, FolderItem *item,
+				  const gchar *id, MsgNumberList *msgnums)
+{
+	SearchResult *result;
+
+	if (id == NULL)
+		return;
+
+	if (search->results.folders == NULL)
+		search->results.folders = g_hash_table_new_full(g_str_hash,
+				g_str_equal, g_free, search_result_free);
+
+	result = g_new0(SearchResult, 1);
+	result->msgnums = g_slist_copy(msgnums);
+	search_result_get_counts(item, result->counts);
+	result->last_num = item->last_num;
+	result->mtime = item->mtime;
+
+	g_hash_table_replace(search->results.folders, g_strdup(id), result);
 }
 
 static gboolean search_filter_folder(MsgNumberList **msgnums, AdvancedSearch *search,
@@ -514,13 +646,36 @@ static gboolean search_impl(MsgInfoList **messages, AdvancedSearch* search,
 		MsgNumberList *cur;
 		MsgInfoList *msgs = NULL;
 		gboolean can_search_on_server = folderItem->folder->klass->supports_server_search;
+		SearchResult *previous = NULL;
+		gchar *id = NULL;
+
+		/* server searches don't take a list of messages to
+		 * restrict the search to */
+		if (!can_search_on_server) {
+			id = folder_item_get_identifier(folderItem);
+			previous = search_results_lookup(search, folderItem, id);
+		}
 
-		if (!search_filter_folder(&msgnums, search, folderItem,
-					  can_search_on_server)) {
+		if (previous != NULL) {
+			debug_print("searching the %d previous results in %s\n",
+				    g_slist_length(previous->msgnums),
+				    folderItem->path ? folderItem->path : "(null)");
+			msgnums = g_slist_copy(previous->msgnums);
+		}
+
+		/* an empty list means the whole folder */
+		if ((previous == NULL || msgnums != NULL)
+		    && !search_filter_folder(&msgnums, search, folderItem,
+					     can_search_on_server)) {
 			g_slist_free(msgnums);
+			g_free(id);
 			return FALSE;
 		}
 
+		if (!search->search_stopped)
+			search_results_insert(search, folderItem, id, msgnums);
+		g_free(id);
+
 		for (cur = msgnums; cur != NULL; cur = cur->next) {
 			MsgInfo *msg = folder_item_get_msginfo(folderItem, GPOINTER_TO_UINT(cur->data));
 
@@ -100,10 +100,12 @@
 #define OLD_MARK_FILE		".sylpheed_mark"
 #define MARK_FILE		".claws_mark"
 #define TAGS_FILE		".claws_tags"
+#define THREAD_FILE		".claws_thread"
 #define PRINTING_PAGE_SETUP_STORAGE_FILE "print_page_setup"
-#define CACHE_VERSION		24
+#define CACHE_VERSION		25
 #define MARK_VERSION		2
 #define TAGS_VERSION		1
+#define THREAD_VERSION		1
 
 #ifdef G_OS_WIN32
 #  define ACTIONS_RC		"actionswinrc"
@@ -80,6 +80,7 @@ gchar *string_table_insert_string(StringTable *table, const gchar *str)
 			   entry->ref_count);
 	} else {
 		entry = string_entry_new(str);
+		table->memusage += strlen(str) + 1 + sizeof(StringEntry);
 		XXX_DEBUG ("inserting %s\n", str);
 		/* insert entry->string instead of str, since it can be
 		 * invalid pointer after this. */
@@ -101,6 +102,7 @@ void string_table_free_string(StringTable *table, const gchar *str)
 			XXX_DEBUG ("refcount of string %s dropped to zero\n",
 				   entry->string);
 			g_hash_table_remove(table->hash_table, str);
+			table->memusage -= strlen(entry->string) + 1 + sizeof(StringEntry);
 			string_entry_free(entry);
 		} else {
 			XXX_DEBUG ("ref-- for %s (%d)\n", entry->string,
@@ -148,3 +150,11 @@ void string_table_get_stats(StringTable *table)
 			     (GHFunc)string_table_stats_for_each_fn, &totals);
 	XXX_DEBUG ("TOTAL UNSPILLED %d (%dK)\n", totals, totals / 1024);
 }
+
+/* memory used by the distinct strings, i.e. once per string */
+guint string_table_get_memusage(StringTable *table)
+{
+	cm_return_val_if_fail(table != NULL, 0);
+
+	return table->memusage;
+}
@@ -23,6 +23,7 @@
 
 typedef struct {
 	GHashTable *hash_table;
+	guint memusage;
 } StringTable;
 
 StringTable *string_table_new     (void);
@@ -32,5 +33,6 @@ gchar *string_table_insert_string (StringTable *table, const gchar *str);
 void   string_table_free_string   (StringTable *table, const gchar *str);
 
 void   string_table_get_stats     (StringTable *table);
+guint  string_table_get_memusage  (StringTable *table);
 
 #endif /* STRINGTABLE_H__ */
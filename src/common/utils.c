@@ -514,7 +514,7 @@ gint get_next_word_len(const gchar *s)
 	return len;
 }
 
-static void trim_subject_for_compare(gchar *str)
+void trim_subject_for_compare(gchar *str)
 {
 	gchar *srcp;
 
@@ -527,7 +527,7 @@ static void trim_subject_for_compare(gchar *str)
 		memmove(str, srcp, strlen(srcp) + 1);
 }
 
-static void trim_subject_for_sort(gchar *str)
+void trim_subject_for_sort(gchar *str)
 {
 	gchar *srcp;
 
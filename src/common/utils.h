@@ -331,6 +331,8 @@ gint subject_compare			(const gchar	*s1,
 gint subject_compare_for_sort		(const gchar	*s1,
 					 const gchar	*s2);
 void trim_subject			(gchar		*str);
+void trim_subject_for_compare		(gchar		*str);
+void trim_subject_for_sort		(gchar		*str);
 void eliminate_parenthesis		(gchar		*str,
 					 gchar		 op,
 					 gchar		 cl);
@@ -88,18 +88,24 @@ void folder_init		(Folder		*folder,
 static gchar *folder_item_get_cache_file	(FolderItem	*item);
 static gchar *folder_item_get_mark_file	(FolderItem	*item);
 static gchar *folder_item_get_tags_file	(FolderItem	*item);
+static gchar *folder_item_get_thread_file	(FolderItem	*item);
 static GNode *folder_get_xml_node	(Folder 	*folder);
 static Folder *folder_get_from_xml	(GNode 		*node);
 static void folder_update_op_count_rec	(GNode		*node);
+static void folder_item_index_add	(FolderItem	*item);
+static void folder_item_index_remove	(FolderItem	*item);
+static void folder_index_rebuild	(GNode		*node);
 
 
 static void folder_get_persist_prefs_recursive
 					(GNode *node, GHashTable *pptable);
 static gboolean persist_prefs_free	(gpointer key, gpointer val, gpointer data);
 static void folder_item_read_cache		(FolderItem *item);
+static void folder_item_cancel_cache_load	(FolderItem *item);
 gint folder_item_scan_full		(FolderItem *item, gboolean filtering);
 static void folder_item_update_with_msg (FolderItem *item, FolderItemUpdateFlags update_flags,
                                          MsgInfo *msg);
+static void folder_item_update_cancel	(FolderItem *item);
 static GHashTable *folder_persist_prefs_new	(Folder *folder);
 static void folder_persist_prefs_free		(GHashTable *pptable);
 static void folder_item_restore_persist_prefs	(FolderItem *item, GHashTable *pptable);
@@ -279,6 +285,8 @@ void folder_destroy(Folder *folder)
 
 	folder->klass->destroy_folder(folder);
 
+	if (folder->items_by_path != NULL)
+		g_hash_table_destroy(folder->items_by_path);
 	g_free(folder->name);
 	g_free(folder);
 }
@@ -393,6 +401,8 @@ FolderItem *folder_item_new(Folder *folder, const gchar *name, const gchar *path
 	item->mark_queue = NULL;
 	item->data = NULL;
 	item->parent_stype = -1;
+	item->index_path = NULL;
+	item->index_real_path = NULL;
 
 	item->sort_key = prefs_common.default_sort_key;
 	item->sort_type = prefs_common.default_sort_type;
@@ -411,6 +421,7 @@ void folder_item_append(FolderItem *parent, FolderItem *item)
 
 	item->folder = parent->folder;
 	g_node_append(parent->node, item->node);
+	folder_item_index_add(item);
 }
 
 void folder_item_remove(FolderItem *item)
@@ -445,8 +456,12 @@ void folder_item_remove(FolderItem *item)
 		item->cache = NULL;
 	}
 	tags_file = folder_item_get_tags_file(item);
-	if (tags_file)
+	if (tags_file) {
+		gchar *journal_file = msgcache_get_journal_file(tags_file);
 		claws_unlink(tags_file);
+		claws_unlink(journal_file);
+		g_free(journal_file);
+	}
 	tags_dir = g_path_get_dirname(tags_file);
 	if (tags_dir)
 		rmdir(tags_dir);
@@ -508,10 +523,13 @@ void folder_item_destroy(FolderItem *item)
 			folder->junk = NULL;
 	}
 
+	folder_item_cancel_cache_load(item);
+	folder_item_index_remove(item);
 	if (item->cache)
 		folder_item_free_cache(item, TRUE);
 	if (item->prefs)
 		folder_item_prefs_free(item->prefs);
+	folder_item_update_cancel(item);
 	g_free(item->name);
 	g_free(item->path);
 
@@ -563,6 +581,7 @@ void folder_item_set_xml(Folder *folder, FolderItem *item, XMLTag *tag)
 		} else if (!strcmp(attr->name, "path")) {
 			g_free(item->path);
 			item->path = g_strdup(attr->value);
+			folder_item_index_add(item);
 		} else if (!strcmp(attr->name, "mtime"))
 			item->mtime = strtoul(attr->value, NULL, 10);
 		else if (!strcmp(attr->name, "new"))
@@ -964,6 +983,8 @@ void folder_scan_tree(Folder *folder, gboolean rebuild)
 	} else if (rebuild)
 		folder_add(folder);
 
+	folder_index_rebuild(folder->node);
+
 	hookdata.folder = folder;
 	hookdata.update_flags = FOLDER_TREE_CHANGED;
 	hookdata.item = NULL;
@@ -993,6 +1014,7 @@ FolderItem *folder_create_folder(FolderItem *parent, const gchar *name)
 		FolderUpdateData hookdata;
 
 		new_item->cache = msgcache_new();
+		msgcache_set_folder_item(new_item->cache, new_item);
 		new_item->cache_dirty = TRUE;
 		new_item->mark_dirty = TRUE;
 		new_item->tags_dirty = TRUE;
@@ -1020,6 +1042,9 @@ gint folder_item_rename(FolderItem *item, gchar *newname)
 		FolderItemUpdateData hookdata;
 		FolderUpdateData hookdata2;
 
+		/* the paths of all subfolders changed too */
+		folder_index_rebuild(item->node);
+
 		hookdata.item = item;
 		hookdata.update_flags = F_ITEM_UPDATE_NAME;
 		hookdata.msg = NULL;
@@ -1272,6 +1297,133 @@ Folder *folder_find_from_name(const gchar *name, FolderClass *klass)
 	return NULL;
 }
 
+/*
+ * Lookup indexes
+ *
+ * Each Folder keeps its items by path, and the items are also kept by
+ * real path, so that finding an item from its identifier or path
+ * doesn't have to walk the folder trees. The indexes follow items
+ * being appended, destroyed, renamed and rescanned, but folder classes
+ * may still change an item's path behind our back: hits are therefore
+ * checked, and a miss falls back to walking the tree, which brings the
+ * index up to date with what it finds.
+ */
+
+/* Gives the key path_cmp() would consider equal to path, or NULL if it
+ * never matches anything. */
+static gchar *folder_index_key(const gchar *path)
+{
+	gchar *key;
+	gsize len;
+
+	if (path == NULL || *path == '\0')
+		return NULL;
+
+	key = g_strdup(path);
+#ifdef G_OS_WIN32
+	subst_char(key, '/', G_DIR_SEPARATOR);
+#endif
+	len = strlen(key);
+	if (key[len - 1] == G_DIR_SEPARATOR)
+		key[len - 1] = '\0';
+	if (*key == '\0') {
+		g_free(key);
+		return NULL;
+	}
+
+	return key;
+}
+
+static GHashTable *folder_item_real_path_index = NULL;
+
+static void folder_index_insert(GHashTable *index, gchar **item_key,
+				gchar *key, FolderItem *item)
+{
+	if (*item_key != NULL) {
+		if (g_hash_table_lookup(index, *item_key) == item)
+			g_hash_table_remove(index, *item_key);
+		g_free(*item_key);
+	}
+	*item_key = key;
+	if (key != NULL)
+		g_hash_table_replace(index, g_strdup(key), item);
+}
+
+static void folder_index_drop(GHashTable *index, gchar **item_key,
+			      FolderItem *item)
+{
+	if (*item_key == NULL)
+		return;
+	if (index != NULL && g_hash_table_lookup(index, *item_key) == item)
+		g_hash_table_remove(index, *item_key);
+	g_free(*item_key);
+	*item_key = NULL;
+}
+
+static void folder_item_index_add(FolderItem *item)
+{
+	Folder *folder = item->folder;
+
+	if (folder == NULL)
+		return;
+	if (folder->items_by_path == NULL)
+		folder->items_by_path = g_hash_table_new_full(g_str_hash, g_str_equal,
+							      g_free, NULL);
+
+	folder_index_insert(folder->items_by_path, &item->index_path,
+			    folder_index_key(item->path), item);
+}
+
+static void folder_item_index_add_real_path(FolderItem *item,
+					    const gchar *real_path)
+{
+	if (folder_item_real_path_index == NULL)
+		folder_item_real_path_index = g_hash_table_new_full(g_str_hash,
+						g_str_equal, g_free, NULL);
+
+	folder_index_insert(folder_item_real_path_index, &item->index_real_path,
+			    folder_index_key(real_path), item);
+}
+
+static void folder_item_index_remove(FolderItem *item)
+{
+	folder_index_drop(item->folder ? item->folder->items_by_path : NULL,
+			  &item->index_path, item);
+	folder_index_drop(folder_item_real_path_index,
+			  &item->index_real_path, item);
+}
+
+static gboolean folder_index_rebuild_func(GNode *node, gpointer data)
+{
+	folder_item_index_add(FOLDER_ITEM(node->data));
+
+	return FALSE;
+}
+
+static void folder_index_rebuild(GNode *node)
+{
+	if (node != NULL)
+		g_node_traverse(node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+				folder_index_rebuild_func, NULL);
+}
+
+static FolderItem *folder_index_lookup(Folder *folder, const gchar *path)
+{
+	FolderItem *item;
+	gchar *key;
+
+	if (folder->items_by_path == NULL ||
+	    (key = folder_index_key(path)) == NULL)
+		return NULL;
+
+	item = g_hash_table_lookup(folder->items_by_path, key);
+	g_free(key);
+	if (item != NULL && path_cmp(path, item->path) != 0)
+		return NULL;
+
+	return item;
+}
+
 static gboolean folder_item_find_func(GNode *node, gpointer data)
 {
 	FolderItem *item = node->data;
@@ -1286,25 +1438,46 @@ static gboolean folder_item_find_func(GNode *node, gpointer data)
 	return TRUE;
 }
 
+/* Finds the item with the given path in folder, the slow way if the
+ * index doesn't know it. */
+static FolderItem *folder_find_item_in_folder(Folder *folder, const gchar *path)
+{
+	FolderItem *item;
+	gpointer d[2];
+
+	if ((item = folder_index_lookup(folder, path)) != NULL)
+		return item;
+
+	d[0] = (gpointer)path;
+	d[1] = NULL;
+	g_node_traverse(folder->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			folder_item_find_func, d);
+	if (d[1] != NULL)
+		folder_item_index_add(FOLDER_ITEM(d[1]));
+
+	return d[1];
+}
+
 FolderItem *folder_find_item_from_path(const gchar *path)
 {
 	Folder *folder;
-	gpointer d[2];
+	FolderItem *item = NULL;
 	GList *list = folder_get_list();
+	GList *cur;
 	
 	folder = list ? list->data:NULL;
 	
 	cm_return_val_if_fail(folder != NULL, NULL);
 
-	d[0] = (gpointer)path;
-	d[1] = NULL;
-	while (d[1] == NULL && list) {
-		folder = FOLDER(list->data);
-		g_node_traverse(folder->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
-			folder_item_find_func, d);
-		list = list->next;
+	for (cur = list; cur != NULL; cur = cur->next) {
+		if ((item = folder_index_lookup(FOLDER(cur->data), path)) != NULL)
+			return item;
 	}
-	return d[1];
+
+	for (cur = list; item == NULL && cur != NULL; cur = cur->next)
+		item = folder_find_item_in_folder(FOLDER(cur->data), path);
+
+	return item;
 }
 
 static gboolean folder_item_find_func_real_path(GNode *node, gpointer data)
@@ -1313,6 +1486,10 @@ static gboolean folder_item_find_func_real_path(GNode *node, gpointer data)
 	gpointer *d = data;
 	const gchar *path = d[0];
 	gchar *tmp = folder_item_get_path(item);
+
+	/* remember all the paths that had to be worked out */
+	if (tmp != NULL)
+		folder_item_index_add_real_path(item, tmp);
 	if (path_cmp(path, tmp) != 0) {
 		g_free(tmp);
 		return FALSE;
@@ -1326,13 +1503,29 @@ static gboolean folder_item_find_func_real_path(GNode *node, gpointer data)
 FolderItem *folder_find_item_from_real_path(const gchar *path)
 {
 	Folder *folder;
+	FolderItem *item;
 	gpointer d[2];
 	GList *list = folder_get_list();
+	gchar *key, *tmp;
 	
 	folder = list ? list->data:NULL;
 	
 	cm_return_val_if_fail(folder != NULL, NULL);
 
+	if (folder_item_real_path_index != NULL &&
+	    (key = folder_index_key(path)) != NULL) {
+		item = g_hash_table_lookup(folder_item_real_path_index, key);
+		g_free(key);
+		if (item != NULL) {
+			tmp = folder_item_get_path(item);
+			if (path_cmp(path, tmp) == 0) {
+				g_free(tmp);
+				return item;
+			}
+			g_free(tmp);
+		}
+	}
+
 	d[0] = (gpointer)path;
 	d[1] = NULL;
 	while (d[1] == NULL && list) {
@@ -1434,7 +1627,6 @@ Folder *folder_find_from_identifier(const gchar *identifier)
 FolderItem *folder_find_item_from_identifier(const gchar *identifier)
 {
 	Folder *folder;
-	gpointer d[2];
 	gchar *str;
 	gchar *p;
 	gchar *name;
@@ -1470,11 +1662,7 @@ FolderItem *folder_find_item_from_identifier(const gchar *identifier)
 
 	path = p;
 
-	d[0] = (gpointer)path;
-	d[1] = NULL;
-	g_node_traverse(folder->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
-			folder_item_find_func, d);
-	return d[1];
+	return folder_find_item_in_folder(folder, path);
 }
 
 /** Returns the FolderItem from a given identifier
@@ -1920,20 +2108,43 @@ gchar *folder_item_get_path(FolderItem *item)
 	return folder->klass->item_get_path(folder, item);
 }
 
-static gint folder_sort_cache_list_by_msgnum(gconstpointer a, gconstpointer b)
+static gint folder_compare_msgnum(gconstpointer a, gconstpointer b)
 {
-	MsgInfo *msginfo_a = (MsgInfo *) a;
-	MsgInfo *msginfo_b = (MsgInfo *) b;
+	guint num_a = *(const guint *)a;
+	guint num_b = *(const guint *)b;
 
-	return (msginfo_a->msgnum - msginfo_b->msgnum);
+	return (num_a > num_b) - (num_a < num_b);
 }
 
-static gint folder_sort_folder_list(gconstpointer a, gconstpointer b)
+/* Copies the message numbers of list into a new sorted array */
+static guint *folder_msgnum_list_to_array(MsgNumberList *list, guint *len)
 {
-	guint gint_a = GPOINTER_TO_INT(a);
-	guint gint_b = GPOINTER_TO_INT(b);
-	
-	return (gint_a - gint_b);
+	guint *nums;
+	guint i = 0;
+
+	*len = g_slist_length(list);
+	nums = g_new(guint, MAX(*len, 1));
+	for (; list != NULL; list = list->next)
+		nums[i++] = GPOINTER_TO_UINT(list->data);
+	qsort(nums, *len, sizeof(guint), folder_compare_msgnum);
+
+	return nums;
+}
+
+/* Same for the messages of a cache, without building a list */
+static guint *folder_msgnum_cache_to_array(MsgCache *cache, guint *len)
+{
+	const MsgCacheColumns *columns = msgcache_get_columns(cache);
+	guint *nums;
+	guint i;
+
+	*len = columns->len;
+	nums = g_new(guint, MAX(*len, 1));
+	for (i = 0; i < *len; i++)
+		nums[i] = columns->msgnum[i];
+	qsort(nums, *len, sizeof(guint), folder_compare_msgnum);
+
+	return nums;
 }
 
 static gint syncronize_flags(FolderItem *item, MsgInfoList *msglist)
@@ -2146,9 +2357,10 @@ static MsgInfo *get_msginfo(FolderItem *item, guint num)
 gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 {
 	Folder *folder;
-	GSList *folder_list = NULL, *cache_list = NULL;
-	GSList *folder_list_cur, *cache_list_cur, *new_list = NULL;
+	GSList *folder_list = NULL, *new_list = NULL;
 	GSList *exists_list = NULL, *elem;
+	guint *folder_nums, *cache_nums;
+	guint folder_len, cache_len = 0, folder_pos = 0, cache_pos = 0;
 	GSList *newmsg_list = NULL;
 	guint newcnt = 0, unreadcnt = 0, totalcnt = 0;
 	guint markedcnt = 0, unreadmarkedcnt = 0;
@@ -2179,51 +2391,33 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 	}
 
 	if(prefs_common.thread_by_subject) {
-		subject_table = g_hash_table_new(g_str_hash, g_str_equal);
+		subject_table = procmsg_subject_table_new();
 	}
 	
 	if (old_uids_valid) {
 		if (!item->cache)
 			folder_item_read_cache(item);
-		cache_list = msgcache_get_msg_list(item->cache);
+		/* numbers only, messages gone from the folder don't need
+		 * to be read from the cache file */
+		cache_nums = folder_msgnum_cache_to_array(item->cache, &cache_len);
 	} else {
 		if (item->cache)
 			msgcache_destroy(item->cache);
 		item->cache = msgcache_new();
+		msgcache_set_folder_item(item->cache, item);
 		item->cache_dirty = TRUE;
 		item->mark_dirty = TRUE;
 		item->tags_dirty = TRUE;
-		cache_list = NULL;
+		cache_nums = g_new(guint, 1);
 	}
 
-	/* Sort both lists */
-    	cache_list = g_slist_sort(cache_list, folder_sort_cache_list_by_msgnum);
-	folder_list = g_slist_sort(folder_list, folder_sort_folder_list);
-
-	cache_list_cur = cache_list;
-	folder_list_cur = folder_list;
-
-	if (cache_list_cur != NULL) {
-		GSList *cache_list_last;
-	
-		cache_cur_num = ((MsgInfo *)cache_list_cur->data)->msgnum;
-		cache_list_last = g_slist_last(cache_list);
-		cache_max_num = ((MsgInfo *)cache_list_last->data)->msgnum;
-	} else {
-		cache_cur_num = G_MAXINT;
-		cache_max_num = 0;
-	}
+	folder_nums = folder_msgnum_list_to_array(folder_list, &folder_len);
+	g_slist_free(folder_list);
 
-	if (folder_list_cur != NULL) {
-		GSList *folder_list_last;
-	
-		folder_cur_num = GPOINTER_TO_INT(folder_list_cur->data);
-		folder_list_last = g_slist_last(folder_list);
-		folder_max_num = GPOINTER_TO_INT(folder_list_last->data);
-	} else {
-		folder_cur_num = G_MAXINT;
-		folder_max_num = 0;
-	}
+	cache_cur_num = cache_len > 0 ? cache_nums[0] : G_MAXINT;
+	cache_max_num = cache_len > 0 ? cache_nums[cache_len - 1] : 0;
+	folder_cur_num = folder_len > 0 ? folder_nums[0] : G_MAXINT;
+	folder_max_num = folder_len > 0 ? folder_nums[folder_len - 1] : 0;
 
 	while ((cache_cur_num != G_MAXINT) || (folder_cur_num != G_MAXINT)) {
 		/*
@@ -2259,13 +2453,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 			}
 
 			/* Move to next folder number */
-			if (folder_list_cur)
-				folder_list_cur = folder_list_cur->next;
-
-			if (folder_list_cur != NULL)
-				folder_cur_num = GPOINTER_TO_INT(folder_list_cur->data);
-			else
-				folder_cur_num = G_MAXINT;
+			folder_pos++;
+			folder_cur_num = folder_pos < folder_len ? folder_nums[folder_pos] : G_MAXINT;
 
 			continue;
 		}
@@ -2279,13 +2468,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 			debug_print("Removed message %d from cache.\n", cache_cur_num);
 
 			/* Move to next cache number */
-			if (cache_list_cur)
-				cache_list_cur = cache_list_cur->next;
-
-			if (cache_list_cur != NULL)
-				cache_cur_num = ((MsgInfo *)cache_list_cur->data)->msgnum;
-			else
-				cache_cur_num = G_MAXINT;
+			cache_pos++;
+			cache_cur_num = cache_pos < cache_len ? cache_nums[cache_pos] : G_MAXINT;
 
 			update_flags |= F_ITEM_UPDATE_MSGCNT | F_ITEM_UPDATE_CONTENT;
 
@@ -2300,7 +2484,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 			MsgInfo *msginfo;
 
 			msginfo = msgcache_get_msg(item->cache, folder_cur_num);
-			if (msginfo && folder->klass->is_msg_changed && folder->klass->is_msg_changed(folder, item, msginfo)) {
+			if (msginfo && folder->klass->is_msg_changed &&
+			    folder->klass->is_msg_changed(folder, item, msginfo)) {
 				msgcache_remove_msg(item->cache, msginfo->msgnum);
 				new_list = g_slist_prepend(new_list, GINT_TO_POINTER(msginfo->msgnum));
 				procmsg_msginfo_free(&msginfo);
@@ -2311,37 +2496,26 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 
 				if(prefs_common.thread_by_subject &&
 					MSG_IS_IGNORE_THREAD(msginfo->flags) &&
-					!subject_table_lookup(subject_table, msginfo->subject)) {
-					subject_table_insert(subject_table, msginfo->subject, msginfo);
+					!procmsg_subject_table_lookup(subject_table, msginfo)) {
+					procmsg_subject_table_insert(subject_table, msginfo, msginfo);
 				}
+			} else {
+				/* its cache record turned out to be unreadable */
+				new_list = g_slist_prepend(new_list, GINT_TO_POINTER(folder_cur_num));
 			}
 			
 			/* Move to next folder and cache number */
-			if (cache_list_cur)
-				cache_list_cur = cache_list_cur->next;
-			
-			if (folder_list_cur)
-				folder_list_cur = folder_list_cur->next;
-
-			if (cache_list_cur != NULL)
-				cache_cur_num = ((MsgInfo *)cache_list_cur->data)->msgnum;
-			else
-				cache_cur_num = G_MAXINT;
-
-			if (folder_list_cur != NULL)
-				folder_cur_num = GPOINTER_TO_INT(folder_list_cur->data);
-			else
-				folder_cur_num = G_MAXINT;
+			cache_pos++;
+			folder_pos++;
+			cache_cur_num = cache_pos < cache_len ? cache_nums[cache_pos] : G_MAXINT;
+			folder_cur_num = folder_pos < folder_len ? folder_nums[folder_pos] : G_MAXINT;
 
 			continue;
 		}
 	}
 	
-	for(cache_list_cur = cache_list; cache_list_cur != NULL; cache_list_cur = g_slist_next(cache_list_cur))
-		procmsg_msginfo_free((MsgInfo **)&(cache_list_cur->data));
-
-	g_slist_free(cache_list);
-	g_slist_free(folder_list);
+	g_free(cache_nums);
+	g_free(folder_nums);
 
 	if (new_list != NULL) {
 		GSList *tmp_list = NULL;
@@ -2374,8 +2548,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 
 				if(prefs_common.thread_by_subject &&
 					MSG_IS_IGNORE_THREAD(msginfo->flags) &&
-					!subject_table_lookup(subject_table, msginfo->subject)) {
-					subject_table_insert(subject_table, msginfo->subject, msginfo);
+					!procmsg_subject_table_lookup(subject_table, msginfo)) {
+					procmsg_subject_table_insert(subject_table, msginfo, msginfo);
 				}			
 			}
 		}
@@ -2404,8 +2578,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 
 					if(prefs_common.thread_by_subject &&
 						MSG_IS_IGNORE_THREAD(msginfo->flags) &&
-						!subject_table_lookup(subject_table, msginfo->subject)) {
-						subject_table_insert(subject_table, msginfo->subject, msginfo);
+						!procmsg_subject_table_lookup(subject_table, msginfo)) {
+						procmsg_subject_table_insert(subject_table, msginfo, msginfo);
 					}
 				}
 				g_slist_free(unfiltered);
@@ -2437,7 +2611,7 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 		}
 		if(prefs_common.thread_by_subject && !msginfo->inreplyto &&
 			!msginfo->references && !MSG_IS_IGNORE_THREAD(msginfo->flags) &&
-			(parent_msginfo = subject_table_lookup(subject_table, msginfo->subject)))
+			(parent_msginfo = procmsg_subject_table_lookup(subject_table, msginfo)))
 		{
 			if(MSG_IS_IGNORE_THREAD(parent_msginfo->flags)) {
 				procmsg_msginfo_change_flags(msginfo, MSG_IGNORE_THREAD, 0,
@@ -2515,44 +2689,6 @@ gint folder_item_scan(FolderItem *item)
 	return folder_item_scan_full(item, TRUE);
 }
 
-static void folder_count_total_cache_memusage(FolderItem *item, gpointer data)
-{
-	gint *memusage = (gint *)data;
-
-	if (item->cache == NULL)
-		return;
-	
-	*memusage += msgcache_get_memory_usage(item->cache);
-}
-
-static gint folder_cache_time_compare_func(gconstpointer a, gconstpointer b)
-{
-	FolderItem *fa = (FolderItem *)a;
-	FolderItem *fb = (FolderItem *)b;
-	
-	return (gint) (msgcache_get_last_access_time(fa->cache) - msgcache_get_last_access_time(fb->cache));
-}
-
-static void folder_find_expired_caches(FolderItem *item, gpointer data)
-{
-	GSList **folder_item_list = (GSList **)data;
-	gint difftime, expiretime;
-	
-	if (item->cache == NULL)
-		return;
-
-	if (item->opened > 0)
-		return;
-
-	difftime = (gint) (time(NULL) - msgcache_get_last_access_time(item->cache));
-	expiretime = prefs_common.cache_min_keep_time * 60;
-	debug_print("Cache unused time: %d (Expire time: %d)\n", difftime, expiretime);
-
-	if (difftime > expiretime && !item->opened && !item->processing_pending) {
-		*folder_item_list = g_slist_insert_sorted(*folder_item_list, item, folder_cache_time_compare_func);
-	}
-}
-
 gboolean folder_item_free_cache(FolderItem *item, gboolean force)
 {
 	cm_return_val_if_fail(item != NULL, TRUE);
@@ -2587,31 +2723,38 @@ void folder_clean_cache_memory(FolderItem *protected_item)
 {
 	gint memusage = 0;
 
-	folder_func_to_all_folders(folder_count_total_cache_memusage, &memusage);	
+	memusage = msgcache_get_total_memory_usage();
+	/* strings shared between the cached messages */
+	memusage += procmsg_msginfo_interned_memusage();
 	debug_print("Total cache memory usage: %d\n", memusage);
 	
 	if (memusage > (prefs_common.cache_max_mem_usage * 1024)) {
-		GSList *folder_item_list = NULL, *listitem;
+		GList *listitem;
+		time_t now = time(NULL);
+		gint expiretime = prefs_common.cache_min_keep_time * 60;
 		
 		debug_print("Trying to free cache memory\n");
 
-		folder_func_to_all_folders(folder_find_expired_caches, &folder_item_list);	
-		listitem = folder_item_list;
+		/* least recently used first, so stop at the first cache
+		 * that hasn't expired yet */
+		listitem = msgcache_get_lru_list();
 		while((listitem != NULL) && (memusage > (prefs_common.cache_max_mem_usage * 1024))) {
-			FolderItem *item = (FolderItem *)(listitem->data);
+			MsgCache *cache = (MsgCache *)(listitem->data);
+			FolderItem *item = msgcache_get_folder_item(cache);
 			gint cache_size = 0;
-			if (item == protected_item) {
-				listitem = listitem->next;
+
+			listitem = listitem->next;
+
+			if ((gint) (now - msgcache_get_last_access_time(cache)) <= expiretime)
+				break;
+			if (item == NULL || item == protected_item ||
+			    item->opened || item->processing_pending)
 				continue;
-			}
 			debug_print("Freeing cache memory for %s\n", item->path ? item->path : item->name);
-			cache_size = msgcache_get_memory_usage(item->cache);
+			cache_size = msgcache_get_memory_usage(cache);
 		        if (folder_item_free_cache(item, FALSE))
 				memusage -= cache_size;
-
-			listitem = listitem->next;
 		}
-		g_slist_free(folder_item_list);
 	}
 }
 
@@ -2647,9 +2790,272 @@ static void folder_item_clean_local_files(FolderItem *item, gint days)
 	}
 }
 
+/* The number of worker threads to start for a pool whose size is set
+ * by a hidden preference; 0 means one thread per processor. */
+static gint folder_worker_threads(gint wanted)
+{
+	if (wanted > 0)
+		return wanted;
+#if GLIB_CHECK_VERSION(2,36,0)
+	return MIN(g_get_num_processors(), 8);
+#else
+	return 2;
+#endif
+}
+
+/*
+ * Background cache loading
+ *
+ * folder_item_read_cache_async() hands the reading of a folder's cache,
+ * mark and tags files to a pool of threads. The caches they read are
+ * given to their folders by an idle handler in the main loop, and
+ * folder_item_read_cache() takes over a load that is still pending
+ * instead of reading the files a second time.
+ */
+typedef struct _FolderCacheLoad {
+	FolderItem *item;
+	gchar *cache_file;
+	gchar *mark_file;
+	gchar *tags_file;
+	MsgTmpFlags tmp_flags;
+	MsgCache *cache;
+	/* protected by cache_load_mutex */
+	gboolean started;
+	gboolean cancelled;
+} FolderCacheLoad;
+
+static GThreadPool *cache_load_pool = NULL;
+static GAsyncQueue *cache_load_done = NULL;
+static GMutex *cache_load_mutex = NULL;
+/* main thread only: the loads not yet finished or cancelled, by item,
+ * and the finished ones taken from cache_load_done while waiting for
+ * another */
+static GHashTable *cache_load_pending = NULL;
+static GSList *cache_load_ready = NULL;
+
+static void folder_cache_load_free(FolderCacheLoad *load)
+{
+	if (load->cache != NULL)
+		msgcache_destroy(load->cache);
+	g_free(load->cache_file);
+	g_free(load->mark_file);
+	g_free(load->tags_file);
+	g_free(load);
+}
+
+static gboolean folder_cache_load_idle(gpointer data);
+
+static void folder_cache_load_thread(gpointer data, gpointer user_data)
+{
+	FolderCacheLoad *load = (FolderCacheLoad *)data;
+	gboolean cancelled;
+
+	g_mutex_lock(cache_load_mutex);
+	cancelled = load->cancelled;
+	load->started = !cancelled;
+	g_mutex_unlock(cache_load_mutex);
+
+	if (!cancelled) {
+		load->cache = msgcache_read_cache_detached(load->item,
+				load->cache_file, load->tmp_flags);
+		if (load->cache != NULL) {
+			msgcache_read_mark(load->cache, load->mark_file);
+			msgcache_read_tags(load->cache, load->tags_file);
+		}
+	}
+
+	g_async_queue_push(cache_load_done, load);
+	g_idle_add(folder_cache_load_idle, NULL);
+}
+
+/* Removes the pending load of item, if any. Returns TRUE if it had
+ * already started, after waiting for it to finish and putting what it
+ * read (not yet attached, possibly NULL) in cache. */
+static gboolean folder_item_take_cache_load(FolderItem *item, MsgCache **cache)
+{
+	FolderCacheLoad *load, *done;
+	gboolean started;
+
+	if (cache_load_pending == NULL ||
+	    (load = g_hash_table_lookup(cache_load_pending, item)) == NULL)
+		return FALSE;
+	g_hash_table_remove(cache_load_pending, item);
+
+	g_mutex_lock(cache_load_mutex);
+	load->cancelled = TRUE;
+	started = load->started;
+	g_mutex_unlock(cache_load_mutex);
+
+	/* the thread will skip it and the idle handler free it */
+	if (!started)
+		return FALSE;
+
+	if (g_slist_find(cache_load_ready, load) != NULL) {
+		cache_load_ready = g_slist_remove(cache_load_ready, load);
+	} else {
+		while ((done = g_async_queue_pop(cache_load_done)) != load)
+			cache_load_ready = g_slist_prepend(cache_load_ready, done);
+	}
+
+	*cache = load->cache;
+	load->cache = NULL;
+	folder_cache_load_free(load);
+
+	return TRUE;
+}
+
+static void folder_item_cancel_cache_load(FolderItem *item)
+{
+	MsgCache *cache = NULL;
+
+	if (folder_item_take_cache_load(item, &cache) && cache != NULL)
+		msgcache_destroy(cache);
+}
+
+static void folder_item_set_cache(FolderItem *item, MsgCache *cache,
+				  const gchar *mark_file,
+				  const gchar *tags_file);
+
+static gboolean folder_cache_load_idle(gpointer data)
+{
+	FolderCacheLoad *load;
+
+	while ((load = g_async_queue_try_pop(cache_load_done)) != NULL)
+		cache_load_ready = g_slist_prepend(cache_load_ready, load);
+
+	/* taken off the lists before anything else, as the update hooks
+	 * may well come back for other folders' caches */
+	while (cache_load_ready != NULL) {
+		load = (FolderCacheLoad *)cache_load_ready->data;
+		cache_load_ready = g_slist_delete_link(cache_load_ready,
+						       cache_load_ready);
+		if (load->cancelled) {
+			folder_cache_load_free(load);
+			continue;
+		}
+		g_hash_table_remove(cache_load_pending, load->item);
+
+		/* folders without a usable cache file are left to be
+		 * scanned when they are actually needed */
+		if (load->cache != NULL && load->item->cache == NULL) {
+			msgcache_attach(load->cache);
+			folder_item_set_cache(load->item, load->cache, NULL, NULL);
+			load->cache = NULL;
+			folder_clean_cache_memory(load->item);
+			folder_item_update(load->item, F_ITEM_UPDATE_MSGCNT);
+		}
+		folder_cache_load_free(load);
+	}
+
+	return FALSE;
+}
+
+/**
+ * Start reading the cache of item in the background, if it isn't
+ * in memory yet. It will be set up from the main loop once read,
+ * or by folder_item_read_cache() if it is needed before that.
+ *
+ * \param item The folder item whose cache should be read
+ */
+void folder_item_read_cache_async(FolderItem *item)
+{
+	FolderCacheLoad *load;
+	GError *error = NULL;
+	gint threads;
+
+	cm_return_if_fail(item != NULL);
+
+	if (item->cache != NULL || item->path == NULL)
+		return;
+
+	if (cache_load_pool == NULL) {
+		threads = folder_worker_threads(prefs_common.cache_load_threads);
+		cache_load_pool = g_thread_pool_new(folder_cache_load_thread, NULL,
+						    threads, FALSE, &error);
+		if (cache_load_pool == NULL) {
+			g_warning("couldn't start cache loading threads: %s",
+				  error ? error->message : "unknown error");
+			if (error)
+				g_error_free(error);
+			return;
+		}
+		cache_load_done = g_async_queue_new();
+		cache_load_mutex = cm_mutex_new();
+		cache_load_pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	if (g_hash_table_lookup(cache_load_pending, item) != NULL)
+		return;
+
+	load = g_new0(FolderCacheLoad, 1);
+	load->item = item;
+	load->cache_file = folder_item_get_cache_file(item);
+	load->mark_file = folder_item_get_mark_file(item);
+	load->tags_file = folder_item_get_tags_file(item);
+	/* worked out here, as it may update item */
+	if (folder_has_parent_of_type(item, F_QUEUE))
+		load->tmp_flags |= MSG_QUEUED;
+	else if (folder_has_parent_of_type(item, F_DRAFT))
+		load->tmp_flags |= MSG_DRAFT;
+
+	g_hash_table_insert(cache_load_pending, item, load);
+	g_thread_pool_push(cache_load_pool, load, NULL);
+}
+
+/* Gives item the cache read from its files, or a new one filled by
+ * scanning the folder if there was none. */
+static void folder_item_set_cache(FolderItem *item, MsgCache *cache,
+				  const gchar *mark_file,
+				  const gchar *tags_file)
+{
+	MsgInfoList *list, *cur;
+	guint unreadmarkedcnt = 0;
+	MsgInfo *msginfo;
+
+	item->cache = cache;
+	item->cache_dirty = FALSE;
+	item->mark_dirty = FALSE;
+	item->tags_dirty = FALSE;
+	if (item->cache)
+		return;
+
+	item->cache = msgcache_new();
+	msgcache_set_folder_item(item->cache, item);
+	item->cache_dirty = TRUE;
+	item->mark_dirty = TRUE;
+	item->tags_dirty = TRUE;
+	folder_item_scan_full(item, TRUE);
+
+	msgcache_read_mark(item->cache, mark_file);
+
+	item->new_msgs = msgcache_count_perm_flags(item->cache, MSG_NEW);
+	item->unread_msgs = msgcache_count_perm_flags(item->cache, MSG_UNREAD);
+	item->marked_msgs = msgcache_count_perm_flags(item->cache, MSG_MARKED);
+	item->replied_msgs = msgcache_count_perm_flags(item->cache, MSG_REPLIED);
+	item->forwarded_msgs = msgcache_count_perm_flags(item->cache, MSG_FORWARDED);
+	item->locked_msgs = msgcache_count_perm_flags(item->cache, MSG_LOCKED);
+	item->ignored_msgs = msgcache_count_perm_flags(item->cache, MSG_IGNORE_THREAD);
+	item->watched_msgs = msgcache_count_perm_flags(item->cache, MSG_WATCH_THREAD);
+
+	/* only these need the messages themselves */
+	list = msgcache_get_msg_list(item->cache);
+	for (cur = list; cur != NULL; cur = g_slist_next(cur)) {
+		msginfo = cur->data;
+
+		if (MSG_IS_UNREAD(msginfo->flags) && procmsg_msg_has_marked_parent(msginfo))
+			unreadmarkedcnt++;
+		procmsg_msginfo_unset_flags(msginfo, MSG_FULLY_CACHED, 0);
+	}
+	item->unreadmarked_msgs = unreadmarkedcnt;
+	procmsg_msg_list_free(list);
+
+	msgcache_read_tags(item->cache, tags_file);
+}
+
 static void folder_item_read_cache(FolderItem *item)
 {
 	gchar *cache_file, *mark_file, *tags_file;
+	MsgCache *cache = NULL;
 	START_TIMING("");
 	cm_return_if_fail(item != NULL);
 
@@ -2657,71 +3063,24 @@ static void folder_item_read_cache(FolderItem *item)
 	        cache_file = folder_item_get_cache_file(item);
 		mark_file = folder_item_get_mark_file(item);
 		tags_file = folder_item_get_tags_file(item);
-		item->cache = msgcache_read_cache(item, cache_file);
-		item->cache_dirty = FALSE;
-		item->mark_dirty = FALSE;
-		item->tags_dirty = FALSE;
-		if (!item->cache) {
-			MsgInfoList *list, *cur;
-			guint newcnt = 0, unreadcnt = 0;
-			guint markedcnt = 0, unreadmarkedcnt = 0;
-			guint repliedcnt = 0, forwardedcnt = 0;
-			guint lockedcnt = 0, ignoredcnt = 0;
-			guint watchedcnt = 0;
-			MsgInfo *msginfo;
-
-			item->cache = msgcache_new();
-			item->cache_dirty = TRUE;
-			item->mark_dirty = TRUE;
-			item->tags_dirty = TRUE;
-			folder_item_scan_full(item, TRUE);
-
-			msgcache_read_mark(item->cache, mark_file);
-
-			list = msgcache_get_msg_list(item->cache);
-			for (cur = list; cur != NULL; cur = g_slist_next(cur)) {
-				msginfo = cur->data;
-
-				if (MSG_IS_NEW(msginfo->flags))
-					newcnt++;
-				if (MSG_IS_UNREAD(msginfo->flags))
-					unreadcnt++;
-				if (MSG_IS_UNREAD(msginfo->flags) && procmsg_msg_has_marked_parent(msginfo))
-					unreadmarkedcnt++;
-				if (MSG_IS_MARKED(msginfo->flags))
-					markedcnt++;
-				if (MSG_IS_REPLIED(msginfo->flags))
-					repliedcnt++;
-				if (MSG_IS_FORWARDED(msginfo->flags))
-					forwardedcnt++;
-				if (MSG_IS_LOCKED(msginfo->flags))
-					lockedcnt++;
-				if (MSG_IS_IGNORE_THREAD(msginfo->flags))
-					ignoredcnt++;
-				if (MSG_IS_WATCH_THREAD(msginfo->flags))
-					watchedcnt++;
-				procmsg_msginfo_unset_flags(msginfo, MSG_FULLY_CACHED, 0);
+		if (folder_item_take_cache_load(item, &cache)) {
+			if (cache != NULL)
+				msgcache_attach(cache);
+		} else {
+			cache = msgcache_read_cache(item, cache_file);
+			if (cache != NULL) {
+				msgcache_read_mark(cache, mark_file);
+				msgcache_read_tags(cache, tags_file);
 			}
-			item->new_msgs = newcnt;
-		        item->unread_msgs = unreadcnt;
-			item->unreadmarked_msgs = unreadmarkedcnt;
-			item->marked_msgs = markedcnt;
-			item->replied_msgs = repliedcnt;
-			item->forwarded_msgs = forwardedcnt;
-			item->locked_msgs = lockedcnt;
-			item->ignored_msgs = ignoredcnt;
-			item->watched_msgs = watchedcnt;
-			procmsg_msg_list_free(list);
-		} else
-			msgcache_read_mark(item->cache, mark_file);
-
-		msgcache_read_tags(item->cache, tags_file);
+		}
+		folder_item_set_cache(item, cache, mark_file, tags_file);
 
 		g_free(cache_file);
 		g_free(mark_file);
 		g_free(tags_file);
 	} else {
 		item->cache = msgcache_new();
+		msgcache_set_folder_item(item->cache, item);
 		item->cache_dirty = TRUE;
 		item->mark_dirty = TRUE;
 		item->tags_dirty = TRUE;
@@ -2734,6 +3093,7 @@ static void folder_item_read_cache(FolderItem *item)
 void folder_item_write_cache(FolderItem *item)
 {
 	gchar *cache_file = NULL, *mark_file = NULL, *tags_file = NULL;
+	gchar *thread_file;
 	FolderItemPrefs *prefs;
 	gint filemode = 0;
 	gchar *id;
@@ -2777,6 +3137,12 @@ void folder_item_write_cache(FolderItem *item)
 		item->tags_dirty = FALSE;
 	}
 
+	thread_file = folder_item_get_thread_file(item);
+	if (thread_file != NULL &&
+	    msgcache_write_thread_links(thread_file, item->cache) < 0)
+		debug_print("couldn't write thread links to %s\n", thread_file);
+	g_free(thread_file);
+
 	if (!need_scan && item->folder->klass->set_mtime) {
 		if (item->mtime == last_mtime) {
 			item->folder->klass->set_mtime(item->folder, item);
@@ -2788,6 +3154,48 @@ void folder_item_write_cache(FolderItem *item)
 	g_free(tags_file);
 }
 
+/**
+ * folder_item_get_thread_links:
+ * @item: the folder.
+ * @mode: the threading preferences the links must have been built with.
+ *
+ * Return the thread index saved with the cache of @item, reading it
+ * on first use.
+ *
+ * Return value: array of #MsgCacheThreadLink owned by the cache, or
+ * NULL.
+ */
+GArray *folder_item_get_thread_links(FolderItem *item, guint32 mode)
+{
+	gchar *thread_file;
+
+	cm_return_val_if_fail(item != NULL, NULL);
+
+	if (!item->cache)
+		folder_item_read_cache(item);
+	if (!item->cache || !item->path)
+		return NULL;
+
+	thread_file = folder_item_get_thread_file(item);
+	if (thread_file != NULL)
+		msgcache_read_thread_links(item->cache, thread_file);
+	g_free(thread_file);
+
+	return msgcache_get_thread_links(item->cache, mode);
+}
+
+void folder_item_set_thread_links(FolderItem *item, GArray *links, guint32 mode)
+{
+	cm_return_if_fail(item != NULL);
+	cm_return_if_fail(links != NULL);
+
+	if (!item->cache || !item->path) {
+		g_array_free(links, TRUE);
+		return;
+	}
+	msgcache_set_thread_links(item->cache, links, mode);
+}
+
 MsgInfo *folder_item_get_msginfo(FolderItem *item, gint num)
 {
 	MsgInfo *msginfo = NULL;
@@ -3857,6 +4265,7 @@ gint folder_item_remove_all_msg(FolderItem *item)
 		if (result == 0) {
 			folder_item_free_cache(item, TRUE);
 			item->cache = msgcache_new();
+			msgcache_set_folder_item(item->cache, item);
 			item->cache_dirty = TRUE;
 			item->mark_dirty = TRUE;
 			item->tags_dirty = TRUE;
@@ -3893,6 +4302,8 @@ void folder_item_change_msg_flags(FolderItem *item, MsgInfo *msginfo, MsgPermFla
 	cm_return_if_fail(msginfo != NULL);
 	
 	item->mark_dirty = TRUE;
+	if (item->cache)
+		msgcache_flags_changed(item->cache, msginfo->msgnum);
 
 	if (item->no_select)
 		return;
@@ -3904,6 +4315,49 @@ void folder_item_change_msg_flags(FolderItem *item, MsgInfo *msginfo, MsgPermFla
 	}
 }
 
+/* msgflags maps each MsgInfo of msglist to its new permanent flags */
+void folder_item_change_msgs_flags(FolderItem *item, MsgInfoList *msglist,
+				   GHashTable *msgflags)
+{
+	MsgInfoList *cur;
+
+	cm_return_if_fail(item != NULL);
+	cm_return_if_fail(msgflags != NULL);
+
+	if (msglist == NULL)
+		return;
+
+	item->mark_dirty = TRUE;
+	if (item->cache) {
+		for (cur = msglist; cur != NULL; cur = cur->next)
+			msgcache_flags_changed(item->cache,
+					       ((MsgInfo *)cur->data)->msgnum);
+	}
+
+	if (item->no_select)
+		return;
+
+	if (item->folder->klass->change_flags_list != NULL
+	    && item->scanning != ITEM_SCANNING_WITH_FLAGS) {
+		item->folder->klass->change_flags_list(item->folder, item,
+						       msglist, msgflags);
+		return;
+	}
+
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		MsgPermFlags newflags = GPOINTER_TO_UINT(
+				g_hash_table_lookup(msgflags, msginfo));
+
+		if (item->folder->klass->change_flags != NULL
+		    && item->scanning != ITEM_SCANNING_WITH_FLAGS)
+			item->folder->klass->change_flags(item->folder, item,
+							  msginfo, newflags);
+		else
+			msginfo->flags.perm_flags = newflags;
+	}
+}
+
 void folder_item_commit_tags(FolderItem *item, MsgInfo *msginfo, GSList *tags_set, GSList *tags_unset)
 {
 	Folder *folder = NULL;
@@ -3920,6 +4374,8 @@ void folder_item_commit_tags(FolderItem *item, MsgInfo *msginfo, GSList *tags_se
 		return;
 	
 	item->tags_dirty = TRUE;
+	if (item->cache)
+		msgcache_tags_changed(item->cache, msginfo->msgnum);
 
 	if (folder->klass->commit_tags == NULL)
 		return;
@@ -3950,6 +4406,7 @@ void folder_item_discard_cache(FolderItem *item)
 	if (!item)
 		return;
 
+	folder_item_cancel_cache_load(item);
 	if (item->cache) {
 		msgcache_destroy(item->cache);
 		item->cache = NULL;
@@ -4014,6 +4471,22 @@ static gchar *folder_item_get_mark_file(FolderItem *item)
 	return file;
 }
 
+static gchar *folder_item_get_thread_file(FolderItem *item)
+{
+	gchar *path;
+	gchar *file;
+
+	cm_return_val_if_fail(item != NULL, NULL);
+	cm_return_val_if_fail(item->path != NULL, NULL);
+
+	path = folder_item_get_path(item);
+	cm_return_val_if_fail(path != NULL, NULL);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, THREAD_FILE, NULL);
+	g_free(path);
+
+	return file;
+}
+
 static gchar *folder_item_get_tags_file(FolderItem *item)
 {
 	gchar *path;
@@ -4497,28 +4970,72 @@ void folder_item_apply_processing(FolderItem *item)
 
 /*
  *  functions for handling FolderItem content changes
+ *
+ *  Updates are merged into item->update_flags and sent by an idle
+ *  handler, once per item and main loop iteration, so that moving or
+ *  filtering many messages redraws the views once. Updates about an
+ *  added or removed message are sent at once together with what is
+ *  pending for the item, unless updates are frozen.
  */
 static gint folder_item_update_freeze_cnt = 0;
+/* the items with update_flags set, in the order they changed */
+static GQueue folder_item_update_pending = G_QUEUE_INIT;
+static guint folder_item_update_idle_id = 0;
+static guint folder_item_update_coalesced = 0;
+
+static gboolean folder_item_update_idle(gpointer data);
+
+static void folder_item_update_queue(FolderItem *item,
+				     FolderItemUpdateFlags update_flags)
+{
+	if (update_flags == 0)
+		return;
+
+	if (item->update_flags == 0)
+		g_queue_push_tail(&folder_item_update_pending, item);
+	else
+		folder_item_update_coalesced++;
+	item->update_flags |= update_flags;
+
+	if (folder_item_update_freeze_cnt == 0
+	    && folder_item_update_idle_id == 0)
+		folder_item_update_idle_id =
+			g_idle_add(folder_item_update_idle, NULL);
+}
+
+/* Forgets the pending updates of item. */
+static void folder_item_update_cancel(FolderItem *item)
+{
+	if (item->update_flags == 0)
+		return;
+
+	g_queue_remove(&folder_item_update_pending, item);
+	item->update_flags = 0;
+}
 
 static void folder_item_update_with_msg(FolderItem *item, FolderItemUpdateFlags update_flags, MsgInfo *msg)
 {
-	if (folder_item_update_freeze_cnt == 0 /* || (msg != NULL && item->opened) */) {
+	if (folder_item_update_freeze_cnt == 0 && msg != NULL) {
 		FolderItemUpdateData source;
 	
 		source.item = item;
-		source.update_flags = update_flags;
+		source.update_flags = update_flags | item->update_flags;
 		source.msg = msg;
+		if (item->update_flags != 0)
+			folder_item_update_coalesced++;
+		folder_item_update_cancel(item);
     		hooks_invoke(FOLDER_ITEM_UPDATE_HOOKLIST, &source);
 	} else {
-		item->update_flags |= update_flags & ~(F_ITEM_UPDATE_ADDMSG | F_ITEM_UPDATE_REMOVEMSG);
+		folder_item_update_queue(item,
+			update_flags & ~(F_ITEM_UPDATE_ADDMSG | F_ITEM_UPDATE_REMOVEMSG));
 	}
 }
 
 /**
- * Notify the folder system about changes to a folder. If the
- * update system is not frozen the FOLDER_ITEM_UPDATE_HOOKLIST will
- * be invoked, otherwise the changes will be remebered until
- * the folder system is thawed.
+ * Notify the folder system about changes to a folder. The
+ * FOLDER_ITEM_UPDATE_HOOKLIST will be invoked from the main loop
+ * once for all changes made to the folder until then, or when the
+ * folder system is thawed if it is frozen.
  *
  * \param item The FolderItem that was changed
  * \param update_flags Type of changed that was made
@@ -4551,26 +5068,57 @@ void folder_item_update_freeze(void)
 	folder_item_update_freeze_cnt++;
 }
 
-static void folder_item_update_func(FolderItem *item, gpointer data)
+/**
+ * Invoke the FOLDER_ITEM_UPDATE_HOOKLIST now for all pending changes,
+ * unless the folder system is frozen.
+ */
+void folder_item_update_flush(void)
 {
 	FolderItemUpdateData source;
-    
-	if (item->update_flags) {
+	FolderItem *item;
+
+	if (folder_item_update_freeze_cnt > 0)
+		return;
+
+	if (folder_item_update_coalesced > 0)
+		debug_print("sending updates for %u folders, %u updates merged\n",
+			    g_queue_get_length(&folder_item_update_pending),
+			    folder_item_update_coalesced);
+
+	/* the hooks can change or destroy folders, taken one by one */
+	while ((item = g_queue_pop_head(&folder_item_update_pending)) != NULL) {
 		source.item = item;
 		source.update_flags = item->update_flags;
 		source.msg = NULL;
-		hooks_invoke(FOLDER_ITEM_UPDATE_HOOKLIST, &source);				
 		item->update_flags = 0;
+		hooks_invoke(FOLDER_ITEM_UPDATE_HOOKLIST, &source);
 	}
 }
 
+/**
+ * The number of folder updates that were merged into another one
+ * since the start.
+ */
+guint folder_item_update_get_coalesced(void)
+{
+	return folder_item_update_coalesced;
+}
+
+static gboolean folder_item_update_idle(gpointer data)
+{
+	folder_item_update_idle_id = 0;
+	folder_item_update_flush();
+
+	return FALSE;
+}
+
 void folder_item_update_thaw(void)
 {
 	if (folder_item_update_freeze_cnt > 0)
 		folder_item_update_freeze_cnt--;
 	if (folder_item_update_freeze_cnt == 0) {
 		/* Update all folders */
-		folder_func_to_all_folders(folder_item_update_func, NULL);
+		folder_item_update_flush();
 	}
 }
 
@@ -4778,6 +5326,239 @@ MsgNumberList *folder_item_get_number_list(FolderItem *item)
 	return nums;
 }
 
+/*
+ * Threaded local search
+ *
+ * The main thread gets the messages of a local folder in chunks, along
+ * with the files of those the message info alone doesn't decide, and
+ * hands them to a pool of threads, each testing them with its own copy
+ * of the predicate. Finished chunks come back through a queue, so progress can
+ * be reported and the search cancelled while the threads keep going.
+ * The first chunk is tested by the main thread itself, which also gets
+ * most of what the matching code sets up on first use out of the way.
+ */
+#define FOLDER_SEARCH_CHUNK	64
+
+typedef struct _FolderSearch {
+	MatcherList *predicate;
+	gboolean read_headers;
+	gboolean read_body;
+	/* copies of predicate not used by a thread right now */
+	GAsyncQueue *matchers;
+	GAsyncQueue *done;
+	volatile gint cancelled;
+} FolderSearch;
+
+typedef struct _FolderSearchChunk {
+	guint count;
+	/* how many were tested before a cancel */
+	guint processed;
+	guint matched;
+	guint nums[FOLDER_SEARCH_CHUNK];
+	/* NULL once tested by the main thread */
+	MsgInfo *msginfos[FOLDER_SEARCH_CHUNK];
+	gchar *files[FOLDER_SEARCH_CHUNK];
+	gboolean matches[FOLDER_SEARCH_CHUNK];
+} FolderSearchChunk;
+
+static void folder_search_chunk_free(FolderSearchChunk *chunk)
+{
+	guint i;
+
+	for (i = 0; i < chunk->count; i++) {
+		procmsg_msginfo_free(&chunk->msginfos[i]);
+		g_free(chunk->files[i]);
+	}
+	g_free(chunk);
+}
+
+static void folder_search_chunk_match(FolderSearchChunk *chunk,
+				      MatcherList *matchers,
+				      volatile gint *cancelled)
+{
+	guint i;
+
+	for (i = 0; i < chunk->count; i++) {
+		if (cancelled != NULL && g_atomic_int_get(cancelled))
+			break;
+		if (chunk->msginfos[i] != NULL)
+			chunk->matches[i] = matcherlist_match_with_file(matchers,
+					chunk->msginfos[i], chunk->files[i]);
+		if (chunk->matches[i])
+			chunk->matched++;
+	}
+	chunk->processed = i;
+}
+
+static void folder_search_thread(gpointer data, gpointer user_data)
+{
+	FolderSearchChunk *chunk = (FolderSearchChunk *)data;
+	FolderSearch *search = (FolderSearch *)user_data;
+	MatcherList *matchers;
+
+	matchers = g_async_queue_pop(search->matchers);
+	folder_search_chunk_match(chunk, matchers, &search->cancelled);
+	g_async_queue_push(search->matchers, matchers);
+
+	g_async_queue_push(search->done, chunk);
+}
+
+/* Adds the message to the chunk; returns FALSE if it can't be read. */
+static gboolean folder_search_chunk_add(FolderSearchChunk *chunk,
+					FolderSearch *search,
+					FolderItem *item, guint num)
+{
+	MsgInfo *msginfo;
+	guint i = chunk->count;
+	gint decided;
+
+	msginfo = folder_item_get_msginfo(item, num);
+	if (msginfo == NULL)
+		return FALSE;
+
+	chunk->nums[i] = num;
+	chunk->count++;
+	if (search->read_headers || search->read_body) {
+		/* only fetch the file if the message info doesn't decide */
+		decided = matcherlist_match_info(search->predicate, msginfo);
+		if (decided < 0) {
+			chunk->files[i] = procmsg_get_message_file_full(msginfo,
+					search->read_headers, search->read_body);
+			/* let the matcher decide what a missing file means */
+			if (chunk->files[i] == NULL)
+				decided = matcherlist_match(search->predicate,
+							    msginfo);
+		}
+		if (decided >= 0) {
+			chunk->matches[i] = decided;
+			procmsg_msginfo_free(&msginfo);
+		}
+	}
+	chunk->msginfos[i] = msginfo;
+
+	return TRUE;
+}
+
+/* Returns FALSE if no threads could be started, otherwise sets matched
+ * to what folder_item_search_msgs_local() should return. */
+static gboolean folder_item_search_msgs_threaded(FolderItem *item,
+						 GSList *nums,
+						 guint msgcount,
+						 gint threads,
+						 MatcherList *predicate,
+						 MsgNumberList **msgs,
+						 SearchProgressNotify progress_cb,
+						 gpointer progress_data,
+						 gint *matched)
+{
+	FolderSearch search;
+	FolderSearchChunk **chunks;
+	FolderSearchChunk *chunk;
+	MatcherList *matchers;
+	GThreadPool *pool;
+	GError *error = NULL;
+	GSList *cur;
+	GSList *result = NULL;
+	guint n_chunks, n_pushed = 0, n_done = 0;
+	guint processed_count = 0, matched_count = 0;
+	gboolean failed = FALSE;
+	gint i;
+	guint j;
+
+	memset(&search, 0, sizeof(search));
+	search.predicate = predicate;
+	matcherlist_needs_file(predicate, &search.read_headers, &search.read_body);
+
+	pool = g_thread_pool_new(folder_search_thread, &search, threads,
+				 FALSE, &error);
+	if (pool == NULL) {
+		g_warning("couldn't start search threads: %s",
+			  error ? error->message : "unknown error");
+		if (error)
+			g_error_free(error);
+		return FALSE;
+	}
+	search.matchers = g_async_queue_new();
+	search.done = g_async_queue_new();
+	for (i = 0; i < threads; i++) {
+		/* compiled here, so the threads only read their copy */
+		matchers = matcherlist_copy(predicate);
+		matcherlist_compile(matchers);
+		g_async_queue_push(search.matchers, matchers);
+	}
+
+	n_chunks = (msgcount + FOLDER_SEARCH_CHUNK - 1) / FOLDER_SEARCH_CHUNK;
+	chunks = g_new0(FolderSearchChunk *, n_chunks);
+
+	cur = nums;
+	while (n_done < n_pushed || (cur != NULL && !failed
+				     && !g_atomic_int_get(&search.cancelled))) {
+		if (cur != NULL && !failed
+		    && !g_atomic_int_get(&search.cancelled)) {
+			chunk = g_new0(FolderSearchChunk, 1);
+			chunks[n_pushed++] = chunk;
+			for (; cur != NULL && chunk->count < FOLDER_SEARCH_CHUNK;
+			     cur = cur->next) {
+				if (!folder_search_chunk_add(chunk, &search, item,
+						GPOINTER_TO_UINT(cur->data))) {
+					failed = TRUE;
+					break;
+				}
+			}
+			if (n_pushed == 1) {
+				folder_search_chunk_match(chunk, predicate, NULL);
+				g_async_queue_push(search.done, chunk);
+			} else {
+				g_thread_pool_push(pool, chunk, NULL);
+			}
+			chunk = g_async_queue_try_pop(search.done);
+		} else {
+			chunk = g_async_queue_pop(search.done);
+		}
+		if (chunk == NULL)
+			continue;
+
+		n_done++;
+		processed_count += chunk->processed;
+		matched_count += chunk->matched;
+		if (progress_cb != NULL
+		    && !g_atomic_int_get(&search.cancelled)
+		    && !progress_cb(progress_data, FALSE, processed_count,
+				    matched_count, msgcount))
+			g_atomic_int_set(&search.cancelled, 1);
+	}
+
+	g_thread_pool_free(pool, FALSE, TRUE);
+	while ((matchers = g_async_queue_try_pop(search.matchers)) != NULL)
+		matcherlist_free(matchers);
+	g_async_queue_unref(search.matchers);
+	g_async_queue_unref(search.done);
+
+	for (j = 0; j < n_pushed; j++) {
+		guint k;
+
+		chunk = chunks[j];
+		for (k = 0; k < chunk->processed; k++) {
+			if (chunk->matches[k])
+				result = g_slist_prepend(result,
+					GUINT_TO_POINTER(chunk->nums[k]));
+		}
+		folder_search_chunk_free(chunk);
+	}
+	g_free(chunks);
+
+	if (failed) {
+		g_slist_free(result);
+		*matched = -1;
+		return TRUE;
+	}
+
+	*msgs = g_slist_reverse(result);
+	*matched = matched_count;
+
+	return TRUE;
+}
+
 gint folder_item_search_msgs_local	(Folder			*folder,
 					 FolderItem		*container,
 					 MsgNumberList		**msgs,
@@ -4791,9 +5572,27 @@ gint folder_item_search_msgs_local	(Folder			*folder,
 	gint matched_count = 0;
 	guint processed_count = 0;
 	gint msgcount;
+	gint threads;
 	GSList *nums = NULL;
 
 	if (*msgs == NULL) {
+		/* flag, age and size conditions can be checked on the
+		 * cache columns without looking at single messages */
+		if (!container->cache && !container->no_select)
+			folder_item_read_cache(container);
+		if (container->cache) {
+			matched_count = matcherlist_match_columns(predicate,
+					msgcache_get_columns(container->cache), msgs);
+			if (matched_count >= 0) {
+				if (progress_cb != NULL)
+					progress_cb(progress_data, FALSE,
+						    msgcache_get_columns(container->cache)->len,
+						    matched_count,
+						    msgcache_get_columns(container->cache)->len);
+				return matched_count;
+			}
+			matched_count = 0;
+		}
 		nums = folder_item_get_number_list(container);
 	} else {
 		nums = *msgs;
@@ -4804,6 +5603,26 @@ gint folder_item_search_msgs_local	(Folder			*folder,
 	if (msgcount < 0)
 		return -1;
 
+	threads = folder_worker_threads(prefs_common.search_threads);
+	/* the files of other folders would be fetched one at a time
+	 * by the main thread anyway; queued messages and drafts are
+	 * few, and checking for them here also records the folder
+	 * type before the threads look it up */
+	if (threads > 1 && msgcount > 2 * FOLDER_SEARCH_CHUNK
+	    && FOLDER_IS_LOCAL(container->folder)
+	    && !folder_has_parent_of_type(container, F_QUEUE)
+	    && !folder_has_parent_of_type(container, F_DRAFT)
+	    && matcherlist_is_thread_safe(predicate)
+	    && folder_item_search_msgs_threaded(container, nums, msgcount,
+				threads, predicate, &result, progress_cb,
+				progress_data, &matched_count)) {
+		if (matched_count >= 0) {
+			g_slist_free(nums);
+			*msgs = result;
+		}
+		return matched_count;
+	}
+
 	for (cur = nums; cur != NULL; cur = cur->next) {
 		guint msgnum = GPOINTER_TO_UINT(cur->data);
 		MsgInfo *msg = folder_item_get_msginfo(container, msgnum);
@@ -4817,6 +5636,7 @@ gint folder_item_search_msgs_local	(Folder			*folder,
 			result = g_slist_prepend(result, GUINT_TO_POINTER(msg->msgnum));
 			matched_count++;
 		}
+		procmsg_msginfo_free(&msg);
 		processed_count++;
 
 		if (progress_cb != NULL
@@ -161,6 +161,9 @@ struct _Folder
 	gpointer data;
 
 	GHashTable *newsart;
+
+	/* FolderItems by path, see folder_find_item_from_identifier() */
+	GHashTable *items_by_path;
 };
 
 /**
@@ -646,6 +649,22 @@ struct _FolderClass
 						 FolderItem	*item,
 						 MsgInfo        *msginfo,
 						 MsgPermFlags	 newflags);
+	/**
+	 * Update the flags of several messages at once, like \c change_flags
+	 * does for one message. If NULL, \c change_flags is called for each
+	 * message.
+	 *
+	 * \param folder The \c Folder of the messages
+	 * \param item The \c FolderItem of the messages
+	 * \param msglist The list of \c MsgInfos whose flags should be
+	 *                updated
+	 * \param msgflags A \c GHashTable from each \c MsgInfo of msglist
+	 *        to the flags it should get
+	 */
+	void		(*change_flags_list)	(Folder		*folder,
+						 FolderItem	*item,
+						 MsgInfoList	*msglist,
+						 GHashTable	*msgflags);
 	/**
 	 * Get the flags for a list of messages. Flags that are not supported
 	 * by the folder should be preserved. They can be copied from
@@ -786,6 +805,10 @@ struct _FolderItem
 	gboolean processing_pending;
 	gint scanning;
 	guint last_seen;
+
+	/* keys the item was last put in the lookup indexes with */
+	gchar *index_path;
+	gchar *index_real_path;
 };
 
 struct _PersistPrefs
@@ -964,12 +987,21 @@ gint   folder_item_remove_all_msg	(FolderItem	*item);
 void 	folder_item_change_msg_flags	(FolderItem 	*item,
 					 MsgInfo 	*msginfo,
 					 MsgPermFlags 	 newflags);
+void	folder_item_change_msgs_flags	(FolderItem	*item,
+					 MsgInfoList	*msglist,
+					 GHashTable	*msgflags);
 gboolean folder_item_is_msg_changed	(FolderItem	*item,
 					 MsgInfo	*msginfo);
 
 void folder_clean_cache_memory		(FolderItem *protected_item);
 void folder_clean_cache_memory_force	(void);
 void folder_item_write_cache		(FolderItem *item);
+void folder_item_read_cache_async	(FolderItem *item);
+GArray *folder_item_get_thread_links	(FolderItem *item,
+					 guint32     mode);
+void folder_item_set_thread_links	(FolderItem *item,
+					 GArray     *links,
+					 guint32     mode);
 
 void folder_item_apply_processing	(FolderItem *item);
 
@@ -979,6 +1011,8 @@ void folder_item_update_recursive	(FolderItem *item,
 					 FolderItemUpdateFlags update_flags);
 void folder_item_update_freeze		(void);
 void folder_item_update_thaw		(void);
+void folder_item_update_flush		(void);
+guint folder_item_update_get_coalesced	(void);
 void folder_item_set_batch		(FolderItem *item, gboolean batch);
 gboolean folder_has_parent_of_type	(FolderItem *item, SpecialFolderItemType type);
 gboolean folder_is_child_of		(FolderItem *item, FolderItem *possibleChild);
@@ -121,7 +121,7 @@ gint folderutils_delete_duplicates(FolderItem *item,
 
 void folderutils_mark_all_read(FolderItem *item)
 {
-	MsgInfoList *msglist, *cur;
+	MsgInfoList *msglist, *cur, *unread = NULL;
 	MainWindow *mainwin = mainwindow_get_mainwindow();
 	int i = 0, m = 0;
 	debug_print("marking all read in item %s\n", (item==NULL)?"NULL":item->name);
@@ -140,21 +140,23 @@ void folderutils_mark_all_read(FolderItem *item)
 			folder_item_update_thaw();
 			return;
 		}
-		folder_item_set_batch(item, TRUE);
 		for (cur = msglist; cur != NULL; cur = g_slist_next(cur)) {
 			MsgInfo *msginfo = cur->data;
 
 			if (msginfo->flags.perm_flags & (MSG_NEW | MSG_UNREAD)) {
-				procmsg_msginfo_unset_flags(msginfo, MSG_NEW | MSG_UNREAD, 0);
+				unread = g_slist_prepend(unread, msginfo);
 				m++;
 			}
 			i++;
-			procmsg_msginfo_free(&msginfo);
 		}
+		unread = g_slist_reverse(unread);
+		folder_item_set_batch(item, TRUE);
+		procmsg_msglist_change_flags(unread, 0, 0, MSG_NEW | MSG_UNREAD, 0);
 		folder_item_set_batch(item, FALSE);
 		folder_item_close(item);
 		debug_print("marked %d messages out of %d as read\n", m, i);
-		g_slist_free(msglist);
+		g_slist_free(unread);
+		procmsg_msg_list_free(msglist);
 	}
 	folder_item_update_thaw();
 }
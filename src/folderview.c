@@ -145,6 +145,12 @@ static void folderview_append_folder	 (FolderView	*folderview,
 					  Folder	*folder);
 static void folderview_update_node	 (FolderView	*folderview,
 					  GtkCMCTreeNode	*node);
+static void folderview_update_folder_item(FolderView	*folderview,
+					  FolderItem	*item);
+static GtkCMCTreeNode *folderview_get_node(FolderView	*folderview,
+					  FolderItem	*item,
+					  gboolean	 create);
+static GSList *folderview_get_items	 (FolderView	*folderview);
 
 static gint folderview_clist_compare	(GtkCMCList	*clist,
 					 gconstpointer	 ptr1,
@@ -573,6 +579,7 @@ void folderview_set_column_order(FolderView *folderview)
 
 	debug_print("recreating tree...\n");
 	gtk_widget_destroy(folderview->ctree);
+	g_hash_table_remove_all(folderview->nodes);
 
 
 	folderview->ctree = ctree = folderview_ctree_create(folderview);
@@ -617,6 +624,9 @@ FolderView *folderview_create(void)
 	/* create popup factories */
 	folderview->popups = g_hash_table_new(g_str_hash, g_str_equal);
 	g_hash_table_foreach(folderview_popups, create_action_groups, folderview);
+	folderview->counts = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						   NULL, g_free);
+	folderview->nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	folderview->ctree        = ctree;
 
@@ -806,13 +816,15 @@ void folderview_set(FolderView *folderview)
 
 	gtk_cmclist_freeze(GTK_CMCLIST(ctree));
 	gtk_cmclist_clear(GTK_CMCLIST(ctree));
+	g_hash_table_remove_all(folderview->counts);
+	g_hash_table_remove_all(folderview->nodes);
 
 	folderview_set_folders(folderview);
 
 	if (sel_item)
-		folderview->selected = gtk_cmctree_find_by_row_data(ctree, NULL, sel_item);
+		folderview->selected = folderview_get_node(folderview, sel_item, TRUE);
 	if (op_item)
-		folderview->opened = gtk_cmctree_find_by_row_data(ctree, NULL, op_item);
+		folderview->opened = folderview_get_node(folderview, op_item, TRUE);
 
 	gtk_cmclist_thaw(GTK_CMCLIST(ctree));
 	main_window_cursor_normal(mainwin);
@@ -830,13 +842,12 @@ void folderview_set_all(void)
 
 void folderview_select(FolderView *folderview, FolderItem *item)
 {
-	GtkCMCTree *ctree = GTK_CMCTREE(folderview->ctree);
 	GtkCMCTreeNode *node;
 	GtkCMCTreeNode *old_selected = folderview->selected;
 
 	if (!item) return;
 
-	node = gtk_cmctree_find_by_row_data(ctree, NULL, item);
+	node = folderview_get_node(folderview, item, TRUE);
 	if (node) folderview_select_node(folderview, node);
 
 	if (old_selected != node)
@@ -932,40 +943,43 @@ void folderview_unselect(FolderView *folderview)
 	folderview->selected = folderview->opened = NULL;
 }
 
-static GtkCMCTreeNode *folderview_find_next_with_flag(GtkCMCTree *ctree,
+static GtkCMCTreeNode *folderview_find_next_with_flag(FolderView *folderview,
 						      GtkCMCTreeNode *node,
 						      MsgPermFlags flag)
 {
+	GtkCMCTree *ctree = GTK_CMCTREE(folderview->ctree);
+	GSList *items, *cur;
 	FolderItem *item;
+	gboolean found = FALSE;
 
-	if (node)
-		node = gtkut_ctree_node_next(ctree, node);
-	else
-		node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list);
+	items = folderview_get_items(folderview);
+	cur = items;
+	if (node) {
+		cur = g_slist_find(items,
+				   gtk_cmctree_node_get_row_data(ctree, node));
+		if (cur)
+			cur = cur->next;
+	}
 
-	for (; node != NULL; node = gtkut_ctree_node_next(ctree, node)) {
-		item = gtk_cmctree_node_get_row_data(ctree, node);
-		if (!item)
-			continue;
+	for (; cur != NULL && !found; cur = cur->next) {
+		item = (FolderItem *)cur->data;
 		if (item->stype == F_TRASH || item->stype == F_DRAFT)
 			continue;
 		switch (flag) {
 		case MSG_UNREAD:
-			if(item->unread_msgs > 0)
-				return node;
+			found = item->unread_msgs > 0;
 			break;
 		case MSG_NEW:
-			if(item->new_msgs > 0)
-				return node;
+			found = item->new_msgs > 0;
 			break;
 		case MSG_MARKED:
-			if(item->marked_msgs > 0)
-				return node;
+			found = item->marked_msgs > 0;
 			break;
 		}
 	}
+	g_slist_free(items);
 
-	return NULL;
+	return found ? folderview_get_node(folderview, item, TRUE) : NULL;
 }
 
 void folderview_select_next_with_flag(FolderView *folderview,
@@ -990,7 +1004,7 @@ void folderview_select_next_with_flag(FolderView *folderview,
 	}
 	prefs_common.always_show_msg = force_open ? OPENMSG_ALWAYS : last_open;
 
-	node = folderview_find_next_with_flag(ctree, folderview->opened, flag);
+	node = folderview_find_next_with_flag(folderview, folderview->opened, flag);
 	if (node != NULL) {
 		folderview_select_node(folderview, node);
 		goto out;
@@ -1002,7 +1016,7 @@ void folderview_select_next_with_flag(FolderView *folderview,
 	}
 
 	/* search again from the first node */
-	node = folderview_find_next_with_flag(ctree, NULL, flag);
+	node = folderview_find_next_with_flag(folderview, NULL, flag);
 	if (node != NULL)
 		folderview_select_node(folderview, node);
 
@@ -1120,6 +1134,35 @@ void folderview_rescan_tree(Folder *folder, gboolean rebuild)
 	inc_unlock();
 }
 
+/* Starts reading the caches of the folders folderview_check_new()
+ * is going to scan, so that they are ready by the time it gets
+ * to them. */
+static void folderview_read_caches_for_check(FolderView *folderview,
+					     Folder *folder)
+{
+	GSList *items, *cur;
+	FolderItem *item;
+
+	items = folderview_get_items(folderview);
+	for (cur = items; cur != NULL; cur = cur->next) {
+		item = (FolderItem *)cur->data;
+		if (!item->path || !item->folder || item->cache) continue;
+		if (item->no_select) continue;
+		if (folder && folder != item->folder) continue;
+		if (!folder && !FOLDER_IS_LOCAL(item->folder)) continue;
+		if (!item->prefs->newmailcheck) continue;
+		if (item->processing_pending == TRUE) continue;
+		if (item->scanning != ITEM_NOT_SCANNING) continue;
+
+		if (!item->folder->klass->scan_required ||
+		    item->folder->klass->scan_required(item->folder, item) ||
+		    item->folder->inbox == item ||
+		    item->opened == TRUE)
+			folder_item_read_cache_async(item);
+	}
+	g_slist_free(items);
+}
+
 /** folderview_check_new()
  *  Scan and update the folder and return the 
  *  count the number of new messages since last check. 
@@ -1129,26 +1172,26 @@ void folderview_rescan_tree(Folder *folder, gboolean rebuild)
 gint folderview_check_new(Folder *folder)
 {
 	GList *list;
+	GSList *items, *cur;
 	FolderItem *item;
 	FolderView *folderview;
-	GtkCMCTree *ctree;
-	GtkCMCTreeNode *node;
 	gint new_msgs = 0;
 	gint former_new_msgs = 0;
 	gint former_new = 0, former_unread = 0, former_total;
 
 	for (list = folderview_list; list != NULL; list = list->next) {
 		folderview = (FolderView *)list->data;
-		ctree = GTK_CMCTREE(folderview->ctree);
 		folderview->scanning_folder = folder;
 		inc_lock();
 		main_window_lock(folderview->mainwin);
 
-		for (node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list);
-		     node != NULL; node = gtkut_ctree_node_next(ctree, node)) {
+		folderview_read_caches_for_check(folderview, folder);
+
+		items = folderview_get_items(folderview);
+		for (cur = items; cur != NULL; cur = cur->next) {
 			gchar *str = NULL;
-			item = gtk_cmctree_node_get_row_data(ctree, node);
-			if (!item || !item->path || !item->folder) continue;
+			item = (FolderItem *)cur->data;
+			if (!item->path || !item->folder) continue;
 			if (item->no_select) continue;
 			if (folder && folder != item->folder) continue;
 			if (!folder && !FOLDER_IS_LOCAL(item->folder)) continue;
@@ -1206,12 +1249,13 @@ gint folderview_check_new(Folder *folder)
 			if (former_new    != item->new_msgs ||
 			    former_unread != item->unread_msgs ||
 			    former_total  != item->total_msgs)
-				folderview_update_node(folderview, node);
+				folderview_update_folder_item(folderview, item);
 
 			new_msgs += item->new_msgs;
 			former_new_msgs += former_new;
 			STATUSBAR_POP(folderview->mainwin);
 		}
+		g_slist_free(items);
 		folderview->scanning_folder = NULL;
 		main_window_unlock(folderview->mainwin);
 		inc_unlock();
@@ -1255,195 +1299,181 @@ void folderview_check_new_all(void)
 	inc_unlock();
 }
 
-static gboolean folderview_have_children_sub(FolderView *folderview,
-					     FolderItem *item,
-					     gboolean in_sub)
+/* Which messages a folder has, and how many folders below it have
+ * some, kept up to date from the differences seen on each update.
+ * Folders whose nodes aren't created yet are counted too. */
+enum {
+	FOLDERVIEW_COUNT_TOTAL,
+	FOLDERVIEW_COUNT_NEW,
+	FOLDERVIEW_COUNT_UNREAD,
+	FOLDERVIEW_COUNT_MARKED,
+	FOLDERVIEW_COUNT_MATCH,
+	FOLDERVIEW_N_COUNTS
+};
+
+typedef struct _FolderViewCounts FolderViewCounts;
+struct _FolderViewCounts {
+	gint own[FOLDERVIEW_N_COUNTS];
+	gint sub[FOLDERVIEW_N_COUNTS];
+};
+
+static FolderViewCounts *folderview_get_counts(FolderView *folderview,
+					       FolderItem *item)
 {
-	GNode *node = NULL;
-	
-	if (!item || !item->folder || !item->folder->node)
-		return FALSE;
-		
-	node = item->folder->node;
-	
-	node = g_node_find(node, G_PRE_ORDER, G_TRAVERSE_ALL, item);
-	node = node->children;
+	FolderViewCounts *counts;
 
-	if (in_sub && item->total_msgs > 0) {
-		return TRUE;
+	counts = g_hash_table_lookup(folderview->counts, item);
+	if (counts == NULL) {
+		counts = g_new0(FolderViewCounts, 1);
+		g_hash_table_insert(folderview->counts, item, counts);
 	}
+	return counts;
+}
 
-	while (node != NULL) {
-		if (node && node->data) {
-			FolderItem *next_item = (FolderItem*) node->data;
-			node = node->next;
-			if (folderview_have_children_sub(folderview, 
-							 next_item, TRUE))
-				return TRUE;
-		}
-	}
+static void folderview_get_own_counts(FolderItem *item, gint *own)
+{
+	gboolean in_queue = folder_has_parent_of_type(item, F_QUEUE);
 
-	return FALSE;
+	own[FOLDERVIEW_COUNT_TOTAL] = item->total_msgs > 0;
+	own[FOLDERVIEW_COUNT_NEW] = item->new_msgs > 0
+				    || (in_queue && item->total_msgs > 0);
+	own[FOLDERVIEW_COUNT_UNREAD] = item->unread_msgs > 0
+				       || (in_queue && item->total_msgs > 0);
+	own[FOLDERVIEW_COUNT_MARKED] = item->marked_msgs != 0;
+	own[FOLDERVIEW_COUNT_MATCH] = item->search_match != 0;
 }
 
-static gboolean folderview_have_children(FolderView *folderview,
-					 FolderItem *item)
+/* the marks a collapsed folder shows for the folders below it */
+static guint folderview_counts_marks(const FolderViewCounts *counts)
 {
-	return folderview_have_children_sub(folderview, item, FALSE);
+	guint marks = 0;
+	gint i;
+
+	for (i = 0; i < FOLDERVIEW_N_COUNTS; i++)
+		if (counts->sub[i] > 0)
+			marks |= 1 << i;
+	return marks;
 }
 
-static gboolean folderview_have_new_children_sub(FolderView *folderview,
-						 FolderItem *item,
-						 gboolean in_sub)
+static void folderview_counts_add(FolderView *folderview,
+				  FolderItem *item, const gint *delta)
 {
-	GNode *node = NULL;
-	
-	if (!item || !item->folder || !item->folder->node)
-		return FALSE;
-		
-	node = item->folder->node;
-	
-	node = g_node_find(node, G_PRE_ORDER, G_TRAVERSE_ALL, item);
-	node = node->children;
-
-	if (in_sub &&
-	    (item->new_msgs > 0 ||
-	    (folder_has_parent_of_type(item, F_QUEUE) && item->total_msgs > 0))) {
-		return TRUE;
-	}
+	GNode *parent;
+	GtkCMCTreeNode *node;
+	FolderViewCounts *counts;
+	GSList *changed = NULL, *cur;
+	guint marks;
+	gint i;
 
-	while (node != NULL) {
-		if (node && node->data) {
-			FolderItem *next_item = (FolderItem*) node->data;
-			node = node->next;
-			if (folderview_have_new_children_sub(folderview, 
-							     next_item, TRUE))
-				return TRUE;
-		}
+	for (parent = item->node ? item->node->parent : NULL; parent != NULL;
+	     parent = parent->parent) {
+		counts = folderview_get_counts(folderview,
+					       FOLDER_ITEM(parent->data));
+		marks = folderview_counts_marks(counts);
+		for (i = 0; i < FOLDERVIEW_N_COUNTS; i++)
+			counts->sub[i] += delta[i];
+		if (folderview_counts_marks(counts) != marks
+		    && (node = g_hash_table_lookup(folderview->nodes,
+						   parent->data)) != NULL)
+			changed = g_slist_prepend(changed, node);
 	}
 
-	return FALSE;
+	for (cur = changed; cur != NULL; cur = cur->next)
+		folderview_update_node(folderview, (GtkCMCTreeNode *)cur->data);
+	g_slist_free(changed);
 }
 
-static gboolean folderview_have_new_children(FolderView *folderview,
-					     FolderItem *item)
-{
-	return folderview_have_new_children_sub(folderview, item, FALSE);
-}
-
-static gboolean folderview_have_unread_children_sub(FolderView *folderview,
-						    FolderItem *item, 
-						    gboolean in_sub)
+/* Updates the counts of the folder, and those of the folders above it
+ * if they changed */
+static FolderViewCounts *folderview_update_counts(FolderView *folderview,
+						  FolderItem *item)
 {
-	GNode *node = NULL;
-	
-	if (!item || !item->folder || !item->folder->node)
-		return FALSE;
-	
-	node = item->folder->node;
-	
-	node = g_node_find(node, G_PRE_ORDER, G_TRAVERSE_ALL, item);
-	node = node->children;
-
-	if (in_sub &&
-	    (item->unread_msgs > 0 ||
-	    (folder_has_parent_of_type(item, F_QUEUE) && item->total_msgs > 0))) {
-		return TRUE;
-	}
+	FolderViewCounts *counts = folderview_get_counts(folderview, item);
+	gint own[FOLDERVIEW_N_COUNTS];
+	gint delta[FOLDERVIEW_N_COUNTS];
+	gboolean changed = FALSE;
+	gint i;
 
-	while (node != NULL) {
-		if (node && node->data) {
-			FolderItem *next_item = (FolderItem*) node->data;
-			node = node->next;
-			if (folderview_have_unread_children_sub(folderview, 
-							        next_item, 
-								TRUE))
-				return TRUE;
-		}
+	folderview_get_own_counts(item, own);
+	for (i = 0; i < FOLDERVIEW_N_COUNTS; i++) {
+		delta[i] = own[i] - counts->own[i];
+		counts->own[i] = own[i];
+		if (delta[i] != 0)
+			changed = TRUE;
 	}
 
-	return FALSE;
-}
+	if (changed)
+		folderview_counts_add(folderview, item, delta);
 
-static gboolean folderview_have_unread_children(FolderView *folderview,
-						FolderItem *item)
-{
-	return folderview_have_unread_children_sub(folderview, item, FALSE);
+	return counts;
 }
 
-static gboolean folderview_have_matching_children_sub(FolderView *folderview,
-						      FolderItem *item,
-						      gboolean in_sub)
+/* Counts a whole folder tree at once, children first */
+static gboolean folderview_init_counts_func(GNode *gnode, gpointer data)
 {
-	GNode *node = NULL;
-
-	if (!item || !item->folder || !item->folder->node)
-		return FALSE;
-
-	node = item->folder->node;
-	
-	node = g_node_find(node, G_PRE_ORDER, G_TRAVERSE_ALL, item);
-	node = node->children;
-
-	if (in_sub && item->search_match){
-		return TRUE;
-	}
+	FolderView *folderview = (FolderView *)data;
+	FolderViewCounts *counts, *child_counts;
+	GNode *child;
+	gint i;
 
-	while (node != NULL) {
-		if (node && node->data) {
-			FolderItem *next_item = (FolderItem*) node->data;
-			node = node->next;
-			if (folderview_have_matching_children_sub(folderview, 
-							          next_item, 
-								  TRUE))
-				return TRUE;
-		}
+	counts = folderview_get_counts(folderview, FOLDER_ITEM(gnode->data));
+	folderview_get_own_counts(FOLDER_ITEM(gnode->data), counts->own);
+	memset(counts->sub, 0, sizeof(counts->sub));
+	for (child = gnode->children; child != NULL; child = child->next) {
+		child_counts = folderview_get_counts(folderview,
+						     FOLDER_ITEM(child->data));
+		for (i = 0; i < FOLDERVIEW_N_COUNTS; i++)
+			counts->sub[i] += child_counts->own[i]
+					  + child_counts->sub[i];
 	}
 
 	return FALSE;
 }
 
-static gboolean folderview_have_matching_children(FolderView *folderview,
-						  FolderItem *item)
+static gboolean folderview_forget_item_func(GNode *gnode, gpointer data)
 {
-	return folderview_have_matching_children_sub(folderview, item, FALSE);
+	FolderView *folderview = (FolderView *)data;
+
+	g_hash_table_remove(folderview->counts, gnode->data);
+	g_hash_table_remove(folderview->nodes, gnode->data);
+	return FALSE;
 }
 
-static gboolean folderview_have_marked_children_sub(FolderView *folderview,
-						    FolderItem *item,
-						    gboolean in_sub)
+/* Takes a folder about to be removed, and the folders below it, out of
+ * the counts of the folders above it */
+static void folderview_forget_item(FolderView *folderview, FolderItem *item)
 {
-	GNode *node = NULL;
-	
-	if (!item || !item->folder || !item->folder->node)
-		return FALSE;
-		
-	node = item->folder->node;
-	
-	node = g_node_find(node, G_PRE_ORDER, G_TRAVERSE_ALL, item);
-	node = node->children;
+	FolderViewCounts *counts;
+	gint delta[FOLDERVIEW_N_COUNTS];
+	gint i;
 
-	if (item->marked_msgs != 0) {
-		return TRUE;
+	counts = g_hash_table_lookup(folderview->counts, item);
+	if (counts != NULL) {
+		for (i = 0; i < FOLDERVIEW_N_COUNTS; i++)
+			delta[i] = -(counts->own[i] + counts->sub[i]);
+		folderview_counts_add(folderview, item, delta);
 	}
 
-	while (node != NULL) {
-		if (node && node->data) {
-			FolderItem *next_item = (FolderItem*) node->data;
-			node = node->next;
-			if (folderview_have_marked_children_sub(folderview,
-							        next_item, TRUE))
-				return TRUE;
-		}
+	if (item->node != NULL) {
+		g_node_traverse(item->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+				folderview_forget_item_func, folderview);
+	} else {
+		g_hash_table_remove(folderview->counts, item);
+		g_hash_table_remove(folderview->nodes, item);
 	}
-
-	return FALSE;
 }
 
-static gboolean folderview_have_marked_children(FolderView *folderview,
-					     FolderItem *item)
+/* Redraws the node of the folder, or only updates its counts if the
+ * node isn't created yet */
+static void folderview_update_folder_item(FolderView *folderview,
+					  FolderItem *item)
 {
-	return folderview_have_marked_children_sub(folderview, item, FALSE);
+	GtkCMCTreeNode *node = g_hash_table_lookup(folderview->nodes, item);
+
+	if (node != NULL)
+		folderview_update_node(folderview, node);
+	else
+		folderview_update_counts(folderview, item);
 }
 
 static void folderview_update_node(FolderView *folderview, GtkCMCTreeNode *node)
@@ -1462,12 +1492,16 @@ static void folderview_update_node(FolderView *folderview, GtkCMCTreeNode *node)
 	gboolean use_bold, use_color;
 	gint *col_pos = folderview->col_pos;
 	SpecialFolderItemType stype;
+	FolderViewCounts *counts;
 	
 	item = gtk_cmctree_node_get_row_data(ctree, node);
 	cm_return_if_fail(item != NULL);
 
+	counts = folderview_update_counts(folderview, item);
+
 	if (!GTK_CMCTREE_ROW(node)->expanded)
-		mark = folderview_have_marked_children(folderview, item);
+		mark = (item->marked_msgs != 0)
+		       || counts->sub[FOLDERVIEW_COUNT_MARKED] > 0;
 	else
 		mark = (item->marked_msgs != 0);
 
@@ -1555,10 +1589,8 @@ static void folderview_update_node(FolderView *folderview, GtkCMCTreeNode *node)
 	name = folder_item_get_name(item);
 
 	if (!GTK_CMCTREE_ROW(node)->expanded) {
-		add_unread_mark = folderview_have_unread_children(
-					folderview, item);
-		add_sub_match_mark = folderview_have_matching_children(
-					folderview, item);
+		add_unread_mark = counts->sub[FOLDERVIEW_COUNT_UNREAD] > 0;
+		add_sub_match_mark = counts->sub[FOLDERVIEW_COUNT_MATCH] > 0;
 	} else {
 		add_unread_mark = FALSE;
 		add_sub_match_mark = FALSE;
@@ -1661,7 +1693,7 @@ static void folderview_update_node(FolderView *folderview, GtkCMCTreeNode *node)
 		}
 		if (!GTK_CMCTREE_ROW(node)->expanded &&
 		    use_bold == FALSE &&
-		    folderview_have_children(folderview, item))
+		    counts->sub[FOLDERVIEW_COUNT_TOTAL] > 0)
 			use_bold = use_color = TRUE;
 		procmsg_msg_list_free(list);
 	} else {
@@ -1672,7 +1704,7 @@ static void folderview_update_node(FolderView *folderview, GtkCMCTreeNode *node)
 		use_color =
 			(item->new_msgs > 0) ||
 			(add_unread_mark &&
-			 folderview_have_new_children(folderview, item));	
+			 counts->sub[FOLDERVIEW_COUNT_NEW] > 0);
 	}
 
 	gtk_cmctree_node_set_foreground(ctree, node, NULL);
@@ -1709,28 +1741,21 @@ static void folderview_update_node(FolderView *folderview, GtkCMCTreeNode *node)
 	}
 
 	gtk_cmctree_node_set_row_style(ctree, node, style);
-
-	if ((node = gtkut_ctree_find_collapsed_parent(ctree, node)) != NULL)
-		folderview_update_node(folderview, node);
 }
 
 void folderview_update_search_icon(FolderItem *item, gboolean matches)
 {
 	GList *list;
 	FolderView *folderview;
-	GtkCMCTree *ctree;
-	GtkCMCTreeNode *node;
 
 	cm_return_if_fail(item != NULL);
 
 	for (list = folderview_list; list != NULL; list = list->next) {
 		folderview = (FolderView *)list->data;
-		ctree = GTK_CMCTREE(folderview->ctree);
 
-		node = gtk_cmctree_find_by_row_data(ctree, NULL, item);
-		if (node && item->search_match != matches) {
+		if (item->search_match != matches) {
 			item->search_match = matches;
-			folderview_update_node(folderview, node);
+			folderview_update_folder_item(folderview, item);
 		}
 	}
 }
@@ -1739,17 +1764,18 @@ static gboolean folderview_update_item_claws(gpointer source, gpointer data)
 {
 	FolderItemUpdateData *update_info = (FolderItemUpdateData *)source;
 	FolderView *folderview = (FolderView *)data;
-	GtkCMCTree *ctree;
 	GtkCMCTreeNode *node;
 	cm_return_val_if_fail(update_info != NULL, TRUE);
 	cm_return_val_if_fail(update_info->item != NULL, TRUE);
 	cm_return_val_if_fail(folderview != NULL, FALSE);
 
-    	ctree = GTK_CMCTREE(folderview->ctree);
+	node = folderview_get_node(folderview, update_info->item, FALSE);
 
-	node = gtk_cmctree_find_by_row_data(ctree, NULL, update_info->item);
-
-	if (node) {
+	if (!node) {
+		/* the marks of the folders above it may change */
+		if (update_info->update_flags & F_ITEM_UPDATE_MSGCNT)
+			folderview_update_counts(folderview, update_info->item);
+	} else {
 		if (update_info->update_flags & (F_ITEM_UPDATE_MSGCNT | F_ITEM_UPDATE_NAME))
 			folderview_update_node(folderview, node);
 
@@ -1763,21 +1789,6 @@ static gboolean folderview_update_item_claws(gpointer source, gpointer data)
 	return FALSE;
 }
 
-static gboolean folderview_gnode_func(GtkCMCTree *ctree, guint depth,
-				      GNode *gnode, GtkCMCTreeNode *cnode,
-				      gpointer data)
-{
-	FolderView *folderview = (FolderView *)data;
-	FolderItem *item = FOLDER_ITEM(gnode->data);
-
-	cm_return_val_if_fail(item != NULL, FALSE);
-
-	gtk_cmctree_node_set_row_data(ctree, cnode, item);
-	folderview_update_node(folderview, cnode);
-
-	return TRUE;
-}
-
 static void folderview_expand_func(GtkCMCTree *ctree, GtkCMCTreeNode *node,
 				   gpointer data)
 {
@@ -1795,16 +1806,160 @@ static void folderview_expand_func(GtkCMCTree *ctree, GtkCMCTreeNode *node,
 	}
 }
 
-static void set_special_folder(GtkCMCTree *ctree, FolderItem *item,
-			       GtkCMCTreeNode *root, GtkCMCTreeNode **prev)
+/* A collapsed folder gets a single child without row data in place of
+ * the nodes of its subfolders, which are only created when needed */
+static gboolean folderview_node_is_lazy(GtkCMCTree *ctree,
+					GtkCMCTreeNode *node)
 {
+	GtkCMCTreeNode *child = GTK_CMCTREE_ROW(node)->children;
+
+	return child != NULL
+	       && gtk_cmctree_node_get_row_data(ctree, child) == NULL;
+}
+
+static GtkCMCTreeNode *folderview_insert_item(FolderView *folderview,
+					      GtkCMCTreeNode *parent,
+					      GtkCMCTreeNode *sibling,
+					      GNode *gnode);
+
+static void folderview_insert_children(FolderView *folderview,
+				       GtkCMCTreeNode *node, GNode *gnode)
+{
+	GtkCMCTreeNode *child = NULL;
+	GNode *work;
+
+	/* inserting before the previous one doesn't walk the siblings */
+	for (work = g_node_last_child(gnode); work != NULL; work = work->prev)
+		child = folderview_insert_item(folderview, node, child, work);
+}
+
+static GtkCMCTreeNode *folderview_insert_item(FolderView *folderview,
+					      GtkCMCTreeNode *parent,
+					      GtkCMCTreeNode *sibling,
+					      GNode *gnode)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(folderview->ctree);
+	FolderItem *item = FOLDER_ITEM(gnode->data);
+	GtkCMCTreeNode *node;
+
+	node = gtk_sctree_insert_node(ctree, parent, sibling, NULL,
+				      FOLDER_SPACING, NULL, NULL,
+				      FALSE, FALSE);
+	gtk_cmctree_node_set_row_data(ctree, node, item);
+	g_hash_table_insert(folderview->nodes, item, node);
+
+	if (gnode->children != NULL) {
+		if (item->collapsed)
+			gtk_sctree_insert_node(ctree, node, NULL, NULL,
+					       FOLDER_SPACING, NULL, NULL,
+					       TRUE, FALSE);
+		else
+			folderview_insert_children(folderview, node, gnode);
+	}
+
+	folderview_update_node(folderview, node);
+
+	return node;
+}
+
+/* Replaces the placeholder child of a node by the nodes of its
+ * subfolders */
+static void folderview_create_children(FolderView *folderview,
+				       GtkCMCTreeNode *node)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(folderview->ctree);
+	GtkCMCTreeNode *child;
+	FolderItem *item;
+
+	if (!folderview_node_is_lazy(ctree, node))
+		return;
+
+	item = gtk_cmctree_node_get_row_data(ctree, node);
+	cm_return_if_fail(item != NULL);
+
+	gtk_cmclist_freeze(GTK_CMCLIST(ctree));
+	gtk_cmctree_remove_node(ctree, GTK_CMCTREE_ROW(node)->children);
+	folderview_insert_children(folderview, node, item->node);
+	for (child = GTK_CMCTREE_ROW(node)->children; child != NULL;
+	     child = GTK_CMCTREE_ROW(child)->sibling)
+		gtk_cmctree_pre_recursive(ctree, child,
+					  folderview_expand_func, folderview);
+	folderview_sort_folders(folderview, node, item->folder);
+	gtk_cmclist_thaw(GTK_CMCLIST(ctree));
+}
+
+/* Returns the node of the folder; if create is set and the node of its
+ * parent only has a placeholder, creates the nodes of its ancestors */
+static GtkCMCTreeNode *folderview_get_node(FolderView *folderview,
+					   FolderItem *item,
+					   gboolean create)
+{
+	GtkCMCTreeNode *node, *parent;
+
+	if (item == NULL)
+		return NULL;
+
+	node = g_hash_table_lookup(folderview->nodes, item);
+	if (node != NULL || !create)
+		return node;
+
+	parent = folderview_get_node(folderview, folder_item_parent(item), TRUE);
+	if (parent == NULL)
+		return NULL;
+	folderview_create_children(folderview, parent);
+
+	return g_hash_table_lookup(folderview->nodes, item);
+}
+
+static gboolean folderview_prepend_item_func(GNode *gnode, gpointer data)
+{
+	GSList **items = (GSList **)data;
+
+	*items = g_slist_prepend(*items, gnode->data);
+	return FALSE;
+}
+
+/* Lists all folders in the order of the tree, including those whose
+ * nodes aren't created yet */
+static GSList *folderview_get_items(FolderView *folderview)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(folderview->ctree);
+	GtkCMCTreeNode *node;
+	GSList *items = NULL;
+	FolderItem *item;
+	GNode *child;
+
+	for (node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list);
+	     node != NULL; node = gtkut_ctree_node_next(ctree, node)) {
+		item = gtk_cmctree_node_get_row_data(ctree, node);
+		if (item == NULL)
+			continue;
+		items = g_slist_prepend(items, item);
+		if (folderview_node_is_lazy(ctree, node)) {
+			for (child = item->node->children; child != NULL;
+			     child = child->next)
+				g_node_traverse(child, G_PRE_ORDER,
+						G_TRAVERSE_ALL, -1,
+						folderview_prepend_item_func,
+						&items);
+		}
+	}
+
+	return g_slist_reverse(items);
+}
+
+static void set_special_folder(FolderView *folderview, FolderItem *item,
+			       GtkCMCTreeNode **prev)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(folderview->ctree);
+
 	if (item) {
 		GtkCMCTreeNode *node, *parent, *sibling;
 
-		node = gtk_cmctree_find_by_row_data(ctree, root, item);
-		if (!node)
-			g_warning("%s not found.", item->path);
-		else {
+		/* if its parent's subfolders aren't created yet, this
+		 * is done when they are */
+		node = folderview_get_node(folderview, item, FALSE);
+		if (node) {
 			parent = GTK_CMCTREE_ROW(node)->parent;
 			if (*prev && parent == GTK_CMCTREE_ROW(*prev)->parent)
 				sibling = GTK_CMCTREE_ROW(*prev)->sibling;
@@ -1840,12 +1995,12 @@ static void folderview_sort_folders(FolderView *folderview, GtkCMCTreeNode *root
 		gtk_cmclist_thaw(GTK_CMCLIST(ctree));
 		return;
 	}
-	set_special_folder(ctree, folder->inbox, root, &prev);
-	set_special_folder(ctree, folder->outbox, root, &prev);
-	set_special_folder(ctree, folder->draft, root, &prev);
-	set_special_folder(ctree, folder->queue, root, &prev);
-	set_special_folder(ctree, folder->trash, root, &prev);
-	set_special_folder(ctree, folder->junk, root, &prev);
+	set_special_folder(folderview, folder->inbox, &prev);
+	set_special_folder(folderview, folder->outbox, &prev);
+	set_special_folder(folderview, folder->draft, &prev);
+	set_special_folder(folderview, folder->queue, &prev);
+	set_special_folder(folderview, folder->trash, &prev);
+	set_special_folder(folderview, folder->junk, &prev);
 	gtk_cmclist_thaw(GTK_CMCLIST(ctree));
 }
 
@@ -1856,8 +2011,9 @@ static void folderview_append_folder(FolderView *folderview, Folder *folder)
 
 	cm_return_if_fail(folder != NULL);
 
-	root = gtk_sctree_insert_gnode(ctree, NULL, NULL, folder->node,
-				      folderview_gnode_func, folderview);
+	g_node_traverse(folder->node, G_POST_ORDER, G_TRAVERSE_ALL, -1,
+			folderview_init_counts_func, folderview);
+	root = folderview_insert_item(folderview, NULL, NULL, folder->node);
 	gtk_cmctree_pre_recursive(ctree, root, folderview_expand_func,
 				folderview);
 	folderview_sort_folders(folderview, root, folder);
@@ -1940,7 +2096,8 @@ static void folderview_set_sens_and_popup_menu(FolderView *folderview, gint row,
 	cm_menu_set_sensitive_full(ui_manager, "Popup/"name, sens)
 
 	SET_SENS("FolderViewPopup/MarkAllRead", item->unread_msgs >= 1);
-	SET_SENS("FolderViewPopup/MarkAllReadRec", folderview_have_unread_children(folderview,item));
+	SET_SENS("FolderViewPopup/MarkAllReadRec", folderview_get_counts(folderview,
+			item)->sub[FOLDERVIEW_COUNT_UNREAD] > 0);
 	SET_SENS("FolderViewPopup/SearchFolder", item->total_msgs >= 1 && 
 		 folderview->selected == folderview->opened);
 	SET_SENS("FolderViewPopup/Properties", TRUE);
@@ -2120,8 +2277,8 @@ static gboolean folderview_key_pressed(GtkWidget *widget, GdkEventKey *event,
 			} else {
 				if ((item = gtk_cmctree_node_get_row_data(GTK_CMCTREE(folderview->ctree),
 						folderview->selected))) {
-					if ((node = gtk_cmctree_find_by_row_data(GTK_CMCTREE(folderview->ctree),
-							NULL, folder_item_parent(item)))) {
+					if ((node = folderview_get_node(folderview,
+							folder_item_parent(item), FALSE))) {
 						gtk_sctree_select(GTK_SCTREE(folderview->ctree), node);
 						if (!gtk_cmctree_node_is_visible(GTK_CMCTREE(folderview->ctree), node))
 							gtk_cmctree_node_moveto(GTK_CMCTREE(folderview->ctree),
@@ -2357,6 +2514,7 @@ static void folderview_tree_expanded(GtkCMCTree *ctree, GtkCMCTreeNode *node,
 	item = gtk_cmctree_node_get_row_data(ctree, node);
 	cm_return_if_fail(item != NULL);
 	item->collapsed = FALSE;
+	folderview_create_children(folderview, node);
 	folderview_update_node(folderview, node);
 }
 
@@ -2395,22 +2553,31 @@ static void folderview_create_folder_node(FolderView *folderview, FolderItem *it
 	gint *col_pos = folderview->col_pos;
 	FolderItemUpdateData hookdata;
 
-	parent_node = gtk_cmctree_find_by_row_data(ctree, NULL, folder_item_parent(item));
-	if (parent_node == NULL)
+	parent_node = folderview_get_node(folderview, folder_item_parent(item), FALSE);
+	if (parent_node == NULL) {
+		/* its node will be created with those of its siblings */
+		folderview_update_counts(folderview, item);
 		return;
+	}
 
 	gtk_cmclist_freeze(GTK_CMCLIST(ctree));
 
-	text[col_pos[F_COL_FOLDER]] = item->name;
-	node = gtk_sctree_insert_node(ctree, parent_node, NULL, text,
-				     FOLDER_SPACING,
-				     folderxpm,
-				     folderopenxpm,
-				     FALSE, FALSE);
+	/* this creates the node if the parent's subfolders didn't
+	 * have any yet */
 	gtk_cmctree_expand(ctree, parent_node);
-	gtk_cmctree_node_set_row_data(ctree, node, item);
-	if (normal_style)
-		gtk_cmctree_node_set_row_style(ctree, node, normal_style);
+	node = folderview_get_node(folderview, item, FALSE);
+	if (node == NULL) {
+		text[col_pos[F_COL_FOLDER]] = item->name;
+		node = gtk_sctree_insert_node(ctree, parent_node, NULL, text,
+					     FOLDER_SPACING,
+					     folderxpm,
+					     folderopenxpm,
+					     FALSE, FALSE);
+		gtk_cmctree_node_set_row_data(ctree, node, item);
+		g_hash_table_insert(folderview->nodes, item, node);
+		if (normal_style)
+			gtk_cmctree_node_set_row_style(ctree, node, normal_style);
+	}
 	folderview_sort_folders(folderview, parent_node, item->folder);
 
 	hookdata.item = item;
@@ -2618,6 +2785,7 @@ void folderview_move_folder(FolderView *folderview, FolderItem *from_folder,
 		            FolderItem *to_folder, gboolean copy)
 {
 	FolderItem *new_folder = NULL;
+	GtkCMCTreeNode *node;
 	gchar *buf;
 	gint status;
 
@@ -2661,9 +2829,9 @@ void folderview_move_folder(FolderView *folderview, FolderItem *from_folder,
 		folder_item_update_thaw();
 		folder_item_update_recursive(new_folder, F_ITEM_UPDATE_MSGCNT);
 
-		folderview_sort_folders(folderview, 
-			gtk_cmctree_find_by_row_data(GTK_CMCTREE(folderview->ctree), 
-				NULL, to_folder), new_folder->folder);
+		node = folderview_get_node(folderview, to_folder, FALSE);
+		if (node != NULL)
+			folderview_sort_folders(folderview, node, new_folder->folder);
 		folderview_select(folderview, new_folder);
 		gtk_cmclist_thaw(GTK_CMCLIST(folderview->ctree));
 	} else {
@@ -2825,10 +2993,10 @@ void folderview_reflect_prefs(void)
 		 G_CALLBACK(folderview_selected), folderview);
 
 	if (item) {
-		GtkCMCTreeNode *node = gtk_cmctree_find_by_row_data(
-			GTK_CMCTREE(folderview->ctree), NULL, item);
+		GtkCMCTreeNode *node;
 
 		folderview_select(folderview, item);
+		node = folderview_get_node(folderview, item, FALSE);
 		folderview->open_folder = FALSE;
 		folderview->selected = node;
 	}
@@ -2944,13 +3112,15 @@ static gboolean folderview_update_folder(gpointer source, gpointer userdata)
 	if (hookdata->update_flags & FOLDER_ADD_FOLDERITEM)
 		folderview_create_folder_node(folderview, hookdata->item);
 	else if (hookdata->update_flags & FOLDER_RENAME_FOLDERITEM) {
-		GtkCMCTreeNode *node = gtk_cmctree_find_by_row_data(GTK_CMCTREE(ctree),
-				NULL, folder_item_parent(hookdata->item));
-		folderview_sort_folders(folderview, node, hookdata->folder);
+		GtkCMCTreeNode *node = folderview_get_node(folderview,
+				folder_item_parent(hookdata->item), FALSE);
+		if (node != NULL)
+			folderview_sort_folders(folderview, node, hookdata->folder);
 	} else if (hookdata->update_flags & FOLDER_REMOVE_FOLDERITEM) {
 		GtkCMCTreeNode *node;
 
-		node = gtk_cmctree_find_by_row_data(GTK_CMCTREE(ctree), NULL, hookdata->item);
+		node = folderview_get_node(folderview, hookdata->item, FALSE);
+		folderview_forget_item(folderview, hookdata->item);
 		if (node != NULL) {
 			gtk_cmctree_remove_node(GTK_CMCTREE(ctree), node);
 			if (folderview->selected == node)
@@ -3301,11 +3471,11 @@ void folderview_remove_item(FolderView *folderview, FolderItem *item)
 	GtkCMCTree *ctree = GTK_CMCTREE(folderview->ctree);
 	g_return_if_fail(ctree != NULL);
 
-	GtkCMCTreeNode *node =
-		gtk_cmctree_find_by_row_data(ctree, NULL, item);
-	g_return_if_fail(node != NULL);
+	GtkCMCTreeNode *node = folderview_get_node(folderview, item, FALSE);
 
-	gtk_cmctree_remove_node(ctree, node);
+	folderview_forget_item(folderview, item);
+	if (node != NULL)
+		gtk_cmctree_remove_node(ctree, node);
 }
 
 void folderview_freeze(FolderView *folderview)
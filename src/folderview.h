@@ -53,6 +53,10 @@ struct _FolderView
 	GtkWidget *ctree;
 
 	GHashTable *popups;
+	/* FolderViewCounts of each folder */
+	GHashTable *counts;
+	/* node of each folder, only for those created */
+	GHashTable *nodes;
 
 	GtkCMCTreeNode *selected;
 	GtkCMCTreeNode *opened;
@@ -126,9 +126,7 @@ LIST_WIDTH (GtkCMCList * clist)
 }
 
 /* returns the GList item for the nth row */
-#define	ROW_ELEMENT(clist, row)	(((row) == (clist)->rows - 1) ? \
-				 (clist)->row_list_end : \
-				 g_list_nth ((clist)->row_list, (row)))
+#define	ROW_ELEMENT(clist, row)	_gtk_cmclist_row_nth ((clist), (row))
 
 
 /* redraw the list if it's not frozen */
@@ -1138,6 +1136,8 @@ gtk_cmclist_init (GtkCMCList *clist)
   clist->row_height = 0;
   clist->row_list = NULL;
   clist->row_list_end = NULL;
+  clist->row_index = g_ptr_array_new ();
+  clist->row_index_valid = FALSE;
 
   clist->columns = 0;
 
@@ -2643,6 +2643,68 @@ set_cell_contents (GtkCMCList    *clist,
     g_object_unref (old_pixbuf);
 }
 
+static gboolean
+row_index_update (GtkCMCList *clist)
+{
+  GList *list;
+  gint i = 0;
+
+  if (clist->row_index_valid && clist->row_index->len == clist->rows)
+    return TRUE;
+
+  g_ptr_array_set_size (clist->row_index, clist->rows);
+  for (list = clist->row_list; list && i < clist->rows; list = list->next, i++)
+    {
+      g_ptr_array_index (clist->row_index, i) = list;
+      GTK_CMCLIST_ROW (list)->index = i;
+    }
+
+  /* the list is being relinked */
+  clist->row_index_valid = (list == NULL && i == clist->rows);
+  return clist->row_index_valid;
+}
+
+GList *
+_gtk_cmclist_row_nth (GtkCMCList *clist,
+		      gint        row)
+{
+  if (row < 0 || row >= clist->rows)
+    return NULL;
+  if (row == clist->rows - 1)
+    return clist->row_list_end;
+  if (row == 0)
+    return clist->row_list;
+
+  if (!row_index_update (clist))
+    return g_list_nth (clist->row_list, row);
+  return g_ptr_array_index (clist->row_index, row);
+}
+
+gint
+_gtk_cmclist_row_position (GtkCMCList *clist,
+			   GList      *list)
+{
+  gint row;
+
+  if (!list)
+    return -1;
+
+  if (row_index_update (clist))
+    {
+      row = GTK_CMCLIST_ROW (list)->index;
+      if (row >= 0 && row < clist->rows &&
+	  g_ptr_array_index (clist->row_index, row) == list)
+	return row;
+    }
+  return g_list_position (clist->row_list, list);
+}
+
+void
+_gtk_cmclist_row_index_invalidate (GtkCMCList *clist)
+{
+  clist->row_index_valid = FALSE;
+}
+
 PangoLayout *
 _gtk_cmclist_create_cell_layout (GtkCMCList       *clist,
 			       GtkCMCListRow    *clist_row,
@@ -2823,6 +2885,7 @@ real_insert_row (GtkCMCList *clist,
       GTK_CMCLIST_GET_CLASS (clist)->set_cell_contents
 	(clist, clist_row, i, GTK_CMCELL_TEXT, text[i], 0, NULL);
 
+  _gtk_cmclist_row_index_invalidate (clist);
   if (!clist->rows)
     {
       clist->row_list = g_list_append (clist->row_list, clist_row);
@@ -2926,6 +2989,7 @@ real_remove_row (GtkCMCList *clist,
   sync_selection (clist, row, SYNC_REMOVE);
 
   /* reset the row end pointer if we're removing at the end of the list */
+  _gtk_cmclist_row_index_invalidate (clist);
   clist->rows--;
   if (clist->row_list == list)
     clist->row_list = g_list_next (list);
@@ -2986,6 +3050,7 @@ real_clear (GtkCMCList *clist)
   clist->row_list = NULL;
   clist->row_list_end = NULL;
   clist->rows = 0;
+  _gtk_cmclist_row_index_invalidate (clist);
   for (list = free_list; list; list = list->next)
     row_delete (clist, GTK_CMCLIST_ROW (list));
   g_list_free (free_list);
@@ -3037,6 +3102,7 @@ real_row_move (GtkCMCList *clist,
 
   /* unlink source row */
   clist_row = ROW_ELEMENT (clist, source_row)->data;
+  _gtk_cmclist_row_index_invalidate (clist);
   if (source_row == clist->rows - 1)
     clist->row_list_end = clist->row_list_end->prev;
   clist->row_list = g_list_remove (clist->row_list, clist_row);
@@ -4002,7 +4068,7 @@ fake_unselect_all (GtkCMCList *clist,
   for (list = clist->undo_selection; list; list = list->next)
     {
       if ((i = GPOINTER_TO_INT (list->data)) == row ||
-	  !(work = g_list_nth (clist->row_list, i)))
+	  !(work = ROW_ELEMENT (clist, i)))
 	continue;
 
       GTK_CMCLIST_ROW (work)->state = GTK_STATE_NORMAL;
@@ -4129,7 +4195,7 @@ resync_selection (GtkCMCList *clist,
 	  list = list->next;
 	  if (row < i || row > e)
 	    {
-	      clist_row = g_list_nth (clist->row_list, row)->data;
+	      clist_row = ROW_ELEMENT (clist, row)->data;
 	      if (clist_row->selectable)
 		{
 		  clist_row->state = GTK_STATE_SELECTED;
@@ -4145,7 +4211,7 @@ resync_selection (GtkCMCList *clist,
 
   if (clist->anchor < clist->drag_pos)
     {
-      for (list = g_list_nth (clist->row_list, i); i <= e;
+      for (list = ROW_ELEMENT (clist, i); i <= e;
 	   i++, list = list->next)
 	if (GTK_CMCLIST_ROW (list)->selectable)
 	  {
@@ -4173,7 +4239,7 @@ resync_selection (GtkCMCList *clist,
     }
   else
     {
-      for (list = g_list_nth (clist->row_list, e); i <= e;
+      for (list = ROW_ELEMENT (clist, e); i <= e;
 	   e--, list = list->prev)
 	if (GTK_CMCLIST_ROW (list)->selectable)
 	  {
@@ -4289,7 +4355,7 @@ update_extended_selection (GtkCMCList *clist,
   /* restore the elements between s1 and e1 */
   if (s1 >= 0)
     {
-      for (i = s1, list = g_list_nth (clist->row_list, i); i <= e1;
+      for (i = s1, list = ROW_ELEMENT (clist, i); i <= e1;
 	   i++, list = list->next)
 	if (GTK_CMCLIST_ROW (list)->selectable)
 	  {
@@ -4327,7 +4393,7 @@ update_extended_selection (GtkCMCList *clist,
   /* extend the selection between s2 and e2 */
   if (s2 >= 0)
     {
-      for (i = s2, list = g_list_nth (clist->row_list, i); i <= e2;
+      for (i = s2, list = ROW_ELEMENT (clist, i); i <= e2;
 	   i++, list = list->next)
 	if (GTK_CMCLIST_ROW (list)->selectable &&
 	    GTK_CMCLIST_ROW (list)->state != clist->anchor_state)
@@ -4542,6 +4608,7 @@ gtk_cmclist_finalize (GObject *object)
   clist = GTK_CMCLIST (object);
 
   columns_delete (clist);
+  g_ptr_array_free (clist->row_index, TRUE);
 
   G_OBJECT_CLASS (gtk_cmclist_parent_class)->finalize (object);
 }
@@ -6661,7 +6728,7 @@ gtk_cmclist_focus_in (GtkWidget     *widget,
     {
       GList *list;
 
-      list = g_list_nth (clist->row_list, clist->focus_row);
+      list = ROW_ELEMENT (clist, clist->focus_row);
       if (list && GTK_CMCLIST_ROW (list)->selectable)
 	g_signal_emit (G_OBJECT (clist), clist_signals[SELECT_ROW], 0,
 			 clist->focus_row, -1, event);
@@ -7345,6 +7412,7 @@ real_sort_list (GtkCMCList *clist)
       clist->undo_unselection = NULL;
     }
    
+  _gtk_cmclist_row_index_invalidate (clist);
   clist->row_list = gtk_cmclist_mergesort (clist, clist->row_list, clist->rows);
 
   work = clist->selection;
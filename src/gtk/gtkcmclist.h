@@ -166,6 +166,11 @@ struct _GtkCMCList
   gint row_height;
   GList *row_list;
   GList *row_list_end;
+
+  /* the links of row_list by position, rebuilt on the first lookup
+   * after the rows changed */
+  GPtrArray *row_index;
+  gboolean row_index_valid;
   
   /* columns */
   gint columns;
@@ -351,6 +356,9 @@ struct _GtkCMCListRow
   guint fg_set     : 1;
   guint bg_set     : 1;
   guint selectable : 1;
+
+  /* position in GtkCMCList::row_index */
+  gint index;
 };
 
 /* Cell Structures */
@@ -769,6 +777,14 @@ PangoLayout *_gtk_cmclist_create_cell_layout (GtkCMCList       *clist,
 					    GtkCMCListRow    *clist_row,
 					    gint            column);
 
+/* row_list lookups by position, in constant time while the rows don't
+ * change; whoever relinks row_list must invalidate the index */
+GList *_gtk_cmclist_row_nth		(GtkCMCList *clist,
+					 gint        row);
+gint   _gtk_cmclist_row_position	(GtkCMCList *clist,
+					 GList      *list);
+void   _gtk_cmclist_row_index_invalidate (GtkCMCList *clist);
+
 
 G_END_DECLS
 
@@ -605,7 +605,7 @@ draw_row (GtkCMCList     *clist,
   /* if the function is passed the pointer to the row instead of null,
    * it avoids this expensive lookup */
   if (!clist_row)
-    clist_row = (g_list_nth (clist->row_list, row))->data;
+    clist_row = (_gtk_cmclist_row_nth (clist, row))->data;
 
   style = clist_row->style ? clist_row->style : gtk_widget_get_style (widget);
 
@@ -1425,7 +1425,7 @@ gtk_cmctree_button_press (GtkWidget      *widget,
       if (!gtk_cmclist_get_selection_info (clist, x, y, &row, &column))
 	return FALSE;
 
-      work = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, row));
+      work = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, row));
 	  
       if (button_actions & GTK_CMBUTTON_EXPANDS &&
 	  (GTK_CMCTREE_ROW (work)->children && !GTK_CMCTREE_ROW (work)->is_leaf  &&
@@ -1592,6 +1592,7 @@ gtk_cmctree_link (GtkCMCTree     *ctree,
 	}
     }
 
+  _gtk_cmclist_row_index_invalidate (clist);
   gtk_cmctree_pre_recursive (ctree, node, tree_update_level, NULL); 
 
   if (clist->row_list_end == NULL ||
@@ -1602,7 +1603,7 @@ gtk_cmctree_link (GtkCMCTree     *ctree,
     {
       gint pos;
 	  
-      pos = g_list_position (clist->row_list, (GList *)node);
+      pos = _gtk_cmclist_row_position (clist, (GList *)node);
   
       if (pos <= clist->focus_row)
 	{
@@ -1668,7 +1669,7 @@ gtk_cmctree_unlink (GtkCMCTree     *ctree,
 	{
 	  gint pos;
 	  
-	  pos = g_list_position (clist->row_list, (GList *)node);
+	  pos = _gtk_cmclist_row_position (clist, (GList *)node);
 	  if (pos + rows < clist->focus_row)
 	    clist->focus_row -= (rows + 1);
 	  else if (pos <= clist->focus_row)
@@ -1733,6 +1734,7 @@ gtk_cmctree_unlink (GtkCMCTree     *ctree,
 	  GTK_CMCTREE_ROW (sibling)->sibling = GTK_CMCTREE_ROW (node)->sibling;
 	}
     }
+  _gtk_cmclist_row_index_invalidate (clist);
 }
 
 static void
@@ -1754,7 +1756,7 @@ real_row_move (GtkCMCList *clist,
     return;
 
   ctree = GTK_CMCTREE (clist);
-  node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, source_row));
+  node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, source_row));
 
   if (source_row < dest_row)
     {
@@ -1777,7 +1779,7 @@ real_row_move (GtkCMCList *clist,
     {
       GtkCMCTreeNode *sibling;
 
-      sibling = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, dest_row));
+      sibling = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, dest_row));
       gtk_cmctree_move (ctree, node, GTK_CMCTREE_ROW (sibling)->parent, sibling);
     }
   else
@@ -1844,7 +1846,7 @@ real_tree_move (GtkCMCTree     *ctree,
 
   work = NULL;
   if (gtk_cmctree_is_viewable (ctree, node))
-    work = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row));
+    work = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row));
       
   gtk_cmctree_unlink (ctree, node, FALSE);
   gtk_cmctree_link (ctree, node, new_parent, new_sibling, FALSE);
@@ -1853,7 +1855,7 @@ real_tree_move (GtkCMCTree     *ctree,
     {
       while (work &&  !gtk_cmctree_is_viewable (ctree, work))
 	work = GTK_CMCTREE_ROW (work)->parent;
-      clist->focus_row = g_list_position (clist->row_list, (GList *)work);
+      clist->focus_row = _gtk_cmclist_row_position (clist, (GList *)work);
       clist->undo_anchor = clist->focus_row;
     }
 
@@ -1883,7 +1885,7 @@ change_focus_row_expansion (GtkCMCTree          *ctree,
     return;
   
   if (!(node =
-	GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row))) ||
+	GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row))) ||
       GTK_CMCTREE_ROW (node)->is_leaf || !(GTK_CMCTREE_ROW (node)->children))
     return;
 
@@ -2012,6 +2014,8 @@ real_tree_expand (GtkCMCTree     *ctree,
       list = (GList *)node;
       list->next = (GList *)(GTK_CMCTREE_ROW (node)->children);
 
+      _gtk_cmclist_row_index_invalidate (clist);
+
       if (visible && !GTK_CMCLIST_AUTO_RESIZE_BLOCKED (clist))
 	{
 	  /* resize auto_resize columns if needed */
@@ -2022,7 +2026,7 @@ real_tree_expand (GtkCMCTree     *ctree,
 	  g_free (cell_width);
 
 	  /* update focus_row position */
-	  row = g_list_position (clist->row_list, (GList *)node);
+	  row = _gtk_cmclist_row_position (clist, (GList *)node);
 	  if (row < clist->focus_row)
 	    clist->focus_row += tmp;
 
@@ -2115,12 +2119,14 @@ real_tree_collapse (GtkCMCTree     *ctree,
 	  clist->row_list_end = (GList *)node;
 	}
 
+      _gtk_cmclist_row_index_invalidate (clist);
+
       if (visible)
 	{
 	  /* resize auto_resize columns if needed */
 	  auto_resize_columns (clist);
 
-	  row = g_list_position (clist->row_list, (GList *)node);
+	  row = _gtk_cmclist_row_position (clist, (GList *)node);
 	  if (row < clist->focus_row)
 	    clist->focus_row -= tmp;
 	  clist->rows -= tmp;
@@ -2633,7 +2639,7 @@ real_select_row (GtkCMCList *clist,
 
   cm_return_if_fail (GTK_IS_CMCTREE (clist));
   
-  if ((node = g_list_nth (clist->row_list, row)) &&
+  if ((node = _gtk_cmclist_row_nth (clist, row)) &&
       GTK_CMCTREE_ROW (node)->row.selectable)
     g_signal_emit (G_OBJECT (clist), ctree_signals[TREE_SELECT_ROW],0,
 		     node, column);
@@ -2649,7 +2655,7 @@ real_unselect_row (GtkCMCList *clist,
 
   cm_return_if_fail (GTK_IS_CMCTREE (clist));
 
-  if ((node = g_list_nth (clist->row_list, row)))
+  if ((node = _gtk_cmclist_row_nth (clist, row)))
     g_signal_emit (G_OBJECT (clist), ctree_signals[TREE_UNSELECT_ROW],0,
 		     node, column);
 }
@@ -2836,7 +2842,7 @@ real_unselect_all (GtkCMCList *clist)
 	{
 	  gtk_cmctree_select
 	    (ctree,
-	     GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row)));
+	     GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row)));
 	  return;
 	}
       break;
@@ -2976,7 +2982,7 @@ real_insert_row (GtkCMCList *clist,
 
   cm_return_val_if_fail (GTK_IS_CMCTREE (clist), -1);
 
-  sibling = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, row));
+  sibling = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, row));
   if (sibling)
     parent = GTK_CMCTREE_ROW (sibling)->parent;
 
@@ -2984,7 +2990,7 @@ real_insert_row (GtkCMCList *clist,
 				NULL, NULL, TRUE, FALSE);
 
   if (GTK_CMCLIST_AUTO_SORT (clist) || !sibling)
-    return g_list_position (clist->row_list, (GList *) node);
+    return _gtk_cmclist_row_position (clist, (GList *) node);
   
   return row;
 }
@@ -3192,7 +3198,7 @@ real_remove_row (GtkCMCList *clist,
 
   cm_return_if_fail (GTK_IS_CMCTREE (clist));
 
-  node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, row));
+  node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, row));
 
   if (node)
     gtk_cmctree_remove_node (GTK_CMCTREE (clist), node);
@@ -3242,6 +3248,7 @@ real_clear (GtkCMCList *clist)
   work = GTK_CMCTREE_NODE (clist->row_list);
   clist->row_list = NULL;
   clist->row_list_end = NULL;
+  _gtk_cmclist_row_index_invalidate (clist);
 
   GTK_CMCLIST_SET_FLAG (clist, CMCLIST_AUTO_RESIZE_BLOCKED);
   while (work)
@@ -3463,7 +3470,7 @@ gtk_cmctree_node_nth (GtkCMCTree *ctree,
   if ((row >= GTK_CMCLIST(ctree)->rows))
     return NULL;
  
-  return GTK_CMCTREE_NODE (g_list_nth (GTK_CMCLIST (ctree)->row_list, row));
+  return GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (GTK_CMCLIST (ctree), row));
 }
 
 gboolean
@@ -3635,7 +3642,7 @@ gtk_cmctree_is_hot_spot (GtkCMCTree *ctree,
   cm_return_val_if_fail (GTK_IS_CMCTREE (ctree), FALSE);
 
   if (gtk_cmclist_get_selection_info (GTK_CMCLIST (ctree), x, y, &row, &column))
-    if ((node = GTK_CMCTREE_NODE(g_list_nth (GTK_CMCLIST (ctree)->row_list, row))))
+    if ((node = GTK_CMCTREE_NODE(_gtk_cmclist_row_nth (GTK_CMCLIST (ctree), row))))
       return ctree_is_hot_spot (ctree, node, row, x, y);
 
   return FALSE;
@@ -4532,7 +4539,7 @@ gtk_cmctree_node_moveto (GtkCMCTree     *ctree,
     node = GTK_CMCTREE_ROW (node)->parent;
 
   if (node)
-    row = g_list_position (clist->row_list, (GList *)node);
+    row = _gtk_cmclist_row_position (clist, (GList *)node);
   
   gtk_cmclist_moveto (clist, row, column, row_align, col_align);
 }
@@ -4546,7 +4553,7 @@ gtk_cmctree_node_is_visible (GtkCMCTree     *ctree,
   cm_return_val_if_fail (ctree != NULL, 0);
   cm_return_val_if_fail (node != NULL, 0);
   
-  row = g_list_position (GTK_CMCLIST (ctree)->row_list, (GList*) node);
+  row = _gtk_cmclist_row_position (GTK_CMCLIST (ctree), (GList*) node);
   return gtk_cmclist_row_is_visible (GTK_CMCLIST (ctree), row);
 }
 
@@ -4760,7 +4767,7 @@ gtk_cmctree_sort_recursive (GtkCMCTree     *ctree,
 
   if (!node || (node && gtk_cmctree_is_viewable (ctree, node)))
     focus_node =
-      GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row));
+      GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row));
       
   gtk_cmctree_post_recursive (ctree, node, GTK_CMCTREE_FUNC (tree_sort), NULL);
 
@@ -4769,7 +4776,7 @@ gtk_cmctree_sort_recursive (GtkCMCTree     *ctree,
 
   if (focus_node)
     {
-      clist->focus_row = g_list_position (clist->row_list,(GList *)focus_node);
+      clist->focus_row = _gtk_cmclist_row_position (clist, (GList *)focus_node);
       clist->undo_anchor = clist->focus_row;
     }
 
@@ -4807,13 +4814,13 @@ gtk_cmctree_sort_node (GtkCMCTree     *ctree,
 
   if (!node || (node && gtk_cmctree_is_viewable (ctree, node)))
     focus_node = GTK_CMCTREE_NODE
-      (g_list_nth (clist->row_list, clist->focus_row));
+      (_gtk_cmclist_row_nth (clist, clist->focus_row));
 
   tree_sort (ctree, node, NULL);
 
   if (focus_node)
     {
-      clist->focus_row = g_list_position (clist->row_list,(GList *)focus_node);
+      clist->focus_row = _gtk_cmclist_row_position (clist, (GList *)focus_node);
       clist->undo_anchor = clist->focus_row;
     }
 
@@ -4829,7 +4836,7 @@ fake_unselect_all (GtkCMCList *clist,
   GList *list;
   GList *focus_node = NULL;
 
-  if (row >= 0 && (focus_node = g_list_nth (clist->row_list, row)))
+  if (row >= 0 && (focus_node = _gtk_cmclist_row_nth (clist, row)))
     {
       if (GTK_CMCTREE_ROW (focus_node)->row.state == GTK_STATE_NORMAL &&
 	  GTK_CMCTREE_ROW (focus_node)->row.selectable)
@@ -4908,7 +4915,7 @@ resync_selection (GtkCMCList *clist, GdkEvent *event)
 
 	  if (gtk_cmctree_is_viewable (ctree, node))
 	    {
-	      row = g_list_position (clist->row_list, (GList *)node);
+	      row = _gtk_cmclist_row_position (clist, (GList *)node);
 	      if (row >= i && row <= e)
 		unselect = FALSE;
 	    }
@@ -4924,7 +4931,7 @@ resync_selection (GtkCMCList *clist, GdkEvent *event)
 
   if (clist->anchor < clist->drag_pos)
     {
-      for (node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, i)); i <= e;
+      for (node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, i)); i <= e;
 	   i++, node = GTK_CMCTREE_NODE_NEXT (node))
 	if (GTK_CMCTREE_ROW (node)->row.selectable)
 	  {
@@ -4948,7 +4955,7 @@ resync_selection (GtkCMCList *clist, GdkEvent *event)
     }
   else
     {
-      for (node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, e)); i <= e;
+      for (node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, e)); i <= e;
 	   e--, node = GTK_CMCTREE_NODE_PREV (node))
 	if (GTK_CMCTREE_ROW (node)->row.selectable)
 	  {
@@ -5139,7 +5146,7 @@ drag_dest_cell (GtkCMCList         *clist,
       y_delta = y - ROW_TOP_YPIXEL (clist, dest_info->cell.row);
       
       if (GTK_CMCLIST_DRAW_DRAG_RECT(clist) &&
-	  !GTK_CMCTREE_ROW (g_list_nth (clist->row_list,
+	  !GTK_CMCTREE_ROW (_gtk_cmclist_row_nth (clist,
 				      dest_info->cell.row))->is_leaf)
 	{
 	  dest_info->insert_pos = GTK_CMCLIST_DRAG_INTO;
@@ -5227,9 +5234,9 @@ gtk_cmctree_drag_motion (GtkWidget      *widget,
 	  GtkCMCTreeNode *drag_source;
 	  GtkCMCTreeNode *drag_target;
 
-	  drag_source = GTK_CMCTREE_NODE (g_list_nth (clist->row_list,
+	  drag_source = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist,
 						    clist->click_cell.row));
-	  drag_target = GTK_CMCTREE_NODE (g_list_nth (clist->row_list,
+	  drag_target = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist,
 						    new_info.cell.row));
 
 	  if (gtk_drag_get_source_widget (context) != widget ||
@@ -5305,9 +5312,9 @@ gtk_cmctree_drag_data_received (GtkWidget        *widget,
 
 	  drag_dest_cell (clist, x, y, &dest_info);
 	  
-	  source_node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list,
+	  source_node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist,
 						    source_info->row));
-	  dest_node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list,
+	  dest_node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist,
 						  dest_info.cell.row));
 
 	  if (!source_node || !dest_node)
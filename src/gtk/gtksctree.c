@@ -113,6 +113,14 @@ sreal_tree_move (GtkCMCTree     *ctree,
 		GtkCMCTreeNode *new_parent, 
 		GtkCMCTreeNode *new_sibling);
 
+static void gtk_sctree_draw_row (GtkCMCList     *clist,
+				 GdkRectangle   *area,
+				 gint            row,
+				 GtkCMCListRow  *clist_row);
+static void sctree_forget_cell_text (GtkCMCTree     *ctree,
+				     GtkCMCTreeNode *node,
+				     gpointer        data);
+
 static GtkCMCTreeClass *parent_class;
 
 static guint sctree_signals[LAST_SIGNAL];
@@ -168,7 +176,7 @@ gtk_sctree_change_focus_row_expansion (GtkCMCTree          *ctree,
     return;
   
   if (!(node =
-	GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row))) ||
+	GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row))) ||
       GTK_CMCTREE_ROW (node)->is_leaf || !(GTK_CMCTREE_ROW (node)->children))
     return;
 
@@ -207,6 +215,12 @@ static void gtk_sctree_finalize(GObject *object)
 	GtkSCTree *sctree = GTK_SCTREE(object);
 	g_free(sctree->use_markup);
 	sctree->use_markup = NULL;
+	if (sctree->cell_text_rows) {
+		g_hash_table_destroy(sctree->cell_text_rows);
+		g_queue_free(sctree->cell_text_lru);
+		sctree->cell_text_rows = NULL;
+		sctree->cell_text_lru = NULL;
+	}
 	G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -265,6 +279,7 @@ gtk_sctree_class_init (GtkSCTreeClass *klass)
 	/* gtk_object_class_add_signals (object_class, sctree_signals, LAST_SIGNAL); */
 
 	clist_class->clear = gtk_sctree_clear;
+	clist_class->draw_row = gtk_sctree_draw_row;
 	clist_class->unselect_all = gtk_sctree_real_unselect_all;
         ctree_class->tree_collapse = gtk_sctree_real_tree_collapse;
 	ctree_class->tree_expand = gtk_sctree_real_tree_expand;
@@ -302,7 +317,7 @@ static gboolean
 row_is_selected(GtkSCTree *sctree, gint row)
 {
 	GtkCMCListRow *clist_row;
-	clist_row =  g_list_nth (GTK_CMCLIST(sctree)->row_list, row)->data;
+	clist_row =  _gtk_cmclist_row_nth (GTK_CMCLIST(sctree), row)->data;
 	return clist_row ? clist_row->state == GTK_STATE_SELECTED : FALSE;
 }
 
@@ -318,8 +333,7 @@ select_range (GtkSCTree *sctree, gint row)
 		prev_row = row;
 		sctree->anchor_row = gtk_cmctree_node_nth(GTK_CMCTREE(sctree), row);
 	} else
-		prev_row = g_list_position(GTK_CMCLIST(sctree)->row_list,
-					   (GList *)sctree->anchor_row);
+		prev_row = _gtk_cmclist_row_position(GTK_CMCLIST(sctree), (GList *)sctree->anchor_row);
 
 	if (row < prev_row) {
 		min = row;
@@ -340,7 +354,7 @@ select_range (GtkSCTree *sctree, gint row)
 	if (max - min > 10)
 		gtk_cmclist_freeze(GTK_CMCLIST(sctree));
 
-	node = g_list_nth((GTK_CMCLIST(sctree))->row_list, min);
+	node = _gtk_cmclist_row_nth(GTK_CMCLIST(sctree), min);
 	for (i = min; i < max; i++) {
 		if (node && GTK_CMCTREE_ROW (node)->row.selectable) {
 			g_signal_emit_by_name(G_OBJECT(sctree), "tree_select_row",
@@ -485,7 +499,7 @@ gtk_sctree_is_hot_spot (GtkSCTree *ctree,
   cm_return_val_if_fail (GTK_IS_SCTREE (ctree), FALSE);
 
   if (gtk_cmclist_get_selection_info (GTK_CMCLIST (ctree), x, y, &row, &column))
-    if ((node = GTK_CMCTREE_NODE(g_list_nth (GTK_CMCLIST (ctree)->row_list, row))))
+    if ((node = GTK_CMCTREE_NODE(_gtk_cmclist_row_nth (GTK_CMCLIST (ctree), row))))
       return sctree_is_hot_spot (ctree, node, row, x, y);
 
   return FALSE;
@@ -767,6 +781,11 @@ gtk_sctree_clear (GtkCMCList *clist)
 	sctree = GTK_SCTREE (clist);
 	sctree->anchor_row = NULL;
 
+	if (sctree->cell_text_rows) {
+		g_hash_table_remove_all(sctree->cell_text_rows);
+		g_queue_clear(sctree->cell_text_lru);
+	}
+
 	if (((GtkCMCListClass *)parent_class)->clear)
 		(* ((GtkCMCListClass *)parent_class)->clear) (clist);
 }
@@ -940,13 +959,15 @@ gtk_sctree_real_tree_collapse (GtkCMCTree     *ctree,
 	  clist->row_list_end = (GList *)node;
 	}
 
+      _gtk_cmclist_row_index_invalidate (clist);
+
       if (visible)
 	{
 	  /* resize auto_resize columns if needed */
 	  gtk_sctree_auto_resize_columns (clist);
 
 	  if (!GTK_SCTREE(clist)->sorting) {
-		  row = g_list_position (clist->row_list, (GList *)node);
+		  row = _gtk_cmclist_row_position (clist, (GList *)node);
 		  if (row < clist->focus_row)
 		    clist->focus_row -= tmp;
 	  }
@@ -1018,17 +1039,172 @@ void gtk_sctree_set_use_markup		    (GtkSCTree		*sctree,
 	sctree->use_markup[column] = markup;
 }
 
+/* Replaces the text of a cell without drawing the row */
+void gtk_sctree_node_set_cell_text (GtkSCTree *sctree, GtkCMCTreeNode *node,
+				    gint column, const gchar *text)
+{
+	GtkCMCList *clist;
+	GtkCMCTree *ctree;
+	GtkCMCListRow *clist_row;
+
+	cm_return_if_fail(GTK_IS_SCTREE(sctree));
+	cm_return_if_fail(node != NULL);
+
+	clist = GTK_CMCLIST(sctree);
+	ctree = GTK_CMCTREE(sctree);
+	cm_return_if_fail(column >= 0 && column < clist->columns);
+
+	clist_row = &GTK_CMCTREE_ROW(node)->row;
+
+	if (column == ctree->tree_column) {
+		GdkPixbuf *pixbuf = NULL;
+		guint8 spacing = 0;
+
+		if (clist_row->cell[column].type == GTK_CMCELL_PIXTEXT) {
+			pixbuf = GTK_CMCELL_PIXTEXT(clist_row->cell[column])->pixbuf;
+			spacing = GTK_CMCELL_PIXTEXT(clist_row->cell[column])->spacing;
+			if (pixbuf)
+				g_object_ref(pixbuf);
+		}
+		GTK_CMCLIST_GET_CLASS(clist)->set_cell_contents
+			(clist, clist_row, column, GTK_CMCELL_PIXTEXT,
+			 text, spacing, pixbuf);
+	} else {
+		GTK_CMCLIST_GET_CLASS(clist)->set_cell_contents
+			(clist, clist_row, column,
+			 text ? GTK_CMCELL_TEXT : GTK_CMCELL_EMPTY,
+			 text, 0, NULL);
+	}
+
+	if (sctree->cell_text_func && column < 32)
+		sctree->cell_text_columns |= (1U << column);
+}
+
+static void sctree_forget_cell_text (GtkCMCTree *ctree, GtkCMCTreeNode *node,
+				     gpointer data)
+{
+	GtkSCTree *sctree = GTK_SCTREE(ctree);
+	GList *link;
+
+	link = g_hash_table_lookup(sctree->cell_text_rows, node);
+	if (link) {
+		g_queue_delete_link(sctree->cell_text_lru, link);
+		g_hash_table_remove(sctree->cell_text_rows, node);
+	}
+}
+
+static void sctree_evict_cell_text (GtkSCTree *sctree)
+{
+	GtkCMCList *clist = GTK_CMCLIST(sctree);
+	GtkCMCTreeNode *node;
+	gint i;
+
+	node = g_queue_pop_tail(sctree->cell_text_lru);
+	g_hash_table_remove(sctree->cell_text_rows, node);
+
+	for (i = 0; i < clist->columns && i < 32; i++)
+		if (sctree->cell_text_columns & (1U << i))
+			gtk_sctree_node_set_cell_text(sctree, node, i, NULL);
+}
+
+/**
+ * gtk_sctree_node_fill_cell_text:
+ * @sctree: the tree
+ * @node: the row
+ *
+ * Makes sure the row has its text, calling the cell text function set with
+ * gtk_sctree_set_cell_text_func() if it has none, and marks the row as the
+ * most recently used one.
+ **/
+void gtk_sctree_node_fill_cell_text (GtkSCTree *sctree, GtkCMCTreeNode *node)
+{
+	GList *link;
+
+	cm_return_if_fail(GTK_IS_SCTREE(sctree));
+
+	if (!sctree->cell_text_func || !node)
+		return;
+
+	link = g_hash_table_lookup(sctree->cell_text_rows, node);
+	if (link) {
+		if (link != sctree->cell_text_lru->head) {
+			g_queue_unlink(sctree->cell_text_lru, link);
+			g_queue_push_head_link(sctree->cell_text_lru, link);
+		}
+		return;
+	}
+
+	/* remember the row first: the function may end up drawing it */
+	g_queue_push_head(sctree->cell_text_lru, node);
+	g_hash_table_insert(sctree->cell_text_rows, node,
+			    sctree->cell_text_lru->head);
+
+	sctree->cell_text_func(sctree, node, sctree->cell_text_data);
+
+	while (g_queue_get_length(sctree->cell_text_lru) > sctree->cell_text_max)
+		sctree_evict_cell_text(sctree);
+}
+
+/**
+ * gtk_sctree_set_cell_text_func:
+ * @sctree: the tree
+ * @func: function setting the text of a row with
+ *	gtk_sctree_node_set_cell_text(), or NULL
+ * @data: data passed to @func
+ * @max_rows: number of rows whose text is kept
+ *
+ * Lets rows be inserted without text. Their text is generated by @func when
+ * they are drawn, and dropped again when more than @max_rows rows have text.
+ **/
+void gtk_sctree_set_cell_text_func (GtkSCTree *sctree,
+				    GtkSCTreeCellTextFunc func,
+				    gpointer data, guint max_rows)
+{
+	cm_return_if_fail(GTK_IS_SCTREE(sctree));
+
+	sctree->cell_text_func = func;
+	sctree->cell_text_data = data;
+	sctree->cell_text_max = MAX(max_rows, 1);
+	sctree->cell_text_columns = 0;
+
+	if (sctree->cell_text_rows) {
+		g_hash_table_remove_all(sctree->cell_text_rows);
+		g_queue_clear(sctree->cell_text_lru);
+	} else if (func) {
+		sctree->cell_text_rows = g_hash_table_new(g_direct_hash,
+							  g_direct_equal);
+		sctree->cell_text_lru = g_queue_new();
+	}
+}
+
+static void
+gtk_sctree_draw_row (GtkCMCList *clist, GdkRectangle *area, gint row,
+		     GtkCMCListRow *clist_row)
+{
+	GtkSCTree *sctree = GTK_SCTREE(clist);
+
+	if (sctree->cell_text_func) {
+		GList *list = _gtk_cmclist_row_nth(clist, row);
+
+		if (list && list->data == clist_row)
+			gtk_sctree_node_fill_cell_text(sctree,
+						       GTK_CMCTREE_NODE(list));
+	}
+
+	((GtkCMCListClass *)parent_class)->draw_row(clist, area, row, clist_row);
+}
+
 void gtk_sctree_select (GtkSCTree *sctree, GtkCMCTreeNode *node)
 {
 	select_row(sctree, 
-		   g_list_position(GTK_CMCLIST(sctree)->row_list, (GList *)node),
+		   _gtk_cmclist_row_position(GTK_CMCLIST(sctree), (GList *)node),
 		   -1, 0, node);
 }
 
 void gtk_sctree_select_with_state (GtkSCTree *sctree, GtkCMCTreeNode *node, int state)
 {
 	select_row(sctree, 
-		   g_list_position(GTK_CMCLIST(sctree)->row_list, (GList *)node),
+		   _gtk_cmclist_row_position(GTK_CMCLIST(sctree), (GList *)node),
 		   -1, state, node);
 }
 
@@ -1047,6 +1223,9 @@ void gtk_sctree_remove_node (GtkSCTree *sctree, GtkCMCTreeNode *node)
 {
 	if (sctree->anchor_row == node)
 		sctree->anchor_row = NULL;
+	if (sctree->cell_text_rows && g_hash_table_size(sctree->cell_text_rows))
+		gtk_cmctree_pre_recursive(GTK_CMCTREE(sctree), node,
+					  sctree_forget_cell_text, NULL);
 	gtk_cmctree_remove_node(GTK_CMCTREE(sctree), node);
 }
 
@@ -1110,6 +1289,188 @@ static void heap_sort(GtkCMCList *clist, GPtrArray *numbers, gint array_size)
 	}
 }
 
+/* Rows sorted by keys, see gtk_sctree_sort_recursive_by_keys() */
+typedef struct _SCTreeSortKeys {
+	GtkSCTreeSortKeyFunc func;
+	gpointer data;
+} SCTreeSortKeys;
+
+typedef struct _SCTreeSortItem {
+	GtkCMCTreeNode *node;
+	GtkSCTreeSortKey key;
+} SCTreeSortItem;
+
+typedef struct _SCTreeSortRun {
+	SCTreeSortItem **items;
+	SCTreeSortItem **tmp;
+	guint len;
+} SCTreeSortRun;
+
+/* below this many rows, sorting isn't split over threads */
+#define SCTREE_THREADED_SORT_MIN	16384
+
+static gint stree_sort_item_cmp (const SCTreeSortItem *a,
+				 const SCTreeSortItem *b)
+{
+	guint i;
+	gint res;
+
+	if (a->key.str != b->key.str) {
+		if (!a->key.str)
+			return 1;
+		if (!b->key.str)
+			return -1;
+		res = strcmp(a->key.str, b->key.str);
+		if (res != 0)
+			return res;
+	}
+	for (i = 0; i < G_N_ELEMENTS(a->key.num); i++)
+		if (a->key.num[i] != b->key.num[i])
+			return (a->key.num[i] < b->key.num[i]) ? -1 : 1;
+	return 0;
+}
+
+/* Merges the sorted items[0..half) and items[half..len) */
+static void stree_sort_merge (SCTreeSortItem **items, SCTreeSortItem **tmp,
+			      guint half, guint len)
+{
+	guint i = 0, j = half, k = 0;
+
+	if (half == 0 || half == len ||
+	    stree_sort_item_cmp(items[half - 1], items[half]) <= 0)
+		return;
+
+	memcpy(tmp, items, half * sizeof(SCTreeSortItem *));
+	while (i < half && j < len) {
+		if (stree_sort_item_cmp(items[j], tmp[i]) < 0)
+			items[k++] = items[j++];
+		else
+			items[k++] = tmp[i++];
+	}
+	while (i < half)
+		items[k++] = tmp[i++];
+}
+
+/* A stable merge sort; only compares keys, so it may run in any thread */
+static void stree_sort_items (SCTreeSortItem **items, SCTreeSortItem **tmp,
+			      guint len)
+{
+	guint i, j, half;
+	SCTreeSortItem *item;
+
+	if (len <= 16) {
+		for (i = 1; i < len; i++) {
+			item = items[i];
+			for (j = i; j > 0 &&
+			     stree_sort_item_cmp(items[j - 1], item) > 0; j--)
+				items[j] = items[j - 1];
+			items[j] = item;
+		}
+		return;
+	}
+
+	half = len / 2;
+	stree_sort_items(items, tmp, half);
+	stree_sort_items(items + half, tmp + half, len - half);
+	stree_sort_merge(items, tmp, half, len);
+}
+
+static void stree_sort_run_thread (gpointer data, gpointer user_data)
+{
+	SCTreeSortRun *run = (SCTreeSortRun *)data;
+
+	stree_sort_items(run->items, run->tmp, run->len);
+}
+
+static gint stree_sort_threads (void)
+{
+#if GLIB_CHECK_VERSION(2,36,0)
+	return MIN(g_get_num_processors(), 8);
+#else
+	return 1;
+#endif
+}
+
+/* Sorts runs of the items in a thread each, then merges them */
+static gboolean stree_sort_items_threaded (SCTreeSortItem **items,
+					   SCTreeSortItem **tmp, guint len)
+{
+	SCTreeSortRun *runs;
+	GThreadPool *pool;
+	GError *error = NULL;
+	guint n_runs, i, width, start, half, end;
+
+	n_runs = stree_sort_threads();
+	if (n_runs < 2 || len < SCTREE_THREADED_SORT_MIN)
+		return FALSE;
+
+	pool = g_thread_pool_new(stree_sort_run_thread, NULL, n_runs,
+				 FALSE, &error);
+	if (pool == NULL) {
+		g_warning("couldn't start sort threads: %s",
+			  error ? error->message : "unknown error");
+		if (error)
+			g_error_free(error);
+		return FALSE;
+	}
+
+	width = (len + n_runs - 1) / n_runs;
+	runs = g_new0(SCTreeSortRun, n_runs);
+	for (i = 0; i < n_runs; i++) {
+		start = MIN(i * width, len);
+		runs[i].items = items + start;
+		runs[i].tmp = tmp + start;
+		runs[i].len = MIN(width, len - start);
+		g_thread_pool_push(pool, &runs[i], NULL);
+	}
+	/* waits for all runs */
+	g_thread_pool_free(pool, FALSE, TRUE);
+	g_free(runs);
+
+	for (; width < len; width *= 2) {
+		for (start = 0; start + width < len; start += 2 * width) {
+			half = width;
+			end = MIN(start + 2 * width, len);
+			stree_sort_merge(items + start, tmp + start,
+					 half, end - start);
+		}
+	}
+
+	return TRUE;
+}
+
+/* Sorts row_array[1..] as heap_sort() would, with keys made once per row */
+static void stree_sort_by_keys (GtkCMCTree *ctree, GPtrArray *row_array,
+				SCTreeSortKeys *keys)
+{
+	SCTreeSortItem *items, **sorted, **tmp;
+	guint len = row_array->len - 1;
+	guint i;
+
+	items = g_new0(SCTreeSortItem, len);
+	sorted = g_new(SCTreeSortItem *, len);
+	tmp = g_new(SCTreeSortItem *, len);
+
+	for (i = 0; i < len; i++) {
+		items[i].node = g_ptr_array_index(row_array, i + 1);
+		keys->func(GTK_SCTREE(ctree), items[i].node, &items[i].key,
+			   keys->data);
+		sorted[i] = &items[i];
+	}
+
+	if (!stree_sort_items_threaded(sorted, tmp, len))
+		stree_sort_items(sorted, tmp, len);
+
+	for (i = 0; i < len; i++)
+		g_ptr_array_index(row_array, i + 1) = sorted[i]->node;
+
+	for (i = 0; i < len; i++)
+		g_free(items[i].key.str);
+	g_free(items);
+	g_free(sorted);
+	g_free(tmp);
+}
+
 static void
 stree_sort (GtkCMCTree    *ctree,
 	   GtkCMCTreeNode *node,
@@ -1118,6 +1479,7 @@ stree_sort (GtkCMCTree    *ctree,
 	GtkCMCTreeNode *list_start, *work, *next;
 	GPtrArray *row_array, *viewable_array;
 	GtkCMCList *clist;
+	SCTreeSortKeys *keys = (SCTreeSortKeys *)data;
 	gint i;
 
 	clist = GTK_CMCLIST (ctree);
@@ -1142,7 +1504,10 @@ stree_sort (GtkCMCTree    *ctree,
 			work = next;
 		}
 
-		heap_sort( clist, row_array, (row_array->len)-1);
+		if (keys)
+			stree_sort_by_keys( ctree, row_array, keys);
+		else
+			heap_sort( clist, row_array, (row_array->len)-1);
 
 		if (node)
 			list_start = GTK_CMCTREE_ROW (node)->children;
@@ -1174,9 +1539,10 @@ stree_sort (GtkCMCTree    *ctree,
 	g_ptr_array_free( viewable_array, TRUE);
 }
 
-void
-gtk_sctree_sort_recursive (GtkCMCTree     *ctree, 
-			  GtkCMCTreeNode *node)
+static void
+stree_sort_recursive (GtkCMCTree     *ctree,
+		      GtkCMCTreeNode *node,
+		      SCTreeSortKeys *keys)
 {
 	GtkCMCList *clist;
 	GtkCMCTreeNode *focus_node = NULL;
@@ -1198,19 +1564,19 @@ gtk_sctree_sort_recursive (GtkCMCTree     *ctree,
 	}
 
 	if (!node || (node && gtk_cmctree_is_viewable (ctree, node)))
-		focus_node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row));
+		focus_node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row));
       
 	GTK_SCTREE(ctree)->sorting = TRUE;
 
-	gtk_cmctree_post_recursive (ctree, node, GTK_CMCTREE_FUNC (stree_sort), NULL);
+	gtk_cmctree_post_recursive (ctree, node, GTK_CMCTREE_FUNC (stree_sort), keys);
 
 	if (!node)
-		stree_sort (ctree, NULL, NULL);
+		stree_sort (ctree, NULL, keys);
 
 	GTK_SCTREE(ctree)->sorting = FALSE;
 
 	if (focus_node) {
-		clist->focus_row = g_list_position (clist->row_list,(GList *)focus_node);
+		clist->focus_row = _gtk_cmclist_row_position (clist, (GList *)focus_node);
 		clist->undo_anchor = clist->focus_row;
 	}
 
@@ -1218,8 +1584,43 @@ gtk_sctree_sort_recursive (GtkCMCTree     *ctree,
 }
 
 void
-gtk_sctree_sort_node (GtkCMCTree     *ctree, 
-		     GtkCMCTreeNode *node)
+gtk_sctree_sort_recursive (GtkCMCTree     *ctree, 
+			  GtkCMCTreeNode *node)
+{
+	stree_sort_recursive (ctree, node, NULL);
+}
+
+/**
+ * gtk_sctree_sort_recursive_by_keys:
+ * @ctree: the tree
+ * @node: the node whose subtree is sorted, or NULL for the whole tree
+ * @func: function setting the sort key of a row
+ * @data: data passed to @func
+ *
+ * Like gtk_sctree_sort_recursive(), but instead of calling the compare
+ * function for every comparison, calls @func once for every row and
+ * compares the keys. Large sets of rows are sorted using several threads;
+ * @func itself is only called from the calling thread.
+ **/
+void
+gtk_sctree_sort_recursive_by_keys (GtkCMCTree           *ctree,
+				   GtkCMCTreeNode       *node,
+				   GtkSCTreeSortKeyFunc  func,
+				   gpointer              data)
+{
+	SCTreeSortKeys keys;
+
+	cm_return_if_fail (func != NULL);
+
+	keys.func = func;
+	keys.data = data;
+	stree_sort_recursive (ctree, node, &keys);
+}
+
+static void
+stree_sort_node (GtkCMCTree     *ctree,
+		 GtkCMCTreeNode *node,
+		 SCTreeSortKeys *keys)
 {
 	GtkCMCList *clist;
 	GtkCMCTreeNode *focus_node = NULL;
@@ -1241,22 +1642,53 @@ gtk_sctree_sort_node (GtkCMCTree     *ctree,
 	}
 
 	if (!node || (node && gtk_cmctree_is_viewable (ctree, node)))
-		focus_node = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row));
+		focus_node = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row));
 
 	GTK_SCTREE(ctree)->sorting = TRUE;
 
-	stree_sort (ctree, node, NULL);
+	stree_sort (ctree, node, keys);
 
 	GTK_SCTREE(ctree)->sorting = FALSE;
 
 	if (focus_node) {
-		clist->focus_row = g_list_position (clist->row_list,(GList *)focus_node);
+		clist->focus_row = _gtk_cmclist_row_position (clist, (GList *)focus_node);
 		clist->undo_anchor = clist->focus_row;
 	}
 
 	gtk_cmclist_thaw (clist);
 }
 
+void
+gtk_sctree_sort_node (GtkCMCTree     *ctree, 
+		     GtkCMCTreeNode *node)
+{
+	stree_sort_node (ctree, node, NULL);
+}
+
+/**
+ * gtk_sctree_sort_node_by_keys:
+ * @ctree: the tree
+ * @node: the node whose children are sorted, or NULL for the top level
+ * @func: function setting the sort key of a row
+ * @data: data passed to @func
+ *
+ * Like gtk_sctree_sort_node(), see gtk_sctree_sort_recursive_by_keys().
+ **/
+void
+gtk_sctree_sort_node_by_keys (GtkCMCTree           *ctree,
+			      GtkCMCTreeNode       *node,
+			      GtkSCTreeSortKeyFunc  func,
+			      gpointer              data)
+{
+	SCTreeSortKeys keys;
+
+	cm_return_if_fail (func != NULL);
+
+	keys.func = func;
+	keys.data = data;
+	stree_sort_node (ctree, node, &keys);
+}
+
 /************************************************************************/
 
 static void
@@ -1309,7 +1741,7 @@ gtk_sctree_unlink (GtkCMCTree     *ctree,
 
 		if (update_focus_row) {
 			gint pos;
-			pos = g_list_position (clist->row_list, (GList *)node);
+			pos = _gtk_cmclist_row_position (clist, (GList *)node);
 			if (pos + rows < clist->focus_row)
 				clist->focus_row -= (rows + 1);
 			else if (pos <= clist->focus_row) {
@@ -1364,6 +1796,7 @@ gtk_sctree_unlink (GtkCMCTree     *ctree,
 			GTK_CMCTREE_ROW (sibling)->sibling = GTK_CMCTREE_ROW (node)->sibling;
 		}
 	}
+	_gtk_cmclist_row_index_invalidate (clist);
 }
 
 static void
@@ -1482,6 +1915,7 @@ gtk_sctree_link (GtkCMCTree     *ctree,
 		}
 	}
 
+	_gtk_cmclist_row_index_invalidate (clist);
 	gtk_cmctree_pre_recursive (ctree, node, stree_update_level, NULL); 
 
 	if (clist->row_list_end == NULL ||
@@ -1490,7 +1924,7 @@ gtk_sctree_link (GtkCMCTree     *ctree,
 
 	if (visible && update_focus_row) {
 		gint pos;
-		pos = g_list_position (clist->row_list, (GList *)node);
+		pos = _gtk_cmclist_row_position (clist, (GList *)node);
   
 		if (pos <= clist->focus_row) {
 			clist->focus_row += rows;
@@ -1782,6 +2216,8 @@ gtk_sctree_real_tree_expand (GtkCMCTree     *ctree,
       list = (GList *)node;
       list->next = (GList *)(GTK_CMCTREE_ROW (node)->children);
 
+      _gtk_cmclist_row_index_invalidate (clist);
+
       if (visible && !GTK_CMCLIST_AUTO_RESIZE_BLOCKED (clist))
 	{
 	  /* resize auto_resize columns if needed */
@@ -1793,7 +2229,7 @@ gtk_sctree_real_tree_expand (GtkCMCTree     *ctree,
 	
 	  if (!GTK_SCTREE(ctree)->sorting) {
 		  /* update focus_row position */
-		  row = g_list_position (clist->row_list, (GList *)node);
+		  row = _gtk_cmclist_row_position (clist, (GList *)node);
 		  if (row < clist->focus_row)
 		    clist->focus_row += tmp;
 	  }
@@ -2016,7 +2452,7 @@ sreal_tree_move (GtkCMCTree     *ctree,
   work = NULL;
 
   if (!GTK_SCTREE(ctree)->sorting && gtk_cmctree_is_viewable (ctree, node))
-    work = GTK_CMCTREE_NODE (g_list_nth (clist->row_list, clist->focus_row));
+    work = GTK_CMCTREE_NODE (_gtk_cmclist_row_nth (clist, clist->focus_row));
       
   gtk_sctree_unlink (ctree, node, FALSE);
   gtk_sctree_link (ctree, node, new_parent, new_sibling, FALSE);
@@ -2025,7 +2461,7 @@ sreal_tree_move (GtkCMCTree     *ctree,
     {
       while (work &&  !gtk_cmctree_is_viewable (ctree, work))
 	work = GTK_CMCTREE_ROW (work)->parent;
-      clist->focus_row = g_list_position (clist->row_list, (GList *)work);
+      clist->focus_row = _gtk_cmclist_row_position (clist, (GList *)work);
       clist->undo_anchor = clist->focus_row;
     }
 
@@ -18,6 +18,22 @@
 typedef struct _GtkSCTree GtkSCTree;
 typedef struct _GtkSCTreeClass GtkSCTreeClass;
 
+typedef void (*GtkSCTreeCellTextFunc) (GtkSCTree	*sctree,
+				       GtkCMCTreeNode	*node,
+				       gpointer		 data);
+
+/* What a row is sorted by: str, a collation key, is compared with strcmp()
+ * first and rows without one sort last; then the numbers in order. */
+typedef struct _GtkSCTreeSortKey {
+	gchar *str;
+	gint64 num[3];
+} GtkSCTreeSortKey;
+
+typedef void (*GtkSCTreeSortKeyFunc) (GtkSCTree		*sctree,
+				      GtkCMCTreeNode	*node,
+				      GtkSCTreeSortKey	*key,
+				      gpointer		 data);
+
 struct _GtkSCTree {
 	GtkCMCTree ctree;
 
@@ -40,6 +56,15 @@ struct _GtkSCTree {
 	gboolean always_expand_recursively;
 	gboolean force_additive_sel;
 	gboolean *use_markup;
+
+	/* Cell text generated on demand, kept for the most recently
+	 * drawn rows only */
+	GtkSCTreeCellTextFunc cell_text_func;
+	gpointer cell_text_data;
+	GHashTable *cell_text_rows;
+	GQueue *cell_text_lru;
+	guint cell_text_max;
+	guint32 cell_text_columns;
 };
 
 struct _GtkSCTreeClass {
@@ -88,6 +113,11 @@ void gtk_sctree_sort_node (GtkCMCTree *ctree, GtkCMCTreeNode *node);
 
 void gtk_sctree_sort_recursive (GtkCMCTree *ctree, GtkCMCTreeNode *node);
 
+void gtk_sctree_sort_recursive_by_keys (GtkCMCTree *ctree, GtkCMCTreeNode *node,
+					GtkSCTreeSortKeyFunc func, gpointer data);
+void gtk_sctree_sort_node_by_keys (GtkCMCTree *ctree, GtkCMCTreeNode *node,
+				   GtkSCTreeSortKeyFunc func, gpointer data);
+
 GtkCMCTreeNode* gtk_sctree_insert_node        (GtkCMCTree *ctree,
                                              GtkCMCTreeNode *parent,
                                              GtkCMCTreeNode *sibling,
@@ -119,6 +149,16 @@ void gtk_sctree_set_column_tooltip	    (GtkSCTree		*sctree,
 void gtk_sctree_set_use_markup		    (GtkSCTree		*sctree,
 					     int		 column,
 					     gboolean		 markup);
+void gtk_sctree_set_cell_text_func	    (GtkSCTree		*sctree,
+					     GtkSCTreeCellTextFunc func,
+					     gpointer		 data,
+					     guint		 max_rows);
+void gtk_sctree_node_set_cell_text	    (GtkSCTree		*sctree,
+					     GtkCMCTreeNode	*node,
+					     gint		 column,
+					     const gchar	*text);
+void gtk_sctree_node_fill_cell_text	    (GtkSCTree		*sctree,
+					     GtkCMCTreeNode	*node);
 gboolean
 gtk_sctree_is_hot_spot (GtkSCTree *ctree, 
 		       gint      x, 
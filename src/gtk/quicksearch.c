@@ -302,6 +302,9 @@ static void searchbar_changed_cb(GtkWidget *widget, QuickSearch *qs)
 	}
 
 	if (prefs_common.summary_quicksearch_dynamic) {
+		/* the search being run is already out of date */
+		if (qs->running)
+			advsearch_abort(qs->asearch);
 		if (qs->press_timeout_id != 0) {
 			g_source_remove(qs->press_timeout_id);
 		}
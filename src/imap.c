@@ -423,6 +423,10 @@ static void imap_change_flags			(Folder 	*folder,
 						 FolderItem 	*item,
 						 MsgInfo 	*msginfo,
 						 MsgPermFlags 	 newflags);
+static void imap_change_flags_list		(Folder		*folder,
+						 FolderItem	*item,
+						 MsgInfoList	*msglist,
+						 GHashTable	*msgflags);
 static gint imap_get_flags			(Folder 	*folder,
 						 FolderItem 	*item,
                     				 MsgInfoList 	*msglist,
@@ -500,6 +504,7 @@ FolderClass *imap_get_class(void)
 		imap_class.remove_all_msg = imap_remove_all_msg;
 		imap_class.is_msg_changed = imap_is_msg_changed;
 		imap_class.change_flags = imap_change_flags;
+		imap_class.change_flags_list = imap_change_flags_list;
 		imap_class.get_flags = imap_get_flags;
 		imap_class.set_batch = imap_set_batch;
 		imap_class.synchronise = imap_synchronise;
@@ -4908,53 +4913,93 @@ gboolean imap_scan_required(Folder *folder, FolderItem *_item)
 	return FALSE;
 }
 
-void imap_change_flags(Folder *folder, FolderItem *item, MsgInfo *msginfo, MsgPermFlags newflags)
+/* Works out the IMAP flags to set and unset to give msginfo newflags. */
+static void imap_get_flags_change(MsgInfo *msginfo, MsgPermFlags newflags,
+				  IMAPFlags *flags_set, IMAPFlags *flags_unset)
 {
-	IMAPSession *session;
-	IMAPFlags flags_set = 0, flags_unset = 0;
-	gint ok = MAILIMAP_NO_ERROR;
-	MsgNumberList numlist;
-	hashtable_data *ht_data = NULL;
-
-	g_return_if_fail(folder != NULL);
-	g_return_if_fail(folder->klass == &imap_class);
-	g_return_if_fail(item != NULL);
-	g_return_if_fail(item->folder == folder);
-	g_return_if_fail(msginfo != NULL);
-	g_return_if_fail(msginfo->folder == item);
+	*flags_set = 0;
+	*flags_unset = 0;
 
 	if (!MSG_IS_MARKED(msginfo->flags) &&  (newflags & MSG_MARKED))
-		flags_set |= IMAP_FLAG_FLAGGED;
+		*flags_set |= IMAP_FLAG_FLAGGED;
 	if ( MSG_IS_MARKED(msginfo->flags) && !(newflags & MSG_MARKED))
-		flags_unset |= IMAP_FLAG_FLAGGED;
+		*flags_unset |= IMAP_FLAG_FLAGGED;
 
 	if (!MSG_IS_UNREAD(msginfo->flags) &&  (newflags & MSG_UNREAD))
-		flags_unset |= IMAP_FLAG_SEEN;
+		*flags_unset |= IMAP_FLAG_SEEN;
 	if ( MSG_IS_UNREAD(msginfo->flags) && !(newflags & MSG_UNREAD))
-		flags_set |= IMAP_FLAG_SEEN;
+		*flags_set |= IMAP_FLAG_SEEN;
 
 	if (!MSG_IS_REPLIED(msginfo->flags) &&  (newflags & MSG_REPLIED))
-		flags_set |= IMAP_FLAG_ANSWERED;
+		*flags_set |= IMAP_FLAG_ANSWERED;
 	if ( MSG_IS_REPLIED(msginfo->flags) && !(newflags & MSG_REPLIED))
-		flags_unset |= IMAP_FLAG_ANSWERED;
+		*flags_unset |= IMAP_FLAG_ANSWERED;
 
 	if (!MSG_IS_FORWARDED(msginfo->flags) &&  (newflags & MSG_FORWARDED))
-		flags_set |= IMAP_FLAG_FORWARDED;
+		*flags_set |= IMAP_FLAG_FORWARDED;
 	if ( MSG_IS_FORWARDED(msginfo->flags) && !(newflags & MSG_FORWARDED))
-		flags_unset |= IMAP_FLAG_FORWARDED;
+		*flags_unset |= IMAP_FLAG_FORWARDED;
 
 	if (!MSG_IS_SPAM(msginfo->flags) &&  (newflags & MSG_SPAM)) {
-		flags_set |= IMAP_FLAG_SPAM;
-		flags_unset |= IMAP_FLAG_HAM;
+		*flags_set |= IMAP_FLAG_SPAM;
+		*flags_unset |= IMAP_FLAG_HAM;
 	}
 	if ( MSG_IS_SPAM(msginfo->flags) && !(newflags & MSG_SPAM)) {
-		flags_set |= IMAP_FLAG_HAM;
-		flags_unset |= IMAP_FLAG_SPAM;
+		*flags_set |= IMAP_FLAG_HAM;
+		*flags_unset |= IMAP_FLAG_SPAM;
 	}
 	if (!MSG_IS_DELETED(msginfo->flags) &&  (newflags & MSG_DELETED))
-		flags_set |= IMAP_FLAG_DELETED;
+		*flags_set |= IMAP_FLAG_DELETED;
 	if ( MSG_IS_DELETED(msginfo->flags) && !(newflags & MSG_DELETED))
-		flags_unset |= IMAP_FLAG_DELETED;
+		*flags_unset |= IMAP_FLAG_DELETED;
+}
+
+/* Queues a flags change in the batch tables of item. */
+static void imap_defer_flags_change(IMAPFolderItem *item, gint msgnum,
+				    IMAPFlags flags_set, IMAPFlags flags_unset)
+{
+	hashtable_data *ht_data = NULL;
+
+	if (flags_set) {
+		ht_data = g_hash_table_lookup(item->flags_set_table, 
+			GINT_TO_POINTER(flags_set));
+		if (ht_data == NULL) {
+			ht_data = g_new0(hashtable_data, 1);
+			ht_data->item = item;
+			g_hash_table_insert(item->flags_set_table, 
+				GINT_TO_POINTER(flags_set), ht_data);
+		}
+		ht_data->msglist = g_slist_prepend(ht_data->msglist, GINT_TO_POINTER(msgnum));
+	} 
+	if (flags_unset) {
+		ht_data = g_hash_table_lookup(item->flags_unset_table, 
+			GINT_TO_POINTER(flags_unset));
+		if (ht_data == NULL) {
+			ht_data = g_new0(hashtable_data, 1);
+			ht_data->item = item;
+			g_hash_table_insert(item->flags_unset_table, 
+				GINT_TO_POINTER(flags_unset), ht_data);
+		}
+		ht_data->msglist = g_slist_prepend(ht_data->msglist, 
+				GINT_TO_POINTER(msgnum));		
+	}
+}
+
+void imap_change_flags(Folder *folder, FolderItem *item, MsgInfo *msginfo, MsgPermFlags newflags)
+{
+	IMAPSession *session;
+	IMAPFlags flags_set = 0, flags_unset = 0;
+	gint ok = MAILIMAP_NO_ERROR;
+	MsgNumberList numlist;
+
+	g_return_if_fail(folder != NULL);
+	g_return_if_fail(folder->klass == &imap_class);
+	g_return_if_fail(item != NULL);
+	g_return_if_fail(item->folder == folder);
+	g_return_if_fail(msginfo != NULL);
+	g_return_if_fail(msginfo->folder == item);
+
+	imap_get_flags_change(msginfo, newflags, &flags_set, &flags_unset);
 
 	if (!flags_set && !flags_unset) {
 		/* the changed flags were not translatable to IMAP-speak.
@@ -4983,29 +5028,8 @@ void imap_change_flags(Folder *folder, FolderItem *item, MsgInfo *msginfo, MsgPe
 		 * command.
 		 */
 		debug_print("IMAP batch mode on, deferring flags change\n");
-		if (flags_set) {
-			ht_data = g_hash_table_lookup(IMAP_FOLDER_ITEM(item)->flags_set_table, 
-				GINT_TO_POINTER(flags_set));
-			if (ht_data == NULL) {
-				ht_data = g_new0(hashtable_data, 1);
-				ht_data->item = IMAP_FOLDER_ITEM(item);
-				g_hash_table_insert(IMAP_FOLDER_ITEM(item)->flags_set_table, 
-					GINT_TO_POINTER(flags_set), ht_data);
-			}
-			ht_data->msglist = g_slist_prepend(ht_data->msglist, GINT_TO_POINTER(msginfo->msgnum));
-		} 
-		if (flags_unset) {
-			ht_data = g_hash_table_lookup(IMAP_FOLDER_ITEM(item)->flags_unset_table, 
-				GINT_TO_POINTER(flags_unset));
-			if (ht_data == NULL) {
-				ht_data = g_new0(hashtable_data, 1);
-				ht_data->item = IMAP_FOLDER_ITEM(item);
-				g_hash_table_insert(IMAP_FOLDER_ITEM(item)->flags_unset_table, 
-					GINT_TO_POINTER(flags_unset), ht_data);
-			}
-			ht_data->msglist = g_slist_prepend(ht_data->msglist, 
-					GINT_TO_POINTER(msginfo->msgnum));		
-		}
+		imap_defer_flags_change(IMAP_FOLDER_ITEM(item), msginfo->msgnum,
+					flags_set, flags_unset);
 	} else {
 		debug_print("IMAP changing flags\n");
 		if (flags_set) {
@@ -5026,6 +5050,53 @@ void imap_change_flags(Folder *folder, FolderItem *item, MsgInfo *msginfo, MsgPe
 	return;
 }
 
+static void imap_change_flags_list(Folder *folder, FolderItem *item,
+				   MsgInfoList *msglist, GHashTable *msgflags)
+{
+	IMAPFolderItem *imap_item = IMAP_FOLDER_ITEM(item);
+	IMAPSession *session;
+	gboolean batching;
+	MsgInfoList *cur;
+
+	g_return_if_fail(folder != NULL);
+	g_return_if_fail(folder->klass == &imap_class);
+	g_return_if_fail(item != NULL);
+	g_return_if_fail(item->folder == folder);
+
+	debug_print("getting session...\n");
+	session = imap_session_get(folder);
+	if (!session) {
+		return;
+	}
+	if (imap_select(session, IMAP_FOLDER(folder), item,
+	    NULL, NULL, NULL, NULL, NULL, FALSE) != MAILIMAP_NO_ERROR) {
+		return;
+	}
+
+	/* messages getting the same change share one UID STORE, whose
+	 * set imap_set_message_flags() sends as ranges */
+	batching = imap_item->batching;
+	if (!batching)
+		imap_set_batch(folder, item, TRUE);
+
+	debug_print("IMAP changing flags for %d messages\n",
+		    g_slist_length(msglist));
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		MsgPermFlags newflags = GPOINTER_TO_UINT(
+				g_hash_table_lookup(msgflags, msginfo));
+		IMAPFlags flags_set, flags_unset;
+
+		imap_get_flags_change(msginfo, newflags, &flags_set, &flags_unset);
+		imap_defer_flags_change(imap_item, msginfo->msgnum,
+					flags_set, flags_unset);
+		msginfo->flags.perm_flags = newflags;
+	}
+
+	if (!batching)
+		imap_set_batch(folder, item, FALSE);
+}
+
 static gint imap_remove_msg(Folder *folder, FolderItem *item, gint uid)
 {
 	gint ok;
@@ -5384,6 +5455,8 @@ bail:
 					g_free(real_tag);
 				}
 				slist_free_strings_full(tags);
+				if (fitem->cache)
+					msgcache_tags_changed(fitem->cache, msginfo->msgnum);
 			}
 		}
 
@@ -223,6 +223,7 @@ static void open_compose_new		(const gchar	*address,
 					 GList		*attach_files);
 
 static void send_queue			(void);
+static void initial_processing_read_cache(FolderItem *item, gpointer data);
 static void initial_processing		(FolderItem *item, gpointer data);
 static void quit_signal_handler         (int sig);
 static void install_basic_sighandlers   (void);
@@ -1379,6 +1380,7 @@ int main(int argc, char *argv[])
 
 	/* make one all-folder processing before using claws */
 	main_window_cursor_wait(mainwin);
+	folder_func_to_all_folders(initial_processing_read_cache, NULL);
 	folder_func_to_all_folders(initial_processing, (gpointer *)mainwin);
 
 	/* if claws crashed, rebuild caches */
@@ -2034,6 +2036,16 @@ static void parse_cmd_opt(int argc, char *argv[])
 	}
 }
 
+/* lets the caches be read in the background while the folders
+ * before them are processed */
+static void initial_processing_read_cache(FolderItem *item, gpointer data)
+{
+	cm_return_if_fail(item);
+
+	if (item->prefs->enable_processing)
+		folder_item_read_cache_async(item);
+}
+
 static void initial_processing(FolderItem *item, gpointer data)
 {
 	MainWindow *mainwin = (MainWindow *)data;
@@ -4778,8 +4778,7 @@ static void update_summary_cb(GtkAction *action, gpointer data)
 	if ((fitem = folderview_get_opened_item(folderview)) == NULL) return;
 
 	folder_update_op_count();
-	folder_item_scan(fitem);
-	summary_show(mainwin->summaryview, fitem);
+	summary_rescan(mainwin->summaryview, fitem);
 }
 
 static void prev_cb(GtkAction *action, gpointer data)
@@ -49,6 +49,7 @@
 #include "tags.h"
 #include "folder_item_prefs.h"
 #include "procmsg.h"
+#include "msgcache.h"
 
 /*!
  *\brief	Keyword lookup element
@@ -338,6 +339,7 @@ void matcherprop_free(MatcherProp *prop)
 {
 	g_free(prop->expr);
 	g_free(prop->header);
+	g_free(prop->fold_expr);
 #ifndef G_OS_WIN32
 	if (prop->preg != NULL) {
 		regfree(prop->preg);
@@ -371,6 +373,109 @@ MatcherProp *matcherprop_copy(const MatcherProp *src)
 	return prop;		
 }
 
+/* How a compiled matcher looks for its expression in a string */
+enum {
+	MATCHER_SEARCH_NONE,		/* not a string match type */
+	MATCHER_SEARCH_PLAIN,		/* strstr() in the string */
+	MATCHER_SEARCH_FOLD_ASCII,	/* ASCII expression, any case */
+	MATCHER_SEARCH_FOLD,		/* strstr() in the casefolded string */
+	MATCHER_SEARCH_REGEXP,		/* regexec() on the string */
+	MATCHER_SEARCH_REGEXP_FOLD	/* regexec() on the casefolded string */
+};
+
+/* without these, a regular expression only matches itself */
+#define MATCHER_REGEXP_SPECIALS "\\^$.[]|()*+?{}"
+
+static gboolean matcher_str_is_ascii(const gchar *str)
+{
+	for (; *str != '\0'; str++) {
+		if ((guchar)*str >= 0x80)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* strstr() ignoring the case of ASCII letters; needle is casefolded */
+static gboolean matcher_ascii_strcasestr(const gchar *haystack,
+					 const gchar *needle)
+{
+	gchar firsts[3];
+	gsize len = strlen(needle);
+	const gchar *p;
+
+	if (len == 0)
+		return TRUE;
+
+	firsts[0] = needle[0];
+	firsts[1] = g_ascii_toupper(needle[0]);
+	firsts[2] = '\0';
+	for (p = strpbrk(haystack, firsts); p != NULL; p = strpbrk(p + 1, firsts)) {
+		if (g_ascii_strncasecmp(p, needle, len) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*!
+ *\brief	Prepare the expression of a matcher once for all the
+ *		strings it is tested on: casefold it, and compile it
+ *		if it is a regular expression with special characters
+ *
+ *\param	prop Matcher structure
+ */
+static void matcherprop_compile(MatcherProp *prop)
+{
+	gboolean regexp, fold;
+
+	if (prop->compiled)
+		return;
+	prop->compiled = TRUE;
+	prop->search = MATCHER_SEARCH_NONE;
+	if (prop->expr == NULL)
+		return;
+
+	switch (prop->matchtype) {
+	case MATCHTYPE_MATCHCASE:
+	case MATCHTYPE_MATCH:
+	case MATCHTYPE_REGEXPCASE:
+	case MATCHTYPE_REGEXP:
+		break;
+	default:
+		return;
+	}
+
+	regexp = (prop->matchtype == MATCHTYPE_REGEXP ||
+		  prop->matchtype == MATCHTYPE_REGEXPCASE);
+	fold = (prop->matchtype == MATCHTYPE_REGEXPCASE ||
+		prop->matchtype == MATCHTYPE_MATCHCASE);
+
+	if (fold)
+		prop->fold_expr = g_utf8_casefold(prop->expr, -1);
+
+	if (regexp && (*prop->expr == '\0' ||
+		       strpbrk(prop->expr, MATCHER_REGEXP_SPECIALS) != NULL)) {
+		prop->search = fold ? MATCHER_SEARCH_REGEXP_FOLD
+				    : MATCHER_SEARCH_REGEXP;
+		if (prop->error != 0)
+			return;
+		prop->preg = g_new0(regex_t, 1);
+		/* if regexp then don't use the escaped string */
+		if (regcomp(prop->preg, fold ? prop->fold_expr : prop->expr,
+			    REG_NOSUB | REG_EXTENDED
+			    | (fold ? REG_ICASE : 0)) != 0) {
+			prop->error = 1;
+			g_free(prop->preg);
+			prop->preg = NULL;
+		}
+	} else if (fold) {
+		prop->search = matcher_str_is_ascii(prop->fold_expr)
+			       ? MATCHER_SEARCH_FOLD_ASCII
+			       : MATCHER_SEARCH_FOLD;
+	} else {
+		prop->search = MATCHER_SEARCH_PLAIN;
+	}
+}
+
 /* ************** match ******************************/
 
 static gboolean match_with_addresses_in_addressbook
@@ -472,55 +577,52 @@ static gboolean match_with_addresses_in_addressbook
 static gboolean matcherprop_string_match(MatcherProp *prop, const gchar *str,
 					 const gchar *debug_context)
 {
-	gchar *str1;
-	gchar *down_expr;
+	gchar *str1 = NULL;
 	gboolean ret = FALSE;
-	gboolean should_free = FALSE;
-	if (str == NULL)
+
+	if (str == NULL || prop->expr == NULL)
 		return FALSE;
 
-	if (prop->matchtype == MATCHTYPE_REGEXPCASE ||
-	    prop->matchtype == MATCHTYPE_MATCHCASE) {
-		str1 = g_utf8_casefold(str, -1);
-		down_expr = g_utf8_casefold(prop->expr, -1);
-		should_free = TRUE;
-	} else {
-		str1 = (gchar *)str;
-		down_expr = (gchar *)prop->expr;
-		should_free = FALSE;
-	}
+	matcherprop_compile(prop);
 
-	switch (prop->matchtype) {
-	case MATCHTYPE_REGEXPCASE:
-	case MATCHTYPE_REGEXP:
-		if (!prop->preg && (prop->error == 0)) {
-			prop->preg = g_new0(regex_t, 1);
-			/* if regexp then don't use the escaped string */
-			if (regcomp(prop->preg, down_expr,
-				    REG_NOSUB | REG_EXTENDED
-				    | ((prop->matchtype == MATCHTYPE_REGEXPCASE)
-				    ? REG_ICASE : 0)) != 0) {
-				prop->error = 1;
-				g_free(prop->preg);
-				prop->preg = NULL;
-			}
-		}
-		if (prop->preg == NULL) {
-			ret = FALSE;
-			goto free_strs;
+	switch (prop->search) {
+	case MATCHER_SEARCH_PLAIN:
+		ret = (strstr(str, prop->expr) != NULL);
+		break;
+	case MATCHER_SEARCH_FOLD_ASCII:
+		/* the casefolded string would only differ by its case */
+		if (matcher_str_is_ascii(str)) {
+			ret = matcher_ascii_strcasestr(str, prop->fold_expr);
+			break;
 		}
-		
-		if (regexec(prop->preg, str1, 0, NULL, 0) == 0)
-			ret = TRUE;
-		else
-			ret = FALSE;
+		/* Fallthrough intended */
+	case MATCHER_SEARCH_FOLD:
+		str1 = g_utf8_casefold(str, -1);
+		ret = (strstr(str1, prop->fold_expr) != NULL);
+		break;
+	case MATCHER_SEARCH_REGEXP_FOLD:
+		/* REG_ICASE already does it for ASCII */
+		if (!matcher_str_is_ascii(str))
+			str1 = g_utf8_casefold(str, -1);
+		/* Fallthrough intended */
+	case MATCHER_SEARCH_REGEXP:
+		ret = (prop->preg != NULL &&
+		       regexec(prop->preg, str1 ? str1 : str, 0, NULL, 0) == 0);
+		break;
+	default:
+		break;
+	}
+	g_free(str1);
 
-		/* debug output */
-		if (debug_filtering_session
-				&& prefs_common.filtering_debug_level >= FILTERING_DEBUG_LEVEL_HIGH) {
-			gchar *stripped = g_strdup(str);
+	/* debug output */
+	if (debug_filtering_session
+			&& prefs_common.filtering_debug_level >= FILTERING_DEBUG_LEVEL_HIGH) {
+		gchar *stripped = g_strdup(str);
 
-			strretchomp(stripped);
+		strretchomp(stripped);
+		switch (prop->matchtype) {
+		case MATCHTYPE_REGEXPCASE:
+		case MATCHTYPE_REGEXP:
 			if (ret) {
 				log_print(LOG_DEBUG_FILTERING,
 						"%s value [ %s ] matches regular expression [ %s ] (%s)\n",
@@ -532,19 +634,9 @@ static gboolean matcherprop_string_match(MatcherProp *prop, const gchar *str,
 						debug_context, stripped, prop->expr,
 						prop->matchtype == MATCHTYPE_REGEXP ? _("Case sensitive"):_("Case insensitive"));
 			}
-			g_free(stripped);
-		}
-		break;
-	case MATCHTYPE_MATCHCASE:
-	case MATCHTYPE_MATCH:
-		ret = (strstr(str1, down_expr) != NULL);
-
-		/* debug output */
-		if (debug_filtering_session
-				&& prefs_common.filtering_debug_level >= FILTERING_DEBUG_LEVEL_HIGH) {
-			gchar *stripped = g_strdup(str);
-
-			strretchomp(stripped);
+			break;
+		case MATCHTYPE_MATCHCASE:
+		case MATCHTYPE_MATCH:
 			if (ret) {
 				log_print(LOG_DEBUG_FILTERING,
 						"%s value [ %s ] contains [ %s ] (%s)\n",
@@ -556,19 +648,13 @@ static gboolean matcherprop_string_match(MatcherProp *prop, const gchar *str,
 						debug_context, stripped, prop->expr,
 						prop->matchtype == MATCHTYPE_MATCH ? _("Case sensitive"):_("Case insensitive"));
 			}
-			g_free(stripped);
+			break;
+		default:
+			break;
 		}
-		break;
-
-	default:
-		break;
-	}
-	
-free_strs:
-	if (should_free) {
-		g_free(str1);
-		g_free(down_expr);
+		g_free(stripped);
 	}
+
 	return ret;
 }
 
@@ -1277,9 +1363,217 @@ void matcherlist_free(MatcherList *cond)
 		matcherprop_free((MatcherProp *) l->data);
 	}
 	g_slist_free(cond->matchers);
+	g_slist_free(cond->info_matchers);
 	g_free(cond);
 }
 
+/*!
+ *\brief	Copy a list of matchers
+ *
+ *\param	src List of matchers to copy
+ *
+ *\return	MatcherList * New list, with its own match state
+ */
+MatcherList *matcherlist_copy(const MatcherList *src)
+{
+	GSList *matchers = NULL;
+	GSList *l;
+
+	cm_return_val_if_fail(src != NULL, NULL);
+
+	for (l = src->matchers; l != NULL; l = g_slist_next(l))
+		matchers = g_slist_prepend(matchers,
+				matcherprop_copy((MatcherProp *) l->data));
+
+	return matcherlist_new(g_slist_reverse(matchers), src->bool_and);
+}
+
+/*!
+ *\brief	Check if a list of matchers can be tested on several
+ *		messages at once from other threads, each thread using
+ *		its own copy of the list and an already fetched message
+ *		file.
+ *
+ *\param	matchers List of matchers
+ *
+ *\return	gboolean TRUE if the list only uses the message info
+ *		and the message file
+ */
+gboolean matcherlist_is_thread_safe(const MatcherList *matchers)
+{
+	GSList *l;
+
+	cm_return_val_if_fail(matchers != NULL, FALSE);
+
+	/* debugging logs to the GUI */
+	if (debug_filtering_session)
+		return FALSE;
+
+	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+
+		switch (matcher->criteria) {
+		/* runs a command */
+		case MATCHCRITERIA_TEST:
+		case MATCHCRITERIA_NOT_TEST:
+		/* reads the address book */
+		case MATCHCRITERIA_FOUND_IN_ADDRESSBOOK:
+		case MATCHCRITERIA_NOT_FOUND_IN_ADDRESSBOOK:
+		/* tags can change from the GUI while searching */
+		case MATCHCRITERIA_TAG:
+		case MATCHCRITERIA_NOT_TAG:
+		case MATCHCRITERIA_TAGGED:
+		case MATCHCRITERIA_NOT_TAGGED:
+			return FALSE;
+		default:
+			break;
+		}
+	}
+
+	return TRUE;
+}
+
+/*!
+ *\brief	Check if every message matched by a matcher is also
+ *		matched by another one
+ *
+ *\param	wide The matcher that may match more messages
+ *\param	narrow The matcher that may match fewer messages
+ *
+ *\return	gboolean TRUE if narrow only matches messages wide
+ *		matches
+ */
+static gboolean matcherprop_narrows(const MatcherProp *wide,
+				    const MatcherProp *narrow)
+{
+	gchar *wide_expr, *narrow_expr;
+	gboolean ret;
+
+	if (wide->criteria != narrow->criteria
+	    || wide->matchtype != narrow->matchtype
+	    || wide->value != narrow->value
+	    || g_strcmp0(wide->header, narrow->header) != 0)
+		return FALSE;
+
+	/* only what a message says can't change between two searches,
+	 * unlike its flags, tags, score or age */
+	switch (wide->criteria) {
+	case MATCHCRITERIA_SUBJECT:
+	case MATCHCRITERIA_FROM:
+	case MATCHCRITERIA_TO:
+	case MATCHCRITERIA_CC:
+	case MATCHCRITERIA_TO_OR_CC:
+	case MATCHCRITERIA_NEWSGROUPS:
+	case MATCHCRITERIA_MESSAGEID:
+	case MATCHCRITERIA_INREPLYTO:
+	case MATCHCRITERIA_REFERENCES:
+	case MATCHCRITERIA_HEADER:
+	case MATCHCRITERIA_HEADERS_PART:
+	case MATCHCRITERIA_HEADERS_CONT:
+	case MATCHCRITERIA_MESSAGE:
+	case MATCHCRITERIA_BODY_PART:
+		break;
+	default:
+		return FALSE;
+	}
+
+	if (g_strcmp0(wide->expr, narrow->expr) == 0)
+		return TRUE;
+	if (wide->expr == NULL || narrow->expr == NULL)
+		return FALSE;
+
+	/* a longer string can only narrow a positive substring match */
+	switch (wide->matchtype) {
+	case MATCHTYPE_MATCH:
+		return strstr(narrow->expr, wide->expr) != NULL;
+	case MATCHTYPE_MATCHCASE:
+		wide_expr = g_utf8_casefold(wide->expr, -1);
+		narrow_expr = g_utf8_casefold(narrow->expr, -1);
+		ret = strstr(narrow_expr, wide_expr) != NULL;
+		g_free(wide_expr);
+		g_free(narrow_expr);
+		return ret;
+	default:
+		return FALSE;
+	}
+}
+
+/*!
+ *\brief	Check if a list of matchers only matches messages that
+ *		another list matches
+ *
+ *\param	wide The list of matchers that may match more messages
+ *\param	narrow The list of matchers that may match fewer messages
+ *
+ *\return	gboolean TRUE if narrow only matches messages wide
+ *		matches
+ */
+static gboolean matcherlist_narrows(const MatcherList *wide,
+				    const MatcherList *narrow)
+{
+	GSList *w, *n;
+	gboolean wide_single, narrow_single;
+
+	if (wide->matchers == NULL || narrow->matchers == NULL)
+		return FALSE;
+
+	wide_single = wide->matchers->next == NULL;
+	narrow_single = narrow->matchers->next == NULL;
+
+	/* each condition of wide is narrowed by a condition ANDed in
+	 * narrow */
+	if ((wide->bool_and || wide_single)
+	    && (narrow->bool_and || narrow_single)) {
+		for (w = wide->matchers; w != NULL; w = w->next) {
+			for (n = narrow->matchers; n != NULL; n = n->next)
+				if (matcherprop_narrows(w->data, n->data))
+					break;
+			if (n == NULL)
+				break;
+		}
+		if (w == NULL)
+			return TRUE;
+	}
+
+	/* each condition ORed in narrow narrows a condition of wide */
+	if ((!wide->bool_and || wide_single)
+	    && (!narrow->bool_and || narrow_single)) {
+		for (n = narrow->matchers; n != NULL; n = n->next) {
+			for (w = wide->matchers; w != NULL; w = w->next)
+				if (matcherprop_narrows(w->data, n->data))
+					break;
+			if (w == NULL)
+				break;
+		}
+		if (n == NULL)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*!
+ *\brief	Check if a list of matchers is strictly narrower than
+ *		another one, so that it can be tested on the result of
+ *		the other one instead of on a whole folder. The same
+ *		search run again is not a refinement: it is run on the
+ *		whole folder.
+ *
+ *\param	wide The previous list of matchers
+ *\param	narrow The new list of matchers
+ *
+ *\return	gboolean TRUE if narrow is a refinement of wide
+ */
+gboolean matcherlist_is_refinement(const MatcherList *wide,
+				   const MatcherList *narrow)
+{
+	cm_return_val_if_fail(wide != NULL, FALSE);
+	cm_return_val_if_fail(narrow != NULL, FALSE);
+
+	return matcherlist_narrows(wide, narrow)
+		&& !matcherlist_narrows(narrow, wide);
+}
+
 /*!
  *\brief	Skip all headers in a message file
  *
@@ -1682,11 +1976,13 @@ static gboolean matcherlist_match_text_content(MatcherList *matchers, MimeInfo *
  *		the criteria
  *
  *\param	matchers List of conditions
- *\param	fp Message file
+ *\param	info Message info
+ *\param	file Message file
  *
  *\return	gboolean TRUE if succesful match
  */
-static gboolean matcherlist_match_body(MatcherList *matchers, gboolean body_only, MsgInfo *info)
+static gboolean matcherlist_match_body(MatcherList *matchers, gboolean body_only,
+				       MsgInfo *info, const gchar *file)
 {
 	MimeInfo *mimeinfo = NULL;
 	MimeInfo *partinfo = NULL;
@@ -1694,7 +1990,11 @@ static gboolean matcherlist_match_body(MatcherList *matchers, gboolean body_only
 
 	cm_return_val_if_fail(info != NULL, FALSE);
 
-	mimeinfo = procmime_scan_message(info);
+	if (!folder_has_parent_of_type(info->folder, F_QUEUE) &&
+	    !folder_has_parent_of_type(info->folder, F_DRAFT))
+		mimeinfo = procmime_scan_file(file);
+	else
+		mimeinfo = procmime_scan_queue_file(file);
 
 	/* Skip headers */
 	partinfo = procmime_mimeinfo_next(mimeinfo);
@@ -1723,17 +2023,73 @@ static gboolean matcherlist_match_body(MatcherList *matchers, gboolean body_only
 	return FALSE;
 }
 
+/*!
+ *\brief	Find out which parts of the message file the criteria
+ *		look at
+ *
+ *\param	matchers Criteria
+ *\param	read_headers Set if the headers are needed
+ *\param	read_body Set if the body is needed
+ *\param	body_only Set if only the body text is needed
+ */
+static void matcherlist_get_file_parts(MatcherList *matchers,
+				       gboolean *read_headers,
+				       gboolean *read_body,
+				       gboolean *body_only)
+{
+	GSList *l;
+
+	*read_headers = FALSE;
+	*read_body = FALSE;
+	*body_only = TRUE;
+	for (l = matchers->matchers ; l != NULL ; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+
+		if (matcherprop_criteria_headers(matcher))
+			*read_headers = TRUE;
+		if (matcherprop_criteria_body(matcher))
+			*read_body = TRUE;
+		if (matcherprop_criteria_message(matcher)) {
+			*read_headers = TRUE;
+			*read_body = TRUE;
+			*body_only = FALSE;
+		}
+	}
+}
+
+/*!
+ *\brief	Check if the criteria need the message file
+ *
+ *\param	matchers Criteria
+ *\param	read_headers Set if the headers are needed
+ *\param	read_body Set if the body is needed
+ *
+ *\return	gboolean TRUE if the message file has to be read
+ */
+gboolean matcherlist_needs_file(MatcherList *matchers,
+				gboolean *read_headers, gboolean *read_body)
+{
+	gboolean body_only;
+
+	cm_return_val_if_fail(matchers != NULL, FALSE);
+
+	matcherlist_get_file_parts(matchers, read_headers, read_body, &body_only);
+
+	return *read_headers || *read_body;
+}
+
 /*!
  *\brief	Check if a message file matches criteria
  *
  *\param	matchers Criteria
  *\param	info Message info
+ *\param	msgfile Message file, or NULL to fetch it
  *\param	result Default result
  *
  *\return	gboolean TRUE if matched
  */
 static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
-				gboolean result)
+				const gchar *msgfile, gboolean result)
 {
 	gboolean read_headers;
 	gboolean read_body;
@@ -1744,21 +2100,10 @@ static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
 
 	/* file need to be read ? */
 
-	read_headers = FALSE;
-	read_body = FALSE;
-	body_only = TRUE;
+	matcherlist_get_file_parts(matchers, &read_headers, &read_body, &body_only);
 	for (l = matchers->matchers ; l != NULL ; l = g_slist_next(l)) {
 		MatcherProp *matcher = (MatcherProp *) l->data;
 
-		if (matcherprop_criteria_headers(matcher))
-			read_headers = TRUE;
-		if (matcherprop_criteria_body(matcher))
-			read_body = TRUE;
-		if (matcherprop_criteria_message(matcher)) {
-			read_headers = TRUE;
-			read_body = TRUE;
-			body_only = FALSE;
-		}
 		matcher->result = FALSE;
 		matcher->done = FALSE;
 	}
@@ -1766,7 +2111,10 @@ static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
 	if (!read_headers && !read_body)
 		return result;
 
-	file = procmsg_get_message_file_full(info, read_headers, read_body);
+	if (msgfile != NULL)
+		file = g_strdup(msgfile);
+	else
+		file = procmsg_get_message_file_full(info, read_headers, read_body);
 	if (file == NULL)
 		return FALSE;
 
@@ -1787,7 +2135,7 @@ static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
 
 	/* read the body */
 	if (read_body) {
-		matcherlist_match_body(matchers, body_only, info);
+		matcherlist_match_body(matchers, body_only, info, file);
 	}
 	
 	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
@@ -1819,29 +2167,108 @@ static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
 }
 
 /*!
- *\brief	Test list of conditions on a message.
+ *\brief	Rank a matcher which only needs the message info by the
+ *		cost of testing it
  *
- *\param	matchers List of conditions
- *\param	info Message info
+ *\param	matcher Compiled matcher structure
  *
- *\return	gboolean TRUE if matched
+ *\return	gint Rank, 0 for the cheapest
  */
-gboolean matcherlist_match(MatcherList *matchers, MsgInfo *info)
+static gint matcherprop_cost(const MatcherProp *matcher)
+{
+	switch (matcher->criteria) {
+	case MATCHCRITERIA_SUBJECT:
+	case MATCHCRITERIA_NOT_SUBJECT:
+	case MATCHCRITERIA_FROM:
+	case MATCHCRITERIA_NOT_FROM:
+	case MATCHCRITERIA_TO:
+	case MATCHCRITERIA_NOT_TO:
+	case MATCHCRITERIA_CC:
+	case MATCHCRITERIA_NOT_CC:
+	case MATCHCRITERIA_TO_OR_CC:
+	case MATCHCRITERIA_NOT_TO_AND_NOT_CC:
+	case MATCHCRITERIA_NEWSGROUPS:
+	case MATCHCRITERIA_NOT_NEWSGROUPS:
+	case MATCHCRITERIA_MESSAGEID:
+	case MATCHCRITERIA_NOT_MESSAGEID:
+	case MATCHCRITERIA_INREPLYTO:
+	case MATCHCRITERIA_NOT_INREPLYTO:
+	case MATCHCRITERIA_REFERENCES:
+	case MATCHCRITERIA_NOT_REFERENCES:
+		return matcher->preg != NULL ? 2 : 1;
+	case MATCHCRITERIA_TAG:
+	case MATCHCRITERIA_NOT_TAG:
+		return 2;
+	/* runs a command */
+	case MATCHCRITERIA_TEST:
+	case MATCHCRITERIA_NOT_TEST:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+static gint matcherprop_cost_compare(gconstpointer a, gconstpointer b)
+{
+	return matcherprop_cost((const MatcherProp *) a)
+	       - matcherprop_cost((const MatcherProp *) b);
+}
+
+/*!
+ *\brief	Prepare a list of conditions for testing messages:
+ *		casefold and compile the expressions once, and order
+ *		the tests of the message info from the cheapest, so
+ *		that a command is only run if the flags matched. Done
+ *		on the first match; do it again after changing the
+ *		list.
+ *
+ *\param	matchers List of conditions
+ */
+void matcherlist_compile(MatcherList *matchers)
 {
 	GSList *l;
-	gboolean result;
 
-	if (!matchers)
-		return FALSE;
+	cm_return_if_fail(matchers != NULL);
 
-	if (matchers->bool_and)
-		result = TRUE;
-	else
-		result = FALSE;
+	g_slist_free(matchers->info_matchers);
+	matchers->info_matchers = NULL;
 
-	/* test the cached elements */
+	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+
+		matcherprop_compile(matcher);
+		if (!matcherprop_criteria_headers(matcher) &&
+		    !matcherprop_criteria_body(matcher) &&
+		    !matcherprop_criteria_message(matcher))
+			matchers->info_matchers = g_slist_prepend
+				(matchers->info_matchers, matcher);
+	}
+	/* the sort is stable: equally cheap tests keep their order */
+	matchers->info_matchers = g_slist_sort
+		(g_slist_reverse(matchers->info_matchers),
+		 matcherprop_cost_compare);
+	matchers->compiled = TRUE;
+}
 
-	for (l = matchers->matchers; l != NULL ;l = g_slist_next(l)) {
+/*!
+ *\brief	Test the conditions which only need the message info,
+ *		cheapest first
+ *
+ *\param	matchers List of conditions
+ *\param	info Message info
+ *
+ *\return	gint 1 or 0 if they decide whether the message matches,
+ *		-1 if the other conditions have to be tested
+ */
+static gint matcherlist_match_info_matchers(MatcherList *matchers,
+					    MsgInfo *info)
+{
+	GSList *l;
+
+	if (!matchers->compiled)
+		matcherlist_compile(matchers);
+
+	for (l = matchers->info_matchers; l != NULL; l = g_slist_next(l)) {
 		MatcherProp *matcher = (MatcherProp *) l->data;
 
 		if (debug_filtering_session) {
@@ -1850,90 +2277,104 @@ gboolean matcherlist_match(MatcherList *matchers, MsgInfo *info)
 			g_free(buf);
 		}
 
-		switch(matcher->criteria) {
-		case MATCHCRITERIA_ALL:
-		case MATCHCRITERIA_UNREAD:
-		case MATCHCRITERIA_NOT_UNREAD:
-		case MATCHCRITERIA_NEW:
-		case MATCHCRITERIA_NOT_NEW:
-		case MATCHCRITERIA_MARKED:
-		case MATCHCRITERIA_NOT_MARKED:
-		case MATCHCRITERIA_DELETED:
-		case MATCHCRITERIA_NOT_DELETED:
-		case MATCHCRITERIA_REPLIED:
-		case MATCHCRITERIA_NOT_REPLIED:
-		case MATCHCRITERIA_FORWARDED:
-		case MATCHCRITERIA_NOT_FORWARDED:
-		case MATCHCRITERIA_LOCKED:
-		case MATCHCRITERIA_NOT_LOCKED:
-		case MATCHCRITERIA_SPAM:
-		case MATCHCRITERIA_NOT_SPAM:
-		case MATCHCRITERIA_HAS_ATTACHMENT:
-		case MATCHCRITERIA_HAS_NO_ATTACHMENT:
-		case MATCHCRITERIA_SIGNED:
-		case MATCHCRITERIA_NOT_SIGNED:
-		case MATCHCRITERIA_COLORLABEL:
-		case MATCHCRITERIA_NOT_COLORLABEL:
-		case MATCHCRITERIA_IGNORE_THREAD:
-		case MATCHCRITERIA_NOT_IGNORE_THREAD:
-		case MATCHCRITERIA_WATCH_THREAD:
-		case MATCHCRITERIA_NOT_WATCH_THREAD:
-		case MATCHCRITERIA_SUBJECT:
-		case MATCHCRITERIA_NOT_SUBJECT:
-		case MATCHCRITERIA_FROM:
-		case MATCHCRITERIA_NOT_FROM:
-		case MATCHCRITERIA_TO:
-		case MATCHCRITERIA_NOT_TO:
-		case MATCHCRITERIA_CC:
-		case MATCHCRITERIA_NOT_CC:
-		case MATCHCRITERIA_TO_OR_CC:
-		case MATCHCRITERIA_NOT_TO_AND_NOT_CC:
-		case MATCHCRITERIA_TAG:
-		case MATCHCRITERIA_NOT_TAG:
-		case MATCHCRITERIA_TAGGED:
-		case MATCHCRITERIA_NOT_TAGGED:
-		case MATCHCRITERIA_AGE_GREATER:
-		case MATCHCRITERIA_AGE_LOWER:
-		case MATCHCRITERIA_AGE_GREATER_HOURS:
-		case MATCHCRITERIA_AGE_LOWER_HOURS:
-		case MATCHCRITERIA_NEWSGROUPS:
-		case MATCHCRITERIA_NOT_NEWSGROUPS:
-		case MATCHCRITERIA_MESSAGEID:
-		case MATCHCRITERIA_NOT_MESSAGEID:
-		case MATCHCRITERIA_INREPLYTO:
-		case MATCHCRITERIA_NOT_INREPLYTO:
-		case MATCHCRITERIA_REFERENCES:
-		case MATCHCRITERIA_NOT_REFERENCES:
-		case MATCHCRITERIA_SCORE_GREATER:
-		case MATCHCRITERIA_SCORE_LOWER:
-		case MATCHCRITERIA_SCORE_EQUAL:
-		case MATCHCRITERIA_SIZE_GREATER:
-		case MATCHCRITERIA_SIZE_SMALLER:
-		case MATCHCRITERIA_SIZE_EQUAL:
-		case MATCHCRITERIA_TEST:
-		case MATCHCRITERIA_NOT_TEST:
-		case MATCHCRITERIA_PARTIAL:
-		case MATCHCRITERIA_NOT_PARTIAL:
-			if (matcherprop_match(matcher, info)) {
-				if (!matchers->bool_and) {
-					if (debug_filtering_session)
-						log_status_ok(LOG_DEBUG_FILTERING, _("message matches\n"));
-					return TRUE;
-				}
+		if (matcherprop_match(matcher, info)) {
+			if (!matchers->bool_and) {
+				if (debug_filtering_session)
+					log_status_ok(LOG_DEBUG_FILTERING, _("message matches\n"));
+				return 1;
 			}
-			else {
-				if (matchers->bool_and) {
-					if (debug_filtering_session)
-						log_status_nok(LOG_DEBUG_FILTERING, _("message does not match\n"));
-					return FALSE;
-				}
+		}
+		else {
+			if (matchers->bool_and) {
+				if (debug_filtering_session)
+					log_status_nok(LOG_DEBUG_FILTERING, _("message does not match\n"));
+				return 0;
 			}
 		}
 	}
 
+	return -1;
+}
+
+/*!
+ *\brief	Test list of conditions on a message as far as possible
+ *		without its file
+ *
+ *\param	matchers List of conditions
+ *\param	info Message info
+ *
+ *\return	gint 1 if matched, 0 if not, -1 if the message file is
+ *		needed to decide
+ */
+gint matcherlist_match_info(MatcherList *matchers, MsgInfo *info)
+{
+	gboolean read_headers, read_body;
+	gint decided;
+
+	cm_return_val_if_fail(matchers != NULL, 0);
+
+	decided = matcherlist_match_info_matchers(matchers, info);
+	if (decided >= 0)
+		return decided;
+	if (matcherlist_needs_file(matchers, &read_headers, &read_body))
+		return -1;
+
+	/* none of them decided: all matched with AND, none with OR */
+	if (debug_filtering_session) {
+		if (matchers->bool_and)
+			log_status_ok(LOG_DEBUG_FILTERING, _("message matches\n"));
+		else
+			log_status_nok(LOG_DEBUG_FILTERING, _("message does not match\n"));
+	}
+	return matchers->bool_and ? 1 : 0;
+}
+
+/*!
+ *\brief	Test list of conditions on a message.
+ *
+ *\param	matchers List of conditions
+ *\param	info Message info
+ *
+ *\return	gboolean TRUE if matched
+ */
+gboolean matcherlist_match(MatcherList *matchers, MsgInfo *info)
+{
+	return matcherlist_match_with_file(matchers, info, NULL);
+}
+
+/*!
+ *\brief	Test list of conditions on a message whose file has
+ *		already been fetched.
+ *
+ *\param	matchers List of conditions
+ *\param	info Message info
+ *\param	msgfile Message file, or NULL to fetch it when needed
+ *
+ *\return	gboolean TRUE if matched
+ */
+gboolean matcherlist_match_with_file(MatcherList *matchers, MsgInfo *info,
+				     const gchar *msgfile)
+{
+	gboolean result;
+	gint decided;
+
+	if (!matchers)
+		return FALSE;
+
+	if (matchers->bool_and)
+		result = TRUE;
+	else
+		result = FALSE;
+
+	/* test the cached elements */
+
+	decided = matcherlist_match_info_matchers(matchers, info);
+	if (decided >= 0)
+		return decided;
+
 	/* test the condition on the file */
 
-	if (matcherlist_match_file(matchers, info, result)) {
+	if (matcherlist_match_file(matchers, info, msgfile, result)) {
 		if (!matchers->bool_and) {
 			if (debug_filtering_session)
 				log_status_ok(LOG_DEBUG_FILTERING, _("message matches\n"));
@@ -1956,6 +2397,225 @@ gboolean matcherlist_match(MatcherList *matchers, MsgInfo *info)
 	return result;
 }
 
+/*!
+ *\brief	Evaluate a flag, age or size condition for all rows
+ *		of the packed cache columns at once
+ *
+ *\param	prop Pointer to matcher structure
+ *\param	columns Columns of a message cache
+ *\param	matches Gets one result per row
+ *
+ *\return	gboolean FALSE if the condition needs more than the
+ *		numeric fields of the messages
+ */
+static gboolean matcherprop_match_columns(MatcherProp *prop,
+					  const MsgCacheColumns *columns,
+					  gboolean *matches)
+{
+	const MsgPermFlags *perm_flags = columns->perm_flags;
+	const MsgTmpFlags *tmp_flags = columns->tmp_flags;
+	const time_t *date_t = columns->date_t;
+	const goffset *size = columns->size;
+	guint i, len = columns->len;
+	guint32 mask = 0;
+	gboolean tmp = FALSE, negate = FALSE;
+	gint age_mult_hours = 1;
+	time_t t;
+
+	switch(prop->criteria) {
+	case MATCHCRITERIA_ALL:
+		for (i = 0; i < len; i++)
+			matches[i] = TRUE;
+		return TRUE;
+	case MATCHCRITERIA_NOT_UNREAD:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_UNREAD:
+		mask = MSG_UNREAD;
+		break;
+	case MATCHCRITERIA_NOT_NEW:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_NEW:
+		mask = MSG_NEW;
+		break;
+	case MATCHCRITERIA_NOT_MARKED:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_MARKED:
+		mask = MSG_MARKED;
+		break;
+	case MATCHCRITERIA_NOT_DELETED:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_DELETED:
+		mask = MSG_DELETED;
+		break;
+	case MATCHCRITERIA_NOT_REPLIED:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_REPLIED:
+		mask = MSG_REPLIED;
+		break;
+	case MATCHCRITERIA_NOT_FORWARDED:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_FORWARDED:
+		mask = MSG_FORWARDED;
+		break;
+	case MATCHCRITERIA_NOT_LOCKED:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_LOCKED:
+		mask = MSG_LOCKED;
+		break;
+	case MATCHCRITERIA_NOT_SPAM:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_SPAM:
+		mask = MSG_SPAM;
+		break;
+	case MATCHCRITERIA_NOT_IGNORE_THREAD:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_IGNORE_THREAD:
+		mask = MSG_IGNORE_THREAD;
+		break;
+	case MATCHCRITERIA_NOT_WATCH_THREAD:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_WATCH_THREAD:
+		mask = MSG_WATCH_THREAD;
+		break;
+	case MATCHCRITERIA_HAS_NO_ATTACHMENT:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_HAS_ATTACHMENT:
+		mask = MSG_HAS_ATTACHMENT;
+		tmp = TRUE;
+		break;
+	case MATCHCRITERIA_NOT_SIGNED:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_SIGNED:
+		mask = MSG_SIGNED;
+		tmp = TRUE;
+		break;
+	case MATCHCRITERIA_NOT_COLORLABEL:
+		negate = TRUE;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_COLORLABEL:
+		for (i = 0; i < len; i++)
+			matches[i] = (MSG_COLORLABEL_FROM_FLAGS(perm_flags[i] & MSG_CLABEL_FLAG_MASK)
+				      == prop->value) != negate;
+		return TRUE;
+	case MATCHCRITERIA_AGE_GREATER:
+	case MATCHCRITERIA_AGE_LOWER:
+		age_mult_hours = 24;
+		/* Fallthrough intended */
+	case MATCHCRITERIA_AGE_GREATER_HOURS:
+	case MATCHCRITERIA_AGE_LOWER_HOURS:
+		negate = (prop->criteria == MATCHCRITERIA_AGE_LOWER ||
+			  prop->criteria == MATCHCRITERIA_AGE_LOWER_HOURS);
+		t = time(NULL);
+		for (i = 0; i < len; i++)
+			matches[i] = (((gint)((t - date_t[i]) / (60 * 60 * age_mult_hours)))
+				      >= prop->value) != negate;
+		return TRUE;
+	case MATCHCRITERIA_SIZE_GREATER:
+		for (i = 0; i < len; i++)
+			matches[i] = size[i] > (goffset) prop->value;
+		return TRUE;
+	case MATCHCRITERIA_SIZE_SMALLER:
+		for (i = 0; i < len; i++)
+			matches[i] = size[i] < (goffset) prop->value;
+		return TRUE;
+	case MATCHCRITERIA_SIZE_EQUAL:
+		for (i = 0; i < len; i++)
+			matches[i] = size[i] == (goffset) prop->value;
+		return TRUE;
+	default:
+		return FALSE;
+	}
+
+	if (tmp) {
+		for (i = 0; i < len; i++)
+			matches[i] = ((tmp_flags[i] & mask) != 0) != negate;
+	} else {
+		for (i = 0; i < len; i++)
+			matches[i] = ((perm_flags[i] & mask) != 0) != negate;
+	}
+	return TRUE;
+}
+
+/*!
+ *\brief	Match the messages of a cache against a list of flag,
+ *		age and size conditions, one condition at a time
+ *		over the packed cache columns
+ *
+ *\param	matchers List of conditions
+ *\param	columns Columns of a message cache
+ *\param	msgs Gets the numbers of the matching messages
+ *
+ *\return	gint Number of matching messages, or -1 if some condition
+ *		needs more than the columns and each message has to go
+ *		through matcherlist_match() instead
+ */
+gint matcherlist_match_columns(MatcherList *matchers,
+			       const MsgCacheColumns *columns,
+			       MsgNumberList **msgs)
+{
+	GSList *l;
+	gboolean *result, *matches;
+	GSList *found = NULL;
+	guint i, len;
+	gint count = 0;
+
+	cm_return_val_if_fail(matchers != NULL, -1);
+	cm_return_val_if_fail(columns != NULL, -1);
+	cm_return_val_if_fail(msgs != NULL, -1);
+
+	/* keep the per message log */
+	if (debug_filtering_session || matchers->matchers == NULL)
+		return -1;
+
+	len = columns->len;
+	result = g_new(gboolean, len + 1);
+	matches = g_new(gboolean, len + 1);
+
+	for (i = 0; i < len; i++)
+		result[i] = matchers->bool_and;
+
+	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+
+		if (!matcherprop_match_columns(matcher, columns, matches)) {
+			g_free(result);
+			g_free(matches);
+			return -1;
+		}
+		if (matchers->bool_and) {
+			for (i = 0; i < len; i++)
+				result[i] = result[i] && matches[i];
+		} else {
+			for (i = 0; i < len; i++)
+				result[i] = result[i] || matches[i];
+		}
+	}
+
+	for (i = len; i > 0; i--) {
+		if (result[i - 1]) {
+			found = g_slist_prepend(found, GUINT_TO_POINTER(columns->msgnum[i - 1]));
+			count++;
+		}
+	}
+	g_free(result);
+	g_free(matches);
+
+	*msgs = found;
+	return count;
+}
+
 
 static gint quote_filter_str(gchar * result, guint size,
 			     const gchar * path)
@@ -40,11 +40,19 @@ struct _MatcherProp {
 	int error;
 	gboolean result;
 	gboolean done;
+	/* set by matcherprop_compile() */
+	gboolean compiled;
+	gint search;
+	gchar *fold_expr;
 };
 
 struct _MatcherList {
 	GSList *matchers;
 	gboolean bool_and;
+	/* set by matcherlist_compile(): the matchers which only need
+	 * the message info, cheapest first */
+	gboolean compiled;
+	GSList *info_matchers;
 };
 
 
@@ -168,11 +176,27 @@ MatcherList * matcherlist_new_from_lines(gchar		*lines,
 					 gboolean	bool_and,
 					 gboolean	case_sensitive);
 void matcherlist_free			(MatcherList	*cond);
+MatcherList *matcherlist_copy		(const MatcherList *src);
 
 MatcherList *matcherlist_parse		(gchar		**str);
+void matcherlist_compile		(MatcherList	*cond);
 
 gboolean matcherlist_match		(MatcherList	*cond, 
 					 MsgInfo	*info);
+gboolean matcherlist_match_with_file	(MatcherList	*cond,
+					 MsgInfo	*info,
+					 const gchar	*msgfile);
+gint matcherlist_match_info		(MatcherList	*cond,
+					 MsgInfo	*info);
+gboolean matcherlist_needs_file		(MatcherList	*cond,
+					 gboolean	*read_headers,
+					 gboolean	*read_body);
+gboolean matcherlist_is_thread_safe	(const MatcherList *cond);
+gboolean matcherlist_is_refinement	(const MatcherList *wide,
+					 const MatcherList *narrow);
+gint matcherlist_match_columns		(MatcherList	*cond,
+					 const MsgCacheColumns *columns,
+					 MsgNumberList	**msgs);
 
 gint matcher_parse_keyword		(gchar		**str);
 gint matcher_parse_number		(gchar		**str);
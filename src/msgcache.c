@@ -29,6 +29,7 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #ifdef _WIN32
 # include <w32lib.h>
 # define MAP_FAILED	((char *) -1)
@@ -91,7 +92,23 @@ static gboolean msgcache_use_mmap_read = TRUE;
 static gboolean msgcache_use_mmap_read = TRUE;
 #endif
 
-static gboolean swapping = TRUE;
+/* caches written before the message index was added are still read */
+#define CACHE_VERSION_NOINDEX	24
+
+/* Since CACHE_VERSION 25 the records are followed by an index of
+ * fixed-width entries sorted by message number, and a footer holding
+ * the offset of the index and its number of entries. */
+#define CACHE_INDEX_FIELDS	7
+#define CACHE_INDEX_ENTRY_SIZE	(CACHE_INDEX_FIELDS * sizeof(guint32))
+#define CACHE_FOOTER_SIZE	(2 * sizeof(guint32))
+
+#define JOURNAL_SUFFIX		".journal"
+/* A journal is compacted into its mark or tags file as soon as it would
+ * hold more than a quarter as many records as the folder has messages */
+#define JOURNAL_MIN_RECORDS	256
+/* A journal starts with the inode, mtime and size of the file it was
+ * appended to; it is ignored once that file has been replaced */
+#define JOURNAL_STAMP_FIELDS	3
 
 typedef enum
 {
@@ -105,6 +122,66 @@ struct _MsgCache {
 	GHashTable	*msgid_table;
 	guint		 memusage;
 	time_t		 last_access;
+
+	/* position in msgcache_lru and what this cache currently counts
+	 * for in msgcache_total_memusage */
+	GList		*lru_link;
+	guint		 accounted;
+
+	/* owns the MsgInfos read from the mapped cache file */
+	MsgInfoArena	*arena;
+
+	/* numeric fields of all messages, and the row of each msgnum
+	 * plus one */
+	MsgCacheColumns	 columns;
+	guint		 columns_alloc;
+	GHashTable	*column_rows;
+
+	/* messages still living in the mapped cache file, see
+	 * msgcache_read_cache_lazy() */
+	GHashTable	*lazy_table;
+	/* hash of the Message-ID of lazy messages <-> GSList of their
+	 * numbers, made by the first lookup by Message-ID */
+	GHashTable	*lazy_msgids;
+	gchar		*map_data;
+	gint		 map_len;
+	FolderItem	*item;
+	MsgTmpFlags	 tmp_flags;
+
+	/* messages whose flags or tags changed since the mark or tags
+	 * file was last written, and the number of records already in
+	 * the matching journal file */
+	GHashTable	*mark_journal;
+	GHashTable	*tags_journal;
+	guint		 mark_journal_len;
+	guint		 tags_journal_len;
+
+	/* thread index of the messages last shown threaded, see
+	 * msgcache_set_thread_links() */
+	GArray		*thread_links;
+	guint32		 thread_mode;
+	gboolean	 thread_links_read;
+	gboolean	 thread_links_dirty;
+};
+
+typedef struct _MsgCacheEntry MsgCacheEntry;
+struct _MsgCacheEntry {
+	guint32		 msgnum;
+	guint32		 offset;
+	guint32		 length;
+	MsgPermFlags	 perm_flags;
+	GSList		*tags;
+};
+
+typedef struct _MsgCacheIndexEntry MsgCacheIndexEntry;
+struct _MsgCacheIndexEntry {
+	guint32		 msgnum;
+	guint32		 offset;
+	guint32		 length;
+	guint32		 size;
+	guint32		 mtime;
+	guint32		 date_t;
+	guint32		 tmp_flags;
 };
 
 typedef struct _StringConverter StringConverter;
@@ -126,34 +203,326 @@ struct _CharsetConverter {
 	gchar *dstcharset;
 };
 
-MsgCache *msgcache_new(void)
+static MsgInfo *msgcache_materialize_msg	(MsgCache	*cache,
+						 guint		 num);
+static void msgcache_materialize_all		(MsgCache	*cache);
+static MsgInfo *msgcache_materialize_msgid	(MsgCache	*cache,
+						 const gchar	*msgid);
+
+/* All live caches, least recently used first, and the sum of their
+ * memory usage, so that folder_clean_cache_memory() doesn't have to
+ * walk the folder tree to find out. */
+static GQueue msgcache_lru = G_QUEUE_INIT;
+static guint msgcache_total_memusage = 0;
+
+/* Marks the cache as just used and brings its share of the total
+ * memory usage up to date; call it after changing the cache. */
+static void msgcache_touch(MsgCache *cache)
+{
+	guint memusage;
+
+	cache->last_access = time(NULL);
+
+	g_queue_unlink(&msgcache_lru, cache->lru_link);
+	g_queue_push_tail_link(&msgcache_lru, cache->lru_link);
+
+	memusage = msgcache_get_memory_usage(cache);
+	msgcache_total_memusage -= cache->accounted;
+	msgcache_total_memusage += memusage;
+	cache->accounted = memusage;
+}
+
+static MsgCache *msgcache_alloc(void)
 {
 	MsgCache *cache;
 	
 	cache = g_new0(MsgCache, 1),
 	cache->msgnum_table = g_hash_table_new(g_int_hash, g_int_equal);
 	cache->msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
+	cache->mark_journal = g_hash_table_new(g_direct_hash, g_direct_equal);
+	cache->tags_journal = g_hash_table_new(g_direct_hash, g_direct_equal);
+	cache->column_rows = g_hash_table_new(g_direct_hash, g_direct_equal);
 	cache->last_access = time(NULL);
 
 	return cache;
 }
 
+static void msgcache_link(MsgCache *cache)
+{
+	cache->lru_link = g_list_alloc();
+	cache->lru_link->data = cache;
+	g_queue_push_tail_link(&msgcache_lru, cache->lru_link);
+}
+
+MsgCache *msgcache_new(void)
+{
+	MsgCache *cache;
+
+	cache = msgcache_alloc();
+	msgcache_link(cache);
+
+	return cache;
+}
+
+static void msgcache_columns_set(MsgCache *cache, guint32 num, goffset size,
+				 time_t date_t, MsgPermFlags perm_flags,
+				 MsgTmpFlags tmp_flags)
+{
+	MsgCacheColumns *columns = &cache->columns;
+	guint row;
+
+	row = GPOINTER_TO_UINT(g_hash_table_lookup(cache->column_rows,
+						   GUINT_TO_POINTER(num)));
+	if (row == 0) {
+		if (columns->len == cache->columns_alloc) {
+			cache->columns_alloc = MAX(64, cache->columns_alloc * 2);
+			columns->msgnum = g_renew(guint32, columns->msgnum, cache->columns_alloc);
+			columns->date_t = g_renew(time_t, columns->date_t, cache->columns_alloc);
+			columns->size = g_renew(goffset, columns->size, cache->columns_alloc);
+			columns->perm_flags = g_renew(MsgPermFlags, columns->perm_flags, cache->columns_alloc);
+			columns->tmp_flags = g_renew(MsgTmpFlags, columns->tmp_flags, cache->columns_alloc);
+		}
+		row = ++columns->len;
+		g_hash_table_insert(cache->column_rows, GUINT_TO_POINTER(num),
+				    GUINT_TO_POINTER(row));
+	}
+	row--;
+
+	columns->msgnum[row] = num;
+	columns->date_t[row] = date_t;
+	columns->size[row] = size;
+	columns->perm_flags[row] = perm_flags;
+	columns->tmp_flags[row] = tmp_flags;
+}
+
+static void msgcache_columns_set_msginfo(MsgCache *cache, MsgInfo *msginfo)
+{
+	msgcache_columns_set(cache, msginfo->msgnum, msginfo->size,
+			     msginfo->date_t, msginfo->flags.perm_flags,
+			     msginfo->flags.tmp_flags);
+}
+
+static void msgcache_columns_set_perm_flags(MsgCache *cache, guint32 num,
+					    MsgPermFlags perm_flags)
+{
+	guint row;
+
+	row = GPOINTER_TO_UINT(g_hash_table_lookup(cache->column_rows,
+						   GUINT_TO_POINTER(num)));
+	if (row != 0)
+		cache->columns.perm_flags[row - 1] = perm_flags;
+}
+
+/* Fills the hole with the last row, so the arrays stay packed. */
+static void msgcache_columns_remove(MsgCache *cache, guint32 num)
+{
+	MsgCacheColumns *columns = &cache->columns;
+	guint row, last;
+
+	row = GPOINTER_TO_UINT(g_hash_table_lookup(cache->column_rows,
+						   GUINT_TO_POINTER(num)));
+	if (row == 0)
+		return;
+
+	g_hash_table_remove(cache->column_rows, GUINT_TO_POINTER(num));
+	row--;
+	last = --columns->len;
+	if (row == last)
+		return;
+
+	columns->msgnum[row] = columns->msgnum[last];
+	columns->date_t[row] = columns->date_t[last];
+	columns->size[row] = columns->size[last];
+	columns->perm_flags[row] = columns->perm_flags[last];
+	columns->tmp_flags[row] = columns->tmp_flags[last];
+	g_hash_table_insert(cache->column_rows, GUINT_TO_POINTER(columns->msgnum[row]),
+			    GUINT_TO_POINTER(row + 1));
+}
+
 static gboolean msgcache_msginfo_free_func(gpointer num, gpointer msginfo, gpointer user_data)
 {
 	procmsg_msginfo_free((MsgInfo **)&msginfo);
 	return TRUE;
 }											  
 
+static gboolean msgcache_entry_free_func(gpointer num, gpointer entry, gpointer user_data)
+{
+	g_slist_free(((MsgCacheEntry *)entry)->tags);
+	g_free(entry);
+	return TRUE;
+}
+
+static void msgcache_lazy_msgids_free_func(gpointer hash, gpointer nums,
+					   gpointer user_data)
+{
+	g_slist_free((GSList *)nums);
+}
+
+static void msgcache_unmap(MsgCache *cache)
+{
+	if (cache->lazy_msgids != NULL) {
+		g_hash_table_foreach(cache->lazy_msgids,
+				     msgcache_lazy_msgids_free_func, NULL);
+		g_hash_table_destroy(cache->lazy_msgids);
+		cache->lazy_msgids = NULL;
+	}
+	if (cache->lazy_table != NULL) {
+		g_hash_table_foreach_remove(cache->lazy_table, msgcache_entry_free_func, NULL);
+		g_hash_table_destroy(cache->lazy_table);
+		cache->lazy_table = NULL;
+	}
+	if (cache->map_data != NULL) {
+#ifdef G_OS_WIN32
+		UnmapViewOfFile((void*) cache->map_data);
+#else
+		munmap(cache->map_data, cache->map_len);
+#endif
+		cache->map_data = NULL;
+		cache->map_len = 0;
+	}
+}
+
+/* Forgets the not yet materialized message num, if any. */
+static gboolean msgcache_drop_entry(MsgCache *cache, guint num)
+{
+	MsgCacheEntry *entry;
+
+	if (cache->lazy_table == NULL)
+		return FALSE;
+
+	entry = g_hash_table_lookup(cache->lazy_table, &num);
+	if (entry == NULL)
+		return FALSE;
+
+	g_hash_table_remove(cache->lazy_table, &entry->msgnum);
+	cache->memusage -= sizeof(MsgCacheEntry);
+	msgcache_entry_free_func(NULL, entry, NULL);
+
+	if (g_hash_table_size(cache->lazy_table) == 0)
+		msgcache_unmap(cache);
+
+	return TRUE;
+}
+
 void msgcache_destroy(MsgCache *cache)
 {
 	cm_return_if_fail(cache != NULL);
 
+	/* detached caches were never counted */
+	if (cache->lru_link != NULL) {
+		g_queue_delete_link(&msgcache_lru, cache->lru_link);
+		msgcache_total_memusage -= cache->accounted;
+	}
+
 	g_hash_table_foreach_remove(cache->msgnum_table, msgcache_msginfo_free_func, NULL);
 	g_hash_table_destroy(cache->msgid_table);
 	g_hash_table_destroy(cache->msgnum_table);
+	g_hash_table_destroy(cache->mark_journal);
+	g_hash_table_destroy(cache->tags_journal);
+	g_hash_table_destroy(cache->column_rows);
+	g_free(cache->columns.msgnum);
+	g_free(cache->columns.date_t);
+	g_free(cache->columns.size);
+	g_free(cache->columns.perm_flags);
+	g_free(cache->columns.tmp_flags);
+	if (cache->thread_links != NULL)
+		g_array_free(cache->thread_links, TRUE);
+	msgcache_unmap(cache);
+	if (cache->arena != NULL)
+		procmsg_arena_release(cache->arena);
 	g_free(cache);
 }
 
+gchar *msgcache_get_journal_file(const gchar *file)
+{
+	cm_return_val_if_fail(file != NULL, NULL);
+
+	return g_strconcat(file, JOURNAL_SUFFIX, NULL);
+}
+
+void msgcache_flags_changed(MsgCache *cache, guint num)
+{
+	cm_return_if_fail(cache != NULL);
+
+	g_hash_table_insert(cache->mark_journal, GUINT_TO_POINTER(num),
+			    GUINT_TO_POINTER(num));
+}
+
+/* Brings the columns up to date after the flags of msginfo changed,
+ * if msginfo is the one held by the cache. */
+void msgcache_update_flags(MsgCache *cache, MsgInfo *msginfo)
+{
+	cm_return_if_fail(cache != NULL);
+	cm_return_if_fail(msginfo != NULL);
+
+	if (g_hash_table_lookup(cache->msgnum_table, &msginfo->msgnum) != msginfo)
+		return;
+
+	msgcache_columns_set_msginfo(cache, msginfo);
+}
+
+const MsgCacheColumns *msgcache_get_columns(MsgCache *cache)
+{
+	cm_return_val_if_fail(cache != NULL, NULL);
+
+	return &cache->columns;
+}
+
+/* Number of messages having any of flags set. */
+guint msgcache_count_perm_flags(MsgCache *cache, MsgPermFlags flags)
+{
+	const MsgPermFlags *perm_flags;
+	guint i, len, count = 0;
+
+	cm_return_val_if_fail(cache != NULL, 0);
+
+	perm_flags = cache->columns.perm_flags;
+	len = cache->columns.len;
+	for (i = 0; i < len; i++)
+		count += (perm_flags[i] & flags) != 0;
+
+	return count;
+}
+
+/**
+ * msgcache_set_thread_links:
+ * @cache: the cache.
+ * @links: array of #MsgCacheThreadLink, owned by @cache afterwards.
+ * @mode: the threading preferences @links were built with.
+ *
+ * Keep the thread index of a folder next to its cache, to be written
+ * by msgcache_write_thread_links(). The index is only a hint: its
+ * user checks that it still matches the messages it threads.
+ */
+void msgcache_set_thread_links(MsgCache *cache, GArray *links, guint32 mode)
+{
+	cm_return_if_fail(cache != NULL);
+
+	if (cache->thread_links != NULL)
+		g_array_free(cache->thread_links, TRUE);
+	cache->thread_links = links;
+	cache->thread_mode = mode;
+	cache->thread_links_read = TRUE;
+	cache->thread_links_dirty = TRUE;
+}
+
+GArray *msgcache_get_thread_links(MsgCache *cache, guint32 mode)
+{
+	cm_return_val_if_fail(cache != NULL, NULL);
+
+	if (cache->thread_links == NULL || cache->thread_mode != mode)
+		return NULL;
+	return cache->thread_links;
+}
+
+void msgcache_tags_changed(MsgCache *cache, guint num)
+{
+	cm_return_if_fail(cache != NULL);
+
+	g_hash_table_insert(cache->tags_journal, GUINT_TO_POINTER(num),
+			    GUINT_TO_POINTER(num));
+}
+
 void msgcache_add_msg(MsgCache *cache, MsgInfo *msginfo) 
 {
 	MsgInfo *newmsginfo;
@@ -161,12 +530,15 @@ void msgcache_add_msg(MsgCache *cache, MsgInfo *msginfo)
 	cm_return_if_fail(cache != NULL);
 	cm_return_if_fail(msginfo != NULL);
 
+	msgcache_drop_entry(cache, msginfo->msgnum);
+
 	newmsginfo = procmsg_msginfo_new_ref(msginfo);
 	g_hash_table_insert(cache->msgnum_table, &newmsginfo->msgnum, newmsginfo);
 	if(newmsginfo->msgid != NULL)
 		g_hash_table_insert(cache->msgid_table, newmsginfo->msgid, newmsginfo);
+	msgcache_columns_set_msginfo(cache, newmsginfo);
 	cache->memusage += procmsg_msginfo_memusage(msginfo);
-	cache->last_access = time(NULL);
+	msgcache_touch(cache);
 
 	msginfo->folder->cache_dirty = TRUE;
 
@@ -180,8 +552,14 @@ void msgcache_remove_msg(MsgCache *cache, guint msgnum)
 	cm_return_if_fail(cache != NULL);
 
 	msginfo = (MsgInfo *) g_hash_table_lookup(cache->msgnum_table, &msgnum);
-	if(!msginfo)
+	msgcache_columns_remove(cache, msgnum);
+	if(!msginfo) {
+		if (msgcache_drop_entry(cache, msgnum)) {
+			cache->item->cache_dirty = TRUE;
+			msgcache_touch(cache);
+		}
 		return;
+	}
 
 	cache->memusage -= procmsg_msginfo_memusage(msginfo);
 	if(msginfo->msgid)
@@ -191,7 +569,7 @@ void msgcache_remove_msg(MsgCache *cache, guint msgnum)
 	msginfo->folder->cache_dirty = TRUE;
 
 	procmsg_msginfo_free(&msginfo);
-	cache->last_access = time(NULL);
+	msgcache_touch(cache);
 
 
 	debug_print("Cache size: %d messages, %u bytes\n", g_hash_table_size(cache->msgnum_table), cache->memusage);
@@ -204,6 +582,8 @@ void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo)
 	cm_return_if_fail(cache != NULL);
 	cm_return_if_fail(msginfo != NULL);
 
+	msgcache_drop_entry(cache, msginfo->msgnum);
+
 	oldmsginfo = g_hash_table_lookup(cache->msgnum_table, &msginfo->msgnum);
 	if(oldmsginfo && oldmsginfo->msgid) 
 		g_hash_table_remove(cache->msgid_table, oldmsginfo->msgid);
@@ -217,8 +597,9 @@ void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo)
 	g_hash_table_insert(cache->msgnum_table, &newmsginfo->msgnum, newmsginfo);
 	if(newmsginfo->msgid)
 		g_hash_table_insert(cache->msgid_table, newmsginfo->msgid, newmsginfo);
+	msgcache_columns_set_msginfo(cache, newmsginfo);
 	cache->memusage += procmsg_msginfo_memusage(newmsginfo);
-	cache->last_access = time(NULL);
+	msgcache_touch(cache);
 	
 	debug_print("Cache size: %d messages, %u bytes\n", g_hash_table_size(cache->msgnum_table), cache->memusage);
 
@@ -234,9 +615,11 @@ MsgInfo *msgcache_get_msg(MsgCache *cache, guint num)
 	cm_return_val_if_fail(cache != NULL, NULL);
 
 	msginfo = g_hash_table_lookup(cache->msgnum_table, &num);
+	if(!msginfo)
+		msginfo = msgcache_materialize_msg(cache, num);
 	if(!msginfo)
 		return NULL;
-	cache->last_access = time(NULL);
+	msgcache_touch(cache);
 	
 	return procmsg_msginfo_new_ref(msginfo);
 }
@@ -249,13 +632,22 @@ MsgInfo *msgcache_get_msg_by_id(MsgCache *cache, const gchar *msgid)
 	cm_return_val_if_fail(msgid != NULL, NULL);
 
 	msginfo = g_hash_table_lookup(cache->msgid_table, msgid);
+	if(!msginfo)
+		msginfo = msgcache_materialize_msgid(cache, msgid);
 	if(!msginfo)
 		return NULL;
-	cache->last_access = time(NULL);
+	msgcache_touch(cache);
 	
 	return procmsg_msginfo_new_ref(msginfo);	
 }
 
+static void msgcache_memusage_func(gpointer key, gpointer value, gpointer user_data)
+{
+	guint *memusage = user_data;
+
+	*memusage += procmsg_msginfo_memusage((MsgInfo *)value);
+}
+
 static void msgcache_get_msg_list_func(gpointer key, gpointer value, gpointer user_data)
 {
 	MsgInfoList **listptr = user_data;
@@ -264,14 +656,36 @@ static void msgcache_get_msg_list_func(gpointer key, gpointer value, gpointer us
 	*listptr = g_slist_prepend(*listptr, procmsg_msginfo_new_ref(msginfo));
 }
 
+static void msgcache_get_msgnum_list_func(gpointer key, gpointer value, gpointer user_data)
+{
+	GSList **listptr = (GSList **)user_data;
+
+	*listptr = g_slist_prepend(*listptr, GUINT_TO_POINTER(*(guint *)key));
+}
+
+/* The numbers of all cached messages, without materializing them. */
+GSList *msgcache_get_msgnum_list(MsgCache *cache)
+{
+	GSList *num_list = NULL;
+
+	cm_return_val_if_fail(cache != NULL, NULL);
+
+	g_hash_table_foreach(cache->msgnum_table, msgcache_get_msgnum_list_func, &num_list);
+	if (cache->lazy_table)
+		g_hash_table_foreach(cache->lazy_table, msgcache_get_msgnum_list_func, &num_list);
+
+	return num_list;
+}
+
 MsgInfoList *msgcache_get_msg_list(MsgCache *cache)
 {
 	MsgInfoList *msg_list = NULL;
 	START_TIMING("");
 	cm_return_val_if_fail(cache != NULL, NULL);
 
+	msgcache_materialize_all(cache);
 	g_hash_table_foreach((GHashTable *)cache->msgnum_table, msgcache_get_msg_list_func, (gpointer)&msg_list);	
-	cache->last_access = time(NULL);
+	msgcache_touch(cache);
 	
 	msg_list = g_slist_reverse(msg_list);
 	END_TIMING();
@@ -285,11 +699,43 @@ time_t msgcache_get_last_access_time(MsgCache *cache)
 	return cache->last_access;
 }
 
+void msgcache_set_folder_item(MsgCache *cache, FolderItem *item)
+{
+	cm_return_if_fail(cache != NULL);
+
+	cache->item = item;
+}
+
+FolderItem *msgcache_get_folder_item(MsgCache *cache)
+{
+	cm_return_val_if_fail(cache != NULL, NULL);
+
+	return cache->item;
+}
+
+GList *msgcache_get_lru_list(void)
+{
+	return msgcache_lru.head;
+}
+
+guint msgcache_get_total_memory_usage(void)
+{
+	return msgcache_total_memusage;
+}
+
 gint msgcache_get_memory_usage(MsgCache *cache)
 {
+	guint memusage;
+
 	cm_return_val_if_fail(cache != NULL, 0);
 
-	return cache->memusage;
+	memusage = cache->memusage;
+	memusage += cache->columns_alloc * (sizeof(guint32) + sizeof(time_t) +
+			sizeof(goffset) + sizeof(MsgPermFlags) + sizeof(MsgTmpFlags));
+	if (cache->arena != NULL)
+		memusage += procmsg_arena_memusage(cache->arena);
+
+	return memusage;
 }
 
 /*
@@ -298,7 +744,7 @@ gint msgcache_get_memory_usage(MsgCache *cache)
 
 #define READ_CACHE_DATA(data, fp, total_len) \
 { \
-	if ((tmp_len = msgcache_read_cache_data_str(fp, &data, conv)) < 0) { \
+	if ((tmp_len = msgcache_read_cache_data_str(fp, &data, conv, swapping)) < 0) { \
 		procmsg_msginfo_free(&msginfo); \
 		error = TRUE; \
 		goto bail_err; \
@@ -332,7 +778,10 @@ gint msgcache_get_memory_usage(MsgCache *cache)
 	walk_data += 4;	rem_len -= 4;								\
 }
 
-#define GET_CACHE_DATA(data, total_len) \
+#define GET_CACHE_DATA(data, total_len) GET_CACHE_DATA_FULL(data, total_len, FALSE)
+#define GET_CACHE_SHARED_DATA(data, total_len) GET_CACHE_DATA_FULL(data, total_len, TRUE)
+
+#define GET_CACHE_DATA_FULL(data, total_len, shared) \
 { \
 	GET_CACHE_DATA_INT(tmp_len);	\
 	if (rem_len < tmp_len) {								\
@@ -340,7 +789,8 @@ gint msgcache_get_memory_usage(MsgCache *cache)
 		error = TRUE;									\
 		goto bail_err;									\
 	}											\
-	if ((tmp_len = msgcache_get_cache_data_str(walk_data, &data, tmp_len, conv)) < 0) { \
+	if ((tmp_len = msgcache_get_cache_data_str(walk_data, &data, tmp_len, conv,	\
+						   cache->arena, shared)) < 0) {	\
 		g_print("error at rem_len:%d\n", rem_len);\
 		procmsg_msginfo_free(&msginfo); \
 		error = TRUE; \
@@ -350,6 +800,17 @@ gint msgcache_get_memory_usage(MsgCache *cache)
 	walk_data += tmp_len; rem_len -= tmp_len; \
 }
 
+#define SKIP_CACHE_DATA()								\
+{											\
+	GET_CACHE_DATA_INT(tmp_len);							\
+	if (tmp_len < 0 || rem_len < tmp_len) {						\
+		g_print("error at rem_len:%d (tmp_len %d)\n", rem_len, tmp_len);		\
+		error = TRUE;								\
+		goto bail_err;								\
+	}										\
+	walk_data += tmp_len; rem_len -= tmp_len;					\
+}
+
 
 #define WRITE_CACHE_DATA_INT(n, fp)			\
 {							\
@@ -462,8 +923,38 @@ static FILE *msgcache_open_data_file(const gchar *file, guint version,
 	return fp;
 }
 
+static void msgcache_get_journal_stamp(const gchar *data_file, guint32 *stamp)
+{
+	struct stat s;
+	gint i;
+
+	for (i = 0; i < JOURNAL_STAMP_FIELDS; i++)
+		stamp[i] = 0;
+	if (g_stat(data_file, &s) < 0)
+		return;
+	stamp[0] = (guint32)s.st_ino;
+	stamp[1] = (guint32)s.st_mtime;
+	stamp[2] = (guint32)s.st_size;
+}
+
+/* Reads the stamp following the version of a journal; returns FALSE if
+ * the journal doesn't apply to the file with the given stamp */
+static gboolean msgcache_read_journal_stamp(FILE *fp, const guint32 *stamp)
+{
+	guint32 data;
+	gint i;
+
+	for (i = 0; i < JOURNAL_STAMP_FIELDS; i++) {
+		if (fread(&data, sizeof(data), 1, fp) != 1 ||
+		    bswap_32(data) != stamp[i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
 static gint msgcache_read_cache_data_str(FILE *fp, gchar **str, 
-					 StringConverter *conv)
+					 StringConverter *conv,
+					 gboolean swapping)
 {
 	gchar *tmpstr = NULL;
 	size_t ni;
@@ -517,7 +1008,8 @@ static gint msgcache_read_cache_data_str(FILE *fp, gchar **str,
 }
 
 static gint msgcache_get_cache_data_str(gchar *src, gchar **str, gint len,
-					 StringConverter *conv)
+					 StringConverter *conv,
+					 MsgInfoArena *arena, gboolean shared)
 {
 	gchar *tmpstr = NULL;
 
@@ -531,6 +1023,11 @@ static gint msgcache_get_cache_data_str(gchar *src, gchar **str, gint len,
 		return -1;
 	}
 
+	if (arena != NULL && conv == NULL) {
+		*str = procmsg_arena_strndup(arena, src, len, shared);
+		return len;
+	}
+
 	tmpstr = g_try_malloc(len + 1);
 
 	if(tmpstr == NULL) {
@@ -546,9 +1043,284 @@ static gint msgcache_get_cache_data_str(gchar *src, gchar **str, gint len,
 	} else 
 		*str = tmpstr;
 
+	if (arena != NULL && *str != NULL) {
+		tmpstr = *str;
+		*str = procmsg_arena_strndup(arena, tmpstr, strlen(tmpstr), shared);
+		g_free(tmpstr);
+	}
+
 	return len;
 }
 
+/* Walks the records of a mapped cache file without allocating anything
+ * but a small MsgCacheEntry per message. The MsgInfos are built later
+ * by msgcache_materialize_msg(), when someone actually asks for them. */
+static gboolean msgcache_read_cache_lazy(MsgCache *cache, gchar *cache_data,
+					 gint end, gint start)
+{
+	gchar *walk_data = cache_data + start;
+	gint rem_len = end - start;
+	gint tmp_len = 0;
+	gboolean error = FALSE;
+	/* lazy mode is only used on files in native byte order */
+	const gboolean swapping = TRUE;
+	guint32 num, size, date_t, tmp_flags, dummy;
+	guint refnum;
+	gint i;
+
+	cache->lazy_table = g_hash_table_new(g_int_hash, g_int_equal);
+
+	while (rem_len > 0) {
+		MsgCacheEntry *entry;
+		gchar *record = walk_data;
+
+		GET_CACHE_DATA_INT(num);
+
+		GET_CACHE_DATA_INT(size);
+		GET_CACHE_DATA_INT(dummy);
+		GET_CACHE_DATA_INT(date_t);
+		GET_CACHE_DATA_INT(tmp_flags);
+		/* fromname, date, from, to, cc, newsgroups, subject,
+		 * msgid, inreplyto, xref */
+		for (i = 0; i < 10; i++)
+			SKIP_CACHE_DATA();
+		/* planned_download, total_size */
+		GET_CACHE_DATA_INT(dummy);
+		GET_CACHE_DATA_INT(dummy);
+		GET_CACHE_DATA_INT(refnum);
+		for (; refnum != 0; refnum--)
+			SKIP_CACHE_DATA();
+
+		if ((entry = g_hash_table_lookup(cache->lazy_table, &num)) != NULL) {
+			g_hash_table_remove(cache->lazy_table, &entry->msgnum);
+			cache->memusage -= sizeof(MsgCacheEntry);
+			msgcache_entry_free_func(NULL, entry, NULL);
+		}
+
+		entry = g_new0(MsgCacheEntry, 1);
+		entry->msgnum = num;
+		entry->offset = record - cache_data;
+		entry->length = walk_data - record;
+		g_hash_table_insert(cache->lazy_table, &entry->msgnum, entry);
+		cache->memusage += sizeof(MsgCacheEntry);
+		msgcache_columns_set(cache, num, size, date_t, 0,
+				     tmp_flags | cache->tmp_flags);
+	}
+
+bail_err:
+	return !error;
+}
+
+/* Builds the MsgInfo for the lazy entry num, moves it into the regular
+ * tables and returns it (owned by the cache). */
+static MsgInfo *msgcache_materialize_msg(MsgCache *cache, guint num)
+{
+	MsgCacheEntry *entry;
+	MsgInfo *msginfo = NULL;
+	StringConverter *conv = NULL;
+	gchar *walk_data;
+	gint rem_len;
+	gint tmp_len = 0;
+	guint memusage = 0;
+	guint32 msgnum;
+	guint refnum;
+	gchar *ref = NULL;
+	gboolean error = FALSE;
+	/* lazy mode is only used on files in native byte order */
+	const gboolean swapping = TRUE;
+
+	if (cache->lazy_table == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup(cache->lazy_table, &num);
+	if (entry == NULL)
+		return NULL;
+
+	walk_data = cache->map_data + entry->offset;
+	rem_len = entry->length;
+
+	GET_CACHE_DATA_INT(msgnum);
+
+	msginfo = procmsg_arena_msginfo_new(cache->arena);
+	msginfo->msgnum = msgnum;
+	memusage += sizeof(MsgInfo);
+
+	GET_CACHE_DATA_INT(msginfo->size);
+	GET_CACHE_DATA_INT(msginfo->mtime);
+	GET_CACHE_DATA_INT(msginfo->date_t);
+	GET_CACHE_DATA_INT(msginfo->flags.tmp_flags);
+
+	GET_CACHE_SHARED_DATA(msginfo->fromname, memusage);
+
+	GET_CACHE_DATA(msginfo->date, memusage);
+	GET_CACHE_SHARED_DATA(msginfo->from, memusage);
+	GET_CACHE_SHARED_DATA(msginfo->to, memusage);
+	GET_CACHE_SHARED_DATA(msginfo->cc, memusage);
+	GET_CACHE_SHARED_DATA(msginfo->newsgroups, memusage);
+	GET_CACHE_DATA(msginfo->subject, memusage);
+	GET_CACHE_DATA(msginfo->msgid, memusage);
+	GET_CACHE_DATA(msginfo->inreplyto, memusage);
+	GET_CACHE_DATA(msginfo->xref, memusage);
+
+	GET_CACHE_DATA_INT(msginfo->planned_download);
+	GET_CACHE_DATA_INT(msginfo->total_size);
+	GET_CACHE_DATA_INT(refnum);
+
+	for (; refnum != 0; refnum--) {
+		ref = NULL;
+
+		GET_CACHE_DATA(ref, memusage);
+
+		if (ref && *ref)
+			msginfo->references =
+				g_slist_prepend(msginfo->references, ref);
+	}
+	if (msginfo->references)
+		msginfo->references =
+			g_slist_reverse(msginfo->references);
+
+bail_err:
+	if (error) {
+		g_warning("cache entry for message %u is corrupted", num);
+		procmsg_msginfo_free(&msginfo);
+		msgcache_columns_remove(cache, num);
+		msgcache_drop_entry(cache, num);
+		return NULL;
+	}
+
+	msginfo->folder = cache->item;
+	msginfo->flags.tmp_flags |= cache->tmp_flags;
+	msginfo->flags.perm_flags = entry->perm_flags;
+	msginfo->tags = entry->tags;
+	entry->tags = NULL;
+	procmsg_msginfo_intern_strings(msginfo);
+
+	g_hash_table_insert(cache->msgnum_table, &msginfo->msgnum, msginfo);
+	if(msginfo->msgid)
+		g_hash_table_insert(cache->msgid_table, msginfo->msgid, msginfo);
+	cache->memusage += procmsg_msginfo_memusage(msginfo);
+
+	msgcache_drop_entry(cache, num);
+
+	return msginfo;
+}
+
+static void msgcache_materialize_all(MsgCache *cache)
+{
+	GList *nums, *cur;
+	START_TIMING("");
+
+	if (cache->lazy_table == NULL)
+		return;
+
+	nums = g_hash_table_get_keys(cache->lazy_table);
+	for (cur = nums; cur != NULL; cur = cur->next)
+		msgcache_materialize_msg(cache, *(guint32 *)cur->data);
+	g_list_free(nums);
+	END_TIMING();
+}
+
+/* Same as g_str_hash(), over len bytes */
+static guint msgcache_msgid_hash(const gchar *msgid, gint len)
+{
+	guint hash = 5381;
+	gint i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash << 5) + hash + (guchar)msgid[i];
+
+	return hash;
+}
+
+/* Finds the Message-ID of the lazy entry where it lies in the mapped
+ * file, without copying it */
+static gboolean msgcache_get_lazy_msgid(MsgCache *cache, MsgCacheEntry *entry,
+					const gchar **msgid, gint *len)
+{
+	gchar *walk_data = cache->map_data + entry->offset;
+	gint rem_len = entry->length;
+	gint tmp_len = 0;
+	gboolean error = FALSE;
+	/* lazy mode is only used on files in native byte order */
+	const gboolean swapping = TRUE;
+	guint32 dummy;
+	gint i;
+
+	/* msgnum, size, mtime, date_t, tmp_flags */
+	for (i = 0; i < 5; i++)
+		GET_CACHE_DATA_INT(dummy);
+	/* fromname, date, from, to, cc, newsgroups, subject */
+	for (i = 0; i < 7; i++)
+		SKIP_CACHE_DATA();
+	GET_CACHE_DATA_INT(tmp_len);
+	if (tmp_len < 0 || rem_len < tmp_len)
+		return FALSE;
+
+	*msgid = walk_data;
+	*len = tmp_len;
+	return TRUE;
+
+bail_err:
+	return FALSE;
+}
+
+/* Hashes the Message-IDs of the lazy entries, read from the mapped
+ * file, so that a lookup only builds the MsgInfos whose Message-ID has
+ * the same hash */
+static void msgcache_index_lazy_msgids(MsgCache *cache)
+{
+	GHashTableIter iter;
+	gpointer value, key;
+	const gchar *msgid;
+	GSList *nums;
+	gint len;
+	START_TIMING("");
+
+	cache->lazy_msgids = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	g_hash_table_iter_init(&iter, cache->lazy_table);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		MsgCacheEntry *entry = (MsgCacheEntry *)value;
+
+		/* a message without Message-ID is never found by it */
+		if (!msgcache_get_lazy_msgid(cache, entry, &msgid, &len) ||
+		    len == 0)
+			continue;
+		key = GUINT_TO_POINTER(msgcache_msgid_hash(msgid, len));
+		nums = g_hash_table_lookup(cache->lazy_msgids, key);
+		g_hash_table_insert(cache->lazy_msgids, key,
+			g_slist_prepend(nums, GUINT_TO_POINTER(entry->msgnum)));
+	}
+	END_TIMING();
+}
+
+/* Builds the lazy entries whose Message-ID may be msgid, and returns the
+ * one that has it (owned by the cache), if any. */
+static MsgInfo *msgcache_materialize_msgid(MsgCache *cache, const gchar *msgid)
+{
+	GSList *nums, *cur;
+	gpointer key;
+
+	if (cache->lazy_table == NULL)
+		return NULL;
+	if (cache->lazy_msgids == NULL)
+		msgcache_index_lazy_msgids(cache);
+
+	key = GUINT_TO_POINTER(msgcache_msgid_hash(msgid, strlen(msgid)));
+	nums = g_hash_table_lookup(cache->lazy_msgids, key);
+	if (nums == NULL)
+		return NULL;
+	/* they aren't lazy any more; the table may also go away once the
+	 * last lazy entry is built */
+	g_hash_table_remove(cache->lazy_msgids, key);
+
+	for (cur = nums; cur != NULL; cur = cur->next)
+		msgcache_materialize_msg(cache, GPOINTER_TO_UINT(cur->data));
+	g_slist_free(nums);
+
+	return g_hash_table_lookup(cache->msgid_table, msgid);
+}
+
 static gchar *strconv_charset_convert(StringConverter *conv, gchar *srcstr)
 {
 	CharsetConverter *charsetconv = (CharsetConverter *) conv;
@@ -564,12 +1336,98 @@ static void strconv_charset_free(StringConverter *conv)
 	g_free(charsetconv->dstcharset);
 }
 
-MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
+/* Same as msgcache_read_cache_lazy(), but takes the records' positions
+ * from the index of the cache file instead of walking them. */
+static gboolean msgcache_read_index(MsgCache *cache, gchar *cache_data,
+				    gint start, guint32 index_offset,
+				    guint32 index_count)
+{
+	gchar *walk_data = cache_data + index_offset;
+	gint rem_len = index_count * CACHE_INDEX_ENTRY_SIZE;
+	gboolean error = FALSE;
+	const gboolean swapping = TRUE;
+
+	cache->lazy_table = g_hash_table_new(g_int_hash, g_int_equal);
+
+	while (rem_len > 0) {
+		MsgCacheEntry *entry;
+		MsgCacheIndexEntry index_entry;
+
+		GET_CACHE_DATA_INT(index_entry.msgnum);
+		GET_CACHE_DATA_INT(index_entry.offset);
+		GET_CACHE_DATA_INT(index_entry.length);
+		GET_CACHE_DATA_INT(index_entry.size);
+		GET_CACHE_DATA_INT(index_entry.mtime);
+		GET_CACHE_DATA_INT(index_entry.date_t);
+		GET_CACHE_DATA_INT(index_entry.tmp_flags);
+
+		/* the record has to lie between the header and the index */
+		if (index_entry.offset < (guint32)start ||
+		    index_entry.offset > index_offset || index_entry.length == 0 ||
+		    index_entry.length > index_offset - index_entry.offset) {
+			g_print("bad index entry for message %u\n", index_entry.msgnum);
+			error = TRUE;
+			goto bail_err;
+		}
+
+		if ((entry = g_hash_table_lookup(cache->lazy_table, &index_entry.msgnum)) != NULL) {
+			g_hash_table_remove(cache->lazy_table, &entry->msgnum);
+			cache->memusage -= sizeof(MsgCacheEntry);
+			msgcache_entry_free_func(NULL, entry, NULL);
+		}
+
+		entry = g_new0(MsgCacheEntry, 1);
+		entry->msgnum = index_entry.msgnum;
+		entry->offset = index_entry.offset;
+		entry->length = index_entry.length;
+		g_hash_table_insert(cache->lazy_table, &entry->msgnum, entry);
+		cache->memusage += sizeof(MsgCacheEntry);
+		msgcache_columns_set(cache, index_entry.msgnum, index_entry.size,
+				     index_entry.date_t, 0,
+				     index_entry.tmp_flags | cache->tmp_flags);
+	}
+
+bail_err:
+	return !error;
+}
+
+/* Reads the footer of an indexed cache file, leaving fp where it was. */
+static gboolean msgcache_read_index_footer(FILE *fp, gboolean swapping,
+					   guint32 *index_offset,
+					   guint32 *index_count)
+{
+	guint32 footer[2];
+	struct stat st;
+	long pos;
+	gboolean ok = TRUE;
+
+	pos = ftell(fp);
+	if (pos < 0 || fstat(fileno(fp), &st) < 0 || st.st_size < pos + CACHE_FOOTER_SIZE)
+		return FALSE;
+
+	if (fseek(fp, st.st_size - CACHE_FOOTER_SIZE, SEEK_SET) < 0 ||
+	    fread(footer, sizeof(footer), 1, fp) != 1)
+		ok = FALSE;
+	if (fseek(fp, pos, SEEK_SET) < 0)
+		ok = FALSE;
+	if (!ok)
+		return FALSE;
+
+	*index_offset = swapping ? bswap_32(footer[0]) : footer[0];
+	*index_count = swapping ? bswap_32(footer[1]) : footer[1];
+
+	return *index_offset >= pos &&
+	       *index_count <= (st.st_size - CACHE_FOOTER_SIZE) / CACHE_INDEX_ENTRY_SIZE &&
+	       (goffset)*index_offset + (goffset)*index_count * CACHE_INDEX_ENTRY_SIZE
+			+ CACHE_FOOTER_SIZE == st.st_size;
+}
+
+MsgCache *msgcache_read_cache_detached(FolderItem *item, const gchar *cache_file,
+				       MsgTmpFlags tmp_flags)
 {
 	MsgCache *cache;
 	FILE *fp;
 	MsgInfo *msginfo;
-	MsgTmpFlags tmp_flags = 0;
 	gchar file_buf[BUFFSIZE];
 	guint32 num;
         guint refnum;
@@ -582,12 +1440,14 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 	gint tmp_len = 0, map_len = -1;
 	char *cache_data = NULL;
 	struct stat st;
+	gboolean lazy = FALSE;
+	gboolean indexed = TRUE;
+	gboolean swapping = TRUE;
+	guint32 index_offset = 0, index_count = 0;
 
 	cm_return_val_if_fail(cache_file != NULL, NULL);
 	cm_return_val_if_fail(item != NULL, NULL);
 
-	swapping = TRUE;
-
 	/* In case we can't open the mark file with MARK_VERSION, check if we can open it with the
 	 * swapped MARK_VERSION. As msgcache_open_data_file swaps it too, if this succeeds, 
 	 * it means it's the old version (not little-endian) on a big-endian machine. The code has
@@ -596,21 +1456,30 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 	if ((fp = msgcache_open_data_file
 		(cache_file, CACHE_VERSION, DATA_READ, file_buf, sizeof(file_buf))) == NULL) {
 		if ((fp = msgcache_open_data_file
-		(cache_file, bswap_32(CACHE_VERSION), DATA_READ, file_buf, sizeof(file_buf))) == NULL)
-			return NULL;
-		else
+		(cache_file, bswap_32(CACHE_VERSION), DATA_READ, file_buf, sizeof(file_buf))) != NULL)
 			swapping = FALSE;
 	}
+	if (fp == NULL) {
+		indexed = FALSE;
+		if ((fp = msgcache_open_data_file
+			(cache_file, CACHE_VERSION_NOINDEX, DATA_READ, file_buf, sizeof(file_buf))) == NULL) {
+			if ((fp = msgcache_open_data_file
+			(cache_file, bswap_32(CACHE_VERSION_NOINDEX), DATA_READ, file_buf, sizeof(file_buf))) == NULL)
+				return NULL;
+			else
+				swapping = FALSE;
+		}
+	}
 
 	debug_print("\tReading %sswapped message cache from %s...\n", swapping?"":"un", cache_file);
 
-	if (folder_has_parent_of_type(item, F_QUEUE)) {
-		tmp_flags |= MSG_QUEUED;
-	} else if (folder_has_parent_of_type(item, F_DRAFT)) {
-		tmp_flags |= MSG_DRAFT;
+	if (msgcache_read_cache_data_str(fp, &srccharset, NULL, swapping) < 0) {
+		fclose(fp);
+		return NULL;
 	}
-
-	if (msgcache_read_cache_data_str(fp, &srccharset, NULL) < 0) {
+	if (indexed && !msgcache_read_index_footer(fp, swapping, &index_offset, &index_count)) {
+		g_warning("message index of %s is corrupted", cache_file);
+		g_free(srccharset);
 		fclose(fp);
 		return NULL;
 	}
@@ -636,7 +1505,7 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 	}
 	g_free(srccharset);
 
-	cache = msgcache_new();
+	cache = msgcache_alloc();
 
 	if (msgcache_use_mmap_read == TRUE) {
 		if (fstat(fileno(fp), &st) >= 0)
@@ -664,14 +1533,35 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 	} else {
 		cache_data = NULL;
 	}
-	if (cache_data != NULL && cache_data != MAP_FAILED) {
-		int rem_len = map_len-ftell(fp);
+#ifndef G_OS_WIN32
+	/* In lazy mode the mapping outlives this function, so only do it
+	 * where the cache file can still be replaced while mapped. */
+	lazy = prefs_common.cache_lazy_load && swapping && conv == NULL;
+#endif
+	if (cache_data != NULL && cache_data != MAP_FAILED)
+		cache->arena = procmsg_arena_new();
+	if (cache_data != NULL && cache_data != MAP_FAILED && lazy) {
+		cache->tmp_flags = tmp_flags;
+		if (indexed)
+			error = !msgcache_read_index(cache, cache_data, ftell(fp),
+						     index_offset, index_count);
+		else
+			error = !msgcache_read_cache_lazy(cache, cache_data, map_len, ftell(fp));
+		if (error) {
+			error = TRUE;
+			goto bail_err;
+		}
+		cache->map_data = cache_data;
+		cache->map_len = map_len;
+		cache_data = NULL;
+	} else if (cache_data != NULL && cache_data != MAP_FAILED) {
+		int rem_len = (indexed ? index_offset : map_len) - ftell(fp);
 		char *walk_data = cache_data+ftell(fp);
 
 		while(rem_len > 0) {
 			GET_CACHE_DATA_INT(num);
 			
-			msginfo = procmsg_msginfo_new();
+			msginfo = procmsg_arena_msginfo_new(cache->arena);
 			msginfo->msgnum = num;
 			memusage += sizeof(MsgInfo);
 
@@ -680,13 +1570,13 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 			GET_CACHE_DATA_INT(msginfo->date_t);
 			GET_CACHE_DATA_INT(msginfo->flags.tmp_flags);
 
-			GET_CACHE_DATA(msginfo->fromname, memusage);
+			GET_CACHE_SHARED_DATA(msginfo->fromname, memusage);
 
 			GET_CACHE_DATA(msginfo->date, memusage);
-			GET_CACHE_DATA(msginfo->from, memusage);
-			GET_CACHE_DATA(msginfo->to, memusage);
-			GET_CACHE_DATA(msginfo->cc, memusage);
-			GET_CACHE_DATA(msginfo->newsgroups, memusage);
+			GET_CACHE_SHARED_DATA(msginfo->from, memusage);
+			GET_CACHE_SHARED_DATA(msginfo->to, memusage);
+			GET_CACHE_SHARED_DATA(msginfo->cc, memusage);
+			GET_CACHE_SHARED_DATA(msginfo->newsgroups, memusage);
 			GET_CACHE_DATA(msginfo->subject, memusage);
 			GET_CACHE_DATA(msginfo->msgid, memusage);
 			GET_CACHE_DATA(msginfo->inreplyto, memusage);
@@ -715,9 +1605,11 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 			g_hash_table_insert(cache->msgnum_table, &msginfo->msgnum, msginfo);
 			if(msginfo->msgid)
 				g_hash_table_insert(cache->msgid_table, msginfo->msgid, msginfo);
+			msgcache_columns_set_msginfo(cache, msginfo);
 		}
 	} else {
-		while (fread(&num, sizeof(num), 1, fp) == 1) {
+		while ((!indexed || ftell(fp) < index_offset) &&
+		       fread(&num, sizeof(num), 1, fp) == 1) {
 			if (swapping)
 				num = bswap_32(num);
 
@@ -765,6 +1657,7 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 			g_hash_table_insert(cache->msgnum_table, &msginfo->msgnum, msginfo);
 			if(msginfo->msgid)
 				g_hash_table_insert(cache->msgid_table, msginfo->msgid, msginfo);
+			msgcache_columns_set_msginfo(cache, msginfo);
 		}
 	}
 bail_err:
@@ -787,27 +1680,101 @@ bail_err:
 		return NULL;
 	}
 
-	cache->last_access = time(NULL);
-	cache->memusage = memusage;
+	cache->item = item;
+
+	debug_print("done. (%d items read, %d deferred)\n", g_hash_table_size(cache->msgnum_table),
+		    cache->lazy_table ? g_hash_table_size(cache->lazy_table) : 0);
+
+	return cache;
+}
+
+static void msgcache_intern_func(gpointer key, gpointer value, gpointer user_data)
+{
+	procmsg_msginfo_intern_strings((MsgInfo *)value);
+}
+
+void msgcache_attach(MsgCache *cache)
+{
+	cm_return_if_fail(cache != NULL);
+	cm_return_if_fail(cache->lru_link == NULL);
+
+	g_hash_table_foreach(cache->msgnum_table, msgcache_intern_func, NULL);
+
+	/* count what is left after interning, the same way
+	 * msgcache_remove_msg() will subtract it */
+	cache->memusage = 0;
+	g_hash_table_foreach(cache->msgnum_table, msgcache_memusage_func, &cache->memusage);
+	if (cache->lazy_table)
+		cache->memusage += g_hash_table_size(cache->lazy_table) * sizeof(MsgCacheEntry);
+
+	msgcache_link(cache);
+	msgcache_touch(cache);
 
-	debug_print("done. (%d items read)\n", g_hash_table_size(cache->msgnum_table));
 	debug_print("Cache size: %d messages, %u bytes\n", g_hash_table_size(cache->msgnum_table), cache->memusage);
+}
+
+MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
+{
+	MsgCache *cache;
+	MsgTmpFlags tmp_flags = 0;
+
+	cm_return_val_if_fail(item != NULL, NULL);
+
+	if (folder_has_parent_of_type(item, F_QUEUE)) {
+		tmp_flags |= MSG_QUEUED;
+	} else if (folder_has_parent_of_type(item, F_DRAFT)) {
+		tmp_flags |= MSG_DRAFT;
+	}
+
+	cache = msgcache_read_cache_detached(item, cache_file, tmp_flags);
+	if (cache != NULL)
+		msgcache_attach(cache);
 
 	return cache;
 }
 
-void msgcache_read_mark(MsgCache *cache, const gchar *mark_file)
+static void msgcache_set_mark(MsgCache *cache, guint32 num, MsgPermFlags perm_flags)
+{
+	MsgInfo *msginfo;
+	MsgCacheEntry *entry;
+
+	if ((msginfo = g_hash_table_lookup(cache->msgnum_table, &num)) != NULL)
+		msginfo->flags.perm_flags = perm_flags;
+	else if (cache->lazy_table != NULL &&
+		 (entry = g_hash_table_lookup(cache->lazy_table, &num)) != NULL)
+		entry->perm_flags = perm_flags;
+	else
+		return;
+
+	msgcache_columns_set_perm_flags(cache, num, perm_flags);
+}
+
+static GSList **msgcache_get_tags_ptr(MsgCache *cache, guint32 num)
 {
-	FILE *fp;
 	MsgInfo *msginfo;
+	MsgCacheEntry *entry;
+
+	if ((msginfo = g_hash_table_lookup(cache->msgnum_table, &num)) != NULL)
+		return &msginfo->tags;
+	else if (cache->lazy_table != NULL &&
+		 (entry = g_hash_table_lookup(cache->lazy_table, &num)) != NULL)
+		return &entry->tags;
+
+	return NULL;
+}
+
+static guint msgcache_read_mark_file(MsgCache *cache, const gchar *mark_file,
+				     const guint32 *stamp)
+{
+	FILE *fp;
 	MsgPermFlags perm_flags;
 	guint32 num;
 	gint map_len = -1;
 	char *cache_data = NULL;
 	struct stat st;
 	gboolean error = FALSE;
-
-	swapping = TRUE;
+	gboolean swapping = TRUE;
+	guint records = 0;
 
 	/* In case we can't open the mark file with MARK_VERSION, check if we can open it with the
 	 * swapped MARK_VERSION. As msgcache_open_data_file swaps it too, if this succeeds, 
@@ -817,11 +1784,17 @@ void msgcache_read_mark(MsgCache *cache, const gchar *mark_file)
 	if ((fp = msgcache_open_data_file(mark_file, MARK_VERSION, DATA_READ, NULL, 0)) == NULL) {
 		/* see if it isn't swapped ? */
 		if ((fp = msgcache_open_data_file(mark_file, bswap_32(MARK_VERSION), DATA_READ, NULL, 0)) == NULL)
-			return;
+			return 0;
 		else
 			swapping = FALSE; /* yay */
 	}
 	debug_print("reading %sswapped mark file.\n", swapping?"":"un");
+
+	if (stamp != NULL && !msgcache_read_journal_stamp(fp, stamp)) {
+		debug_print("ignoring stale journal %s\n", mark_file);
+		fclose(fp);
+		return 0;
+	}
 	
 	if (msgcache_use_mmap_read) {
 		if (fstat(fileno(fp), &st) >= 0)
@@ -856,10 +1829,8 @@ void msgcache_read_mark(MsgCache *cache, const gchar *mark_file)
 		while(rem_len > 0) {
 			GET_CACHE_DATA_INT(num);
 			GET_CACHE_DATA_INT(perm_flags);
-			msginfo = g_hash_table_lookup(cache->msgnum_table, &num);
-			if(msginfo) {
-				msginfo->flags.perm_flags = perm_flags;
-			}
+			msgcache_set_mark(cache, num, perm_flags);
+			records++;
 		}
 	} else {
 		while (fread(&num, sizeof(num), 1, fp) == 1) {
@@ -871,10 +1842,8 @@ void msgcache_read_mark(MsgCache *cache, const gchar *mark_file)
 			}
 			if (swapping)
 				perm_flags = bswap_32(perm_flags);
-			msginfo = g_hash_table_lookup(cache->msgnum_table, &num);
-			if(msginfo) {
-				msginfo->flags.perm_flags = perm_flags;
-			}
+			msgcache_set_mark(cache, num, perm_flags);
+			records++;
 		}	
 	}
 bail_err:
@@ -889,19 +1858,39 @@ bail_err:
 	if (error) {
 		debug_print("error reading cache mark from %s\n", mark_file);
 	}
+	return records;
 }
 
-void msgcache_read_tags(MsgCache *cache, const gchar *tags_file)
+void msgcache_read_mark(MsgCache *cache, const gchar *mark_file)
+{
+	gchar *journal_file;
+	guint32 stamp[JOURNAL_STAMP_FIELDS];
+
+	cm_return_if_fail(cache != NULL);
+	cm_return_if_fail(mark_file != NULL);
+
+	msgcache_read_mark_file(cache, mark_file, NULL);
+
+	/* replay the flag changes appended since the last full write */
+	msgcache_get_journal_stamp(mark_file, stamp);
+	journal_file = msgcache_get_journal_file(mark_file);
+	cache->mark_journal_len = msgcache_read_mark_file(cache, journal_file,
+							  stamp);
+	g_free(journal_file);
+}
+
+static guint msgcache_read_tags_file(MsgCache *cache, const gchar *tags_file,
+				     const guint32 *stamp)
 {
 	FILE *fp;
-	MsgInfo *msginfo;
+	GSList **tags, *unknown = NULL;
 	guint32 num;
 	gint map_len = -1;
 	char *cache_data = NULL;
 	struct stat st;
 	gboolean error = FALSE;
-
-	swapping = TRUE;
+	gboolean swapping = TRUE;
+	guint records = 0;
 
 	/* In case we can't open the mark file with MARK_VERSION, check if we can open it with the
 	 * swapped MARK_VERSION. As msgcache_open_data_file swaps it too, if this succeeds, 
@@ -911,11 +1900,17 @@ void msgcache_read_tags(MsgCache *cache, const gchar *tags_file)
 	if ((fp = msgcache_open_data_file(tags_file, TAGS_VERSION, DATA_READ, NULL, 0)) == NULL) {
 		/* see if it isn't swapped ? */
 		if ((fp = msgcache_open_data_file(tags_file, bswap_32(TAGS_VERSION), DATA_READ, NULL, 0)) == NULL)
-			return;
+			return 0;
 		else
 			swapping = FALSE; /* yay */
 	}
 	debug_print("reading %sswapped tags file.\n", swapping?"":"un");
+
+	if (stamp != NULL && !msgcache_read_journal_stamp(fp, stamp)) {
+		debug_print("ignoring stale journal %s\n", tags_file);
+		fclose(fp);
+		return 0;
+	}
 	
 	if (msgcache_use_mmap_read) {
 		if (fstat(fileno(fp), &st) >= 0)
@@ -950,43 +1945,46 @@ void msgcache_read_tags(MsgCache *cache, const gchar *tags_file)
 		while(rem_len > 0) {
 			gint id = -1;
 			GET_CACHE_DATA_INT(num);
-			msginfo = g_hash_table_lookup(cache->msgnum_table, &num);
-			if(msginfo) {
-				g_slist_free(msginfo->tags);
-				msginfo->tags = NULL;
-				do {
-					GET_CACHE_DATA_INT(id);
-					if (id > 0) {
-						msginfo->tags = g_slist_prepend(
-							msginfo->tags, 
-							GINT_TO_POINTER(id));
-					}
-				} while (id > 0);
-				msginfo->tags = g_slist_reverse(msginfo->tags);
-			}
+			tags = msgcache_get_tags_ptr(cache, num);
+			/* still consume the ids of messages we don't know */
+			if(!tags)
+				tags = &unknown;
+			g_slist_free(*tags);
+			*tags = NULL;
+			do {
+				GET_CACHE_DATA_INT(id);
+				if (id > 0) {
+					*tags = g_slist_prepend(
+						*tags, 
+						GINT_TO_POINTER(id));
+				}
+			} while (id > 0);
+			*tags = g_slist_reverse(*tags);
+			records++;
 		}
 	} else {
 		while (fread(&num, sizeof(num), 1, fp) == 1) {
 			gint id = -1;
 			if (swapping)
 				num = bswap_32(num);
-			msginfo = g_hash_table_lookup(cache->msgnum_table, &num);
-			if(msginfo) {
-				g_slist_free(msginfo->tags);
-				msginfo->tags = NULL;
-				do {
-					if (fread(&id, sizeof(id), 1, fp) != 1) 
-						id = -1;
-					if (swapping)
-						id = bswap_32(id);
-					if (id > 0) {
-						msginfo->tags = g_slist_prepend(
-							msginfo->tags, 
-							GINT_TO_POINTER(id));
-					}
-				} while (id > 0);
-				msginfo->tags = g_slist_reverse(msginfo->tags);
-			}
+			tags = msgcache_get_tags_ptr(cache, num);
+			if(!tags)
+				tags = &unknown;
+			g_slist_free(*tags);
+			*tags = NULL;
+			do {
+				if (fread(&id, sizeof(id), 1, fp) != 1) 
+					id = -1;
+				if (swapping)
+					id = bswap_32(id);
+				if (id > 0) {
+					*tags = g_slist_prepend(
+						*tags, 
+						GINT_TO_POINTER(id));
+				}
+			} while (id > 0);
+			*tags = g_slist_reverse(*tags);
+			records++;
 		}
 	}
 bail_err:
@@ -998,9 +1996,29 @@ bail_err:
 #endif
 	}
 	fclose(fp);
+	g_slist_free(unknown);
 	if (error) {
 		debug_print("error reading cache tags from %s\n", tags_file);
 	}
+	return records;
+}
+
+void msgcache_read_tags(MsgCache *cache, const gchar *tags_file)
+{
+	gchar *journal_file;
+	guint32 stamp[JOURNAL_STAMP_FIELDS];
+
+	cm_return_if_fail(cache != NULL);
+	cm_return_if_fail(tags_file != NULL);
+
+	msgcache_read_tags_file(cache, tags_file, NULL);
+
+	/* replay the tag changes appended since the last full write */
+	msgcache_get_journal_stamp(tags_file, stamp);
+	journal_file = msgcache_get_journal_file(tags_file);
+	cache->tags_journal_len = msgcache_read_tags_file(cache, journal_file,
+							  stamp);
+	g_free(journal_file);
 }
 
 static int msgcache_write_cache(MsgInfo *msginfo, FILE *fp)
@@ -1037,21 +2055,20 @@ static int msgcache_write_cache(MsgInfo *msginfo, FILE *fp)
 	return w_err ? -1 : wrote;
 }
 
-static int msgcache_write_flags(MsgInfo *msginfo, FILE *fp)
+static int msgcache_write_flags(guint msgnum, MsgPermFlags flags, FILE *fp)
 {
-	MsgPermFlags flags = msginfo->flags.perm_flags;
 	int w_err = 0, wrote = 0;
-	WRITE_CACHE_DATA_INT(msginfo->msgnum, fp);
+	WRITE_CACHE_DATA_INT(msgnum, fp);
 	WRITE_CACHE_DATA_INT(flags, fp);
 	return w_err ? -1 : wrote;
 }
 
-static int msgcache_write_tags(MsgInfo *msginfo, FILE *fp)
+static int msgcache_write_tags(guint msgnum, GSList *tags, FILE *fp)
 {
-	GSList *cur = msginfo->tags;
+	GSList *cur = tags;
 	int w_err = 0, wrote = 0;
 
-	WRITE_CACHE_DATA_INT(msginfo->msgnum, fp);
+	WRITE_CACHE_DATA_INT(msgnum, fp);
 	for (; cur; cur = cur->next) {
 		gint id = GPOINTER_TO_INT(cur->data);
 		if (tags_get_tag(id) != NULL) {
@@ -1072,8 +2089,57 @@ struct write_fps
 	guint cache_size;
 	guint mark_size;
 	guint tags_size;
+	gchar *map_data;
+	GArray *index;
 };
 
+static void msgcache_index_append(struct write_fps *write_fps, guint32 msgnum,
+				  guint32 offset, guint32 length, guint32 size,
+				  guint32 mtime, guint32 date_t, guint32 tmp_flags)
+{
+	MsgCacheIndexEntry index_entry;
+
+	index_entry.msgnum = msgnum;
+	index_entry.offset = offset;
+	index_entry.length = length;
+	index_entry.size = size;
+	index_entry.mtime = mtime;
+	index_entry.date_t = date_t;
+	index_entry.tmp_flags = tmp_flags;
+	g_array_append_val(write_fps->index, index_entry);
+}
+
+static gint msgcache_index_compare_func(gconstpointer a, gconstpointer b)
+{
+	const MsgCacheIndexEntry *ea = a, *eb = b;
+
+	return (ea->msgnum > eb->msgnum) - (ea->msgnum < eb->msgnum);
+}
+
+static int msgcache_write_index(GArray *index, guint32 index_offset, FILE *fp)
+{
+	guint i;
+	int w_err = 0, wrote = 0;
+
+	g_array_sort(index, msgcache_index_compare_func);
+
+	for (i = 0; i < index->len; i++) {
+		MsgCacheIndexEntry *index_entry = &g_array_index(index, MsgCacheIndexEntry, i);
+
+		WRITE_CACHE_DATA_INT(index_entry->msgnum, fp);
+		WRITE_CACHE_DATA_INT(index_entry->offset, fp);
+		WRITE_CACHE_DATA_INT(index_entry->length, fp);
+		WRITE_CACHE_DATA_INT(index_entry->size, fp);
+		WRITE_CACHE_DATA_INT(index_entry->mtime, fp);
+		WRITE_CACHE_DATA_INT(index_entry->date_t, fp);
+		WRITE_CACHE_DATA_INT(index_entry->tmp_flags, fp);
+	}
+	WRITE_CACHE_DATA_INT(index_offset, fp);
+	WRITE_CACHE_DATA_INT(index->len, fp);
+
+	return w_err ? -1 : wrote;
+}
+
 static void msgcache_write_func(gpointer key, gpointer value, gpointer user_data)
 {
 	MsgInfo *msginfo;
@@ -1087,18 +2153,25 @@ static void msgcache_write_func(gpointer key, gpointer value, gpointer user_data
 		tmp = msgcache_write_cache(msginfo, write_fps->cache_fp);
 		if (tmp < 0)
 			write_fps->error = 1;
-		else
+		else {
+			msgcache_index_append(write_fps, msginfo->msgnum,
+				write_fps->cache_size, tmp, msginfo->size,
+				msginfo->mtime, msginfo->date_t,
+				msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK);
 			write_fps->cache_size += tmp;
+		}
 	}
 	if (write_fps->mark_fp) {
-	tmp= msgcache_write_flags(msginfo, write_fps->mark_fp);
+	tmp= msgcache_write_flags(msginfo->msgnum, msginfo->flags.perm_flags,
+				  write_fps->mark_fp);
 		if (tmp < 0)
 			write_fps->error = 1;
 		else
 			write_fps->mark_size += tmp;
 		}
 	if (write_fps->tags_fp) {
-		tmp = msgcache_write_tags(msginfo, write_fps->tags_fp);
+		tmp = msgcache_write_tags(msginfo->msgnum, msginfo->tags,
+					  write_fps->tags_fp);
 		if (tmp < 0)
 			write_fps->error = 1;
 		else
@@ -1106,6 +2179,252 @@ static void msgcache_write_func(gpointer key, gpointer value, gpointer user_data
 	}
 }
 
+static void msgcache_write_lazy_func(gpointer key, gpointer value, gpointer user_data)
+{
+	MsgCacheEntry *entry;
+	struct write_fps *write_fps;
+	int tmp;
+
+	entry = (MsgCacheEntry *)value;
+	write_fps = user_data;
+
+	/* the record was never parsed, so it can be copied as is */
+	if (write_fps->cache_fp) {
+		gchar *record = write_fps->map_data + entry->offset;
+
+		if (SC_FWRITE(record, 1, entry->length, write_fps->cache_fp) != entry->length)
+			write_fps->error = 1;
+		else {
+			/* msgnum, size, mtime, date_t, tmp_flags; lazy
+			 * records are always in native byte order */
+			msgcache_index_append(write_fps, entry->msgnum,
+				write_fps->cache_size, entry->length,
+				MMAP_TO_GUINT32_SWAPPED((record + 4)),
+				MMAP_TO_GUINT32_SWAPPED((record + 8)),
+				MMAP_TO_GUINT32_SWAPPED((record + 12)),
+				MMAP_TO_GUINT32_SWAPPED((record + 16)));
+			write_fps->cache_size += entry->length;
+		}
+	}
+	if (write_fps->mark_fp) {
+		tmp = msgcache_write_flags(entry->msgnum, entry->perm_flags,
+					   write_fps->mark_fp);
+		if (tmp < 0)
+			write_fps->error = 1;
+		else
+			write_fps->mark_size += tmp;
+	}
+	if (write_fps->tags_fp) {
+		tmp = msgcache_write_tags(entry->msgnum, entry->tags,
+					  write_fps->tags_fp);
+		if (tmp < 0)
+			write_fps->error = 1;
+		else
+			write_fps->tags_size += tmp;
+	}
+}
+
+/* Appends the flags, or the tags, of the messages changed since the last
+ * write to the journal next to data_file. Returns the number of records
+ * appended, or -1 if data_file has to be rewritten as a whole instead. */
+static gint msgcache_append_journal(MsgCache *cache, const gchar *data_file,
+				    gboolean tags)
+{
+	GHashTable *journal = tags ? cache->tags_journal : cache->mark_journal;
+	guint journal_len = tags ? cache->tags_journal_len : cache->mark_journal_len;
+	guint version = tags ? TAGS_VERSION : MARK_VERSION;
+	guint32 stamp[JOURNAL_STAMP_FIELDS];
+	GHashTableIter iter;
+	gpointer key;
+	gchar *journal_file;
+	FILE *fp;
+	guint total;
+	gint records = 0, i;
+	int error = 0, w_err = 0, wrote = 0;
+
+	total = g_hash_table_size(cache->msgnum_table);
+	if (cache->lazy_table)
+		total += g_hash_table_size(cache->lazy_table);
+	if (journal_len + g_hash_table_size(journal) > MAX(JOURNAL_MIN_RECORDS, total / 4))
+		return -1;
+
+	/* a journal left from a previous version of data_file is started
+	 * over */
+	msgcache_get_journal_stamp(data_file, stamp);
+	journal_file = msgcache_get_journal_file(data_file);
+	fp = msgcache_open_data_file(journal_file, version, DATA_READ, NULL, 0);
+	if (fp != NULL && msgcache_read_journal_stamp(fp, stamp)) {
+		fclose(fp);
+		fp = msgcache_open_data_file(journal_file, version,
+					     DATA_APPEND, NULL, 0);
+	} else {
+		if (fp != NULL)
+			fclose(fp);
+		if (tags)
+			cache->tags_journal_len = 0;
+		else
+			cache->mark_journal_len = 0;
+		fp = msgcache_open_data_file(journal_file, version,
+					     DATA_WRITE, NULL, 0);
+		for (i = 0; fp != NULL && i < JOURNAL_STAMP_FIELDS; i++)
+			WRITE_CACHE_DATA_INT(stamp[i], fp);
+		if (fp != NULL && w_err != 0) {
+			fclose(fp);
+			fp = NULL;
+		}
+	}
+	g_free(journal_file);
+	if (fp == NULL)
+		return -1;
+
+	g_hash_table_iter_init(&iter, journal);
+	while (!error && g_hash_table_iter_next(&iter, &key, NULL)) {
+		guint num = GPOINTER_TO_UINT(key);
+		MsgInfo *msginfo;
+		MsgCacheEntry *entry;
+		MsgPermFlags perm_flags;
+		GSList *msgtags;
+		int tmp;
+
+		if ((msginfo = g_hash_table_lookup(cache->msgnum_table, &num)) != NULL) {
+			perm_flags = msginfo->flags.perm_flags;
+			msgtags = msginfo->tags;
+		} else if (cache->lazy_table != NULL &&
+			   (entry = g_hash_table_lookup(cache->lazy_table, &num)) != NULL) {
+			perm_flags = entry->perm_flags;
+			msgtags = entry->tags;
+		} else
+			continue;
+
+		if (tags)
+			tmp = msgcache_write_tags(num, msgtags, fp);
+		else
+			tmp = msgcache_write_flags(num, perm_flags, fp);
+		if (tmp < 0)
+			error = 1;
+		else
+			records++;
+	}
+
+	error |= (fflush(fp) != 0);
+	if (prefs_common.flush_metadata)
+		error |= (fsync(fileno(fp)) != 0);
+	error |= (fclose(fp) != 0);
+
+	return error ? -1 : records;
+}
+
+static void msgcache_remove_journal(const gchar *data_file)
+{
+	gchar *journal_file = msgcache_get_journal_file(data_file);
+
+	if (is_file_exist(journal_file) && claws_unlink(journal_file) < 0)
+		FILE_OP_ERROR(journal_file, "unlink");
+	g_free(journal_file);
+}
+
+void msgcache_read_thread_links(MsgCache *cache, const gchar *thread_file)
+{
+	FILE *fp;
+	GArray *links = NULL;
+	guint32 mode, count, i;
+	MsgCacheThreadLink *link;
+	struct stat st;
+	long pos;
+
+	cm_return_if_fail(cache != NULL);
+	cm_return_if_fail(thread_file != NULL);
+
+	if (cache->thread_links_read)
+		return;
+	cache->thread_links_read = TRUE;
+
+	if ((fp = msgcache_open_data_file(thread_file, THREAD_VERSION,
+					  DATA_READ, NULL, 0)) == NULL)
+		return;
+
+	if (fread(&mode, sizeof(mode), 1, fp) != 1 ||
+	    fread(&count, sizeof(count), 1, fp) != 1)
+		goto bail_err;
+	mode = bswap_32(mode);
+	count = bswap_32(count);
+
+	/* don't trust count further than the file holds */
+	pos = ftell(fp);
+	if (pos < 0 || fstat(fileno(fp), &st) < 0 || st.st_size < pos ||
+	    count > (st.st_size - pos) / sizeof(MsgCacheThreadLink))
+		goto bail_err;
+
+	links = g_array_sized_new(FALSE, FALSE, sizeof(MsgCacheThreadLink), count);
+	g_array_set_size(links, count);
+	if (count > 0 &&
+	    fread(links->data, sizeof(MsgCacheThreadLink), count, fp) != count)
+		goto bail_err;
+	for (i = 0; i < count; i++) {
+		link = &g_array_index(links, MsgCacheThreadLink, i);
+		link->msgnum = bswap_32(link->msgnum);
+		link->parent = bswap_32(link->parent);
+		link->date_t = bswap_32(link->date_t);
+	}
+	fclose(fp);
+
+	debug_print("read %u thread links from %s\n", count, thread_file);
+	cache->thread_links = links;
+	cache->thread_mode = mode;
+	return;
+
+bail_err:
+	debug_print("error reading thread links from %s\n", thread_file);
+	if (links != NULL)
+		g_array_free(links, TRUE);
+	fclose(fp);
+}
+
+gint msgcache_write_thread_links(const gchar *thread_file, MsgCache *cache)
+{
+	FILE *fp;
+	gchar *new_file;
+	MsgCacheThreadLink *link;
+	guint i;
+	int w_err = 0, wrote = 0;
+
+	cm_return_val_if_fail(thread_file != NULL, -1);
+	cm_return_val_if_fail(cache != NULL, -1);
+
+	if (!cache->thread_links_dirty || cache->thread_links == NULL)
+		return 0;
+
+	new_file = g_strconcat(thread_file, ".new", NULL);
+	if ((fp = msgcache_open_data_file(new_file, THREAD_VERSION,
+					  DATA_WRITE, NULL, 0)) == NULL) {
+		g_free(new_file);
+		return -1;
+	}
+
+	WRITE_CACHE_DATA_INT(cache->thread_mode, fp);
+	WRITE_CACHE_DATA_INT(cache->thread_links->len, fp);
+	for (i = 0; i < cache->thread_links->len && w_err == 0; i++) {
+		link = &g_array_index(cache->thread_links, MsgCacheThreadLink, i);
+		WRITE_CACHE_DATA_INT(link->msgnum, fp);
+		WRITE_CACHE_DATA_INT(link->parent, fp);
+		WRITE_CACHE_DATA_INT(link->date_t, fp);
+	}
+
+	if (fclose(fp) != 0)
+		w_err = 1;
+	if (w_err != 0) {
+		claws_unlink(new_file);
+		g_free(new_file);
+		return -1;
+	}
+	move_file(new_file, thread_file, TRUE);
+	g_free(new_file);
+
+	debug_print("wrote %d bytes of thread links to %s\n", wrote, thread_file);
+	cache->thread_links_dirty = FALSE;
+	return 0;
+}
+
 gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar *tags_file, MsgCache *cache)
 {
 	struct write_fps write_fps;
@@ -1115,6 +2434,32 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 	START_TIMING("");
 	cm_return_val_if_fail(cache != NULL, -1);
 
+	/* As long as the message list itself didn't change, flag and tag
+	 * changes only need to be appended to the journals. */
+	if (cache_file == NULL && mark_file != NULL) {
+		gint appended = msgcache_append_journal(cache, mark_file, FALSE);
+		if (appended >= 0) {
+			debug_print("\tAppended %d records to the mark journal\n", appended);
+			cache->mark_journal_len += appended;
+			g_hash_table_remove_all(cache->mark_journal);
+			mark_file = NULL;
+		}
+	}
+	if (cache_file == NULL && tags_file != NULL) {
+		gint appended = msgcache_append_journal(cache, tags_file, TRUE);
+		if (appended >= 0) {
+			debug_print("\tAppended %d records to the tags journal\n", appended);
+			cache->tags_journal_len += appended;
+			g_hash_table_remove_all(cache->tags_journal);
+			tags_file = NULL;
+		}
+	}
+	if (cache_file == NULL && mark_file == NULL && tags_file == NULL) {
+		msgcache_touch(cache);
+		END_TIMING();
+		return 0;
+	}
+
 	new_cache = g_strconcat(cache_file, ".new", NULL);
 	new_mark  = g_strconcat(mark_file, ".new", NULL);
 	new_tags  = g_strconcat(tags_file, ".new", NULL);
@@ -1123,6 +2468,8 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 	write_fps.cache_size = 0;
 	write_fps.mark_size = 0;
 	write_fps.tags_size = 0;
+	write_fps.map_data = cache->map_data;
+	write_fps.index = NULL;
 
 	/* open files and write headers */
 
@@ -1192,8 +2539,12 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 		FILE_OP_ERROR(new_cache, "chmod");
 
 	/* headers written, note file size */
-	if (write_fps.cache_fp)
+	if (write_fps.cache_fp) {
 		write_fps.cache_size = ftell(write_fps.cache_fp);
+		write_fps.index = g_array_sized_new(FALSE, FALSE, sizeof(MsgCacheIndexEntry),
+				g_hash_table_size(cache->msgnum_table) +
+				(cache->lazy_table ? g_hash_table_size(cache->lazy_table) : 0));
+	}
 	if (write_fps.mark_fp)
 		write_fps.mark_size = ftell(write_fps.mark_fp);
 	if (write_fps.tags_fp)
@@ -1210,6 +2561,18 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 #endif
 	/* write data to the files */
 	g_hash_table_foreach(cache->msgnum_table, msgcache_write_func, (gpointer)&write_fps);
+	if (cache->lazy_table)
+		g_hash_table_foreach(cache->lazy_table, msgcache_write_lazy_func, (gpointer)&write_fps);
+	if (write_fps.cache_fp && !write_fps.error) {
+		gint tmp = msgcache_write_index(write_fps.index, write_fps.cache_size,
+						write_fps.cache_fp);
+		if (tmp < 0)
+			write_fps.error = 1;
+		else
+			write_fps.cache_size += tmp;
+	}
+	if (write_fps.index)
+		g_array_free(write_fps.index, TRUE);
 #ifdef HAVE_FWRITE_UNLOCKED
 	/* unlock files */
 	if (write_fps.cache_fp)
@@ -1254,14 +2617,24 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 		g_free(new_tags);
 		return -1;
 	} else {
-		/* switch files */
+		/* switch files; a journal left behind by a crash before
+		 * it is removed no longer matches the stamp of its file,
+		 * and isn't replayed */
 		if (cache_file)
 			move_file(new_cache, cache_file, TRUE);
-		if (mark_file)
+		if (mark_file) {
 			move_file(new_mark, mark_file, TRUE);
-		if (tags_file)
+			msgcache_remove_journal(mark_file);
+			cache->mark_journal_len = 0;
+			g_hash_table_remove_all(cache->mark_journal);
+		}
+		if (tags_file) {
 			move_file(new_tags, tags_file, TRUE);
-		cache->last_access = time(NULL);
+			msgcache_remove_journal(tags_file);
+			cache->tags_journal_len = 0;
+			g_hash_table_remove_all(cache->tags_journal);
+		}
+		msgcache_touch(cache);
 	}
 
 	g_free(new_cache);
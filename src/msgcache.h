@@ -31,10 +31,38 @@ typedef struct _MsgCache MsgCache;
 #include "procmsg.h"
 #include "folder.h"
 
+/* The numeric fields of every cached message, materialized or not,
+ * packed into parallel arrays. Row order is arbitrary. */
+struct _MsgCacheColumns {
+	guint		 len;
+	guint32		*msgnum;
+	time_t		*date_t;
+	goffset		*size;
+	MsgPermFlags	*perm_flags;
+	MsgTmpFlags	*tmp_flags;
+};
+
+/* One message of the thread index kept next to the cache, parents
+ * before their children. */
+typedef struct _MsgCacheThreadLink MsgCacheThreadLink;
+struct _MsgCacheThreadLink {
+	guint32		 msgnum;
+	guint32		 parent;	/* 0 for the root of a thread */
+	guint32		 date_t;
+};
+
 MsgCache   	*msgcache_new				(void);
 void	   	 msgcache_destroy			(MsgCache *cache);
 MsgCache   	*msgcache_read_cache			(FolderItem *item,
 							 const gchar *cache_file);
+/* Reads a cache without touching anything but the new cache, so it can
+ * run outside of the main thread; together with msgcache_read_mark()
+ * and msgcache_read_tags(). The result must be handed to
+ * msgcache_attach() on the main thread before it is used. */
+MsgCache   	*msgcache_read_cache_detached		(FolderItem *item,
+							 const gchar *cache_file,
+							 MsgTmpFlags tmp_flags);
+void	   	 msgcache_attach			(MsgCache *cache);
 void	   	 msgcache_read_mark			(MsgCache *cache,
 							 const gchar *mark_file);
 void	   	 msgcache_read_tags			(MsgCache *cache,
@@ -54,7 +82,32 @@ MsgInfo	   	*msgcache_get_msg			(MsgCache *cache,
 MsgInfo	   	*msgcache_get_msg_by_id			(MsgCache *cache,
 							 const gchar *msgid);
 MsgInfoList	*msgcache_get_msg_list			(MsgCache *cache);
+GSList		*msgcache_get_msgnum_list		(MsgCache *cache);
+void		 msgcache_flags_changed			(MsgCache *cache,
+							 guint num);
+void		 msgcache_tags_changed			(MsgCache *cache,
+							 guint num);
+void		 msgcache_update_flags			(MsgCache *cache,
+							 MsgInfo *msginfo);
+const MsgCacheColumns *msgcache_get_columns		(MsgCache *cache);
+guint		 msgcache_count_perm_flags		(MsgCache *cache,
+							 MsgPermFlags flags);
+gchar		*msgcache_get_journal_file		(const gchar *file);
+void		 msgcache_read_thread_links		(MsgCache *cache,
+							 const gchar *thread_file);
+gint		 msgcache_write_thread_links		(const gchar *thread_file,
+							 MsgCache *cache);
+void		 msgcache_set_thread_links		(MsgCache *cache,
+							 GArray *links,
+							 guint32 mode);
+GArray		*msgcache_get_thread_links		(MsgCache *cache,
+							 guint32 mode);
 time_t	   	 msgcache_get_last_access_time		(MsgCache *cache);
 gint	   	 msgcache_get_memory_usage		(MsgCache *cache);
+void		 msgcache_set_folder_item		(MsgCache *cache,
+							 FolderItem *item);
+FolderItem	*msgcache_get_folder_item		(MsgCache *cache);
+GList		*msgcache_get_lru_list			(void);
+guint		 msgcache_get_total_memory_usage	(void);
 
 #endif
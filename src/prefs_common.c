@@ -1105,6 +1105,16 @@ static PrefParam param[] = {
 	{"cache_min_keep_time", "0", &prefs_common.cache_min_keep_time, P_INT,
 	 NULL, NULL, NULL},
 #endif
+	{"cache_lazy_load", "TRUE", &prefs_common.cache_lazy_load, P_BOOL,
+	 NULL, NULL, NULL},
+	{"cache_load_threads", "0", &prefs_common.cache_load_threads, P_INT,
+	 NULL, NULL, NULL},
+	{"search_threads", "0", &prefs_common.search_threads, P_INT,
+	 NULL, NULL, NULL},
+	{"summary_progressive_rows", "5000", &prefs_common.summary_progressive_rows,
+	 P_INT, NULL, NULL, NULL},
+	{"summary_text_cache_rows", "2000", &prefs_common.summary_text_cache_rows,
+	 P_INT, NULL, NULL, NULL},
 	{"thread_by_subject_max_age", "10", &prefs_common.thread_by_subject_max_age,
 	P_INT, NULL, NULL, NULL },
 	{"last_opened_folder", "", &prefs_common.last_opened_folder,
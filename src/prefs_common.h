@@ -434,6 +434,11 @@ struct _PrefsCommon
 	/* Memory cache*/
 	gint cache_max_mem_usage;
 	gint cache_min_keep_time;
+	gboolean cache_lazy_load;
+	gint cache_load_threads;
+	gint search_threads;
+	gint summary_text_cache_rows;
+	gint summary_progressive_rows;
 	
 	/* boolean for work offline 
 	   stored here for use in inc.c */
@@ -1047,14 +1047,21 @@ gboolean procmime_msginfo_is_encrypted(MsgInfo *msginfo)
 
 gchar *procmime_get_tmp_file_name(MimeInfo *mimeinfo)
 {
-	static guint32 id = 0;
+	static volatile gint id = 0;
 	gchar *base;
 	gchar *filename;
 	gchar f_prefix[10];
 
 	cm_return_val_if_fail(mimeinfo != NULL, NULL);
 
-	g_snprintf(f_prefix, sizeof(f_prefix), "%08x.", id++);
+	/* messages can be searched from several threads */
+#if GLIB_CHECK_VERSION(2,30,0)
+	g_snprintf(f_prefix, sizeof(f_prefix), "%08x.",
+		   (guint32)g_atomic_int_add(&id, 1));
+#else
+	g_snprintf(f_prefix, sizeof(f_prefix), "%08x.",
+		   (guint32)g_atomic_int_exchange_and_add(&id, 1));
+#endif
 
 	if ((mimeinfo->type == MIMETYPE_TEXT) && !g_ascii_strcasecmp(mimeinfo->subtype, "html"))
 		base = g_strdup("mimetmp.html");
@@ -49,6 +49,7 @@
 #include "timing.h"
 #include "inc.h"
 #include "privacy.h"
+#include "stringtable.h"
 
 extern SessionStats session_stats;
 
@@ -111,6 +112,128 @@ struct MarkSum {
 	gint first;
 };
 
+static void procmsg_msginfo_set_subject_key(MsgInfo *msginfo)
+{
+	gchar *subject = msginfo->subject, *end;
+	gint prefix_length;
+
+	msginfo->subject_key_set = TRUE;
+	if (subject == NULL)
+		return;
+
+	/* like trim_subject_for_sort() */
+	while (g_ascii_isspace(*subject))
+		subject++;
+	prefix_length = subject_get_prefix_length(subject);
+	msginfo->subject_is_reply = (prefix_length > 0);
+	subject += prefix_length;
+
+	for (end = subject + strlen(subject);
+	     end > subject && g_ascii_isspace(end[-1]); end--)
+		;
+	if (*end != '\0') {
+		msginfo->subject_key = g_strndup(subject, end - subject);
+		msginfo->subject_key_owned = TRUE;
+	} else
+		msginfo->subject_key = subject;
+
+	msginfo->subject_hash = g_str_hash(msginfo->subject_key);
+}
+
+/**
+ * procmsg_msginfo_get_subject_key:
+ * @msginfo: a message.
+ *
+ * The subject of @msginfo without its reply or forward prefixes and
+ * the blanks around it, as used to thread and sort by subject. It is
+ * computed on first use and kept with @msginfo.
+ *
+ * Return value: the normalized subject, or NULL if there is no
+ * subject.
+ */
+const gchar *procmsg_msginfo_get_subject_key(MsgInfo *msginfo)
+{
+	cm_return_val_if_fail(msginfo != NULL, NULL);
+
+	if (!msginfo->subject_key_set)
+		procmsg_msginfo_set_subject_key(msginfo);
+	return msginfo->subject_key;
+}
+
+/* whether the subject starts with a reply or forward prefix */
+gboolean procmsg_msginfo_subject_is_reply(MsgInfo *msginfo)
+{
+	cm_return_val_if_fail(msginfo != NULL, FALSE);
+
+	if (!msginfo->subject_key_set)
+		procmsg_msginfo_set_subject_key(msginfo);
+	return msginfo->subject_is_reply;
+}
+
+static guint subject_key_hash(gconstpointer key)
+{
+	MsgInfo *msginfo = (MsgInfo *)key;
+
+	if (!msginfo->subject_key_set)
+		procmsg_msginfo_set_subject_key(msginfo);
+	return msginfo->subject_hash;
+}
+
+static gboolean subject_key_equal(gconstpointer a, gconstpointer b)
+{
+	const gchar *key_a = procmsg_msginfo_get_subject_key((MsgInfo *)a);
+	const gchar *key_b = procmsg_msginfo_get_subject_key((MsgInfo *)b);
+
+	if (key_a == NULL || key_b == NULL)
+		return key_a == key_b;
+	return !strcmp(key_a, key_b);
+}
+
+/* Tables of messages by normalized subject. The keys are the MsgInfos
+ * themselves, so that their saved hash is used; an inserted message
+ * must outlive its entry. */
+GHashTable *procmsg_subject_table_new(void)
+{
+	return g_hash_table_new(subject_key_hash, subject_key_equal);
+}
+
+gpointer procmsg_subject_table_lookup(GHashTable *subject_table,
+				      MsgInfo *msginfo)
+{
+	const gchar *key;
+
+	cm_return_val_if_fail(subject_table != NULL, NULL);
+	cm_return_val_if_fail(msginfo != NULL, NULL);
+
+	key = procmsg_msginfo_get_subject_key(msginfo);
+	if (key == NULL || *key == '\0')
+		return NULL;
+	return g_hash_table_lookup(subject_table, msginfo);
+}
+
+void procmsg_subject_table_insert(GHashTable *subject_table,
+				  MsgInfo *msginfo, gpointer data)
+{
+	const gchar *key;
+
+	cm_return_if_fail(subject_table != NULL);
+	cm_return_if_fail(msginfo != NULL);
+
+	key = procmsg_msginfo_get_subject_key(msginfo);
+	if (key == NULL || *key == '\0')
+		return;
+	g_hash_table_replace(subject_table, msginfo, data);
+}
+
+void procmsg_subject_table_remove(GHashTable *subject_table,
+				  MsgInfo *msginfo)
+{
+	cm_return_if_fail(subject_table != NULL);
+	cm_return_if_fail(msginfo != NULL);
+
+	g_hash_table_remove(subject_table, msginfo);
+}
+
 /* CLAWS subject threading:
   
   in the first round it inserts subject lines in a 
@@ -125,7 +248,6 @@ struct MarkSum {
 
 static void subject_hashtable_insert(GHashTable *hashtable, GNode *node)
 {
-	gchar *subject;
 	MsgInfo *msginfo;
 	GSList *list = NULL;
 
@@ -134,37 +256,30 @@ static void subject_hashtable_insert(GHashTable *hashtable, GNode *node)
 	msginfo = (MsgInfo *) node->data;
 	cm_return_if_fail(msginfo != NULL);
 
-	subject = msginfo->subject;
-	if (subject == NULL)
+	if (procmsg_msginfo_get_subject_key(msginfo) == NULL)
 		return;
 
-	subject += subject_get_prefix_length(subject);
-
-	list = g_hash_table_lookup(hashtable, subject);
+	/* an existing key, the first message inserted, is kept */
+	list = g_hash_table_lookup(hashtable, msginfo);
 	list = g_slist_prepend(list, node);
-	g_hash_table_insert(hashtable, subject, list);
+	g_hash_table_insert(hashtable, msginfo, list);
 }
 
 static GNode *subject_hashtable_lookup(GHashTable *hashtable, MsgInfo *msginfo)
 {
-	gchar *subject;
 	GSList *list, *cur;
 	GNode *node = NULL, *hashtable_node = NULL;
-	gint prefix_length;
 	MsgInfo *hashtable_msginfo = NULL, *best_msginfo = NULL;
 	gboolean match;
     
 	cm_return_val_if_fail(hashtable != NULL, NULL);
 
-	subject = msginfo->subject;
-	if (subject == NULL)
+	if (procmsg_msginfo_get_subject_key(msginfo) == NULL)
 		return NULL;
-	prefix_length = subject_get_prefix_length(subject);
-	if (prefix_length <= 0)
+	if (!procmsg_msginfo_subject_is_reply(msginfo))
 		return NULL;
-	subject += prefix_length;
 	
-	list = g_hash_table_lookup(hashtable, subject);
+	list = g_hash_table_lookup(hashtable, msginfo);
 	if (list == NULL)
 		return NULL;
 
@@ -204,112 +319,604 @@ static void subject_hashtable_free(gpointer key, gpointer value, gpointer data)
 	g_slist_free(value);
 }
 
-/* return the reversed thread tree */
-GNode *procmsg_get_thread_tree(GSList *mlist)
+/* Message-ID threading:
+
+  every message is linked under the best parent present when it is
+  added: the In-Reply-To message, else the first message of its
+  References that is known. Parents that are still missing are
+  remembered in the waiting table (Message-ID <-> nodes), and the
+  node is moved as soon as a better parent arrives. Threads thus do
+  not depend on the order of the list, and adding a message costs
+  about the length of its References, whether the tree is being
+  built or is already shown.
+*/
+
+#define THREAD_RANK_NONE	G_MAXINT
+
+struct _MsgThreads {
+	GNode *root;
+	GHashTable *msgid_table;	/* Message-ID <-> first node with it */
+	GHashTable *waiting;		/* missing Message-ID <-> GSList of nodes */
+	GHashTable *rank;		/* node <-> rank of its parent + 1 */
+	GHashTable *marks;		/* node <-> last pass marking it */
+	guint mark;
+	GHashTable *subject_table;
+	GHashTable *msginfos;		/* MsgInfo <-> node, kept trees only */
+	gboolean by_subject;
+	gint by_subject_max_age;
+	gboolean finished;
+	/* FALSE when loaded from a thread index: the tables are empty */
+	gboolean indexed;
+	/* the thread index of the folder matches the tree */
+	gboolean saved;
+};
+
+/* 0 for In-Reply-To, n for the n-th References entry */
+static gint msg_threads_parent_rank(MsgInfo *msginfo, const gchar *msgid)
 {
-	GNode *root, *parent, *node, *next;
-	GHashTable *msgid_table;
-	GHashTable *subject_hashtable = NULL;
-	MsgInfo *msginfo;
-	const gchar *msgid;
-        GSList *reflist;
-	START_TIMING("");
-	root = g_node_new(NULL);
-	msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
-	
-	if (prefs_common.thread_by_subject) {
-		subject_hashtable = g_hash_table_new(g_str_hash, g_str_equal);
+	GSList *cur;
+	gint rank = 1;
+
+	if (msginfo->inreplyto && !strcmp(msginfo->inreplyto, msgid))
+		return 0;
+	for (cur = msginfo->references; cur != NULL; cur = cur->next, rank++)
+		if (!strcmp((gchar *)cur->data, msgid))
+			return rank;
+
+	return THREAD_RANK_NONE;
+}
+
+static gint msg_threads_get_rank(MsgThreads *threads, GNode *node)
+{
+	gpointer rank = g_hash_table_lookup(threads->rank, node);
+
+	return rank ? GPOINTER_TO_INT(rank) - 1 : THREAD_RANK_NONE;
+}
+
+static void msg_threads_set_rank(MsgThreads *threads, GNode *node, gint rank)
+{
+	g_hash_table_insert(threads->rank, node, GINT_TO_POINTER(rank + 1));
+}
+
+/* Marks node and its ancestors for a new pass, after which
+ * msg_threads_is_marked() tells in constant time whether a node is one
+ * of them, instead of walking up the tree for each node */
+static void msg_threads_mark_ancestors(MsgThreads *threads, GNode *node)
+{
+	/* a node not in the table reads as mark 0 */
+	if (++threads->mark == 0) {
+		g_hash_table_remove_all(threads->marks);
+		threads->mark = 1;
 	}
+	for (; node != NULL; node = node->parent)
+		g_hash_table_insert(threads->marks, node,
+				    GUINT_TO_POINTER(threads->mark));
+}
 
-	for (; mlist != NULL; mlist = mlist->next) {
-		msginfo = (MsgInfo *)mlist->data;
-		parent = root;
+static gboolean msg_threads_is_marked(MsgThreads *threads, GNode *node)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(threads->marks, node))
+		== threads->mark;
+}
 
-		if (msginfo->inreplyto) {
-			parent = g_hash_table_lookup(msgid_table, msginfo->inreplyto);
-			if (parent == NULL) {
-				parent = root;
+static void msg_threads_wait(MsgThreads *threads, const gchar *msgid,
+			     GNode *node)
+{
+	GSList *waiting = g_hash_table_lookup(threads->waiting, msgid);
+
+	if (waiting == NULL || waiting->data != node)
+		g_hash_table_insert(threads->waiting, (gchar *)msgid,
+				    g_slist_prepend(waiting, node));
+}
+
+/* move the nodes waiting for msgid under parent if it is better
+   than the parent they have */
+static void msg_threads_adopt(MsgThreads *threads, const gchar *msgid,
+			      GNode *parent)
+{
+	GSList *waiting, *cur;
+	GNode *node;
+	gint rank;
+	gboolean marked = FALSE;
+
+	waiting = g_hash_table_lookup(threads->waiting, msgid);
+	if (waiting == NULL)
+		return;
+	g_hash_table_remove(threads->waiting, msgid);
+
+	for (cur = waiting; cur != NULL; cur = cur->next) {
+		node = (GNode *)cur->data;
+		if (node == parent)
+			continue;
+		rank = msg_threads_parent_rank((MsgInfo *)node->data, msgid);
+		if (rank >= msg_threads_get_rank(threads, node))
+			continue;
+		/* circular reference; the nodes moved under parent don't
+		 * change its ancestors */
+		if (!marked) {
+			msg_threads_mark_ancestors(threads, parent);
+			marked = TRUE;
+		}
+		if (msg_threads_is_marked(threads, node))
+			continue;
+		g_node_unlink(node);
+		g_node_insert_before(parent, parent->children, node);
+		msg_threads_set_rank(threads, node, rank);
+	}
+	g_slist_free(waiting);
+}
+
+/* thread by subject the nodes not threaded by Message-ID which
+   would have chosen node, once the tree has been finished */
+static void msg_threads_subject_update(MsgThreads *threads, GNode *node)
+{
+	MsgInfo *msginfo = (MsgInfo *)node->data, *other;
+	GSList *list, *cur;
+	GNode *cur_node, *parent;
+	gboolean marked = FALSE;
+
+	if (procmsg_msginfo_get_subject_key(msginfo) == NULL)
+		return;
+	list = g_hash_table_lookup(threads->subject_table, msginfo);
+
+	if (node->parent == threads->root &&
+	    msg_threads_get_rank(threads, node) == THREAD_RANK_NONE) {
+		parent = subject_hashtable_lookup(threads->subject_table, msginfo);
+		if (parent != NULL && parent != node) {
+			msg_threads_mark_ancestors(threads, parent);
+			if (!msg_threads_is_marked(threads, node)) {
+				g_node_unlink(node);
+				g_node_append(parent, node);
 			}
 		}
-		node = g_node_insert_data_before
-			(parent, parent == root ? parent->children : NULL,
-			 msginfo);
-		if ((msgid = msginfo->msgid) && g_hash_table_lookup(msgid_table, msgid) == NULL)
-			g_hash_table_insert(msgid_table, (gchar *)msgid, node);
-
-		/* CLAWS: add subject to hashtable (without prefix) */
-		if (prefs_common.thread_by_subject) {
-			subject_hashtable_insert(subject_hashtable, node);
+	}
+
+	/* see subject_hashtable_lookup() */
+	for (cur = list; cur != NULL; cur = cur->next) {
+		cur_node = (GNode *)cur->data;
+		other = (MsgInfo *)cur_node->data;
+		if (cur_node == node ||
+		    msg_threads_get_rank(threads, cur_node) != THREAD_RANK_NONE)
+			continue;
+		if (msginfo->date_t >= other->date_t ||
+		    abs(difftime(other->date_t, msginfo->date_t)) >
+		    threads->by_subject_max_age * 3600 * 24)
+			continue;
+		if (cur_node->parent == threads->root) {
+			if (!procmsg_msginfo_subject_is_reply(other))
+				continue;
+		} else if (((MsgInfo *)cur_node->parent->data)->date_t <=
+			   msginfo->date_t)
+			continue;
+		/* the nodes moved under node don't change its ancestors */
+		if (!marked) {
+			msg_threads_mark_ancestors(threads, node);
+			marked = TRUE;
 		}
+		if (msg_threads_is_marked(threads, cur_node))
+			continue;
+		g_node_unlink(cur_node);
+		g_node_append(node, cur_node);
 	}
+}
 
-	/* complete the unfinished threads */
-	for (node = root->children; node != NULL; ) {
-		next = node->next;
-		msginfo = (MsgInfo *)node->data;
-		parent = NULL;
-		
-                if (msginfo->inreplyto)
-			parent = g_hash_table_lookup(msgid_table, msginfo->inreplyto);
-
-		/* try looking for the indirect parent */
-		if (!parent && msginfo->references) {
-			for (reflist = msginfo->references;
-			     reflist != NULL; reflist = reflist->next)
-				if ((parent = g_hash_table_lookup
-					(msgid_table, reflist->data)) != NULL)
-					break;
-                }                                        
-              
-		/* node should not be the parent, and node should not
-		   be an ancestor of parent (circular reference) */
-		if (parent && parent != node &&
-		    !g_node_is_ancestor(node, parent)) {
-			g_node_unlink(node);
-			g_node_insert_before
-				(parent, parent->children, node);
+static void msg_threads_add(MsgThreads *threads, MsgInfo *msginfo)
+{
+	GNode *node, *parent = NULL;
+	GSList *reflist = msginfo->references;
+	const gchar *msgid = msginfo->inreplyto;
+	gint rank;
+
+	threads->saved = FALSE;
+
+	node = g_node_new(msginfo);
+	if (threads->msginfos != NULL)
+		g_hash_table_insert(threads->msginfos,
+				    procmsg_msginfo_new_ref(msginfo), node);
+
+	/* In-Reply-To first, then the References in order */
+	for (rank = 0; ; rank++) {
+		if (rank > 0) {
+			if (reflist == NULL)
+				break;
+			msgid = (const gchar *)reflist->data;
+			reflist = reflist->next;
 		}
-               
+		if (msgid == NULL || *msgid == '\0')
+			continue;
+		if ((parent = g_hash_table_lookup(threads->msgid_table,
+						  msgid)) != NULL)
+			break;
+		msg_threads_wait(threads, msgid, node);
+	}
+
+	if (parent != NULL) {
+		g_node_append(parent, node);
+		msg_threads_set_rank(threads, node, rank);
+	} else
+		g_node_prepend(threads->root, node);
+
+	if ((msgid = msginfo->msgid) != NULL && *msgid != '\0' &&
+	    g_hash_table_lookup(threads->msgid_table, msgid) == NULL) {
+		g_hash_table_insert(threads->msgid_table, (gchar *)msgid, node);
+		msg_threads_adopt(threads, msgid, node);
+	}
+
+	/* CLAWS: add subject to hashtable (without prefix) */
+	if (threads->by_subject) {
+		subject_hashtable_insert(threads->subject_table, node);
+		if (threads->finished)
+			msg_threads_subject_update(threads, node);
+	}
+}
+
+typedef struct _MsgThreadsTops {
+	GHashTable *tops;
+	GNode *top;
+} MsgThreadsTops;
+
+static gboolean msg_threads_set_top(GNode *node, gpointer data)
+{
+	MsgThreadsTops *tops = (MsgThreadsTops *)data;
+
+	g_hash_table_insert(tops->tops, node, tops->top);
+	return FALSE;
+}
+
+/* The top level node of the thread holding node, as threads are only
+ * joined while they are threaded by subject: each joined top level
+ * node leads to the node of the thread it joined */
+static GNode *msg_threads_find_top(GHashTable *tops, GNode *node)
+{
+	GNode *top = node, *next;
+
+	while ((next = g_hash_table_lookup(tops, top)) != top)
+		top = next;
+	while (node != top) {
+		next = g_hash_table_lookup(tops, node);
+		g_hash_table_insert(tops, node, top);
 		node = next;
 	}
+	return top;
+}
+
+static void msg_threads_finish(MsgThreads *threads)
+{
+	GNode *node, *parent, *next;
+	MsgInfo *msginfo;
+	MsgThreadsTops tops;
 
-	if (prefs_common.thread_by_subject) {
+	if (threads->by_subject) {
 		START_TIMING("thread by subject");
-		for (node = root->children; node && node != NULL;) {
+		tops.tops = g_hash_table_new(g_direct_hash, g_direct_equal);
+		for (node = threads->root->children; node != NULL;
+		     node = node->next) {
+			tops.top = node;
+			g_node_traverse(node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+					msg_threads_set_top, &tops);
+		}
+
+		for (node = threads->root->children; node != NULL; node = next) {
 			next = node->next;
 			msginfo = (MsgInfo *) node->data;
-			
-			parent = subject_hashtable_lookup(subject_hashtable, msginfo);
-			
-			/* the node may already be threaded by IN-REPLY-TO, so go up 
-			 * in the tree to 
-			   find the parent node */
-			if (parent != NULL) {
-				if (g_node_is_ancestor(node, parent))
-					parent = NULL;
-				if (parent == node)
-					parent = NULL;
-			}
-			
+
+			parent = subject_hashtable_lookup(threads->subject_table,
+							  msginfo);
+
+			/* the node may already be threaded by IN-REPLY-TO, so
+			 * parent may be in its own thread */
+			if (parent != NULL &&
+			    msg_threads_find_top(tops.tops, parent) == node)
+				parent = NULL;
+
 			if (parent) {
 				g_node_unlink(node);
 				g_node_append(parent, node);
+				g_hash_table_insert(tops.tops, node,
+					msg_threads_find_top(tops.tops, parent));
 			}
+		}
+		g_hash_table_destroy(tops.tops);
+		END_TIMING();
+	}
+	threads->finished = TRUE;
+}
 
-			node = next;
-		}	
+static guint32 msg_threads_mode(void)
+{
+	if (!prefs_common.thread_by_subject)
+		return 0;
+	return ((guint32)prefs_common.thread_by_subject_max_age << 1) | 1;
+}
+
+static MsgThreads *msg_threads_alloc(gboolean keep)
+{
+	MsgThreads *threads = g_new0(MsgThreads, 1);
+
+	threads->root = g_node_new(NULL);
+	threads->msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
+	threads->waiting = g_hash_table_new(g_str_hash, g_str_equal);
+	threads->rank = g_hash_table_new(g_direct_hash, g_direct_equal);
+	threads->marks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	threads->by_subject = prefs_common.thread_by_subject;
+	threads->by_subject_max_age = prefs_common.thread_by_subject_max_age;
+	if (threads->by_subject)
+		threads->subject_table = procmsg_subject_table_new();
+	if (keep)
+		threads->msginfos = g_hash_table_new(g_direct_hash, g_direct_equal);
+	threads->indexed = TRUE;
+
+	return threads;
+}
+
+static MsgThreads *msg_threads_new(GSList *mlist, gboolean keep)
+{
+	MsgThreads *threads = msg_threads_alloc(keep);
+
+	for (; mlist != NULL; mlist = mlist->next)
+		msg_threads_add(threads, (MsgInfo *)mlist->data);
+
+	msg_threads_finish(threads);
+
+	return threads;
+}
+
+static void msg_threads_unref_msginfo(gpointer key, gpointer value, gpointer data)
+{
+	MsgInfo *msginfo = (MsgInfo *)key;
+
+	procmsg_msginfo_free(&msginfo);
+}
+
+static void msg_threads_waiting_free(gpointer key, gpointer value, gpointer data)
+{
+	g_slist_free(value);
+}
+
+/* return the reversed thread tree */
+GNode *procmsg_get_thread_tree(GSList *mlist)
+{
+	MsgThreads *threads;
+	GNode *root;
+	START_TIMING("");
+
+	threads = msg_threads_new(mlist, FALSE);
+	root = threads->root;
+	threads->root = NULL;
+	procmsg_msg_threads_free(threads);
+
+	END_TIMING();
+	return root;
+}
+
+/**
+ * procmsg_msg_threads_new:
+ * @mlist: messages to thread.
+ *
+ * Thread @mlist like procmsg_get_thread_tree(), and keep what is
+ * needed to add messages to the threads later. The messages are
+ * referenced until procmsg_msg_threads_free().
+ */
+MsgThreads *procmsg_msg_threads_new(GSList *mlist)
+{
+	MsgThreads *threads;
+	START_TIMING("");
+
+	threads = msg_threads_new(mlist, TRUE);
+
+	END_TIMING();
+	return threads;
+}
+
+/**
+ * procmsg_msg_threads_load:
+ * @item: the folder of the messages.
+ * @mlist: messages to thread.
+ *
+ * Thread @mlist from the thread index saved by
+ * procmsg_msg_threads_save(), without looking at Message-IDs or
+ * subjects. The index is used only if it holds exactly the messages
+ * of @mlist, and was built with the current threading preferences.
+ * New messages can't be added to the result, so that
+ * procmsg_msg_threads_update() fails once @mlist grows.
+ *
+ * Return value: the threads, or NULL if the index can't be used.
+ */
+MsgThreads *procmsg_msg_threads_load(FolderItem *item, GSList *mlist)
+{
+	MsgThreads *threads;
+	GHashTable *msgnums, *nodes;
+	GArray *links;
+	MsgCacheThreadLink *link;
+	MsgInfo *msginfo;
+	GNode *parent, *node;
+	guint i;
+	START_TIMING("");
+
+	cm_return_val_if_fail(item != NULL, NULL);
+
+	links = folder_item_get_thread_links(item, msg_threads_mode());
+	if (links == NULL || links->len != g_slist_length(mlist)) {
 		END_TIMING();
+		return NULL;
 	}
-	
-	if (prefs_common.thread_by_subject)
-	{
-		g_hash_table_foreach(subject_hashtable, subject_hashtable_free, NULL);
-		g_hash_table_destroy(subject_hashtable);
+
+	msgnums = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (; mlist != NULL; mlist = mlist->next) {
+		msginfo = (MsgInfo *)mlist->data;
+		g_hash_table_insert(msgnums, GUINT_TO_POINTER(msginfo->msgnum),
+				    msginfo);
+	}
+	nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+	threads = msg_threads_alloc(TRUE);
+	threads->indexed = FALSE;
+
+	for (i = 0; i < links->len; i++) {
+		link = &g_array_index(links, MsgCacheThreadLink, i);
+		msginfo = g_hash_table_lookup(msgnums,
+					      GUINT_TO_POINTER(link->msgnum));
+		if (msginfo == NULL || (guint32)msginfo->date_t != link->date_t ||
+		    g_hash_table_lookup(nodes, GUINT_TO_POINTER(link->msgnum)))
+			break;
+		if (link->parent == 0)
+			parent = threads->root;
+		else if ((parent = g_hash_table_lookup(nodes,
+				GUINT_TO_POINTER(link->parent))) == NULL)
+			break;
+
+		node = g_node_append_data(parent, msginfo);
+		g_hash_table_insert(nodes, GUINT_TO_POINTER(link->msgnum), node);
+		g_hash_table_insert(threads->msginfos,
+				    procmsg_msginfo_new_ref(msginfo), node);
+	}
+
+	g_hash_table_destroy(nodes);
+	g_hash_table_destroy(msgnums);
+
+	if (i < links->len) {
+		debug_print("thread index doesn't match the messages\n");
+		procmsg_msg_threads_free(threads);
+		END_TIMING();
+		return NULL;
 	}
 
-	g_hash_table_destroy(msgid_table);
+	threads->finished = TRUE;
+	threads->saved = TRUE;
 	END_TIMING();
-	return root;
+	return threads;
+}
+
+static gboolean msg_threads_link_func(GNode *node, gpointer data)
+{
+	GArray *links = (GArray *)data;
+	MsgCacheThreadLink link;
+	MsgInfo *msginfo = (MsgInfo *)node->data;
+
+	if (msginfo == NULL)
+		return FALSE;
+
+	link.msgnum = msginfo->msgnum;
+	link.parent = node->parent->data ?
+		((MsgInfo *)node->parent->data)->msgnum : 0;
+	link.date_t = (guint32)msginfo->date_t;
+	g_array_append_val(links, link);
+
+	return FALSE;
+}
+
+/**
+ * procmsg_msg_threads_save:
+ * @threads: the threads.
+ * @item: the folder of the messages.
+ *
+ * Keep the parent of every message of @threads as the thread index
+ * of @item, written along with its cache, for
+ * procmsg_msg_threads_load(). Does nothing if @threads did not change
+ * since they were last saved or loaded.
+ */
+void procmsg_msg_threads_save(MsgThreads *threads, FolderItem *item)
+{
+	GArray *links;
+
+	cm_return_if_fail(threads != NULL);
+	cm_return_if_fail(threads->msginfos != NULL);
+	cm_return_if_fail(item != NULL);
+
+	if (threads->saved)
+		return;
+
+	links = g_array_sized_new(FALSE, FALSE, sizeof(MsgCacheThreadLink),
+				  g_hash_table_size(threads->msginfos));
+	g_node_traverse(threads->root, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+			msg_threads_link_func, links);
+	folder_item_set_thread_links(item, links, msg_threads_mode());
+	threads->saved = TRUE;
+}
+
+/**
+ * procmsg_msg_threads_update:
+ * @threads: threads built by procmsg_msg_threads_new().
+ * @mlist: the messages the threads should now hold.
+ *
+ * Add the messages of @mlist missing in @threads. Removing messages
+ * is not supported: if some message of @threads is not in @mlist,
+ * or the threading preferences changed, nothing is done and FALSE
+ * is returned so that the caller builds new threads.
+ *
+ * Return value: TRUE if @threads now hold @mlist.
+ */
+gboolean procmsg_msg_threads_update(MsgThreads *threads, GSList *mlist)
+{
+	GSList *cur, *added = NULL;
+	guint known = 0, count = 0;
+
+	cm_return_val_if_fail(threads != NULL, FALSE);
+	cm_return_val_if_fail(threads->msginfos != NULL, FALSE);
+
+	if (threads->by_subject != prefs_common.thread_by_subject ||
+	    threads->by_subject_max_age != prefs_common.thread_by_subject_max_age)
+		return FALSE;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		if (g_hash_table_lookup(threads->msginfos, cur->data) != NULL)
+			known++;
+		else
+			added = g_slist_prepend(added, cur->data);
+	}
+	/* loaded threads know the parents but not the Message-IDs */
+	if (known != g_hash_table_size(threads->msginfos) ||
+	    (added != NULL && !threads->indexed)) {
+		g_slist_free(added);
+		return FALSE;
+	}
+
+	added = g_slist_reverse(added);
+	for (cur = added; cur != NULL; cur = cur->next, count++)
+		msg_threads_add(threads, (MsgInfo *)cur->data);
+	g_slist_free(added);
+
+	debug_print("threads: %u messages added, %u kept\n", count, known);
+	return TRUE;
+}
+
+/**
+ * procmsg_msg_threads_get_root:
+ * @threads: the threads.
+ *
+ * Return value: the root of the thread tree, owned by @threads. The
+ * order of its children is not meaningful once messages have been
+ * added by procmsg_msg_threads_update().
+ */
+GNode *procmsg_msg_threads_get_root(MsgThreads *threads)
+{
+	cm_return_val_if_fail(threads != NULL, NULL);
+
+	return threads->root;
+}
+
+void procmsg_msg_threads_free(MsgThreads *threads)
+{
+	if (threads == NULL)
+		return;
+
+	if (threads->root != NULL)
+		g_node_destroy(threads->root);
+	if (threads->msginfos != NULL) {
+		g_hash_table_foreach(threads->msginfos,
+				     msg_threads_unref_msginfo, NULL);
+		g_hash_table_destroy(threads->msginfos);
+	}
+	if (threads->subject_table != NULL) {
+		g_hash_table_foreach(threads->subject_table,
+				     subject_hashtable_free, NULL);
+		g_hash_table_destroy(threads->subject_table);
+	}
+	g_hash_table_foreach(threads->waiting, msg_threads_waiting_free, NULL);
+	g_hash_table_destroy(threads->waiting);
+	g_hash_table_destroy(threads->rank);
+	g_hash_table_destroy(threads->marks);
+	g_hash_table_destroy(threads->msgid_table);
+	g_free(threads);
 }
 
 gint procmsg_move_messages(GSList *mlist)
@@ -1182,6 +1789,166 @@ gint procmsg_save_to_outbox(FolderItem *outbox, const gchar *file,
 }
 
 
+/* Addresses and newsgroups repeat a lot across a folder (think of
+ * mailing lists), so cached and copied MsgInfos share them. */
+static StringTable *msginfo_strings = NULL;
+
+static gchar *procmsg_string_intern(const gchar *str)
+{
+	if (str == NULL)
+		return NULL;
+
+	if (msginfo_strings == NULL)
+		msginfo_strings = string_table_new();
+
+	return string_table_insert_string(msginfo_strings, str);
+}
+
+static void procmsg_string_release(const gchar *str)
+{
+	if (str == NULL || msginfo_strings == NULL)
+		return;
+
+	string_table_free_string(msginfo_strings, str);
+}
+
+void procmsg_msginfo_intern_strings(MsgInfo *msginfo)
+{
+	gchar *tmp;
+
+	/* arena strings are already shared within their folder */
+	if (msginfo == NULL || msginfo->interned || msginfo->arena)
+		return;
+
+#define MEMBINTERN(mmb)	{ tmp = procmsg_string_intern(msginfo->mmb); \
+			  g_free(msginfo->mmb); \
+			  msginfo->mmb = tmp; }
+	MEMBINTERN(fromname);
+	MEMBINTERN(from);
+	MEMBINTERN(to);
+	MEMBINTERN(cc);
+	MEMBINTERN(newsgroups);
+#undef MEMBINTERN
+
+	msginfo->interned = TRUE;
+}
+
+guint procmsg_msginfo_interned_memusage(void)
+{
+	if (msginfo_strings == NULL)
+		return 0;
+
+	return string_table_get_memusage(msginfo_strings);
+}
+
+/* A cache arena hands out MsgInfos in blocks and copies their header
+ * strings into a string chunk, so that loading a folder cache costs a
+ * few large allocations and dropping it a few large frees. MsgInfos
+ * still count their references as usual; the arena itself goes away
+ * once its owner released it and the last of its MsgInfos is freed,
+ * so MsgInfos that escaped the cache stay valid. */
+#define ARENA_BLOCK_MSGS	256
+
+struct _MsgInfoArena {
+	GSList		*blocks;
+	guint		 block_used;
+	GStringChunk	*strings;
+	GHashTable	*shared;
+	guint		 memusage;
+	guint		 live;
+	gboolean	 released;
+};
+
+MsgInfoArena *procmsg_arena_new(void)
+{
+	MsgInfoArena *arena;
+
+	arena = g_new0(MsgInfoArena, 1);
+	arena->strings = g_string_chunk_new(16 * 1024);
+	arena->shared = g_hash_table_new(g_str_hash, g_str_equal);
+	arena->block_used = ARENA_BLOCK_MSGS;
+
+	return arena;
+}
+
+static void procmsg_arena_free(MsgInfoArena *arena)
+{
+	GSList *cur;
+
+	for (cur = arena->blocks; cur != NULL; cur = cur->next)
+		g_free(cur->data);
+	g_slist_free(arena->blocks);
+	g_hash_table_destroy(arena->shared);
+	g_string_chunk_free(arena->strings);
+	g_free(arena);
+}
+
+void procmsg_arena_release(MsgInfoArena *arena)
+{
+	cm_return_if_fail(arena != NULL);
+	cm_return_if_fail(!arena->released);
+
+	arena->released = TRUE;
+	if (arena->live == 0)
+		procmsg_arena_free(arena);
+}
+
+MsgInfo *procmsg_arena_msginfo_new(MsgInfoArena *arena)
+{
+	MsgInfo *newmsginfo;
+
+	cm_return_val_if_fail(arena != NULL, NULL);
+	cm_return_val_if_fail(!arena->released, NULL);
+
+	if (arena->block_used == ARENA_BLOCK_MSGS) {
+		arena->blocks = g_slist_prepend(arena->blocks,
+				g_new0(MsgInfo, ARENA_BLOCK_MSGS));
+		arena->block_used = 0;
+	}
+	newmsginfo = (MsgInfo *)arena->blocks->data + arena->block_used;
+	arena->block_used++;
+	arena->live++;
+
+	newmsginfo->refcnt = 1;
+	newmsginfo->arena = arena;
+
+	return newmsginfo;
+}
+
+/* Copies len bytes of str into the arena. Shared strings are stored
+ * once per arena, which is worth it for addresses and newsgroups. */
+gchar *procmsg_arena_strndup(MsgInfoArena *arena, const gchar *str,
+			     gsize len, gboolean shared)
+{
+	gchar buf[BUFFSIZE];
+	gchar *newstr;
+
+	cm_return_val_if_fail(arena != NULL, NULL);
+	cm_return_val_if_fail(str != NULL, NULL);
+
+	if (shared && len < sizeof(buf)) {
+		memcpy(buf, str, len);
+		buf[len] = '\0';
+		newstr = g_hash_table_lookup(arena->shared, buf);
+		if (newstr != NULL)
+			return newstr;
+		newstr = g_string_chunk_insert_len(arena->strings, buf, len);
+		g_hash_table_insert(arena->shared, newstr, newstr);
+	} else
+		newstr = g_string_chunk_insert_len(arena->strings, str, len);
+
+	arena->memusage += len + 1;
+
+	return newstr;
+}
+
+guint procmsg_arena_memusage(MsgInfoArena *arena)
+{
+	cm_return_val_if_fail(arena != NULL, 0);
+
+	return arena->memusage;
+}
+
 MsgInfo *procmsg_msginfo_new_ref(MsgInfo *msginfo)
 {
 	msginfo->refcnt++;
@@ -1235,6 +2002,7 @@ MsgInfo *procmsg_msginfo_copy(MsgInfo *msginfo)
 #define MEMBCOPY(mmb)	newmsginfo->mmb = msginfo->mmb
 #define MEMBDUP(mmb)	newmsginfo->mmb = msginfo->mmb ? \
 			g_strdup(msginfo->mmb) : NULL
+#define MEMBINTERN(mmb)	newmsginfo->mmb = procmsg_string_intern(msginfo->mmb)
 
 	MEMBCOPY(msgnum);
 	MEMBCOPY(size);
@@ -1243,13 +2011,14 @@ MsgInfo *procmsg_msginfo_copy(MsgInfo *msginfo)
 
 	MEMBCOPY(flags);
 
-	MEMBDUP(fromname);
+	MEMBINTERN(fromname);
 
 	MEMBDUP(date);
-	MEMBDUP(from);
-	MEMBDUP(to);
-	MEMBDUP(cc);
-	MEMBDUP(newsgroups);
+	MEMBINTERN(from);
+	MEMBINTERN(to);
+	MEMBINTERN(cc);
+	MEMBINTERN(newsgroups);
+	newmsginfo->interned = TRUE;
 	MEMBDUP(subject);
 	MEMBDUP(msgid);
 	MEMBDUP(inreplyto);
@@ -1373,6 +2142,7 @@ MsgInfo *procmsg_msginfo_get_full_info(MsgInfo *msginfo)
 }
 
 #define FREENULL(n) { g_free(n); n = NULL; }
+#define RELEASENULL(n) { procmsg_string_release(n); n = NULL; }
 void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 {
 	MsgInfo *msginfo = *msginfo_ptr;
@@ -1390,17 +2160,29 @@ void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 
 	FREENULL(msginfo->fromspace);
 
-	FREENULL(msginfo->fromname);
+	if (msginfo->arena) {
+		/* the header strings live in the arena */
+	} else if (msginfo->interned) {
+		RELEASENULL(msginfo->fromname);
+		RELEASENULL(msginfo->from);
+		RELEASENULL(msginfo->to);
+		RELEASENULL(msginfo->cc);
+		RELEASENULL(msginfo->newsgroups);
+	} else {
+		FREENULL(msginfo->fromname);
+		FREENULL(msginfo->from);
+		FREENULL(msginfo->to);
+		FREENULL(msginfo->cc);
+		FREENULL(msginfo->newsgroups);
+	}
 
-	FREENULL(msginfo->date);
-	FREENULL(msginfo->from);
-	FREENULL(msginfo->to);
-	FREENULL(msginfo->cc);
-	FREENULL(msginfo->newsgroups);
-	FREENULL(msginfo->subject);
-	FREENULL(msginfo->msgid);
-	FREENULL(msginfo->inreplyto);
-	FREENULL(msginfo->xref);
+	if (msginfo->arena == NULL) {
+		FREENULL(msginfo->date);
+		FREENULL(msginfo->subject);
+		FREENULL(msginfo->msgid);
+		FREENULL(msginfo->inreplyto);
+		FREENULL(msginfo->xref);
+	}
 
 	if (msginfo->extradata) {
 		if (msginfo->extradata->avatars) {
@@ -1424,17 +2206,30 @@ void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 		FREENULL(msginfo->extradata->resent_from);
 		FREENULL(msginfo->extradata);
 	}
-	slist_free_strings_full(msginfo->references);
+	if (msginfo->arena)
+		g_slist_free(msginfo->references);
+	else
+		slist_free_strings_full(msginfo->references);
 	msginfo->references = NULL;
 	g_slist_free(msginfo->tags);
 	msginfo->tags = NULL;
 
+	if (msginfo->subject_key_owned)
+		FREENULL(msginfo->subject_key);
+
 	FREENULL(msginfo->plaintext_file);
 
-	g_free(msginfo);
+	if (msginfo->arena) {
+		MsgInfoArena *arena = msginfo->arena;
+
+		if (--arena->live == 0 && arena->released)
+			procmsg_arena_free(arena);
+	} else
+		g_free(msginfo);
 	*msginfo_ptr = NULL;
 }
 #undef FREENULL
+#undef RELEASENULL
 
 guint procmsg_msginfo_memusage(MsgInfo *msginfo)
 {
@@ -1442,31 +2237,40 @@ guint procmsg_msginfo_memusage(MsgInfo *msginfo)
 	GSList *tmp;
 	
 	memusage += sizeof(MsgInfo);
-	if (msginfo->fromname)
-		memusage += strlen(msginfo->fromname);
-	if (msginfo->date)
-		memusage += strlen(msginfo->date);
-	if (msginfo->from)
-		memusage += strlen(msginfo->from);
-	if (msginfo->to)
-		memusage += strlen(msginfo->to);
-	if (msginfo->cc)
-		memusage += strlen(msginfo->cc);
-	if (msginfo->newsgroups)
-		memusage += strlen(msginfo->newsgroups);
-	if (msginfo->subject)
-		memusage += strlen(msginfo->subject);
-	if (msginfo->msgid)
-		memusage += strlen(msginfo->msgid);
-	if (msginfo->inreplyto)
-		memusage += strlen(msginfo->inreplyto);
+	/* shared and arena strings are accounted for once, in
+	 * procmsg_msginfo_interned_memusage() and procmsg_arena_memusage() */
+	if (!msginfo->interned && !msginfo->arena) {
+		if (msginfo->fromname)
+			memusage += strlen(msginfo->fromname);
+		if (msginfo->from)
+			memusage += strlen(msginfo->from);
+		if (msginfo->to)
+			memusage += strlen(msginfo->to);
+		if (msginfo->cc)
+			memusage += strlen(msginfo->cc);
+		if (msginfo->newsgroups)
+			memusage += strlen(msginfo->newsgroups);
+	}
+	if (!msginfo->arena) {
+		if (msginfo->date)
+			memusage += strlen(msginfo->date);
+		if (msginfo->subject)
+			memusage += strlen(msginfo->subject);
+		if (msginfo->msgid)
+			memusage += strlen(msginfo->msgid);
+		if (msginfo->inreplyto)
+			memusage += strlen(msginfo->inreplyto);
+	}
 
 	for (tmp = msginfo->references; tmp; tmp=tmp->next) {
 		gchar *r = (gchar *)tmp->data;
-		memusage += r?strlen(r):0 + sizeof(GSList);
+		memusage += r && !msginfo->arena ? strlen(r) : 0;
+		memusage += sizeof(GSList);
 	}
 	if (msginfo->fromspace)
 		memusage += strlen(msginfo->fromspace);
+	if (msginfo->subject_key_owned)
+		memusage += strlen(msginfo->subject_key);
 
 	for (tmp = msginfo->tags; tmp; tmp=tmp->next) {
 		memusage += sizeof(GSList);
@@ -1957,6 +2761,8 @@ void procmsg_msginfo_set_flags(MsgInfo *msginfo, MsgPermFlags perm_flags, MsgTmp
 
 	/* update notification */
 	if ((perm_flags_old != perm_flags_new) || (tmp_flags_old != msginfo->flags.tmp_flags)) {
+		if (msginfo->folder->cache)
+			msgcache_update_flags(msginfo->folder->cache, msginfo);
 		msginfo_update.msginfo = msginfo;
 		msginfo_update.flags = MSGINFO_UPDATE_FLAGS;
 		hooks_invoke(MSGINFO_UPDATE_HOOKLIST, &msginfo_update);
@@ -1993,6 +2799,8 @@ void procmsg_msginfo_unset_flags(MsgInfo *msginfo, MsgPermFlags perm_flags, MsgT
 
 	/* update notification */
 	if ((perm_flags_old != perm_flags_new) || (tmp_flags_old != msginfo->flags.tmp_flags)) {
+		if (msginfo->folder->cache)
+			msgcache_update_flags(msginfo->folder->cache, msginfo);
 		msginfo_update.msginfo = msginfo;
 		msginfo_update.flags = MSGINFO_UPDATE_FLAGS;
 		hooks_invoke(MSGINFO_UPDATE_HOOKLIST, &msginfo_update);
@@ -2039,6 +2847,8 @@ void procmsg_msginfo_change_flags(MsgInfo *msginfo,
 
 	/* update notification */
 	if ((perm_flags_old != perm_flags_new) || (tmp_flags_old != msginfo->flags.tmp_flags)) {
+		if (msginfo->folder->cache)
+			msgcache_update_flags(msginfo->folder->cache, msginfo);
 		msginfo_update.msginfo = msginfo;
 		msginfo_update.flags = MSGINFO_UPDATE_FLAGS;
 		hooks_invoke(MSGINFO_UPDATE_HOOKLIST, &msginfo_update);
@@ -2046,6 +2856,129 @@ void procmsg_msginfo_change_flags(MsgInfo *msginfo,
 	}
 }
 
+/* Changes the flags of messages that all belong to item. */
+static void procmsg_msglist_change_flags_in_item(FolderItem *item,
+				MsgInfoList *msglist,
+				MsgPermFlags add_perm_flags, MsgTmpFlags add_tmp_flags,
+				MsgPermFlags rem_perm_flags, MsgTmpFlags rem_tmp_flags)
+{
+	GHashTable *new_flags, *old_flags;
+	MsgInfoList *changed = NULL, *updated = NULL, *cur;
+	MsgInfoUpdate msginfo_update;
+
+	debug_print("Changing flags for %d messages in folder %s\n",
+		    g_slist_length(msglist), item->path);
+
+	/* Perm Flags handling */
+	new_flags = g_hash_table_new(g_direct_hash, g_direct_equal);
+	old_flags = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		MsgPermFlags perm_flags_new, perm_flags_old;
+
+		perm_flags_old = msginfo->flags.perm_flags;
+		perm_flags_new = (msginfo->flags.perm_flags & ~rem_perm_flags) | add_perm_flags;
+		if ((add_perm_flags & MSG_IGNORE_THREAD) || (perm_flags_old & MSG_IGNORE_THREAD)) {
+			perm_flags_new &= ~(MSG_NEW | MSG_UNREAD);
+		}
+		if ((add_perm_flags & MSG_WATCH_THREAD) || (perm_flags_old & MSG_WATCH_THREAD)) {
+			perm_flags_new &= ~(MSG_IGNORE_THREAD);
+		}
+		if (perm_flags_old == perm_flags_new)
+			continue;
+
+		changed = g_slist_prepend(changed, msginfo);
+		g_hash_table_insert(new_flags, msginfo,
+				    GUINT_TO_POINTER(perm_flags_new));
+		g_hash_table_insert(old_flags, msginfo,
+				    GUINT_TO_POINTER(perm_flags_old));
+	}
+	changed = g_slist_reverse(changed);
+
+	if (changed != NULL) {
+		folder_item_change_msgs_flags(item, changed, new_flags);
+
+		for (cur = changed; cur != NULL; cur = cur->next)
+			update_folder_msg_counts(item, (MsgInfo *)cur->data,
+				GPOINTER_TO_UINT(g_hash_table_lookup(old_flags,
+								     cur->data)));
+		summary_update_unread(mainwindow_get_mainwindow()->summaryview, NULL);
+	}
+
+	/* Tmp flags handling */
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		MsgTmpFlags tmp_flags_old = msginfo->flags.tmp_flags;
+
+		msginfo->flags.tmp_flags &= ~rem_tmp_flags;
+		msginfo->flags.tmp_flags |= add_tmp_flags;
+
+		if (tmp_flags_old != msginfo->flags.tmp_flags
+		    || g_hash_table_lookup_extended(old_flags, msginfo, NULL, NULL))
+			updated = g_slist_prepend(updated, msginfo);
+	}
+	updated = g_slist_reverse(updated);
+
+	/* update notification */
+	for (cur = updated; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (item->cache)
+			msgcache_update_flags(item->cache, msginfo);
+		msginfo_update.msginfo = msginfo;
+		msginfo_update.flags = MSGINFO_UPDATE_FLAGS;
+		hooks_invoke(MSGINFO_UPDATE_HOOKLIST, &msginfo_update);
+	}
+	if (updated != NULL)
+		folder_item_update(item, F_ITEM_UPDATE_MSGCNT);
+
+	g_slist_free(updated);
+	g_slist_free(changed);
+	g_hash_table_destroy(new_flags);
+	g_hash_table_destroy(old_flags);
+}
+
+/*!
+ *\brief	Change the flags of a list of messages
+ *
+ *\param	msglist Messages to change, usually from the same folder
+ *
+ * Does the same as procmsg_msginfo_change_flags() on each message, but
+ * gives the changes of all messages of a folder to its FolderClass at
+ * once, and updates the folder and the summary once per folder.
+ */
+void procmsg_msglist_change_flags(MsgInfoList *msglist,
+				MsgPermFlags add_perm_flags, MsgTmpFlags add_tmp_flags,
+				MsgPermFlags rem_perm_flags, MsgTmpFlags rem_tmp_flags)
+{
+	MsgInfoList *cur, *run = NULL;
+	FolderItem *item = NULL;
+
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (msginfo == NULL || msginfo->folder == NULL)
+			continue;
+		if (msginfo->folder != item && run != NULL) {
+			run = g_slist_reverse(run);
+			procmsg_msglist_change_flags_in_item(item, run,
+				add_perm_flags, add_tmp_flags,
+				rem_perm_flags, rem_tmp_flags);
+			g_slist_free(run);
+			run = NULL;
+		}
+		item = msginfo->folder;
+		run = g_slist_prepend(run, msginfo);
+	}
+	if (run != NULL) {
+		run = g_slist_reverse(run);
+		procmsg_msglist_change_flags_in_item(item, run,
+			add_perm_flags, add_tmp_flags,
+			rem_perm_flags, rem_tmp_flags);
+		g_slist_free(run);
+	}
+}
+
 /*!
  *\brief	check for flags (e.g. mark) in prior msgs of current thread
  *
@@ -234,6 +234,22 @@ struct _MsgInfo
 	GSList *tags;
 
 	MsgInfoExtraData *extradata;
+
+	/* fromname, from, to, cc and newsgroups belong to the shared
+	 * string table, see procmsg_msginfo_intern_strings() */
+	gboolean interned;
+
+	/* the MsgInfo and its header strings belong to a cache arena,
+	 * see procmsg_arena_new() */
+	MsgInfoArena *arena;
+
+	/* subject without reply prefixes and surrounding blanks, and
+	 * its hash, see procmsg_msginfo_get_subject_key() */
+	gchar *subject_key;
+	guint subject_hash;
+	guint subject_key_set	: 1;
+	guint subject_key_owned	: 1;
+	guint subject_is_reply	: 1;
 };
 
 struct _MsgInfoExtraData
@@ -305,8 +321,31 @@ void	procmsg_get_mark_sum		(const gchar	*folder,
 					 gint		*max,
 					 gint		 first);
 
+const gchar *procmsg_msginfo_get_subject_key
+					(MsgInfo	*msginfo);
+gboolean procmsg_msginfo_subject_is_reply
+					(MsgInfo	*msginfo);
+GHashTable *procmsg_subject_table_new	(void);
+gpointer procmsg_subject_table_lookup	(GHashTable	*subject_table,
+					 MsgInfo	*msginfo);
+void	procmsg_subject_table_insert	(GHashTable	*subject_table,
+					 MsgInfo	*msginfo,
+					 gpointer	 data);
+void	procmsg_subject_table_remove	(GHashTable	*subject_table,
+					 MsgInfo	*msginfo);
+
 GNode  *procmsg_get_thread_tree		(GSList		*mlist);
 
+MsgThreads *procmsg_msg_threads_new	(GSList		*mlist);
+MsgThreads *procmsg_msg_threads_load	(FolderItem	*item,
+					 GSList		*mlist);
+void	procmsg_msg_threads_save	(MsgThreads	*threads,
+					 FolderItem	*item);
+gboolean procmsg_msg_threads_update	(MsgThreads	*threads,
+					 GSList		*mlist);
+GNode  *procmsg_msg_threads_get_root	(MsgThreads	*threads);
+void	procmsg_msg_threads_free	(MsgThreads	*threads);
+
 gint	procmsg_move_messages		(GSList		*mlist);
 void	procmsg_copy_messages		(GSList		*mlist);
 
@@ -344,6 +383,17 @@ MsgInfo *procmsg_msginfo_get_full_info_from_file
 					const gchar *file);
 void	 procmsg_msginfo_free		(MsgInfo	**msginfo);
 guint	 procmsg_msginfo_memusage	(MsgInfo	*msginfo);
+void	 procmsg_msginfo_intern_strings	(MsgInfo	*msginfo);
+guint	 procmsg_msginfo_interned_memusage(void);
+
+MsgInfoArena *procmsg_arena_new		(void);
+void	 procmsg_arena_release		(MsgInfoArena	*arena);
+MsgInfo *procmsg_arena_msginfo_new	(MsgInfoArena	*arena);
+gchar	*procmsg_arena_strndup		(MsgInfoArena	*arena,
+					 const gchar	*str,
+					 gsize		 len,
+					 gboolean	 shared);
+guint	 procmsg_arena_memusage		(MsgInfoArena	*arena);
 
 gint procmsg_send_message_queue_with_lock(const gchar *file,
 					  gchar **errstr,
@@ -368,6 +418,11 @@ void procmsg_msginfo_change_flags	(MsgInfo *msginfo,
 					 MsgTmpFlags add_tmp_flags,
 					 MsgPermFlags rem_perm_flags, 
 					 MsgTmpFlags rem_tmp_flags);
+void procmsg_msglist_change_flags	(MsgInfoList *msglist,
+					 MsgPermFlags add_perm_flags,
+					 MsgTmpFlags add_tmp_flags,
+					 MsgPermFlags rem_perm_flags,
+					 MsgTmpFlags rem_tmp_flags);
 gint procmsg_remove_special_headers	(const gchar 	*in, 
 					 const gchar 	*out);
 
@@ -49,6 +49,15 @@ typedef struct _MsgInfoExtraData	MsgInfoExtraData;
 struct _MsgInfoAvatar;
 typedef struct _MsgInfoAvatar		MsgInfoAvatar;
 
+struct _MsgInfoArena;
+typedef struct _MsgInfoArena		MsgInfoArena;
+
+struct _MsgCacheColumns;
+typedef struct _MsgCacheColumns		MsgCacheColumns;
+
+struct _MsgThreads;
+typedef struct _MsgThreads		MsgThreads;
+
 typedef GSList MsgInfoList;
 typedef GSList MsgNumberList;
 
@@ -87,6 +87,11 @@
 #define SUMMARY_COL_LOCKED_WIDTH	13
 #define SUMMARY_COL_MIME_WIDTH		11
 
+/* rows keeping their text when it is only set for drawn rows */
+#define SUMMARY_TEXT_CACHE_MIN_ROWS	256
+/* rows inserted per idle step once the newest ones are shown */
+#define SUMMARY_PROGRESSIVE_CHUNK	2000
+
 static int normal_row_height = -1;
 static GtkStyle *bold_style;
 static GtkStyle *bold_marked_style;
@@ -162,6 +167,17 @@ static void summary_status_show		(SummaryView		*summaryview);
 static void summary_set_column_titles	(SummaryView		*summaryview);
 static void summary_set_ctree_from_list	(SummaryView		*summaryview,
 					 GSList			*mlist);
+static void summary_progressive_cancel	(SummaryView		*summaryview);
+static void summary_progressive_finish	(SummaryView		*summaryview);
+static void summary_progressive_insert_flagged
+					(SummaryView		*summaryview,
+					 MsgPermFlags		 flags);
+static void summary_progressive_insert_msgnum
+					(SummaryView		*summaryview,
+					 guint			 msgnum);
+static GtkCMCTreeNode *summary_get_end_node
+					(SummaryView		*summaryview,
+					 gboolean		 last);
 static inline void summary_set_header	(SummaryView		*summaryview,
 					 gchar			*text[],
 					 MsgInfo		*msginfo);
@@ -340,54 +356,10 @@ static gboolean summary_drag_motion_cb(GtkWidget      *widget,
 static void summary_drag_end(GtkWidget *widget,
 					  GdkDragContext *drag_context,
 					  SummaryView 	 *summaryview);
-/* custom compare functions for sorting */
-
-static gint summary_cmp_by_mark		(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_status	(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_mime		(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_num		(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_size		(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_date		(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_thread_date	(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_from		(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_simplified_subject
-					(GtkCMCList 		*clist, 
-					 gconstpointer 		 ptr1, 
-					 gconstpointer 		 ptr2);
-static gint summary_cmp_by_score	(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_label	(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_to		(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_subject	(GtkCMCList		*clist,
-					 gconstpointer		 ptr1,
-					 gconstpointer		 ptr2);
-static gint summary_cmp_by_locked	(GtkCMCList 		*clist,
-				         gconstpointer 		 ptr1, 
-					 gconstpointer 		 ptr2);
-static gint summary_cmp_by_tags		(GtkCMCList 		*clist,
-				         gconstpointer 		 ptr1, 
-					 gconstpointer 		 ptr2);
+static void summary_sort_key_func	(GtkSCTree		*sctree,
+					 GtkCMCTreeNode		*node,
+					 GtkSCTreeSortKey	*key,
+					 gpointer		 data);
 
 static void quicksearch_execute_cb	(QuickSearch    *quicksearch,
 					 gpointer	 data);
@@ -1192,6 +1164,16 @@ static gboolean summary_check_consistency(FolderItem *item, GSList *mlist)
 	return TRUE;
 }
 
+/* Scans item and shows it again */
+void summary_rescan(SummaryView *summaryview, FolderItem *item)
+{
+	cm_return_if_fail(summaryview != NULL);
+	cm_return_if_fail(item != NULL);
+
+	folder_item_scan(item);
+	summary_show(summaryview, item);
+}
+
 gboolean summaryview_search_root_progress(gpointer data, guint at, guint matched, guint total)
 {
 	SummaryView *summaryview = (SummaryView*) data;
@@ -1295,6 +1277,10 @@ gboolean summary_show(SummaryView *summaryview, FolderItem *item)
 	summary_freeze(summaryview);
 
 	summary_clear_list(summaryview);
+	if (!is_refresh) {
+		procmsg_msg_threads_free(summaryview->threads);
+		summaryview->threads = NULL;
+	}
 
 	buf = NULL;
 	if (!item || !item->path || !folder_item_parent(item) || item->no_select) {
@@ -1462,22 +1448,17 @@ gboolean summary_show(SummaryView *summaryview, FolderItem *item)
 				   message, but do not display it */
 				node = summary_find_next_flagged_msg(summaryview, NULL,
 								     MSG_UNREAD, FALSE);
-				if (node == NULL && GTK_CMCLIST(ctree)->row_list != NULL)
-					node = gtk_cmctree_node_nth
-						(ctree,
-						 item->sort_type == SORT_DESCENDING
-						 ? 0 : GTK_CMCLIST(ctree)->rows - 1);
+				if (node == NULL)
+					node = summary_get_end_node(summaryview,
+						item->sort_type != SORT_DESCENDING);
 				summary_unlock(summaryview);
 				summary_select_node(summaryview, node, FALSE, TRUE);
 				summary_lock(summaryview);
 			}
 		} else {
 			/* just select first/last */
-			if (GTK_CMCLIST(ctree)->row_list != NULL)
-				node = gtk_cmctree_node_nth
-					(ctree,
-					 item->sort_type == SORT_DESCENDING
-					 ? 0 : GTK_CMCLIST(ctree)->rows - 1);
+			node = summary_get_end_node(summaryview,
+					item->sort_type != SORT_DESCENDING);
 			gtk_sctree_select(GTK_SCTREE(ctree), node);
 			summaryview->selected = node;
 			gtk_cmctree_node_moveto(ctree, node, 0, 0.5, 0);
@@ -1520,20 +1501,12 @@ gboolean summary_show(SummaryView *summaryview, FolderItem *item)
 				}
 				break;
 			case ACTION_LAST_LIST:
-				if (GTK_CMCLIST(ctree)->row_list != NULL) {
-					node = gtk_cmctree_node_nth
-						(ctree,
-						 item->sort_type == SORT_DESCENDING
-						 ? 0 : GTK_CMCLIST(ctree)->rows - 1);
-				}
+				node = summary_get_end_node(summaryview,
+						item->sort_type != SORT_DESCENDING);
 				break;
 			case ACTION_FIRST_LIST:
-				if (GTK_CMCLIST(ctree)->row_list != NULL) {
-					node = gtk_cmctree_node_nth
-						(ctree,
-						 item->sort_type == SORT_ASCENDING
-						 ? 0 : GTK_CMCLIST(ctree)->rows - 1);
-				}
+				node = summary_get_end_node(summaryview,
+						item->sort_type != SORT_ASCENDING);
 				break;
 			case ACTION_NOTHING:
 			case ACTION_UNSET:
@@ -1587,6 +1560,7 @@ void summary_clear_list(SummaryView *summaryview)
 
 	summary_freeze(summaryview);
 
+	summary_progressive_cancel(summaryview);
 	gtk_cmctree_pre_recursive(GTK_CMCTREE(summaryview->ctree),
 				NULL, summary_free_msginfo_func, NULL);
 
@@ -1630,6 +1604,8 @@ void summary_clear_all(SummaryView *summaryview)
 {
 	messageview_clear(summaryview->messageview);
 	summary_clear_list(summaryview);
+	procmsg_msg_threads_free(summaryview->threads);
+	summaryview->threads = NULL;
 	summary_set_menu_sensitive(summaryview);
 	toolbar_main_set_sensitive(summaryview->mainwin);
 	summary_status_show(summaryview);
@@ -2324,6 +2300,8 @@ static GtkCMCTreeNode *summary_find_prev_flagged_msg(SummaryView *summaryview,
 	GtkCMCTreeNode *node;
 	MsgInfo *msginfo;
 
+	summary_progressive_insert_flagged(summaryview, flags);
+
 	if (current_node) {
 		if (start_from_prev)
 			node = GTK_CMCTREE_NODE_PREV(current_node);
@@ -2349,6 +2327,8 @@ static GtkCMCTreeNode *summary_find_next_flagged_msg(SummaryView *summaryview,
 	GtkCMCTreeNode *node;
 	MsgInfo *msginfo;
 
+	summary_progressive_insert_flagged(summaryview, flags);
+
 	if (current_node) {
 		if (start_from_next)
 			node = gtkut_ctree_node_next(ctree, current_node);
@@ -2377,6 +2357,8 @@ static GtkCMCTreeNode *summary_find_msg_by_msgnum(SummaryView *summaryview,
 	GtkCMCTreeNode *node;
 	MsgInfo *msginfo;
 
+	summary_progressive_insert_msgnum(summaryview, msgnum);
+
 	node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list);
 
 	for (; node != NULL; node = gtkut_ctree_node_next(ctree, node)) {
@@ -2387,31 +2369,6 @@ static GtkCMCTreeNode *summary_find_msg_by_msgnum(SummaryView *summaryview,
 	return node;
 }
 
-static guint attract_hash_func(gconstpointer key)
-{
-	gchar *str;
-	gchar *p;
-	guint h;
-
-	Xstrdup_a(str, (const gchar *)key, return 0);
-	trim_subject(str);
-
-	p = str;
-	h = *p;
-
-	if (h) {
-		for (p += 1; *p != '\0'; p++)
-			h = (h << 5) - h + *p;
-	}
-
-	return h;
-}
-
-static gint attract_compare_func(gconstpointer a, gconstpointer b)
-{
-	return subject_compare((const gchar *)a, (const gchar *)b) == 0;
-}
-
 void summary_attract_by_subject(SummaryView *summaryview)
 {
 	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
@@ -2421,6 +2378,10 @@ void summary_attract_by_subject(SummaryView *summaryview)
 	GtkCMCTreeNode *tmp;
 	MsgInfo *src_msginfo, *dst_msginfo;
 	GHashTable *subject_table;
+	GStringChunk *subjects;
+	gchar *subject;
+
+	summary_progressive_finish(summaryview);
 
 	debug_print("Attracting messages by subject...\n");
 	STATUSBAR_PUSH(summaryview->mainwin,
@@ -2429,8 +2390,10 @@ void summary_attract_by_subject(SummaryView *summaryview)
 	main_window_cursor_wait(summaryview->mainwin);
 	summary_freeze(summaryview);
 
-	subject_table = g_hash_table_new(attract_hash_func,
-					 attract_compare_func);
+	/* subjects as compared by subject_compare(), trimmed once per
+	 * message */
+	subject_table = g_hash_table_new(g_str_hash, g_str_equal);
+	subjects = g_string_chunk_new(4096);
 
 	for (src_node = GTK_CMCTREE_NODE(clist->row_list);
 	     src_node != NULL;
@@ -2440,9 +2403,12 @@ void summary_attract_by_subject(SummaryView *summaryview)
 		if (!src_msginfo) continue;
 		if (!src_msginfo->subject) continue;
 
+		subject = g_string_chunk_insert(subjects, src_msginfo->subject);
+		trim_subject_for_compare(subject);
+		if (!*subject) continue;
+
 		/* find attracting node */
-		dst_node = g_hash_table_lookup(subject_table,
-					       src_msginfo->subject);
+		dst_node = g_hash_table_lookup(subject_table, subject);
 
 		if (dst_node) {
 			dst_msginfo = GTKUT_CTREE_NODE_GET_ROW_DATA(dst_node);
@@ -2458,11 +2424,11 @@ void summary_attract_by_subject(SummaryView *summaryview)
 				gtk_cmctree_move(ctree, src_node, NULL, sibling);
 		}
 
-		g_hash_table_insert(subject_table,
-				    src_msginfo->subject, src_node);
+		g_hash_table_insert(subject_table, subject, src_node);
 	}
 
 	g_hash_table_destroy(subject_table);
+	g_string_chunk_free(subjects);
 
 	gtk_cmctree_node_moveto(ctree, summaryview->selected, 0, 0.5, 0);
 
@@ -2912,7 +2878,7 @@ void summary_sort(SummaryView *summaryview,
 {
 	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
 	GtkCMCList *clist = GTK_CMCLIST(summaryview->ctree);
-	GtkCMCListCompareFunc cmp_func = NULL;
+	gboolean complete;
 	START_TIMING("");
 	g_signal_handlers_block_by_func(G_OBJECT(summaryview->ctree),
 				       G_CALLBACK(summary_tree_expanded), summaryview);
@@ -2920,50 +2886,19 @@ void summary_sort(SummaryView *summaryview,
 
 	switch (sort_key) {
 	case SORT_BY_MARK:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_mark;
-		break;
 	case SORT_BY_STATUS:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_status;
-		break;
 	case SORT_BY_MIME:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_mime;
-		break;
 	case SORT_BY_NUMBER:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_num;
-		break;
 	case SORT_BY_SIZE:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_size;
-		break;
 	case SORT_BY_DATE:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_date;
-		break;
 	case SORT_BY_THREAD_DATE:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_thread_date;
-		break;
 	case SORT_BY_FROM:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_from;
-		break;
 	case SORT_BY_SUBJECT:
-		if (summaryview->simplify_subject_preg)
-			cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_simplified_subject;
-		else
-			cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_subject;
-		break;
 	case SORT_BY_SCORE:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_score;
-		break;
 	case SORT_BY_LABEL:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_label;
-		break;
 	case SORT_BY_TO:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_to;
-		break;
 	case SORT_BY_LOCKED:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_locked;
-		break;
 	case SORT_BY_TAGS:
-		cmp_func = (GtkCMCListCompareFunc)summary_cmp_by_tags;
-		break;
 	case SORT_BY_NONE:
 		break;
 	default:
@@ -2980,24 +2915,34 @@ void summary_sort(SummaryView *summaryview,
 	if (summaryview->sort_key == SORT_BY_NONE)
 		goto unlock;
 
-	if (cmp_func != NULL) {
-		debug_print("Sorting summary...\n");
-		STATUSBAR_PUSH(summaryview->mainwin, _("Sorting summary..."));
+	debug_print("Sorting summary...\n");
+	STATUSBAR_PUSH(summaryview->mainwin, _("Sorting summary..."));
+
+	main_window_cursor_wait(summaryview->mainwin);
 
-		main_window_cursor_wait(summaryview->mainwin);
+	/* for rows whose From or To text isn't set yet */
+	complete = prefs_common.use_addr_book &&
+		   (sort_key == SORT_BY_FROM || sort_key == SORT_BY_TO);
+	if (complete)
+		start_address_completion(NULL);
 
-		gtk_cmclist_set_compare_func(clist, cmp_func);
+	gtk_cmclist_set_sort_type(clist, (GtkSortType)sort_type);
+	{
+		START_TIMING("sort by keys");
+		gtk_sctree_sort_recursive_by_keys(ctree, NULL,
+				summary_sort_key_func, summaryview);
+		END_TIMING();
+	}
 
-		gtk_cmclist_set_sort_type(clist, (GtkSortType)sort_type);
-		gtk_sctree_sort_recursive(ctree, NULL);
+	if (complete)
+		end_address_completion();
 
-		gtk_cmctree_node_moveto(ctree, summaryview->selected, 0, 0.5, 0);
+	gtk_cmctree_node_moveto(ctree, summaryview->selected, 0, 0.5, 0);
 
-		main_window_cursor_normal(summaryview->mainwin);
+	main_window_cursor_normal(summaryview->mainwin);
 
-		debug_print("Sorting summary done.\n");
-		STATUSBAR_POP(summaryview->mainwin);
-	}
+	debug_print("Sorting summary done.\n");
+	STATUSBAR_POP(summaryview->mainwin);
 unlock:
 	summary_thaw(summaryview);
 	g_signal_handlers_unblock_by_func(G_OBJECT(summaryview->ctree),
@@ -3054,6 +2999,45 @@ static gboolean summary_thread_is_read(GNode *gnode)
     return all_read;
 }
 
+/* Sets the text of a row inserted without text, from the tree's draw
+ * handler: the cells are replaced without redrawing the row. */
+static void summary_cell_text_func(GtkSCTree *sctree, GtkCMCTreeNode *node,
+				   gpointer data)
+{
+	SummaryView *summaryview = (SummaryView *)data;
+	MsgInfo *msginfo = GTKUT_CTREE_NODE_GET_ROW_DATA(node);
+	gchar *text[N_SUMMARY_COLS];
+	gint *col_pos = summaryview->col_pos;
+	gboolean vert_layout = (prefs_common.layout_mode == VERTICAL_LAYOUT);
+	gboolean small_layout = (prefs_common.layout_mode == SMALL_LAYOUT);
+
+	if (!msginfo)
+		return;
+
+	summary_set_header(summaryview, text, msginfo);
+
+	gtk_sctree_node_set_cell_text(sctree, node, col_pos[S_COL_SUBJECT],
+				      text[col_pos[S_COL_SUBJECT]]);
+#define SET_TEXT(col) {						\
+	if (summaryview->col_state[col_pos[col]].visible)	\
+		gtk_sctree_node_set_cell_text(sctree, node,	\
+				col_pos[col], text[col_pos[col]]); \
+}
+
+	SET_TEXT(S_COL_NUMBER);
+	SET_TEXT(S_COL_SCORE);
+	SET_TEXT(S_COL_SIZE);
+	SET_TEXT(S_COL_DATE);
+	SET_TEXT(S_COL_FROM);
+	SET_TEXT(S_COL_TO);
+	SET_TEXT(S_COL_TAGS);
+
+#undef SET_TEXT
+
+	if ((vert_layout || small_layout) && prefs_common.two_line_vert)
+		g_free(text[col_pos[S_COL_SUBJECT]]);
+}
+
 static gboolean summary_insert_gnode_func(GtkCMCTree *ctree, guint depth, GNode *gnode,
 				   GtkCMCTreeNode *cnode, gpointer data)
 {
@@ -3066,6 +3050,12 @@ static gboolean summary_insert_gnode_func(GtkCMCTree *ctree, guint depth, GNode
 	gboolean vert_layout = (prefs_common.layout_mode == VERTICAL_LAYOUT);
 	gboolean small_layout = (prefs_common.layout_mode == SMALL_LAYOUT);
 
+	if (GTK_SCTREE(ctree)->cell_text_func) {
+		gtk_cmctree_set_node_info(ctree, cnode, NULL, 2, NULL, NULL,
+				FALSE, summaryview->threaded && !summaryview->thread_collapsed);
+		goto set_data;
+	}
+
 	summary_set_header(summaryview, text, msginfo);
 
 	gtk_cmctree_set_node_info(ctree, cnode, text[col_pos[S_COL_SUBJECT]], 2,
@@ -3095,6 +3085,7 @@ static gboolean summary_insert_gnode_func(GtkCMCTree *ctree, guint depth, GNode
 
 #undef SET_TEXT
 
+set_data:
 	GTKUT_CTREE_NODE_SET_ROW_DATA(cnode, msginfo);
 	summary_set_marks_func(ctree, cnode, summaryview);
 
@@ -3104,21 +3095,387 @@ static gboolean summary_insert_gnode_func(GtkCMCTree *ctree, guint depth, GNode
 	return TRUE;
 }
 
+/* Inserts a message above the other top level rows */
+static GtkCMCTreeNode *summary_insert_msginfo(SummaryView *summaryview,
+					      MsgInfo *msginfo)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
+	GtkCMCTreeNode *sibling = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list);
+	GtkCMCTreeNode *node;
+	gchar *text[N_SUMMARY_COLS];
+	gboolean vert_layout = (prefs_common.layout_mode == VERTICAL_LAYOUT);
+	gboolean small_layout = (prefs_common.layout_mode == SMALL_LAYOUT);
+
+	if (GTK_SCTREE(ctree)->cell_text_func) {
+		node = gtk_sctree_insert_node
+			(ctree, NULL, sibling, NULL, 2,
+			 NULL, NULL,
+			 FALSE, FALSE);
+	} else {
+		summary_set_header(summaryview, text, msginfo);
+
+		node = gtk_sctree_insert_node
+			(ctree, NULL, sibling, text, 2,
+			 NULL, NULL,
+			 FALSE, FALSE);
+		if ((vert_layout || small_layout) && prefs_common.two_line_vert)
+			g_free(text[summaryview->col_pos[S_COL_SUBJECT]]);
+	}
+
+	GTKUT_CTREE_NODE_SET_ROW_DATA(node, msginfo);
+	summary_set_marks_func(ctree, node, summaryview);
+
+	if (msginfo->msgid && msginfo->msgid[0] != '\0')
+		g_hash_table_insert(summaryview->msgid_table,
+				    msginfo->msgid, node);
+
+	if (summaryview->subject_table)
+		procmsg_subject_table_insert(summaryview->subject_table,
+					     msginfo, node);
+	return node;
+}
+
+/* Inserts a message, or a thread if progressive_threaded, above the
+ * other top level rows */
+static GtkCMCTreeNode *summary_insert_entry(SummaryView *summaryview,
+					    gpointer entry)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
+
+	if (!summaryview->progressive_threaded)
+		return summary_insert_msginfo(summaryview, (MsgInfo *)entry);
+
+	return gtk_sctree_insert_gnode(ctree, NULL,
+			GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list),
+			(GNode *)entry, summary_insert_gnode_func, summaryview);
+}
+
+static void summary_set_parent_marks_func(GtkCMCTree *ctree,
+					  GtkCMCTreeNode *node, gpointer data)
+{
+	if (GTK_CMCTREE_ROW(node)->children)
+		summary_set_row_marks((SummaryView *)data, node);
+}
+
+static gint summary_cmp_newest_msginfo(gconstpointer a, gconstpointer b)
+{
+	const MsgInfo *msginfo1 = *(const MsgInfo **)a;
+	const MsgInfo *msginfo2 = *(const MsgInfo **)b;
+
+	if (msginfo1->date_t != msginfo2->date_t)
+		return (msginfo1->date_t < msginfo2->date_t) ? 1 : -1;
+	return (msginfo1->msgnum < msginfo2->msgnum) ? 1 :
+		(msginfo1->msgnum > msginfo2->msgnum) ? -1 : 0;
+}
+
+static gint summary_cmp_newest_thread(gconstpointer a, gconstpointer b)
+{
+	const MsgInfo *msginfo1 = (*(const GNode **)a)->data;
+	const MsgInfo *msginfo2 = (*(const GNode **)b)->data;
+	time_t date1 = msginfo1 ? msginfo1->thread_date : 0;
+	time_t date2 = msginfo2 ? msginfo2->thread_date : 0;
+
+	if (date1 != date2)
+		return (date1 < date2) ? 1 : -1;
+	return 0;
+}
+
+static gboolean summary_free_gnode_msginfo(GNode *node, gpointer data)
+{
+	MsgInfo *msginfo = (MsgInfo *)node->data;
+
+	procmsg_msginfo_free(&msginfo);
+	return FALSE;
+}
+
+/* Drops the messages not inserted yet; this must be done before the
+ * threads they belong to are freed. */
+static void summary_progressive_cancel(SummaryView *summaryview)
+{
+	GPtrArray *entries = summaryview->progressive;
+	guint i;
+
+	if (summaryview->progressive_id) {
+		g_source_remove(summaryview->progressive_id);
+		summaryview->progressive_id = 0;
+	}
+	if (entries == NULL)
+		return;
+
+	for (i = summaryview->progressive_pos; i < entries->len; i++) {
+		if (summaryview->progressive_threaded) {
+			g_node_traverse(g_ptr_array_index(entries, i),
+					G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+					summary_free_gnode_msginfo, NULL);
+		} else {
+			MsgInfo *msginfo = g_ptr_array_index(entries, i);
+			procmsg_msginfo_free(&msginfo);
+		}
+	}
+	g_ptr_array_free(entries, TRUE);
+	summaryview->progressive = NULL;
+	summaryview->progressive_pos = 0;
+}
+
+/* Inserts up to count more of the entries left by
+ * summary_set_ctree_from_list(), keeping the rows sorted and the
+ * rows in view where they are */
+static void summary_progressive_insert(SummaryView *summaryview, guint count)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
+	GtkCMCList *clist = GTK_CMCLIST(ctree);
+	GPtrArray *entries = summaryview->progressive;
+	GtkCMCTreeNode *top = NULL, *node;
+	GSList *inserted = NULL, *cur;
+	gint row, column;
+	guint end;
+	START_TIMING("");
+
+	if (entries == NULL)
+		return;
+
+	end = entries->len - summaryview->progressive_pos;
+	end = summaryview->progressive_pos + MIN(count, end);
+
+	if (clist->rows > 0 &&
+	    gtk_cmclist_get_selection_info(clist, 0, 0, &row, &column))
+		top = gtk_cmctree_node_nth(ctree, row);
+
+	summary_freeze(summaryview);
+	g_signal_handlers_block_by_func(G_OBJECT(ctree),
+				       G_CALLBACK(summary_tree_expanded), summaryview);
+	if (prefs_common.use_addr_book)
+		start_address_completion(NULL);
+
+	for (; summaryview->progressive_pos < end;
+	     summaryview->progressive_pos++) {
+		node = summary_insert_entry(summaryview,
+				g_ptr_array_index(entries,
+						  summaryview->progressive_pos));
+		if (node)
+			inserted = g_slist_prepend(inserted, node);
+	}
+
+	if (summaryview->sort_key != SORT_BY_NONE) {
+		for (cur = inserted; cur != NULL; cur = cur->next) {
+			node = (GtkCMCTreeNode *)cur->data;
+			if (GTK_CMCTREE_ROW(node)->children)
+				gtk_sctree_sort_recursive_by_keys(ctree, node,
+					summary_sort_key_func, summaryview);
+		}
+		gtk_sctree_sort_node_by_keys(ctree, NULL,
+					     summary_sort_key_func, summaryview);
+	}
+
+	if (prefs_common.bold_unread && summaryview->progressive_threaded) {
+		for (cur = inserted; cur != NULL; cur = cur->next)
+			gtk_cmctree_pre_recursive(ctree, (GtkCMCTreeNode *)cur->data,
+					summary_set_parent_marks_func, summaryview);
+	}
+	g_slist_free(inserted);
+
+	if (prefs_common.use_addr_book)
+		end_address_completion();
+	g_signal_handlers_unblock_by_func(G_OBJECT(ctree),
+				       G_CALLBACK(summary_tree_expanded), summaryview);
+	summary_thaw(summaryview);
+
+	if (top && gtk_cmctree_is_viewable(ctree, top))
+		gtk_cmctree_node_moveto(ctree, top, -1, 0, 0);
+
+	if (summaryview->progressive_pos == entries->len) {
+		g_ptr_array_free(entries, TRUE);
+		summaryview->progressive = NULL;
+		summaryview->progressive_pos = 0;
+		summary_status_show(summaryview);
+	}
+	END_TIMING();
+}
+
+static gboolean summary_progressive_idle(gpointer data)
+{
+	SummaryView *summaryview = (SummaryView *)data;
+
+	if (summaryview->progressive && !summary_is_locked(summaryview))
+		summary_progressive_insert(summaryview,
+					   SUMMARY_PROGRESSIVE_CHUNK);
+
+	if (summaryview->progressive == NULL) {
+		summaryview->progressive_id = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Inserts the rest of the folder now, for operations on all messages */
+static void summary_progressive_finish(SummaryView *summaryview)
+{
+	if (summaryview->progressive == NULL)
+		return;
+
+	debug_print("inserting the %d remaining messages now\n",
+		    summaryview->progressive->len - summaryview->progressive_pos);
+	summary_progressive_insert(summaryview, G_MAXUINT);
+	if (summaryview->progressive_id) {
+		g_source_remove(summaryview->progressive_id);
+		summaryview->progressive_id = 0;
+	}
+}
+
+typedef struct _SummaryEntryMatch {
+	MsgPermFlags flags;	/* any of them, or 0 to match msgnum */
+	guint msgnum;
+	gboolean found;
+} SummaryEntryMatch;
+
+static gboolean summary_entry_match_msginfo(MsgInfo *msginfo,
+					    SummaryEntryMatch *match)
+{
+	if (msginfo == NULL)
+		return FALSE;
+	if (match->flags != 0)
+		return (msginfo->flags.perm_flags & match->flags) != 0;
+	return msginfo->msgnum == match->msgnum;
+}
+
+static gboolean summary_entry_match_func(GNode *node, gpointer data)
+{
+	SummaryEntryMatch *match = (SummaryEntryMatch *)data;
+
+	match->found = summary_entry_match_msginfo((MsgInfo *)node->data,
+						   match);
+	return match->found;
+}
+
+/* Inserts now the pending entries holding a message that match
+ * accepts, so that lookups see all of them in their sorted place
+ * without inserting the whole folder */
+static void summary_progressive_insert_matching(SummaryView *summaryview,
+						SummaryEntryMatch *match)
+{
+	GPtrArray *entries = summaryview->progressive;
+	GPtrArray *others;
+	gpointer entry;
+	guint i, pos, matched = 0;
+
+	if (entries == NULL)
+		return;
+
+	/* move them ahead of the others, which keep their order */
+	pos = summaryview->progressive_pos;
+	others = g_ptr_array_new();
+	for (i = pos; i < entries->len; i++) {
+		entry = g_ptr_array_index(entries, i);
+		if (summaryview->progressive_threaded) {
+			match->found = FALSE;
+			g_node_traverse((GNode *)entry, G_PRE_ORDER,
+					G_TRAVERSE_ALL, -1,
+					summary_entry_match_func, match);
+		} else {
+			match->found = summary_entry_match_msginfo
+						((MsgInfo *)entry, match);
+		}
+		if (match->found)
+			entries->pdata[pos + matched++] = entry;
+		else
+			g_ptr_array_add(others, entry);
+	}
+	if (others->len > 0)
+		memcpy(entries->pdata + pos + matched, others->pdata,
+		       others->len * sizeof(gpointer));
+	g_ptr_array_free(others, TRUE);
+
+	if (matched > 0) {
+		debug_print("inserting %d matching messages or threads now\n",
+			    matched);
+		summary_progressive_insert(summaryview, matched);
+	}
+}
+
+static void summary_progressive_insert_flagged(SummaryView *summaryview,
+					       MsgPermFlags flags)
+{
+	SummaryEntryMatch match = { flags, 0, FALSE };
+
+	if (flags != 0)
+		summary_progressive_insert_matching(summaryview, &match);
+}
+
+static void summary_progressive_insert_msgnum(SummaryView *summaryview,
+					      guint msgnum)
+{
+	SummaryEntryMatch match = { 0, msgnum, FALSE };
+
+	summary_progressive_insert_matching(summaryview, &match);
+}
+
+/* The first row, or the last one, as it is once all the rows are
+ * inserted. The pending entries are ordered newest first, so when the
+ * rows are ordered by date the row at the oldest end comes from the
+ * last pending entry; with other orders, the rest is inserted. */
+static GtkCMCTreeNode *summary_get_end_node(SummaryView *summaryview,
+					    gboolean last)
+{
+	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
+	GPtrArray *entries = summaryview->progressive;
+	MsgInfo *oldest = NULL;
+	gboolean by_date, top_oldest;
+
+	if (entries != NULL) {
+		if (summaryview->progressive_threaded)
+			by_date = summaryview->sort_key == SORT_BY_THREAD_DATE;
+		else
+			by_date = summaryview->sort_key == SORT_BY_DATE;
+		/* unsorted, each entry went above the newer ones */
+		top_oldest = summaryview->sort_key == SORT_BY_NONE ||
+			     summaryview->sort_type == SORT_ASCENDING;
+
+		if (summaryview->progressive_threaded)
+			oldest = ((GNode *)g_ptr_array_index(entries,
+						entries->len - 1))->data;
+		else
+			oldest = g_ptr_array_index(entries, entries->len - 1);
+
+		if (!by_date && summaryview->sort_key != SORT_BY_NONE)
+			summary_progressive_finish(summaryview);
+		else if (last != top_oldest && oldest != NULL)
+			summary_progressive_insert_msgnum(summaryview,
+							  oldest->msgnum);
+		else if (last != top_oldest)
+			summary_progressive_finish(summaryview);
+		/* else the newest end, already inserted */
+	}
+
+	if (GTK_CMCLIST(ctree)->row_list == NULL)
+		return NULL;
+	return gtk_cmctree_node_nth(ctree,
+			last ? GTK_CMCLIST(ctree)->rows - 1 : 0);
+}
+
 static void summary_set_ctree_from_list(SummaryView *summaryview,
 					GSList *mlist)
 {
 	GtkCMCTree *ctree = GTK_CMCTREE(summaryview->ctree);
-	MsgInfo *msginfo;
 	GtkCMCTreeNode *node = NULL;
 	GHashTable *msgid_table;
 	GHashTable *subject_table = NULL;
+	GPtrArray *entries;
 	GSList * cur;
-	gboolean vert_layout = (prefs_common.layout_mode == VERTICAL_LAYOUT);
-	gboolean small_layout = (prefs_common.layout_mode == SMALL_LAYOUT);
+	gboolean lazy_text;
+	guint i, count;
 	START_TIMING("");
 	
 	if (!mlist) return;
 
+	/* Only format the rows that get drawn. Address book lookups need
+	 * the completion to be started, so those are still done up front. */
+	lazy_text = prefs_common.summary_text_cache_rows > 0 &&
+		    !prefs_common.use_addr_book;
+	gtk_sctree_set_cell_text_func(GTK_SCTREE(ctree),
+			lazy_text ? summary_cell_text_func : NULL, summaryview,
+			MAX(prefs_common.summary_text_cache_rows,
+			    SUMMARY_TEXT_CACHE_MIN_ROWS));
+
 	debug_print("Setting summary from message data...\n");
 	STATUSBAR_PUSH(summaryview->mainwin,
 		       _("Setting summary from message data..."));
@@ -3131,7 +3488,7 @@ static void summary_set_ctree_from_list(SummaryView *summaryview,
 	summaryview->msgid_table = msgid_table;
 
 	if (prefs_common.thread_by_subject) {
-		subject_table = g_hash_table_new(g_str_hash, g_str_equal);
+		subject_table = procmsg_subject_table_new();
 		summaryview->subject_table = subject_table;
 	} else {
 		summaryview->subject_table = NULL;
@@ -3140,60 +3497,68 @@ static void summary_set_ctree_from_list(SummaryView *summaryview,
 	if (prefs_common.use_addr_book)
 		start_address_completion(NULL);
 	
+	entries = g_ptr_array_new();
+	summaryview->progressive_threaded = summaryview->threaded;
 	if (summaryview->threaded) {
 		GNode *root, *gnode;
 		START_TIMING("threaded");
-		root = procmsg_get_thread_tree(mlist);
+		if (summaryview->threads == NULL)
+			summaryview->threads = procmsg_msg_threads_load
+				(summaryview->folder_item, mlist);
+		if (summaryview->threads == NULL ||
+		    !procmsg_msg_threads_update(summaryview->threads, mlist)) {
+			procmsg_msg_threads_free(summaryview->threads);
+			summaryview->threads = procmsg_msg_threads_new(mlist);
+		}
+		procmsg_msg_threads_save(summaryview->threads,
+					 summaryview->folder_item);
+		root = procmsg_msg_threads_get_root(summaryview->threads);
 
-		
 		for (gnode = root->children; gnode != NULL;
 		     gnode = gnode->next) {
             if (!summaryview->folder_item->hide_read_threads ||
                     !summary_thread_is_read(gnode))
             {
                 summary_find_thread_age(gnode);
-                node = gtk_sctree_insert_gnode
-                    (ctree, NULL, node, gnode,
-                     summary_insert_gnode_func, summaryview);
+                g_ptr_array_add(entries, gnode);
             }
 		}
 
-		g_node_destroy(root);
-                
 		END_TIMING();
 	} else {
-		gchar *text[N_SUMMARY_COLS];
-		START_TIMING("unthreaded");
-		cur = mlist;
-		for (; mlist != NULL; mlist = mlist->next) {
-			msginfo = (MsgInfo *)mlist->data;
-
-			summary_set_header(summaryview, text, msginfo);
-
-			node = gtk_sctree_insert_node
-				(ctree, NULL, node, text, 2,
-				 NULL, NULL,
-				 FALSE, FALSE);
-			if ((vert_layout || small_layout) && prefs_common.two_line_vert)
-				g_free(text[summaryview->col_pos[S_COL_SUBJECT]]);
-
-			GTKUT_CTREE_NODE_SET_ROW_DATA(node, msginfo);
-			summary_set_marks_func(ctree, node, summaryview);
-
-			if (msginfo->msgid && msginfo->msgid[0] != '\0')
-				g_hash_table_insert(msgid_table,
-						    msginfo->msgid, node);
-
-			if (prefs_common.thread_by_subject)
-				subject_table_insert(subject_table,
-					     msginfo->subject,
-					     node);
-		}
-		mlist = cur;
-		END_TIMING();
+		for (cur = mlist; cur != NULL; cur = cur->next)
+			g_ptr_array_add(entries, cur->data);
+	}
+
+	/* Show the newest messages or threads first in a large folder,
+	 * and insert the others when idle */
+	count = entries->len;
+	if (prefs_common.summary_progressive_rows > 0 &&
+	    count > prefs_common.summary_progressive_rows) {
+		g_ptr_array_sort(entries, summaryview->threaded ?
+				 summary_cmp_newest_thread :
+				 summary_cmp_newest_msginfo);
+		count = prefs_common.summary_progressive_rows;
+	}
+
+	START_TIMING("inserting");
+	for (i = 0; i < count; i++)
+		summary_insert_entry(summaryview, g_ptr_array_index(entries, i));
+	END_TIMING();
+
+	if (count < entries->len) {
+		debug_print("%d messages or threads left to insert\n",
+			    entries->len - count);
+		summaryview->progressive = entries;
+		summaryview->progressive_pos = count;
+		summaryview->progressive_id = g_idle_add_full(G_PRIORITY_LOW,
+				summary_progressive_idle, summaryview, NULL);
+	} else {
+		g_ptr_array_free(entries, TRUE);
 	}
 
-	if (prefs_common.enable_hscrollbar &&
+	/* the subjects aren't known yet with lazy_text */
+	if (prefs_common.enable_hscrollbar && !lazy_text &&
 	    summaryview->col_pos[S_COL_SUBJECT] == N_SUMMARY_COLS - 1) {
 		gint optimal_width;
 
@@ -3263,72 +3628,15 @@ static gchar *summary_complete_address(const gchar *addr)
 	return res;
 }
 
-static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
-			       MsgInfo *msginfo)
+/* The text of the From and To columns; may point to static buffers */
+static void summary_get_from_to_text(SummaryView *summaryview,
+				     MsgInfo *msginfo,
+				     gchar **from, gchar **to)
 {
-	static gchar date_modified[80];
-	static gchar col_score[11];
-	static gchar buf[BUFFSIZE], tmp1[BUFFSIZE], tmp2[BUFFSIZE], tmp3[BUFFSIZE];
-	gint *col_pos = summaryview->col_pos;
-	gchar *from_text = NULL, *to_text = NULL, *tags_text = NULL;
+	static gchar buf[BUFFSIZE], tmp2[BUFFSIZE], addr_buf[BUFFSIZE];
+	gchar *from_text = NULL, *to_text = NULL;
 	gboolean should_swap = FALSE;
-	gboolean vert_layout = (prefs_common.layout_mode == VERTICAL_LAYOUT);
-	gboolean small_layout = (prefs_common.layout_mode == SMALL_LAYOUT);
-	static const gchar *color_dim_rgb = NULL;
-	if (!color_dim_rgb)
-		color_dim_rgb = gdk_color_to_string(&summaryview->color_dim);
-	text[col_pos[S_COL_FROM]]   = "";
-	text[col_pos[S_COL_TO]]     = "";
-	text[col_pos[S_COL_SUBJECT]]= "";
-	text[col_pos[S_COL_MARK]]   = "";
-	text[col_pos[S_COL_STATUS]] = "";
-	text[col_pos[S_COL_MIME]]   = "";
-	text[col_pos[S_COL_LOCKED]] = "";
-	text[col_pos[S_COL_DATE]]   = "";
-	text[col_pos[S_COL_TAGS]]   = "";
-	if (summaryview->col_state[summaryview->col_pos[S_COL_NUMBER]].visible)
-		text[col_pos[S_COL_NUMBER]] = itos(msginfo->msgnum);
-	else
-		text[col_pos[S_COL_NUMBER]] = "";
 
-	/* slow! */
-	if (summaryview->col_state[summaryview->col_pos[S_COL_SIZE]].visible)
-		text[col_pos[S_COL_SIZE]] = to_human_readable(msginfo->size);
-	else
-		text[col_pos[S_COL_SIZE]] = "";
-
-	if (summaryview->col_state[summaryview->col_pos[S_COL_SCORE]].visible)
-		text[col_pos[S_COL_SCORE]] = itos_buf(col_score, msginfo->score);
-	else
-		text[col_pos[S_COL_SCORE]] = "";
-
-	if (summaryview->col_state[summaryview->col_pos[S_COL_TAGS]].visible) {
-		tags_text = procmsg_msginfo_get_tags_str(msginfo);
-		if (!tags_text) {
-			text[col_pos[S_COL_TAGS]] = "-";
-		} else {
-			strncpy2(tmp1, tags_text, sizeof(tmp1));
-			tmp1[sizeof(tmp1)-1]='\0';
-			g_free(tags_text);
-			text[col_pos[S_COL_TAGS]] = tmp1;
-		}
-	} else
-		text[col_pos[S_COL_TAGS]] = "";
-
-	/* slow! */
-	if (summaryview->col_state[summaryview->col_pos[S_COL_DATE]].visible || 
-	    ((vert_layout || small_layout) && prefs_common.two_line_vert)) {
-		if (msginfo->date_t && msginfo->date_t > 0) {
-			procheader_date_get_localtime(date_modified,
-						      sizeof(date_modified),
-						      msginfo->date_t);
-			text[col_pos[S_COL_DATE]] = date_modified;
-		} else if (msginfo->date)
-			text[col_pos[S_COL_DATE]] = msginfo->date;
-		else
-			text[col_pos[S_COL_DATE]] = _("(No Date)");
-	}
-	
 	if (prefs_common.swap_from && msginfo->from && msginfo->to
 	&&  !summaryview->col_state[summaryview->col_pos[S_COL_TO]].visible) {
 		gchar *addr = NULL;
@@ -3349,9 +3657,11 @@ static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
 			from_text = msginfo->fromname;
 		else if (prefs_common.summary_from_show == SHOW_BOTH)
 			from_text = msginfo->from;
-		else {
-			from_text = msginfo->from;
-			extract_address(from_text);
+		else if (msginfo->from) {
+			/* msginfo->from is shared between messages */
+			strncpy2(addr_buf, msginfo->from, sizeof(addr_buf));
+			extract_address(addr_buf);
+			from_text = addr_buf;
 		}
 		if (!from_text)
 			from_text = _("(No From)");
@@ -3366,10 +3676,10 @@ static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
 				from_text = msginfo->fromname;
 			else if (prefs_common.summary_from_show == SHOW_BOTH)
 				from_text = msginfo->from;
-			else {
-				from_text = msginfo->from;
-				if (from_text)
-					extract_address(from_text);
+			else if (msginfo->from) {
+				strncpy2(addr_buf, msginfo->from, sizeof(addr_buf));
+				extract_address(addr_buf);
+				from_text = addr_buf;
 			}
 			if (!from_text)
 				from_text = _("(No From)");
@@ -3382,9 +3692,9 @@ static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
 		     )
 		   );
 
-	text[col_pos[S_COL_TO]] = to_text;
+	*to = to_text;
 	if (!should_swap) {
-		text[col_pos[S_COL_FROM]] = from_text;
+		*from = from_text;
 	} else {
 		if (prefs_common.use_addr_book) {
 			gchar *tmp = summary_complete_address(to_text);
@@ -3398,9 +3708,79 @@ static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
 		}
 		snprintf(tmp2, BUFFSIZE-1, "➜ %s", to_text);
 		tmp2[BUFFSIZE-1]='\0';
-		text[col_pos[S_COL_FROM]] = tmp2;
+		*from = tmp2;
+	}
+}
+
+static inline void summary_set_header(SummaryView *summaryview, gchar *text[],
+			       MsgInfo *msginfo)
+{
+	static gchar date_modified[80];
+	static gchar col_score[11];
+	static gchar tmp1[BUFFSIZE], tmp3[BUFFSIZE];
+	gint *col_pos = summaryview->col_pos;
+	gchar *tags_text = NULL;
+	gboolean vert_layout = (prefs_common.layout_mode == VERTICAL_LAYOUT);
+	gboolean small_layout = (prefs_common.layout_mode == SMALL_LAYOUT);
+	static const gchar *color_dim_rgb = NULL;
+	if (!color_dim_rgb)
+		color_dim_rgb = gdk_color_to_string(&summaryview->color_dim);
+	text[col_pos[S_COL_FROM]]   = "";
+	text[col_pos[S_COL_TO]]     = "";
+	text[col_pos[S_COL_SUBJECT]]= "";
+	text[col_pos[S_COL_MARK]]   = "";
+	text[col_pos[S_COL_STATUS]] = "";
+	text[col_pos[S_COL_MIME]]   = "";
+	text[col_pos[S_COL_LOCKED]] = "";
+	text[col_pos[S_COL_DATE]]   = "";
+	text[col_pos[S_COL_TAGS]]   = "";
+	if (summaryview->col_state[summaryview->col_pos[S_COL_NUMBER]].visible)
+		text[col_pos[S_COL_NUMBER]] = itos(msginfo->msgnum);
+	else
+		text[col_pos[S_COL_NUMBER]] = "";
+
+	/* slow! */
+	if (summaryview->col_state[summaryview->col_pos[S_COL_SIZE]].visible)
+		text[col_pos[S_COL_SIZE]] = to_human_readable(msginfo->size);
+	else
+		text[col_pos[S_COL_SIZE]] = "";
+
+	if (summaryview->col_state[summaryview->col_pos[S_COL_SCORE]].visible)
+		text[col_pos[S_COL_SCORE]] = itos_buf(col_score, msginfo->score);
+	else
+		text[col_pos[S_COL_SCORE]] = "";
+
+	if (summaryview->col_state[summaryview->col_pos[S_COL_TAGS]].visible) {
+		tags_text = procmsg_msginfo_get_tags_str(msginfo);
+		if (!tags_text) {
+			text[col_pos[S_COL_TAGS]] = "-";
+		} else {
+			strncpy2(tmp1, tags_text, sizeof(tmp1));
+			tmp1[sizeof(tmp1)-1]='\0';
+			g_free(tags_text);
+			text[col_pos[S_COL_TAGS]] = tmp1;
+		}
+	} else
+		text[col_pos[S_COL_TAGS]] = "";
+
+	/* slow! */
+	if (summaryview->col_state[summaryview->col_pos[S_COL_DATE]].visible || 
+	    ((vert_layout || small_layout) && prefs_common.two_line_vert)) {
+		if (msginfo->date_t && msginfo->date_t > 0) {
+			procheader_date_get_localtime(date_modified,
+						      sizeof(date_modified),
+						      msginfo->date_t);
+			text[col_pos[S_COL_DATE]] = date_modified;
+		} else if (msginfo->date)
+			text[col_pos[S_COL_DATE]] = msginfo->date;
+		else
+			text[col_pos[S_COL_DATE]] = _("(No Date)");
 	}
 	
+	summary_get_from_to_text(summaryview, msginfo,
+				 &text[col_pos[S_COL_FROM]],
+				 &text[col_pos[S_COL_TO]]);
+	
 	if (summaryview->simplify_subject_preg != NULL)
 		text[col_pos[S_COL_SUBJECT]] = msginfo->subject ? 
 			string_remove_match(tmp3, BUFFSIZE, msginfo->subject, 
@@ -4137,11 +4517,36 @@ void summary_mark_all_read(SummaryView *summaryview)
 	
 	if (summary_is_locked(summaryview))
 		return;
+	summary_progressive_finish(summaryview);
 	START_LONG_OPERATION(summaryview, TRUE);
 	folder_item_set_batch(summaryview->folder_item, TRUE);
-	for (node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list); node != NULL;
-	     node = gtkut_ctree_node_next(ctree, node))
-		summary_mark_row_as_read(summaryview, node);
+	if (summaryview->folder_item->processing_pending) {
+		for (node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list); node != NULL;
+		     node = gtkut_ctree_node_next(ctree, node))
+			summary_mark_row_as_read(summaryview, node);
+	} else {
+		GSList *msglist = NULL, *rows = NULL, *cur;
+
+		/* change them all at once, then redraw their rows */
+		for (node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list); node != NULL;
+		     node = gtkut_ctree_node_next(ctree, node)) {
+			MsgInfo *msginfo = gtk_cmctree_node_get_row_data(ctree, node);
+
+			if (msginfo == NULL
+			    || !(MSG_IS_NEW(msginfo->flags) || MSG_IS_UNREAD(msginfo->flags)))
+				continue;
+			msglist = g_slist_prepend(msglist, msginfo);
+			rows = g_slist_prepend(rows, node);
+		}
+		msglist = g_slist_reverse(msglist);
+		procmsg_msglist_change_flags(msglist, 0, 0, MSG_NEW | MSG_UNREAD, 0);
+		for (cur = rows; cur != NULL; cur = cur->next)
+			summary_set_row_marks(summaryview, GTK_CMCTREE_NODE(cur->data));
+		debug_print("%d messages are marked as read\n",
+			    g_slist_length(msglist));
+		g_slist_free(msglist);
+		g_slist_free(rows);
+	}
 	folder_item_set_batch(summaryview->folder_item, FALSE);
 	for (node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list); node != NULL;
 	     node = gtkut_ctree_node_next(ctree, node)) {
@@ -4739,6 +5144,7 @@ void summary_select_all(SummaryView *summaryview)
 {
 	if (!summaryview->folder_item) return;
 
+	summary_progressive_finish(summaryview);
 	summary_lock(summaryview);
 	gtk_cmclist_select_all(GTK_CMCLIST(summaryview->ctree));
 	summary_unlock(summaryview);
@@ -5160,10 +5566,10 @@ static void summary_execute_move_func(GtkCMCTree *ctree, GtkCMCTreeNode *node,
 					    msginfo->msgid);
 		if (prefs_common.thread_by_subject &&
 		    msginfo->subject && *msginfo->subject &&
-		    node == subject_table_lookup(summaryview->subject_table,
-						 msginfo->subject)) {
-			subject_table_remove(summaryview->subject_table,
-					     msginfo->subject);
+		    node == procmsg_subject_table_lookup(summaryview->subject_table,
+						 msginfo)) {
+			procmsg_subject_table_remove(summaryview->subject_table,
+					     msginfo);
 		}
 	}
 }
@@ -5257,10 +5663,10 @@ static void summary_execute_delete_func(GtkCMCTree *ctree, GtkCMCTreeNode *node,
 		}	
 		if (prefs_common.thread_by_subject &&
 		    msginfo->subject && *msginfo->subject && 
-		    node == subject_table_lookup(summaryview->subject_table,
-						 msginfo->subject)) {
-			subject_table_remove(summaryview->subject_table,
-					     msginfo->subject);
+		    node == procmsg_subject_table_lookup(summaryview->subject_table,
+						 msginfo)) {
+			procmsg_subject_table_remove(summaryview->subject_table,
+					     msginfo);
 		}					    
 	}
 }
@@ -5286,10 +5692,10 @@ static void summary_execute_expunge_func(GtkCMCTree *ctree, GtkCMCTreeNode *node
 		}	
 		if (prefs_common.thread_by_subject &&
 		    msginfo->subject && *msginfo->subject && 
-		    node == subject_table_lookup(summaryview->subject_table,
-						 msginfo->subject)) {
-			subject_table_remove(summaryview->subject_table,
-					     msginfo->subject);
+		    node == procmsg_subject_table_lookup(summaryview->subject_table,
+						 msginfo)) {
+			procmsg_subject_table_remove(summaryview->subject_table,
+					     msginfo);
 		}					    
 	}
 }
@@ -5361,9 +5767,8 @@ static void summary_thread_build(SummaryView *summaryview)
 		}
 
 		if (msginfo && prefs_common.thread_by_subject && parent == NULL) {
-			parent = subject_table_lookup
-				(summaryview->subject_table,
-				 msginfo->subject);
+			parent = procmsg_subject_table_lookup
+				(summaryview->subject_table, msginfo);
 		}
 
 		if (parent && parent != node && parent != GTK_CMCTREE_ROW(node)->parent) {
@@ -6140,6 +6545,9 @@ static void summary_tags_menu_item_activate_item_cb(GtkMenuItem *menu_item,
 
 void summaryview_destroy(SummaryView *summaryview)
 {
+	summary_progressive_cancel(summaryview);
+	procmsg_msg_threads_free(summaryview->threads);
+	summaryview->threads = NULL;
 	if(summaryview->simplify_subject_preg) {
 		regfree(summaryview->simplify_subject_preg);
 		g_free(summaryview->simplify_subject_preg);
@@ -7377,236 +7785,122 @@ static void summary_drag_data_received(GtkWidget        *widget,
 }
 
 
-/* custom compare functions for sorting */
+/* sort keys */
 
-static gint summary_cmp_by_date(GtkCMCList *clist,
-		      gconstpointer ptr1, gconstpointer ptr2)
+/* The text of a column if it has been set */
+static const gchar *summary_sort_cell_text(GtkCMCTreeNode *node, gint column)
 {
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
-	gint res;
-	if (!msginfo1 || !msginfo2)
-		return -1;
-
-	res = (msginfo1->date_t - msginfo2->date_t);
-	if (res == 0)
-		res = msginfo1->msgnum - msginfo2->msgnum;
-	return res;
-}
+	GtkCMCListRow *row = &GTK_CMCTREE_ROW(node)->row;
 
-#define CMP_FUNC_DEF(func_name, val)					 \
-static gint func_name(GtkCMCList *clist,				 \
-		      gconstpointer ptr1, gconstpointer ptr2)		 \
-{									 \
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;		 \
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;		 \
-	gint res;							 \
-	if (!msginfo1 || !msginfo2)					 \
-		return -1;						 \
-									 \
-	res = (val);							 \
-	return (res != 0) ? res:summary_cmp_by_date(clist, ptr1, ptr2);	 \
-}
-
-CMP_FUNC_DEF(summary_cmp_by_mark,
-	     MSG_IS_MARKED(msginfo1->flags) - MSG_IS_MARKED(msginfo2->flags))
-CMP_FUNC_DEF(summary_cmp_by_status,
-	     (-(MSG_IS_SPAM(msginfo1->flags))+(MSG_IS_UNREAD(msginfo1->flags)<<1)+(MSG_IS_NEW(msginfo1->flags)<<2)) 
-	     - (-(MSG_IS_SPAM(msginfo2->flags))+(MSG_IS_UNREAD(msginfo2->flags)<<1)+(MSG_IS_NEW(msginfo2->flags)<<2)) )
-CMP_FUNC_DEF(summary_cmp_by_mime,
-	     MSG_IS_WITH_ATTACHMENT(msginfo1->flags) - MSG_IS_WITH_ATTACHMENT(msginfo2->flags))
-CMP_FUNC_DEF(summary_cmp_by_label,
-	     MSG_GET_COLORLABEL(msginfo1->flags) -
-	     MSG_GET_COLORLABEL(msginfo2->flags))
-CMP_FUNC_DEF(summary_cmp_by_locked,
-	     MSG_IS_LOCKED(msginfo1->flags) - MSG_IS_LOCKED(msginfo2->flags))
-
-CMP_FUNC_DEF(summary_cmp_by_num, msginfo1->msgnum - msginfo2->msgnum)
-CMP_FUNC_DEF(summary_cmp_by_size, msginfo1->size - msginfo2->size)
-
-#undef CMP_FUNC_DEF
-
-static gint summary_cmp_by_subject(GtkCMCList *clist,
-				   gconstpointer ptr1,
-				   gconstpointer ptr2)
-{
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
-	gint res;
-
-	if (!msginfo1->subject)
-		return (msginfo2->subject != NULL);
-	if (!msginfo2->subject)
-		return -1;
-
-	res = subject_compare_for_sort
-		(msginfo1->subject, msginfo2->subject);
-	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
-}
-
-static gint summary_cmp_by_thread_date(GtkCMCList *clist,
-				   gconstpointer ptr1,
-				   gconstpointer ptr2)
-{
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
-	gint thread_diff = msginfo1->thread_date - msginfo2->thread_date;
-	
-	if (msginfo1->thread_date > 0 && msginfo2->thread_date > 0)
-		return thread_diff;
-	else 
-		return msginfo1->date_t - msginfo2->date_t;
+	if (row->cell[column].type != GTK_CMCELL_TEXT)
+		return NULL;
+	return GTK_CMCELL_TEXT(row->cell[column])->text;
 }
 
-static gint summary_cmp_by_from(GtkCMCList *clist, gconstpointer ptr1,
-				gconstpointer ptr2)
+/* Made once per row by summary_sort(). Rows are ordered by the string,
+ * then by the number the key is for, then by date and number. */
+static void summary_sort_key_func(GtkSCTree *sctree, GtkCMCTreeNode *node,
+				  GtkSCTreeSortKey *key, gpointer data)
 {
-	const gchar *str1, *str2;
-	const GtkCMCListRow *r1 = (const GtkCMCListRow *) ptr1;
-	const GtkCMCListRow *r2 = (const GtkCMCListRow *) ptr2;
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
-	const SummaryView *sv = g_object_get_data(G_OBJECT(clist), "summaryview");
-	gint res;
+	SummaryView *summaryview = (SummaryView *)data;
+	MsgInfo *msginfo = GTKUT_CTREE_NODE_GET_ROW_DATA(node);
+	gint *col_pos = summaryview->col_pos;
+	SummaryColumnState *col_state = summaryview->col_state;
+	const gchar *str = NULL;
+	gchar *from, *to, *simplified, *tags = NULL;
+	gchar buf[BUFFSIZE];
 
-	cm_return_val_if_fail(sv, -1);
-	if (sv->col_state[sv->col_pos[S_COL_FROM]].visible) {
-		str1 = GTK_CMCELL_TEXT(r1->cell[sv->col_pos[S_COL_FROM]])->text;
-		str2 = GTK_CMCELL_TEXT(r2->cell[sv->col_pos[S_COL_FROM]])->text;
-	} else {
-		str1 = msginfo1->from;
-		str2 = msginfo2->from;
-	}
+	if (!msginfo)
+		return;
 
-	if (!str1)
-		return str2 != NULL;
- 
-	if (!str2)
- 		return -1;
- 
-	res = g_utf8_collate(str1, str2);
-	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
-}
- 
-static gint summary_cmp_by_to(GtkCMCList *clist, gconstpointer ptr1,
-				gconstpointer ptr2)
-{
-	const gchar *str1, *str2;
-	const GtkCMCListRow *r1 = (const GtkCMCListRow *) ptr1;
-	const GtkCMCListRow *r2 = (const GtkCMCListRow *) ptr2;
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
-	const SummaryView *sv = g_object_get_data(G_OBJECT(clist), "summaryview");
-	gint res;
-	cm_return_val_if_fail(sv, -1);
-	
-	if (sv->col_state[sv->col_pos[S_COL_TO]].visible) {
-		str1 = GTK_CMCELL_TEXT(r1->cell[sv->col_pos[S_COL_TO]])->text;
-		str2 = GTK_CMCELL_TEXT(r2->cell[sv->col_pos[S_COL_TO]])->text;
-	} else {
-		str1 = msginfo1->to;
-		str2 = msginfo2->to;
-	}
+	key->num[1] = msginfo->date_t;
+	key->num[2] = msginfo->msgnum;
 
-	if (!str1)
-		return str2 != NULL;
- 
-	if (!str2)
- 		return -1;
- 
-	res = g_utf8_collate(str1, str2);
-	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
-}
- 
-static gint summary_cmp_by_tags(GtkCMCList *clist, gconstpointer ptr1,
-				gconstpointer ptr2)
-{
-	gchar *str1, *str2;
-	const GtkCMCListRow *r1 = (const GtkCMCListRow *) ptr1;
-	const GtkCMCListRow *r2 = (const GtkCMCListRow *) ptr2;
-	const SummaryView *sv = g_object_get_data(G_OBJECT(clist), "summaryview");
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
-	gint res;
-	cm_return_val_if_fail(sv, -1);
-	
-	if (sv->col_state[sv->col_pos[S_COL_TAGS]].visible) {
-		str1 = g_strdup(GTK_CMCELL_TEXT(r1->cell[sv->col_pos[S_COL_TAGS]])->text);
-		str2 = g_strdup(GTK_CMCELL_TEXT(r2->cell[sv->col_pos[S_COL_TAGS]])->text);
-	} else {
-		str1 = procmsg_msginfo_get_tags_str(msginfo1);
-		str2 = procmsg_msginfo_get_tags_str(msginfo2);
-	}
-
-	if (!str1) {
-		res = (str2 != NULL);
-		g_free(str2);
-		return res;
-	}
-	if (!str2) {
-		g_free(str1);
- 		return -1;
-	}
- 
-	res = g_utf8_collate(str1, str2);
-	g_free(str1);
-	g_free(str2);
-	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
-}
- 
-static gint summary_cmp_by_simplified_subject
-	(GtkCMCList *clist, gconstpointer ptr1, gconstpointer ptr2)
-{
-	const FolderItemPrefs *prefs;
-	const gchar *str1, *str2;
-	const GtkCMCListRow *r1 = (const GtkCMCListRow *) ptr1;
-	const GtkCMCListRow *r2 = (const GtkCMCListRow *) ptr2;
-	const MsgInfo *msginfo1 = r1->data;
-	const MsgInfo *msginfo2 = r2->data;
-	const SummaryView *sv = g_object_get_data(G_OBJECT(clist), "summaryview");
-	gint res;
-
-	cm_return_val_if_fail(sv, -1);
-	cm_return_val_if_fail(msginfo1 != NULL && msginfo2 != NULL, -1);
-	
-	if (sv->col_state[sv->col_pos[S_COL_SUBJECT]].visible) {
-		str1 = GTK_CMCELL_TEXT(r1->cell[sv->col_pos[S_COL_SUBJECT]])->text;
-		str2 = GTK_CMCELL_TEXT(r2->cell[sv->col_pos[S_COL_SUBJECT]])->text;
-	} else {
-		str1 = msginfo1->subject;
-		str2 = msginfo2->subject;
+	switch (summaryview->sort_key) {
+	case SORT_BY_MARK:
+		key->num[0] = MSG_IS_MARKED(msginfo->flags) ? 1 : 0;
+		break;
+	case SORT_BY_STATUS:
+		key->num[0] = -(MSG_IS_SPAM(msginfo->flags) ? 1 : 0)
+			+ (MSG_IS_UNREAD(msginfo->flags) ? 2 : 0)
+			+ (MSG_IS_NEW(msginfo->flags) ? 4 : 0);
+		break;
+	case SORT_BY_MIME:
+		key->num[0] = MSG_IS_WITH_ATTACHMENT(msginfo->flags) ? 1 : 0;
+		break;
+	case SORT_BY_LABEL:
+		key->num[0] = MSG_GET_COLORLABEL(msginfo->flags);
+		break;
+	case SORT_BY_LOCKED:
+		key->num[0] = MSG_IS_LOCKED(msginfo->flags) ? 1 : 0;
+		break;
+	case SORT_BY_NUMBER:
+		key->num[0] = msginfo->msgnum;
+		break;
+	case SORT_BY_SIZE:
+		key->num[0] = msginfo->size;
+		break;
+	case SORT_BY_SCORE:
+		key->num[0] = msginfo->score;
+		break;
+	case SORT_BY_THREAD_DATE:
+		key->num[0] = msginfo->thread_date > 0 ?
+			msginfo->thread_date : msginfo->date_t;
+		break;
+	case SORT_BY_FROM:
+	case SORT_BY_TO:
+		if (summaryview->sort_key == SORT_BY_FROM) {
+			if (!col_state[col_pos[S_COL_FROM]].visible) {
+				str = msginfo->from;
+				break;
+			}
+			str = summary_sort_cell_text(node, col_pos[S_COL_FROM]);
+		} else {
+			if (!col_state[col_pos[S_COL_TO]].visible) {
+				str = msginfo->to;
+				break;
+			}
+			str = summary_sort_cell_text(node, col_pos[S_COL_TO]);
+		}
+		if (!str) {
+			/* not drawn yet */
+			summary_get_from_to_text(summaryview, msginfo, &from, &to);
+			str = (summaryview->sort_key == SORT_BY_FROM) ? from : to;
+		}
+		break;
+	case SORT_BY_TAGS:
+		if (col_state[col_pos[S_COL_TAGS]].visible)
+			str = summary_sort_cell_text(node, col_pos[S_COL_TAGS]);
+		if (!str) {
+			str = tags = procmsg_msginfo_get_tags_str(msginfo);
+			if (!str && col_state[col_pos[S_COL_TAGS]].visible)
+				str = "-";
+		}
+		break;
+	case SORT_BY_SUBJECT:
+		if (!msginfo->subject)
+			break;
+		if (summaryview->simplify_subject_preg &&
+		    col_state[col_pos[S_COL_SUBJECT]].visible) {
+			simplified = string_remove_match(buf, sizeof(buf),
+					msginfo->subject,
+					summaryview->simplify_subject_preg);
+			if (simplified != buf)
+				strncpy2(buf, simplified, sizeof(buf));
+			trim_subject_for_sort(buf);
+			str = buf;
+		} else {
+			/* already trimmed */
+			str = procmsg_msginfo_get_subject_key(msginfo);
+		}
+		break;
+	default:
+		break;
 	}
 
-	if (!str1)
-		return str2 != NULL;
-
-	if (!str2)
-		return -1;
-
-	prefs = msginfo1->folder->prefs;
-	if (!prefs)
-		prefs = msginfo2->folder->prefs;
-	if (!prefs)
-		return -1;
-	
-	res = subject_compare_for_sort(str1, str2);
-	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
-}
-
-static gint summary_cmp_by_score(GtkCMCList *clist,
-				 gconstpointer ptr1, gconstpointer ptr2)
-{
-	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
-	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
-	int diff;
-
-	/* if score are equal, sort by date */
-
-	diff = msginfo1->score - msginfo2->score;
-	if (diff != 0)
-		return diff;
-	else
-		return summary_cmp_by_date(clist, ptr1, ptr2);
+	if (str)
+		key->str = g_utf8_collate_key(str, -1);
+	g_free(tags);
 }
 
 static void summary_ignore_thread_func(GtkCMCTree *ctree, GtkCMCTreeNode *row, gpointer data)
@@ -155,6 +155,14 @@ private:
 	/* table for looking up message-id */
 	GHashTable *msgid_table;
 	GHashTable *subject_table;
+	/* threads of the shown folder, kept to add new messages */
+	MsgThreads *threads;
+	/* messages, or threads if progressive_threaded, still to be
+	 * inserted by the idle handler progressive_id, newest first */
+	GPtrArray *progressive;
+	guint progressive_pos;
+	gboolean progressive_threaded;
+	guint progressive_id;
 
 	/* list for moving/deleting messages */
 	GSList *mlist;
@@ -178,6 +186,8 @@ void summaryview_destroy(SummaryView *summaryview);
 void summary_init		  (SummaryView		*summaryview);
 gboolean summary_show		  (SummaryView		*summaryview,
 				   FolderItem		*fitem);
+void summary_rescan		  (SummaryView		*summaryview,
+				   FolderItem		*fitem);
 void summary_clear_list		  (SummaryView		*summaryview);
 void summary_clear_all		  (SummaryView		*summaryview);
 